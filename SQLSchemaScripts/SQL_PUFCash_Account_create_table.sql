@@ -8,3 +8,4 @@ CREATE TABLE IF NOT EXISTS PUFCash_Account (
    );
 
 CREATE UNIQUE INDEX Account_ID_index ON PUFCash_Account (ID);
+CREATE INDEX Account_ChipNum_index ON PUFCash_Account (ChipNum, TID, Amount);
@@ -10,3 +10,4 @@ CREATE TABLE IF NOT EXISTS PUFCash_LLK (
    );
 
 CREATE UNIQUE INDEX LLK_ID_index ON PUFCash_LLK (id);
+CREATE INDEX LLK_Status_index ON PUFCash_LLK (Status);
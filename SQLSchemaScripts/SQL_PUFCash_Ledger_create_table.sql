@@ -0,0 +1,9 @@
+PRAGMA foreign_keys = ON;
+
+CREATE TABLE IF NOT EXISTS PUFCash_Ledger ( 
+   ChipNum INTEGER NOT NULL,
+   TxnID INTEGER NOT NULL,
+   Amount INTEGER NOT NULL,
+   Status INTEGER NOT NULL,
+   PRIMARY KEY (ChipNum, TxnID)
+   );
@@ -11,3 +11,4 @@ CREATE TABLE IF NOT EXISTS PUFCash_WRec (
    );
 
 CREATE UNIQUE INDEX WRec_ID_index ON PUFCash_WRec (id);
+CREATE INDEX WRec_AnonChipNum_index ON PUFCash_WRec (AnonChipNum);
@@ -9,3 +9,4 @@ CREATE TABLE IF NOT EXISTS ZeroTrustAuthenToken (
    );
 
 CREATE UNIQUE INDEX ZTAT_ID_index ON ZeroTrustAuthenToken (ID);
+CREATE INDEX ZTAT_Status_index ON ZeroTrustAuthenToken (STATUS, ChipNum, Chlng_num);
@@ -11,6 +11,8 @@
 // Copyright: Univ. of New Mexico
 //--------------------------------------------------------------------------------
 
+// splice() for SockRelayB.
+#define _GNU_SOURCE 1
 
 #include "utility.h"
 #include "common.h"
@@ -615,6 +617,7 @@ fflush(stdout);
 
 // Copy connecting client IP into return variable.
       strcpy(client_IP, inet_ntoa(address.sin_addr));
+      InitSocketConnection(new_socket);
 
 // Add new socket to array of sockets
       for ( i = 0; i < max_clients; i++ )
@@ -704,261 +707,1628 @@ printf("Connected host IP %s has sent another message!\n" , client_IP); fflush(s
 
 // ========================================================================================================
 // ========================================================================================================
-// Open up a socket and listen for connections from clients 
+// Open the listening socket of the epoll acceptor. The listening socket is non-blocking and registered edge-triggered, so 
+// WaitEpollSocketServer drains every pending connection after a single wakeup. 'max_clients' bounds the number of open 
+// connections tracked in 'client_sockets'.
 
-int OpenSocketServer(int max_string_len, int *server_socket_desc_ptr, char *server_IP, int port_number, 
-   int *client_socket_desc_ptr, struct sockaddr_in *client_addr_ptr, int accept_only, int check_and_return)
+EpollServerStruct *OpenEpollSocketServer(char *server_IP, int port_number, int backlog, int max_clients)
    {
-   struct sockaddr_in server_addr;
-   int sizeof_sock;
-   int queue_size = 1;
+   EpollServerStruct *ESS_ptr;
+   struct sockaddr_in address;
+   struct epoll_event event;
    int opt = TRUE;
+   int i;
 
-// Create a socket and prepare the socket_in structure.
-   if ( accept_only == 0 )
+   if ( (ESS_ptr = (EpollServerStruct *)calloc(1, sizeof(EpollServerStruct))) == NULL )
+      { printf("ERROR: OpenEpollSocketServer(): Failed to allocate storage for EpollServerStruct!\n"); exit(EXIT_FAILURE); }
+
+   ESS_ptr->max_clients = max_clients;
+   ESS_ptr->max_events = SERVER_MAX_EVENTS;
+   if ( (ESS_ptr->client_sockets = (int *)calloc(max_clients, sizeof(int))) == NULL ||
+      (ESS_ptr->client_registered = (unsigned char *)calloc(max_clients, sizeof(unsigned char))) == NULL ||
+      (ESS_ptr->free_slots = (int *)malloc(max_clients * sizeof(int))) == NULL ||
+      (ESS_ptr->ready_slots = (int *)malloc(max_clients * sizeof(int))) == NULL ||
+      (ESS_ptr->events = (struct epoll_event *)calloc(ESS_ptr->max_events, sizeof(struct epoll_event))) == NULL )
+      { printf("ERROR: OpenEpollSocketServer(): Failed to allocate storage for %d clients!\n", max_clients); exit(EXIT_FAILURE); }
+
+// Free slots are handed out lowest index first.
+   for ( i = 0; i < max_clients; i++ )
+      ESS_ptr->free_slots[i] = max_clients - 1 - i;
+   ESS_ptr->num_free_slots = max_clients;
+   pthread_mutex_init(&(ESS_ptr->slot_mutex), NULL);
+
+   if ( (ESS_ptr->listen_socket_desc = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
+      { perror("OpenEpollSocketServer(): socket failed"); exit(EXIT_FAILURE); }
+   if ( setsockopt(ESS_ptr->listen_socket_desc, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )
+      { perror("OpenEpollSocketServer(): setsockopt"); exit(EXIT_FAILURE); }
+
+   memset(&address, 0, sizeof(address));
+   address.sin_family = AF_INET;
+   address.sin_addr.s_addr = inet_addr(server_IP);
+   address.sin_port = htons(port_number);
+
+   if ( bind(ESS_ptr->listen_socket_desc, (struct sockaddr *)&address, sizeof(address)) < 0 )
+      { perror("OpenEpollSocketServer(): bind failed"); exit(EXIT_FAILURE); }
+   if ( listen(ESS_ptr->listen_socket_desc, backlog) < 0 )
+      { perror("OpenEpollSocketServer(): listen"); exit(EXIT_FAILURE); }
+   if ( fcntl(ESS_ptr->listen_socket_desc, F_SETFL, fcntl(ESS_ptr->listen_socket_desc, F_GETFL, 0) | O_NONBLOCK) < 0 )
+      { perror("OpenEpollSocketServer(): fcntl"); exit(EXIT_FAILURE); }
+
+   if ( (ESS_ptr->epoll_desc = epoll_create1(0)) < 0 )
+      { perror("OpenEpollSocketServer(): epoll_create1"); exit(EXIT_FAILURE); }
+
+// The listening socket is tagged with 0, client slot i with i + 1.
+   event.events = EPOLLIN | EPOLLET;
+   event.data.u64 = 0;
+   if ( epoll_ctl(ESS_ptr->epoll_desc, EPOLL_CTL_ADD, ESS_ptr->listen_socket_desc, &event) < 0 )
+      { perror("OpenEpollSocketServer(): epoll_ctl"); exit(EXIT_FAILURE); }
+
+// The eventfd that wakes epoll_wait when a connection is put on 'ready_slots' is tagged with the largest value.
+   if ( (ESS_ptr->wakeup_desc = eventfd(0, EFD_NONBLOCK)) < 0 )
+      { perror("OpenEpollSocketServer(): eventfd"); exit(EXIT_FAILURE); }
+   event.events = EPOLLIN | EPOLLET;
+   event.data.u64 = UINT64_MAX;
+   if ( epoll_ctl(ESS_ptr->epoll_desc, EPOLL_CTL_ADD, ESS_ptr->wakeup_desc, &event) < 0 )
+      { perror("OpenEpollSocketServer(): epoll_ctl"); exit(EXIT_FAILURE); }
+
+// Connections may have queued before the first epoll_wait, so the first call tries accept() directly.
+   ESS_ptr->accept_pending = 1;
+
+printf("OpenEpollSocketServer(): Listener on port %d\tBacklog %d\tMax clients %d\n", port_number, backlog, max_clients); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   return ESS_ptr;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Store 'socket_desc' in a free slot and return the slot index, or -1 if all 'max_clients' slots are in use. When 'arm' 
+// is 1, the socket is registered one-shot so its next request is returned by WaitEpollSocketServer. Used for connections 
+// we accept and for sockets opened elsewhere, e.g., the TTP's connection to the Bank.
+
+int AddEpollSocketServerClient(int max_string_len, EpollServerStruct *ESS_ptr, int socket_desc, int arm)
+   {
+   int client_index;
+
+   pthread_mutex_lock(&(ESS_ptr->slot_mutex));
+   if ( ESS_ptr->num_free_slots == 0 )
+      client_index = -1;
+   else
       {
-//      printf("OpenSocketServer(): Creating a socket\n"); fflush(stdout); 
-      *server_socket_desc_ptr = socket(AF_INET, SOCK_STREAM, 0);
-      if ( *server_socket_desc_ptr == -1 )
-         { printf("ERROR: OpenSocketServer(): Could not create socket"); fflush(stdout); }
+      ESS_ptr->num_free_slots--;
+      client_index = ESS_ptr->free_slots[ESS_ptr->num_free_slots];
+      ESS_ptr->client_sockets[client_index] = socket_desc;
+      ESS_ptr->client_registered[client_index] = 0;
+      }
+   pthread_mutex_unlock(&(ESS_ptr->slot_mutex));
 
-// Set master socket to allow multiple connections, this is just a good habit, it will work without this.
-      if( setsockopt(*server_socket_desc_ptr, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )
-         { perror("OpenSocketServer(): setsockopt"); exit(EXIT_FAILURE); }
+   if ( client_index != -1 && arm == 1 )
+      RearmEpollSocketServerClient(ESS_ptr, client_index);
 
-// Do non-block fctrl call
-      if ( check_and_return == 1 )
+   return client_index;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Block until a new connection arrives or an armed client socket becomes readable. Returns the socket descriptor and its 
+// slot in 'client_index_ptr'. 'client_IP' is filled in for new connections only and is set to the empty string for 
+// requests on connections that are already open. Returns -1 with 'client_index_ptr' set to -1 when interrupted by a 
+// signal, so the caller can check its run flag.
+
+int WaitEpollSocketServer(int max_string_len, EpollServerStruct *ESS_ptr, char *client_IP, int *client_index_ptr)
+   {
+   struct sockaddr_in address;
+   socklen_t addrlen;
+   int new_socket, client_index;
+   uint64_t tag, count;
+
+   *client_index_ptr = -1;
+   strcpy(client_IP, "");
+
+   while (1)
+      {
+
+// Drain the listen queue. The listening socket is edge-triggered, so we keep accepting until it reports EAGAIN.
+      while ( ESS_ptr->accept_pending == 1 )
          {
-         int flags = fcntl(*server_socket_desc_ptr, F_GETFL, 0);
-         if (flags < 0) return 0;
-         flags = flags | O_NONBLOCK;
-         if ( fcntl(*server_socket_desc_ptr, F_SETFL, flags) != 0 )
-            { printf("ERROR: OpenSocketServer(): Failed to set 'fcntl' flags to non-blocking!\n"); exit(EXIT_FAILURE); }
+         addrlen = sizeof(address);
+         if ( (new_socket = accept(ESS_ptr->listen_socket_desc, (struct sockaddr *)&address, &addrlen)) < 0 )
+            {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+               ESS_ptr->accept_pending = 0;
+            else if ( errno != EINTR && errno != ECONNABORTED )
+               { perror("WaitEpollSocketServer(): accept"); exit(EXIT_FAILURE); }
+            continue;
+            }
+
+// Accepted sockets do not inherit O_NONBLOCK, which the blocking SockGetB/SockSendB routines depend on.
+         if ( (client_index = AddEpollSocketServerClient(max_string_len, ESS_ptr, new_socket, 0)) == -1 )
+            {
+            printf("WARNING: WaitEpollSocketServer(): All %d client slots in use -- refusing connection from %s!\n", 
+               ESS_ptr->max_clients, inet_ntoa(address.sin_addr)); fflush(stdout);
+            close(new_socket);
+            continue;
+            }
+
+#ifdef DEBUG
+printf("WaitEpollSocketServer(): New connection, socket fd is %d, IP is %s, port %d, slot %d\n", new_socket, inet_ntoa(address.sin_addr), 
+   ntohs(address.sin_port), client_index); fflush(stdout);
+#endif
+
+         InitSocketConnection(new_socket);
+         strcpy(client_IP, inet_ntoa(address.sin_addr));
+         *client_index_ptr = client_index;
+         return new_socket;
          }
-        
-// Prepare the sockaddr_in structure for the server. For the XWIN version when the devices are on different subnets, e.g.
-// 192.168.1.10 and 192.168.2.10, etc, use INADDR_ANY to allow them to connect to the server. Can't do this if running
-// multiple command line versions of the protocol.
-      server_addr.sin_family = AF_INET;
 
-      server_addr.sin_addr.s_addr = inet_addr(server_IP);
-//      server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+// Connections whose next request is already buffered in user space.
+      client_index = -1;
+      pthread_mutex_lock(&(ESS_ptr->slot_mutex));
+      if ( ESS_ptr->num_ready_slots > 0 )
+         {
+         ESS_ptr->num_ready_slots--;
+         client_index = ESS_ptr->ready_slots[ESS_ptr->num_ready_slots];
+         }
+      pthread_mutex_unlock(&(ESS_ptr->slot_mutex));
+      if ( client_index != -1 )
+         {
+         *client_index_ptr = client_index;
+         return ESS_ptr->client_sockets[client_index];
+         }
 
-      server_addr.sin_port = htons(port_number);
+// Hand out the events left over from the last epoll_wait before waiting again.
+      if ( ESS_ptr->next_event < ESS_ptr->num_events )
+         {
+         tag = ESS_ptr->events[ESS_ptr->next_event].data.u64;
+         ESS_ptr->next_event++;
+
+         if ( tag == 0 )
+            { ESS_ptr->accept_pending = 1; continue; }
+         if ( tag == UINT64_MAX )
+            { while ( read(ESS_ptr->wakeup_desc, &count, sizeof(count)) > 0 ); continue; }
+
+// Client sockets are one-shot, so this slot stays disarmed until the worker servicing it re-arms or closes it.
+         client_index = (int)(tag - 1);
+         *client_index_ptr = client_index;
+         return ESS_ptr->client_sockets[client_index];
+         }
 
-      memset(server_addr.sin_zero, 0, 8); 
+      ESS_ptr->next_event = 0;
+      if ( (ESS_ptr->num_events = epoll_wait(ESS_ptr->epoll_desc, ESS_ptr->events, ESS_ptr->max_events, -1)) < 0 )
+         {
+         ESS_ptr->num_events = 0;
+         if ( errno == EINTR )
+            return -1;
+         perror("WaitEpollSocketServer(): epoll_wait"); exit(EXIT_FAILURE);
+         }
+      }
+   }
 
-// Bind the server with the socket.
-      if ( bind(*server_socket_desc_ptr, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0 )
-         { printf("ERROR: OpenSocketServer(): Failed to bind!\n"); exit(EXIT_FAILURE); }
-//   printf("OpenSocketServer(): Bind done!\n"); fflush(stdout);
 
-// Listen to the socket. 'queue_size' indicates how many requests can be pending before an error is
-// returned to the remote computer requesting a connection.
-      listen(*server_socket_desc_ptr, queue_size);
+// ========================================================================================================
+// ========================================================================================================
+// Re-arm a persistent connection so its next request is returned by WaitEpollSocketServer. Data that arrived while the 
+// socket was disarmed is reported immediately. Thread safe: each slot is only touched by the thread that owns it.
+
+void RearmEpollSocketServerClient(EpollServerStruct *ESS_ptr, int client_index)
+   {
+   struct epoll_event event;
+   uint64_t one = 1;
+   int op;
+
+// The next request was read ahead into the receive buffer, so the socket may never become readable again. Queue the slot
+// directly and wake up epoll_wait.
+   if ( SockRecvPending(ESS_ptr->client_sockets[client_index]) > 0 )
+      {
+      pthread_mutex_lock(&(ESS_ptr->slot_mutex));
+      ESS_ptr->ready_slots[ESS_ptr->num_ready_slots] = client_index;
+      ESS_ptr->num_ready_slots++;
+      pthread_mutex_unlock(&(ESS_ptr->slot_mutex));
+      if ( write(ESS_ptr->wakeup_desc, &one, sizeof(one)) != sizeof(one) )
+         { printf("ERROR: RearmEpollSocketServerClient(): eventfd write failed: %s!\n", strerror(errno)); exit(EXIT_FAILURE); }
+      return;
       }
 
-//   printf("OpenSocketServer(): Waiting for incoming connections from clients ....\n"); fflush(stdout);
+   event.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+   event.data.u64 = (uint64_t)client_index + 1;
 
-// Waiting and accept incoming connection from the client. Device address information is returned
-// Note: you can also use 'select' here to determine if a connection request exists.
-   sizeof_sock = sizeof(struct sockaddr_in);
+   if ( ESS_ptr->client_registered[client_index] == 0 )
+      op = EPOLL_CTL_ADD;
+   else
+      op = EPOLL_CTL_MOD;
+   if ( epoll_ctl(ESS_ptr->epoll_desc, op, ESS_ptr->client_sockets[client_index], &event) < 0 )
+      { printf("ERROR: RearmEpollSocketServerClient(): epoll_ctl failed for slot %d: %s!\n", client_index, strerror(errno)); exit(EXIT_FAILURE); }
+   ESS_ptr->client_registered[client_index] = 1;
 
-   if ( check_and_return == 0 )
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Close the connection in 'client_index' and return the slot to the free list.
+
+void CloseEpollSocketServerClient(EpollServerStruct *ESS_ptr, int client_index)
+   {
+   if ( ESS_ptr->client_registered[client_index] == 1 )
+      epoll_ctl(ESS_ptr->epoll_desc, EPOLL_CTL_DEL, ESS_ptr->client_sockets[client_index], NULL);
+   SockClose(ESS_ptr->client_sockets[client_index]);
+
+   pthread_mutex_lock(&(ESS_ptr->slot_mutex));
+   ESS_ptr->client_sockets[client_index] = 0;
+   ESS_ptr->client_registered[client_index] = 0;
+   ESS_ptr->free_slots[ESS_ptr->num_free_slots] = client_index;
+   ESS_ptr->num_free_slots++;
+   pthread_mutex_unlock(&(ESS_ptr->slot_mutex));
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Bounded MPMC queue of ready connections. Push blocks while the queue is full and Pop blocks while it is empty, so 
+// neither the acceptor nor idle workers spin.
+
+ServerConnQueueStruct *CreateServerConnQueue(int capacity)
+   {
+   ServerConnQueueStruct *SCQ_ptr;
+
+   if ( (SCQ_ptr = (ServerConnQueueStruct *)calloc(1, sizeof(ServerConnQueueStruct))) == NULL ||
+      (SCQ_ptr->conns = (ServerConnStruct *)calloc(capacity, sizeof(ServerConnStruct))) == NULL )
+      { printf("ERROR: CreateServerConnQueue(): Failed to allocate queue of size %d!\n", capacity); exit(EXIT_FAILURE); }
+
+   SCQ_ptr->capacity = capacity;
+   pthread_mutex_init(&(SCQ_ptr->queue_mutex), NULL);
+   pthread_cond_init(&(SCQ_ptr->not_empty_cv), NULL);
+   pthread_cond_init(&(SCQ_ptr->not_full_cv), NULL);
+
+   return SCQ_ptr;
+   }
+
+
+void PushServerConnQueue(ServerConnQueueStruct *SCQ_ptr, ServerConnStruct *conn_ptr)
+   {
+   pthread_mutex_lock(&(SCQ_ptr->queue_mutex));
+   if ( SCQ_ptr->num_conns == SCQ_ptr->capacity )
+      SCQ_ptr->num_full_waits++;
+   while ( SCQ_ptr->num_conns == SCQ_ptr->capacity )
+      pthread_cond_wait(&(SCQ_ptr->not_full_cv), &(SCQ_ptr->queue_mutex));
+
+   gettimeofday(&(conn_ptr->queued_tv), NULL);
+   SCQ_ptr->conns[(SCQ_ptr->head + SCQ_ptr->num_conns) % SCQ_ptr->capacity] = *conn_ptr;
+   SCQ_ptr->num_conns++;
+   SCQ_ptr->num_pushed++;
+   if ( SCQ_ptr->num_conns > SCQ_ptr->max_num_conns )
+      SCQ_ptr->max_num_conns = SCQ_ptr->num_conns;
+
+   pthread_cond_signal(&(SCQ_ptr->not_empty_cv));
+   pthread_mutex_unlock(&(SCQ_ptr->queue_mutex));
+
+   return;
+   }
+
+
+// Returns 1 with the oldest connection in 'conn_ptr', 0 if 'timeout_ms' (-1 waits forever) expired first, or -1 if the queue 
+// was shut down and is empty.
+int PopServerConnQueue(ServerConnQueueStruct *SCQ_ptr, ServerConnStruct *conn_ptr, int timeout_ms)
+   {
+   struct timespec deadline;
+   struct timeval now;
+   double wait_us;
+
+   if ( timeout_ms >= 0 )
       {
-      while ( (*client_socket_desc_ptr = accept(*server_socket_desc_ptr, (struct sockaddr *)client_addr_ptr, (socklen_t*)&sizeof_sock)) < 0 )
-         ;
-//   if (*client_socket_desc_ptr < 0)
-//      { printf("ERROR: OpenSocketServer(): Failed accept\n"); exit(EXIT_FAILURE); }
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += timeout_ms/1000;
+      deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+      if ( deadline.tv_nsec >= 1000000000L )
+         { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+      }
 
-//   printf("OpenSocketServer(): Connection accepted!\n"); fflush(stdout); 
-      return 1;
+   pthread_mutex_lock(&(SCQ_ptr->queue_mutex));
+   while ( SCQ_ptr->num_conns == 0 && SCQ_ptr->shutdown == 0 )
+      {
+      if ( timeout_ms < 0 )
+         pthread_cond_wait(&(SCQ_ptr->not_empty_cv), &(SCQ_ptr->queue_mutex));
+      else if ( pthread_cond_timedwait(&(SCQ_ptr->not_empty_cv), &(SCQ_ptr->queue_mutex), &deadline) == ETIMEDOUT && 
+         SCQ_ptr->num_conns == 0 )
+         { pthread_mutex_unlock(&(SCQ_ptr->queue_mutex)); return 0; }
       }
-   else
+
+   if ( SCQ_ptr->num_conns == 0 )
+      { pthread_mutex_unlock(&(SCQ_ptr->queue_mutex)); return -1; }
+
+   *conn_ptr = SCQ_ptr->conns[SCQ_ptr->head];
+   SCQ_ptr->head = (SCQ_ptr->head + 1) % SCQ_ptr->capacity;
+   SCQ_ptr->num_conns--;
+
+   gettimeofday(&now, NULL);
+   wait_us = (double)(now.tv_sec - conn_ptr->queued_tv.tv_sec)*1000000.0 + (double)(now.tv_usec - conn_ptr->queued_tv.tv_usec);
+   SCQ_ptr->total_wait_us += wait_us;
+   if ( wait_us > SCQ_ptr->max_wait_us )
+      SCQ_ptr->max_wait_us = wait_us;
+
+   pthread_cond_signal(&(SCQ_ptr->not_full_cv));
+   pthread_mutex_unlock(&(SCQ_ptr->queue_mutex));
+
+   return 1;
+   }
+
+
+void ShutdownServerConnQueue(ServerConnQueueStruct *SCQ_ptr)
+   {
+   pthread_mutex_lock(&(SCQ_ptr->queue_mutex));
+   SCQ_ptr->shutdown = 1;
+   pthread_cond_broadcast(&(SCQ_ptr->not_empty_cv));
+   pthread_mutex_unlock(&(SCQ_ptr->queue_mutex));
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Worker thread pool. 'worker_args' must hold 'max_workers' preallocated per-worker structures. The caller stores the pool 
+// pointer in them between CreateThreadPool and StartThreadPool; 'worker_func' then loops on GetThreadPoolTask until it 
+// returns 0 and returns.
+
+ThreadPoolStruct *CreateThreadPool(int min_workers, int max_workers, int idle_timeout_ms, int queue_size, 
+   void *(*worker_func)(void *), void *worker_args, size_t worker_arg_size)
+   {
+   ThreadPoolStruct *TP_ptr;
+
+   if ( min_workers < 1 || max_workers < min_workers )
+      { printf("ERROR: CreateThreadPool(): Invalid worker counts: min %d, max %d!\n", min_workers, max_workers); exit(EXIT_FAILURE); }
+
+   if ( (TP_ptr = (ThreadPoolStruct *)calloc(1, sizeof(ThreadPoolStruct))) == NULL ||
+      (TP_ptr->worker_ids = (pthread_t *)calloc(max_workers, sizeof(pthread_t))) == NULL ||
+      (TP_ptr->worker_active = (unsigned char *)calloc(max_workers, sizeof(unsigned char))) == NULL )
+      { printf("ERROR: CreateThreadPool(): Failed to allocate pool of %d workers!\n", max_workers); exit(EXIT_FAILURE); }
+
+   TP_ptr->SCQ_ptr = CreateServerConnQueue(queue_size);
+   TP_ptr->worker_func = worker_func;
+   TP_ptr->worker_args = (char *)worker_args;
+   TP_ptr->worker_arg_size = worker_arg_size;
+   TP_ptr->min_workers = min_workers;
+   TP_ptr->max_workers = max_workers;
+   TP_ptr->idle_timeout_ms = idle_timeout_ms;
+   pthread_mutex_init(&(TP_ptr->pool_mutex), NULL);
+
+   return TP_ptr;
+   }
+
+
+// Start a worker in the first free slot. Called with 'pool_mutex' held. Returns 0 if all slots are in use.
+static int SpawnThreadPoolWorker(ThreadPoolStruct *TP_ptr)
+   {
+   int worker_num, err;
+
+   for ( worker_num = 0; worker_num < TP_ptr->max_workers; worker_num++ )
+      if ( TP_ptr->worker_active[worker_num] == 0 )
+         break;
+   if ( worker_num == TP_ptr->max_workers )
+      return 0;
+
+   if ( (err = pthread_create(&(TP_ptr->worker_ids[worker_num]), NULL, TP_ptr->worker_func, 
+      (void *)(TP_ptr->worker_args + worker_num*TP_ptr->worker_arg_size))) != 0 )
+      { printf("WARNING: SpawnThreadPoolWorker(): Failed to create worker %d: %d\n", worker_num, err); fflush(stdout); return 0; }
+
+   TP_ptr->worker_active[worker_num] = 1;
+   TP_ptr->num_workers++;
+   if ( TP_ptr->num_workers > TP_ptr->max_num_workers )
+      TP_ptr->max_num_workers = TP_ptr->num_workers;
+
+   return 1;
+   }
+
+
+void StartThreadPool(ThreadPoolStruct *TP_ptr)
+   {
+   int i;
+
+   pthread_mutex_lock(&(TP_ptr->pool_mutex));
+   for ( i = 0; i < TP_ptr->min_workers; i++ )
+      SpawnThreadPoolWorker(TP_ptr);
+   pthread_mutex_unlock(&(TP_ptr->pool_mutex));
+
+printf("StartThreadPool(): Started %d workers (min %d, max %d)\n", TP_ptr->num_workers, TP_ptr->min_workers, TP_ptr->max_workers); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   return;
+   }
+
+
+// Queue a connection and add a worker if more connections are waiting than there are idle workers.
+void SubmitThreadPoolTask(ThreadPoolStruct *TP_ptr, ServerConnStruct *conn_ptr)
+   {
+   int num_conns;
+
+   PushServerConnQueue(TP_ptr->SCQ_ptr, conn_ptr);
+
+   pthread_mutex_lock(&(TP_ptr->SCQ_ptr->queue_mutex));
+   num_conns = TP_ptr->SCQ_ptr->num_conns;
+   pthread_mutex_unlock(&(TP_ptr->SCQ_ptr->queue_mutex));
+
+   pthread_mutex_lock(&(TP_ptr->pool_mutex));
+   if ( TP_ptr->shutdown == 0 && num_conns > TP_ptr->num_idle_workers && TP_ptr->num_workers < TP_ptr->max_workers )
+      SpawnThreadPoolWorker(TP_ptr);
+   pthread_mutex_unlock(&(TP_ptr->pool_mutex));
+
+   return;
+   }
+
+
+// Called by worker 'worker_num' for its next connection. Returns 1 with the connection in 'conn_ptr', or 0 when the worker must 
+// return: either the pool is shutting down and the queue is drained, or the worker sat idle for 'idle_timeout_ms' while more 
+// than 'min_workers' were running. Workers leaving on an idle timeout detach themselves; ShutdownThreadPool joins the others.
+int GetThreadPoolTask(ThreadPoolStruct *TP_ptr, int worker_num, ServerConnStruct *conn_ptr)
+   {
+   int status;
+
+   while (1)
       {
-      if ( (*client_socket_desc_ptr = accept(*server_socket_desc_ptr, (struct sockaddr *)client_addr_ptr, (socklen_t*)&sizeof_sock)) < 0 )
+      pthread_mutex_lock(&(TP_ptr->pool_mutex));
+      TP_ptr->num_idle_workers++;
+      pthread_mutex_unlock(&(TP_ptr->pool_mutex));
+
+      status = PopServerConnQueue(TP_ptr->SCQ_ptr, conn_ptr, TP_ptr->idle_timeout_ms);
+
+      pthread_mutex_lock(&(TP_ptr->pool_mutex));
+      TP_ptr->num_idle_workers--;
+      if ( status == 1 )
+         { pthread_mutex_unlock(&(TP_ptr->pool_mutex)); return 1; }
+
+      if ( status == -1 || (TP_ptr->shutdown == 0 && TP_ptr->num_workers > TP_ptr->min_workers) )
+         {
+         TP_ptr->num_workers--;
+         if ( status == 0 )
+            {
+            TP_ptr->worker_active[worker_num] = 0;
+            pthread_detach(pthread_self());
+            }
+         pthread_mutex_unlock(&(TP_ptr->pool_mutex));
          return 0;
-      else
-         return 1;
+         }
+      pthread_mutex_unlock(&(TP_ptr->pool_mutex));
+      }
+   }
+
+
+// Stop accepting work, let the workers finish the queued connections and wait for all of them to return.
+void ShutdownThreadPool(ThreadPoolStruct *TP_ptr)
+   {
+   int worker_num;
+
+   pthread_mutex_lock(&(TP_ptr->pool_mutex));
+   TP_ptr->shutdown = 1;
+   pthread_mutex_unlock(&(TP_ptr->pool_mutex));
+
+   ShutdownServerConnQueue(TP_ptr->SCQ_ptr);
+
+// Workers still marked active never detach once 'shutdown' is set, so they can all be joined.
+   for ( worker_num = 0; worker_num < TP_ptr->max_workers; worker_num++ )
+      if ( TP_ptr->worker_active[worker_num] == 1 )
+         {
+         pthread_join(TP_ptr->worker_ids[worker_num], NULL);
+         TP_ptr->worker_active[worker_num] = 0;
+         }
+
+   return;
+   }
+
+
+void PrintThreadPoolStats(ThreadPoolStruct *TP_ptr)
+   {
+   ServerConnQueueStruct *SCQ_ptr = TP_ptr->SCQ_ptr;
+
+   pthread_mutex_lock(&(TP_ptr->pool_mutex));
+   pthread_mutex_lock(&(SCQ_ptr->queue_mutex));
+   printf("ThreadPool: Workers %d (idle %d, peak %d, min %d, max %d)\tQueued %ld\tDepth %d (peak %d of %d, full %ld times)\tWait ave %.1f us max %.1f us\n", 
+      TP_ptr->num_workers, TP_ptr->num_idle_workers, TP_ptr->max_num_workers, TP_ptr->min_workers, TP_ptr->max_workers, SCQ_ptr->num_pushed, 
+      SCQ_ptr->num_conns, SCQ_ptr->max_num_conns, SCQ_ptr->capacity, SCQ_ptr->num_full_waits, 
+      SCQ_ptr->num_pushed > SCQ_ptr->num_conns ? SCQ_ptr->total_wait_us/(double)(SCQ_ptr->num_pushed - SCQ_ptr->num_conns) : 0.0, 
+      SCQ_ptr->max_wait_us); 
+   fflush(stdout);
+   pthread_mutex_unlock(&(SCQ_ptr->queue_mutex));
+   pthread_mutex_unlock(&(TP_ptr->pool_mutex));
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Pool of persistent connections to a server. 'first_socket_desc' is an already open (and authenticated) connection that 
+// becomes channel 0; the others are opened by AcquireChannel when every open channel is busy. 'authen_func' is called with 
+// 'authen_arg' and the socket of each channel the pool opens, and must return 1 once the server has authenticated the 
+// channel the same way as channel 0, or 0 if that fails.
+
+ChannelPoolStruct *CreateChannelPool(char *server_IP, int port_number, int first_socket_desc, int max_channels, 
+   int (*authen_func)(void *, int), void *authen_arg)
+   {
+   ChannelPoolStruct *CP_ptr;
+   int channel_num;
+
+   if ( max_channels < 1 )
+      { printf("ERROR: CreateChannelPool(): Number of channels %d must be at least 1!\n", max_channels); exit(EXIT_FAILURE); }
+
+   if ( (CP_ptr = (ChannelPoolStruct *)calloc(1, sizeof(ChannelPoolStruct))) == NULL )
+      { printf("ERROR: CreateChannelPool(): Failed to allocate pool!\n"); exit(EXIT_FAILURE); }
+   if ( (CP_ptr->socket_descs = (int *)malloc(max_channels * sizeof(int))) == NULL )
+      { printf("ERROR: CreateChannelPool(): Failed to allocate 'socket_descs'!\n"); exit(EXIT_FAILURE); }
+   if ( (CP_ptr->channel_busy = (int *)calloc(max_channels, sizeof(int))) == NULL )
+      { printf("ERROR: CreateChannelPool(): Failed to allocate 'channel_busy'!\n"); exit(EXIT_FAILURE); }
+
+   strcpy(CP_ptr->server_IP, server_IP);
+   CP_ptr->port_number = port_number;
+   CP_ptr->authen_func = authen_func;
+   CP_ptr->authen_arg = authen_arg;
+   CP_ptr->max_channels = max_channels;
+   for ( channel_num = 0; channel_num < max_channels; channel_num++ )
+      CP_ptr->socket_descs[channel_num] = -1;
+   CP_ptr->socket_descs[0] = first_socket_desc;
+   CP_ptr->num_channels = 1;
+
+   pthread_mutex_init(&(CP_ptr->pool_mutex), NULL);
+   pthread_cond_init(&(CP_ptr->pool_cv), NULL);
+
+   return CP_ptr;
+   }
+
+
+// Return the socket descriptor of an idle channel and mark it busy. Opens (and authenticates) a new channel if none is idle and 
+// the pool is not full, otherwise waits for ReleaseChannel. A failed connect or authentication is not retried until another 
+// channel is released or discarded.
+int AcquireChannel(int max_string_len, ChannelPoolStruct *CP_ptr)
+   {
+   struct timeval t1, t2;
+   int channel_num, socket_desc, waited, open_failed;
+   double wait_us;
+
+   gettimeofday(&t1, 0);
+   waited = 0;
+   open_failed = 0;
+
+   pthread_mutex_lock(&(CP_ptr->pool_mutex));
+   while ( 1 )
+      {
+
+// Idle open channel.
+      for ( channel_num = 0; channel_num < CP_ptr->max_channels; channel_num++ )
+         if ( CP_ptr->socket_descs[channel_num] != -1 && CP_ptr->channel_busy[channel_num] == 0 )
+            break;
+      if ( channel_num < CP_ptr->max_channels )
+         break;
+
+// Unopened slot. Reserve it and connect without holding the lock.
+      if ( open_failed == 0 )
+         {
+         for ( channel_num = 0; channel_num < CP_ptr->max_channels; channel_num++ )
+            if ( CP_ptr->socket_descs[channel_num] == -1 && CP_ptr->channel_busy[channel_num] == 0 )
+               break;
+         if ( channel_num < CP_ptr->max_channels )
+            {
+            CP_ptr->channel_busy[channel_num] = 1;
+            pthread_mutex_unlock(&(CP_ptr->pool_mutex));
+
+            if ( OpenSocketClient(max_string_len, CP_ptr->server_IP, CP_ptr->port_number, &socket_desc) < 0 )
+               socket_desc = -1;
+            else if ( CP_ptr->authen_func(CP_ptr->authen_arg, socket_desc) == 0 )
+               {
+               printf("WARNING: AcquireChannel(): Server did not authenticate channel %d on socket %d -- closing it!\n", channel_num, 
+                  socket_desc); fflush(stdout);
+               SockClose(socket_desc);
+               socket_desc = -1;
+               }
+
+            pthread_mutex_lock(&(CP_ptr->pool_mutex));
+            if ( socket_desc != -1 )
+               {
+               CP_ptr->socket_descs[channel_num] = socket_desc;
+               CP_ptr->num_channels++;
+               CP_ptr->channel_busy[channel_num] = 0;
+
+printf("AcquireChannel(): Opened channel %d to %s with socket %d (%d open)\n", channel_num, CP_ptr->server_IP, socket_desc, 
+   CP_ptr->num_channels); fflush(stdout);
+#ifdef DEBUG
+#endif
+               break;
+               }
+            CP_ptr->channel_busy[channel_num] = 0;
+            open_failed = 1;
+            printf("WARNING: AcquireChannel(): Failed to open channel %d to %s -- waiting for an open channel!\n", channel_num, 
+               CP_ptr->server_IP); fflush(stdout);
+            continue;
+            }
+         }
+
+      waited = 1;
+      pthread_cond_wait(&(CP_ptr->pool_cv), &(CP_ptr->pool_mutex));
+      open_failed = 0;
+      }
+
+   CP_ptr->channel_busy[channel_num] = 1;
+   CP_ptr->num_busy++;
+   socket_desc = CP_ptr->socket_descs[channel_num];
+
+   gettimeofday(&t2, 0);
+   wait_us = (double)(t2.tv_sec - t1.tv_sec)*1000000.0 + (double)(t2.tv_usec - t1.tv_usec);
+   CP_ptr->num_acquires++;
+   CP_ptr->num_waits += waited;
+   CP_ptr->total_wait_us += wait_us;
+   if ( wait_us > CP_ptr->max_wait_us )
+      CP_ptr->max_wait_us = wait_us;
+   pthread_mutex_unlock(&(CP_ptr->pool_mutex));
+
+   return socket_desc;
+   }
+
+
+void ReleaseChannel(ChannelPoolStruct *CP_ptr, int socket_desc)
+   {
+   int channel_num;
+
+   pthread_mutex_lock(&(CP_ptr->pool_mutex));
+   for ( channel_num = 0; channel_num < CP_ptr->max_channels; channel_num++ )
+      if ( CP_ptr->socket_descs[channel_num] == socket_desc && CP_ptr->channel_busy[channel_num] == 1 )
+         break;
+   if ( channel_num == CP_ptr->max_channels )
+      { printf("ERROR: ReleaseChannel(): Socket %d is not a busy channel!\n", socket_desc); exit(EXIT_FAILURE); }
+
+   CP_ptr->channel_busy[channel_num] = 0;
+   CP_ptr->num_busy--;
+   pthread_cond_signal(&(CP_ptr->pool_cv));
+   pthread_mutex_unlock(&(CP_ptr->pool_mutex));
+
+   return;
+   }
+
+
+// Close a busy channel whose exchange failed, instead of releasing it, so its socket (which may be in the middle of a message) is 
+// never handed to another thread. The slot is reopened by a later AcquireChannel.
+void DiscardChannel(ChannelPoolStruct *CP_ptr, int socket_desc)
+   {
+   int channel_num;
+
+   pthread_mutex_lock(&(CP_ptr->pool_mutex));
+   for ( channel_num = 0; channel_num < CP_ptr->max_channels; channel_num++ )
+      if ( CP_ptr->socket_descs[channel_num] == socket_desc && CP_ptr->channel_busy[channel_num] == 1 )
+         break;
+   if ( channel_num == CP_ptr->max_channels )
+      { printf("ERROR: DiscardChannel(): Socket %d is not a busy channel!\n", socket_desc); exit(EXIT_FAILURE); }
+
+   SockClose(socket_desc);
+   CP_ptr->socket_descs[channel_num] = -1;
+   CP_ptr->channel_busy[channel_num] = 0;
+   CP_ptr->num_channels--;
+   CP_ptr->num_busy--;
+   CP_ptr->num_discards++;
+
+printf("DiscardChannel(): Closed channel %d to %s with socket %d (%d open)\n", channel_num, CP_ptr->server_IP, socket_desc, 
+   CP_ptr->num_channels); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   pthread_cond_signal(&(CP_ptr->pool_cv));
+   pthread_mutex_unlock(&(CP_ptr->pool_mutex));
+
+   return;
+   }
+
+
+// Close every open channel. Called after the worker threads are done.
+void CloseChannelPool(ChannelPoolStruct *CP_ptr)
+   {
+   int channel_num;
+
+   for ( channel_num = 0; channel_num < CP_ptr->max_channels; channel_num++ )
+      if ( CP_ptr->socket_descs[channel_num] != -1 )
+         SockClose(CP_ptr->socket_descs[channel_num]);
+
+   pthread_mutex_destroy(&(CP_ptr->pool_mutex));
+   pthread_cond_destroy(&(CP_ptr->pool_cv));
+   free(CP_ptr->socket_descs);
+   free(CP_ptr->channel_busy);
+   free(CP_ptr);
+
+   return;
+   }
+
+
+void PrintChannelPoolStats(ChannelPoolStruct *CP_ptr)
+   {
+   pthread_mutex_lock(&(CP_ptr->pool_mutex));
+   printf("ChannelPool: %s: Channels %d (busy %d, max %d, discarded %ld)\tAcquired %ld (waited %ld times)\tWait ave %.1f us max %.1f us\n", 
+      CP_ptr->server_IP, CP_ptr->num_channels, CP_ptr->num_busy, CP_ptr->max_channels, CP_ptr->num_discards, CP_ptr->num_acquires, 
+      CP_ptr->num_waits, CP_ptr->num_acquires > 0 ? CP_ptr->total_wait_us/(double)CP_ptr->num_acquires : 0.0, CP_ptr->max_wait_us); 
+   fflush(stdout);
+   pthread_mutex_unlock(&(CP_ptr->pool_mutex));
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Open up a socket and listen for connections from clients 
+
+int OpenSocketServer(int max_string_len, int *server_socket_desc_ptr, char *server_IP, int port_number, 
+   int *client_socket_desc_ptr, struct sockaddr_in *client_addr_ptr, int accept_only, int check_and_return)
+   {
+   struct sockaddr_in server_addr;
+   int sizeof_sock;
+   int queue_size = 1;
+   int opt = TRUE;
+
+// Create a socket and prepare the socket_in structure.
+   if ( accept_only == 0 )
+      {
+//      printf("OpenSocketServer(): Creating a socket\n"); fflush(stdout); 
+      *server_socket_desc_ptr = socket(AF_INET, SOCK_STREAM, 0);
+      if ( *server_socket_desc_ptr == -1 )
+         { printf("ERROR: OpenSocketServer(): Could not create socket"); fflush(stdout); }
+
+// Set master socket to allow multiple connections, this is just a good habit, it will work without this.
+      if( setsockopt(*server_socket_desc_ptr, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )
+         { perror("OpenSocketServer(): setsockopt"); exit(EXIT_FAILURE); }
+
+// Do non-block fctrl call
+      if ( check_and_return == 1 )
+         {
+         int flags = fcntl(*server_socket_desc_ptr, F_GETFL, 0);
+         if (flags < 0) return 0;
+         flags = flags | O_NONBLOCK;
+         if ( fcntl(*server_socket_desc_ptr, F_SETFL, flags) != 0 )
+            { printf("ERROR: OpenSocketServer(): Failed to set 'fcntl' flags to non-blocking!\n"); exit(EXIT_FAILURE); }
+         }
+        
+// Prepare the sockaddr_in structure for the server. For the XWIN version when the devices are on different subnets, e.g.
+// 192.168.1.10 and 192.168.2.10, etc, use INADDR_ANY to allow them to connect to the server. Can't do this if running
+// multiple command line versions of the protocol.
+      server_addr.sin_family = AF_INET;
+
+      server_addr.sin_addr.s_addr = inet_addr(server_IP);
+//      server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+      server_addr.sin_port = htons(port_number);
+
+      memset(server_addr.sin_zero, 0, 8); 
+
+// Bind the server with the socket.
+      if ( bind(*server_socket_desc_ptr, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0 )
+         { printf("ERROR: OpenSocketServer(): Failed to bind!\n"); exit(EXIT_FAILURE); }
+//   printf("OpenSocketServer(): Bind done!\n"); fflush(stdout);
+
+// Listen to the socket. 'queue_size' indicates how many requests can be pending before an error is
+// returned to the remote computer requesting a connection.
+      listen(*server_socket_desc_ptr, queue_size);
+      }
+
+//   printf("OpenSocketServer(): Waiting for incoming connections from clients ....\n"); fflush(stdout);
+
+// Waiting and accept incoming connection from the client. Device address information is returned
+// Note: you can also use 'select' here to determine if a connection request exists.
+   sizeof_sock = sizeof(struct sockaddr_in);
+
+   if ( check_and_return == 0 )
+      {
+      while ( (*client_socket_desc_ptr = accept(*server_socket_desc_ptr, (struct sockaddr *)client_addr_ptr, (socklen_t*)&sizeof_sock)) < 0 )
+         ;
+      InitSocketConnection(*client_socket_desc_ptr);
+//   if (*client_socket_desc_ptr < 0)
+//      { printf("ERROR: OpenSocketServer(): Failed accept\n"); exit(EXIT_FAILURE); }
+
+//   printf("OpenSocketServer(): Connection accepted!\n"); fflush(stdout); 
+      return 1;
+      }
+   else
+      {
+      if ( (*client_socket_desc_ptr = accept(*server_socket_desc_ptr, (struct sockaddr *)client_addr_ptr, (socklen_t*)&sizeof_sock)) < 0 )
+         return 0;
+      InitSocketConnection(*client_socket_desc_ptr);
+      return 1;
+      }
+
+   return 1;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Open up a client socket connection. Returns 0 on success and -1 if fails.
+
+int OpenSocketClient(int max_string_len, char *server_IP, int port_number, int *server_socket_desc_ptr)
+   {
+   struct sockaddr_in server_addr;
+   int result;
+
+//   printf("OpenSocketClient(): Creating a socket\n"); fflush(stdout); 
+   if ( (*server_socket_desc_ptr = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
+      { printf("ERROR: OpenSocketClient(): Could not create socket"); exit(EXIT_FAILURE); }
+        
+   server_addr.sin_addr.s_addr = inet_addr(server_IP);
+   server_addr.sin_family = AF_INET;
+   server_addr.sin_port = htons(port_number);
+   memset(server_addr.sin_zero, 0, 8); 
+
+// Connect to it. 9/14/2018: Changing this from 'exit' to return error.
+   if ( (result = connect(*server_socket_desc_ptr, (struct sockaddr *)&server_addr, sizeof(server_addr))) < 0 )
+      { printf("INFO: OpenSocketClient: Connect failed -- no listener\n"); fflush(stdout); }
+     
+//   printf("OpenSocketClient(): Connected\n"); fflush(stdout);
+
+// Close the socket if the connect fails.
+   if ( result < 0 )
+      close(*server_socket_desc_ptr);
+   else
+      InitSocketConnection(*server_socket_desc_ptr);
+
+   return result;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Open up a datagram socket for receiving broadcasts
+
+int OpenSocketServerUDP(int max_string_len, int *bcast_server_socket_desc_ptr, char *server_IP, int port_number, 
+   struct sockaddr_in *client_addr_ptr, int accept_only, int check_and_return, char *buff, char *bcast_subnet_IP)
+   {
+   struct sockaddr_in my_addr;
+   unsigned int sizeof_sock;
+   int opt = TRUE;
+   int broadcastEnable = 1;
+
+// Initialize the buffer to a NULL string.
+   buff[0] = '\0';
+
+// Create a socket and prepare the socket_in structure.
+   if ( accept_only == 0 )
+      {
+      if ( (*bcast_server_socket_desc_ptr = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
+         { perror("ERROR: OpenSocketServerUDP(): Cannnot create DATAGRAM socket!"); exit(EXIT_FAILURE); }
+
+// Set master socket to allow multiple connections, this is just a good habit, it will work without this.
+      if( setsockopt(*bcast_server_socket_desc_ptr, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )
+         { perror("ERROR: OpenSocketServerUDP(): setsockopt to allow multiple connections"); exit(EXIT_FAILURE); }
+
+// Enable reception of broadcast messages.
+      setsockopt(*bcast_server_socket_desc_ptr, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable));
+
+// Do non-block fctrl call
+      if ( check_and_return == 1 )
+         {
+         struct timeval read_timeout;
+         read_timeout.tv_sec = 0;
+         read_timeout.tv_usec = 1000;
+         setsockopt(*bcast_server_socket_desc_ptr, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof(read_timeout));
+
+//         int flags = fcntl(*bcast_server_socket_desc_ptr, F_GETFL, 0);
+//         if (flags < 0) return 0;
+//         flags = flags | O_NONBLOCK;
+//         if ( fcntl(*bcast_server_socket_desc_ptr, F_SETFL, flags) != 0 )
+//            { printf("ERROR: OpenSocketServerUDP(): Failed to set 'fcntl' flags to non-blocking!\n"); exit(EXIT_FAILURE); }
+         }
+
+// Prepare the sockaddr_in structure for the server. 
+      memset(&my_addr, '\0', sizeof(struct sockaddr_in));
+      my_addr.sin_family = AF_INET;
+      my_addr.sin_port = (in_port_t)htons(port_number+1);
+//      my_addr.sin_addr.s_addr = inet_addr(server_IP);
+      my_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+//      my_addr.sin_addr.s_addr = inet_addr(bcast_subnet_IP);
+
+      if ( bind(*bcast_server_socket_desc_ptr, (struct sockaddr *)&my_addr, sizeof(my_addr)) < 0 )
+         { perror("ERROR: OpenSockeServerUDP(): Failed to bind"); }
+
+// No 'listen' call for UDP.
+      }
+
+#ifdef DEBUG
+printf("Checking\n"); fflush(stdout);
+#endif
+
+   sizeof_sock = sizeof(struct sockaddr_in);
+   recvfrom(*bcast_server_socket_desc_ptr, buff, max_string_len, 0, (struct sockaddr *)client_addr_ptr, &sizeof_sock);
+
+   return 1;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Per-connection receive buffers for SockGetB, indexed by socket descriptor and allocated on first use. A socket 
+// that uses SockGetB MUST be closed with SockClose so a later connection that reuses the descriptor does not see 
+// stale bytes.
+
+static SockRecvBufStruct *SockRecvBufArr[SOCK_RECV_BUF_MAX_FDS];
+static pthread_mutex_t SockRecvBufArr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static SockRecvBufStruct *GetSockRecvBuf(int socket_desc)
+   {
+   SockRecvBufStruct *RB_ptr;
+
+   if ( socket_desc < 0 || socket_desc >= SOCK_RECV_BUF_MAX_FDS )
+      return NULL;
+
+   if ( (RB_ptr = __atomic_load_n(&(SockRecvBufArr[socket_desc]), __ATOMIC_ACQUIRE)) != NULL )
+      return RB_ptr;
+
+   pthread_mutex_lock(&SockRecvBufArr_mutex);
+   if ( (RB_ptr = SockRecvBufArr[socket_desc]) == NULL )
+      {
+      if ( (RB_ptr = (SockRecvBufStruct *)calloc(1, sizeof(SockRecvBufStruct))) == NULL )
+         { printf("ERROR: GetSockRecvBuf(): Failed to allocate receive buffer!\n"); exit(EXIT_FAILURE); }
+      pthread_mutex_init(&(RB_ptr->buf_mutex), NULL);
+      __atomic_store_n(&(SockRecvBufArr[socket_desc]), RB_ptr, __ATOMIC_RELEASE);
+      }
+   pthread_mutex_unlock(&SockRecvBufArr_mutex);
+
+   return RB_ptr;
+   }
+
+
+// Discard anything buffered for 'socket_desc'. The buffer itself is kept for the next connection on this descriptor.
+static void ResetSockRecvBuf(int socket_desc)
+   {
+   SockRecvBufStruct *RB_ptr;
+
+   if ( socket_desc < 0 || socket_desc >= SOCK_RECV_BUF_MAX_FDS )
+      return;
+   if ( (RB_ptr = __atomic_load_n(&(SockRecvBufArr[socket_desc]), __ATOMIC_ACQUIRE)) == NULL )
+      return;
+
+   pthread_mutex_lock(&(RB_ptr->buf_mutex));
+   RB_ptr->start = RB_ptr->end = 0;
+   pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Set up a newly connected or accepted socket. TCP_NODELAY sends the small command strings and nonces of the protocol 
+// immediately instead of holding them for the ACK of the previous segment (Nagle); SockCork is used where several 
+// messages are sent back to back.
+
+void InitSocketConnection(int socket_desc)
+   {
+   int opt = 1;
+
+   if ( setsockopt(socket_desc, IPPROTO_TCP, TCP_NODELAY, (char *)&opt, sizeof(opt)) < 0 )
+      { printf("WARNING: InitSocketConnection(): Failed to set TCP_NODELAY on socket %d!\n", socket_desc); fflush(stdout); }
+   ResetSockRecvBuf(socket_desc);
+
+   return;
+   }
+
+
+// Hold partial segments while 'cork' is 1 and flush them when it is set back to 0. Brackets bursts of SockSendB calls so 
+// they leave in as few segments as possible.
+void SockCork(int socket_desc, int cork)
+   {
+   setsockopt(socket_desc, IPPROTO_TCP, TCP_CORK, (char *)&cork, sizeof(cork));
+   return;
+   }
+
+
+// Number of bytes already read from 'socket_desc' that SockGetB has not returned yet.
+int SockRecvPending(int socket_desc)
+   {
+   SockRecvBufStruct *RB_ptr;
+   int num_bytes;
+
+   if ( socket_desc < 0 || socket_desc >= SOCK_RECV_BUF_MAX_FDS )
+      return 0;
+   if ( (RB_ptr = __atomic_load_n(&(SockRecvBufArr[socket_desc]), __ATOMIC_ACQUIRE)) == NULL )
+      return 0;
+
+   pthread_mutex_lock(&(RB_ptr->buf_mutex));
+   num_bytes = RB_ptr->end - RB_ptr->start;
+   pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+
+   return num_bytes;
+   }
+
+
+int SockClose(int socket_desc)
+   {
+   ResetSockRecvBuf(socket_desc);
+   return close(socket_desc);
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Read exactly 'num_bytes' into 'buffer', first from the receive buffer and then from the socket. Returns -1 if the 
+// connection fails or is closed by the peer.
+
+static int SockRecvAll(int socket_desc, unsigned char *buffer, int num_bytes)
+   {
+   int tot_bytes_received, n;
+
+   tot_bytes_received = 0;
+   while ( tot_bytes_received < num_bytes )
+      {
+      if ( (n = recv(socket_desc, &buffer[tot_bytes_received], num_bytes - tot_bytes_received, MSG_WAITALL)) <= 0 )
+         {
+         if ( n < 0 && errno == EINTR )
+            continue;
+         return -1;
+         }
+      tot_bytes_received += n;
+      }
+
+   return tot_bytes_received;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// This function is designed to buffer data but in kernel space. It allows binary data to be transmitted. 
+// To accomplish this, the first three bytes are interpreted as the length of the binary byte stream that follows.
+// Reads go through the connection's receive buffer, so a short message and its length usually arrive with one recv.
+
+int SockGetB(unsigned char *buffer, int buffer_size, int socket_desc)
+   {
+   SockRecvBufStruct *RB_ptr;
+   int target_num_bytes, num_buffered, n;
+   unsigned char buffer_num_bytes[3];
+
+// Descriptors beyond the buffer table are read directly.
+   if ( (RB_ptr = GetSockRecvBuf(socket_desc)) == NULL )
+      {
+      if ( SockRecvAll(socket_desc, buffer_num_bytes, 3) < 0 )
+         { printf("ERROR: SockGetB(): Error in receiving three byte cnt!\n"); fflush(stdout); return -1; }
+      target_num_bytes = (int)(buffer_num_bytes[2] << 16) + (int)(buffer_num_bytes[1] << 8) + (int)buffer_num_bytes[0];
+      if ( target_num_bytes > buffer_size )
+         { 
+         printf("ERROR: SockGetB(): 'target_num_bytes' %d is larger than buffer input size %d\n", 
+            target_num_bytes, buffer_size); fflush(stdout); return -1;
+         }
+      if ( SockRecvAll(socket_desc, buffer, target_num_bytes) < 0 )
+         { printf("ERROR: SockGetB(): Error in receiving transmitted data!\n"); fflush(stdout); return -1; }
+      return target_num_bytes;
+      }
+
+   pthread_mutex_lock(&(RB_ptr->buf_mutex));
+
+// Fill the buffer until the three byte count is available, taking whatever else the socket already holds.
+   while ( RB_ptr->end - RB_ptr->start < 3 )
+      {
+      if ( RB_ptr->start > 0 )
+         {
+         memmove(RB_ptr->data, &(RB_ptr->data[RB_ptr->start]), RB_ptr->end - RB_ptr->start);
+         RB_ptr->end -= RB_ptr->start;
+         RB_ptr->start = 0;
+         }
+      if ( (n = recv(socket_desc, &(RB_ptr->data[RB_ptr->end]), SOCK_RECV_BUF_SIZE - RB_ptr->end, 0)) <= 0 )
+         {
+         if ( n < 0 && errno == EINTR )
+            continue;
+         pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+         printf("ERROR: SockGetB(): Error in receiving three byte cnt!\n"); fflush(stdout); return -1; 
+         }
+      RB_ptr->end += n;
+      }
+
+// Translate the binary bytes into an integer.
+   target_num_bytes = (int)(RB_ptr->data[RB_ptr->start + 2] << 16) + (int)(RB_ptr->data[RB_ptr->start + 1] << 8) + 
+      (int)RB_ptr->data[RB_ptr->start];
+   RB_ptr->start += 3;
+
+// Sanity check.
+   if ( target_num_bytes > buffer_size )
+      { 
+      RB_ptr->start = RB_ptr->end = 0;
+      pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+      printf("ERROR: SockGetB(): 'target_num_bytes' %d is larger than buffer input size %d\n", 
+         target_num_bytes, buffer_size); fflush(stdout); return -1;
+      }
+
+// Copy what is buffered and read the rest of a large message directly into the caller's buffer.
+   num_buffered = RB_ptr->end - RB_ptr->start;
+   if ( num_buffered > target_num_bytes )
+      num_buffered = target_num_bytes;
+   memcpy(buffer, &(RB_ptr->data[RB_ptr->start]), num_buffered);
+   RB_ptr->start += num_buffered;
+   if ( RB_ptr->start == RB_ptr->end )
+      RB_ptr->start = RB_ptr->end = 0;
+
+   if ( num_buffered < target_num_bytes && SockRecvAll(socket_desc, &buffer[num_buffered], target_num_bytes - num_buffered) < 0 )
+      {
+      pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+      printf("ERROR: SockGetB(): Error in receiving transmitted data!\n"); fflush(stdout); return -1; 
+      }
+
+   pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+
+// DEBUG
+//printf("SockGetB(): received %d bytes\n", target_num_bytes); fflush(stdout);
+
+   return target_num_bytes;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// This function sends binary or ASCII data of 'buffer_size' unsigned characters through the socket. The three byte 
+// length and the data go out in one sendmsg() call, so a short message is a single TCP segment.
+
+int SockSendB(unsigned char *buffer, int buffer_size, int socket_desc)
+   {
+   unsigned char num_bytes[3];
+   struct iovec iov[2];
+   struct msghdr msg;
+   ssize_t n;
+
+// Sanity check. Don't yet support transfers larger than 16,777,215 bytes.
+   if ( buffer_size > 16777215 )
+      { printf("ERROR: SockSendB(): Size of buffer %d larger than max (16777215)!\n", buffer_size); fflush(stdout); return -1; }
+
+   num_bytes[2] = (unsigned char)((buffer_size & 0x00FF0000) >> 16);
+   num_bytes[1] = (unsigned char)((buffer_size & 0x0000FF00) >> 8);
+   num_bytes[0] = (unsigned char)(buffer_size & 0x000000FF);
+
+   iov[0].iov_base = num_bytes;
+   iov[0].iov_len = 3;
+   iov[1].iov_base = buffer;
+   iov[1].iov_len = buffer_size;
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = iov;
+   msg.msg_iovlen = 2;
+
+// Resume after partial sends, which happen for large buffers.
+   while ( msg.msg_iovlen > 0 )
+      {
+      if ( (n = sendmsg(socket_desc, &msg, 0)) < 0 )
+         {
+         if ( errno == EINTR )
+            continue;
+         printf("ERROR: SockSendB(): Send of %d bytes failed\n", buffer_size); fflush(stdout); return -1; 
+         }
+      while ( msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov[0].iov_len )
+         {
+         n -= msg.msg_iov[0].iov_len;
+         msg.msg_iov++;
+         msg.msg_iovlen--;
+         }
+      if ( msg.msg_iovlen > 0 )
+         {
+         msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + n;
+         msg.msg_iov[0].iov_len -= n;
+         }
+      }
+
+   return 0;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Write all 'num_bytes' to the socket. Returns -1 on failure.
+
+static int SockSendAll(int socket_desc, unsigned char *buffer, int num_bytes)
+   {
+   int tot_bytes_sent, n;
+
+   tot_bytes_sent = 0;
+   while ( tot_bytes_sent < num_bytes )
+      {
+      if ( (n = send(socket_desc, &buffer[tot_bytes_sent], num_bytes - tot_bytes_sent, 0)) < 0 )
+         {
+         if ( errno == EINTR )
+            continue;
+         return -1;
+         }
+      tot_bytes_sent += n;
+      }
+
+   return tot_bytes_sent;
+   }
+
+
+// Move up to 'num_bytes' from one socket to another through a pipe with splice(), so the data never enters user space. Returns 
+// the number of bytes delivered, which is short if splice stops early (e.g. it is not supported for these descriptors), or -1 
+// if bytes were taken from the source but could not be delivered.
+static int SockSpliceAll(int from_socket_desc, int to_socket_desc, int num_bytes)
+   {
+   int pipe_descs[2];
+   int tot_bytes_moved, in_pipe, n;
+
+   if ( pipe(pipe_descs) < 0 )
+      return 0;
+
+   tot_bytes_moved = 0;
+   in_pipe = 0;
+   while ( tot_bytes_moved < num_bytes )
+      {
+      if ( in_pipe == 0 )
+         {
+         if ( (n = splice(from_socket_desc, NULL, pipe_descs[1], NULL, num_bytes - tot_bytes_moved, SPLICE_F_MOVE)) <= 0 )
+            {
+            if ( n < 0 && errno == EINTR )
+               continue;
+            break;
+            }
+         in_pipe = n;
+         }
+      if ( (n = splice(pipe_descs[0], NULL, to_socket_desc, NULL, in_pipe, SPLICE_F_MOVE)) <= 0 )
+         {
+         if ( n < 0 && errno == EINTR )
+            continue;
+         tot_bytes_moved = -1;
+         break;
+         }
+      in_pipe -= n;
+      tot_bytes_moved += n;
+      }
+
+   close(pipe_descs[0]);
+   close(pipe_descs[1]);
+
+   return tot_bytes_moved;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Forward 'num_msgs' SockSendB messages from one socket to another without storing them, for the TTP when it is only a 
+// relay between Alice and the Bank. Bytes are sent on as they arrive, so a run of messages streams through instead of being 
+// received in full and then re-sent one at a time. If 'msg_num_bytes' is positive, every message must be exactly that size, 
+// otherwise at most 'max_string_len' bytes. The large part of a big message is moved with splice(). Bytes read past the last 
+// message stay in the receive buffer for the next SockGetB. Returns the number of bytes forwarded or -1.
+
+int SockRelayB(int max_string_len, int from_socket_desc, int to_socket_desc, int num_msgs, int msg_num_bytes)
+   {
+   SockRecvBufStruct *RB_ptr;
+   unsigned char chunk[SOCK_RELAY_CHUNK_SIZE];
+   int msg_num, target_num_bytes, frame_bytes_left, num_bytes, tot_bytes_relayed, n;
+
+   tot_bytes_relayed = 0;
+
+// Descriptors beyond the buffer table: copy each message through a small stack buffer.
+   if ( (RB_ptr = GetSockRecvBuf(from_socket_desc)) == NULL )
+      {
+      for ( msg_num = 0; msg_num < num_msgs; msg_num++ )
+         {
+         if ( SockRecvAll(from_socket_desc, chunk, 3) < 0 )
+            { printf("ERROR: SockRelayB(): Error in receiving three byte cnt!\n"); fflush(stdout); return -1; }
+         target_num_bytes = (int)(chunk[2] << 16) + (int)(chunk[1] << 8) + (int)chunk[0];
+         if ( (msg_num_bytes > 0 && target_num_bytes != msg_num_bytes) || (msg_num_bytes <= 0 && target_num_bytes > max_string_len) )
+            { printf("ERROR: SockRelayB(): Message %d has unexpected size %d!\n", msg_num, target_num_bytes); fflush(stdout); return -1; }
+         if ( SockSendAll(to_socket_desc, chunk, 3) < 0 )
+            { printf("ERROR: SockRelayB(): Error in forwarding three byte cnt!\n"); fflush(stdout); return -1; }
+         for ( frame_bytes_left = target_num_bytes; frame_bytes_left > 0; frame_bytes_left -= num_bytes )
+            {
+            num_bytes = frame_bytes_left < SOCK_RELAY_CHUNK_SIZE ? frame_bytes_left : SOCK_RELAY_CHUNK_SIZE;
+            if ( SockRecvAll(from_socket_desc, chunk, num_bytes) < 0 || SockSendAll(to_socket_desc, chunk, num_bytes) < 0 )
+               { printf("ERROR: SockRelayB(): Error in forwarding message %d!\n", msg_num); fflush(stdout); return -1; }
+            }
+         tot_bytes_relayed += target_num_bytes + 3;
+         }
+      return tot_bytes_relayed;
+      }
+
+   pthread_mutex_lock(&(RB_ptr->buf_mutex));
+
+   msg_num = 0;
+   frame_bytes_left = 0;
+   while ( msg_num < num_msgs )
+      {
+
+// Start of a frame: the three byte count must be buffered to check the size.
+      if ( frame_bytes_left == 0 && RB_ptr->end - RB_ptr->start >= 3 )
+         {
+         target_num_bytes = (int)(RB_ptr->data[RB_ptr->start + 2] << 16) + (int)(RB_ptr->data[RB_ptr->start + 1] << 8) + 
+            (int)RB_ptr->data[RB_ptr->start];
+         if ( (msg_num_bytes > 0 && target_num_bytes != msg_num_bytes) || (msg_num_bytes <= 0 && target_num_bytes > max_string_len) )
+            {
+            RB_ptr->start = RB_ptr->end = 0;
+            pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+            printf("ERROR: SockRelayB(): Message %d has unexpected size %d!\n", msg_num, target_num_bytes); fflush(stdout); return -1;
+            }
+         frame_bytes_left = target_num_bytes + 3;
+         }
+
+// Forward whatever part of the current frame is buffered.
+      if ( frame_bytes_left > 0 && RB_ptr->end > RB_ptr->start )
+         {
+         num_bytes = RB_ptr->end - RB_ptr->start;
+         if ( num_bytes > frame_bytes_left )
+            num_bytes = frame_bytes_left;
+         if ( SockSendAll(to_socket_desc, &(RB_ptr->data[RB_ptr->start]), num_bytes) < 0 )
+            {
+            pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+            printf("ERROR: SockRelayB(): Error in forwarding message %d!\n", msg_num); fflush(stdout); return -1; 
+            }
+         RB_ptr->start += num_bytes;
+         if ( RB_ptr->start == RB_ptr->end )
+            RB_ptr->start = RB_ptr->end = 0;
+         frame_bytes_left -= num_bytes;
+         tot_bytes_relayed += num_bytes;
+         if ( frame_bytes_left == 0 )
+            msg_num++;
+         continue;
+         }
+
+// Buffer is empty in the middle of a large frame: splice the rest of it across. Whatever splice does not move is read below.
+      if ( frame_bytes_left >= SOCK_RELAY_SPLICE_MIN_BYTES )
+         {
+         if ( (n = SockSpliceAll(from_socket_desc, to_socket_desc, frame_bytes_left)) < 0 )
+            {
+            pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+            printf("ERROR: SockRelayB(): Error in splicing message %d!\n", msg_num); fflush(stdout); return -1; 
+            }
+         if ( n > 0 )
+            {
+            frame_bytes_left -= n;
+            tot_bytes_relayed += n;
+            if ( frame_bytes_left == 0 )
+               msg_num++;
+            continue;
+            }
+         }
+
+// Read whatever the socket has now.
+      if ( RB_ptr->start > 0 )
+         {
+         memmove(RB_ptr->data, &(RB_ptr->data[RB_ptr->start]), RB_ptr->end - RB_ptr->start);
+         RB_ptr->end -= RB_ptr->start;
+         RB_ptr->start = 0;
+         }
+      if ( (n = recv(from_socket_desc, &(RB_ptr->data[RB_ptr->end]), SOCK_RECV_BUF_SIZE - RB_ptr->end, 0)) <= 0 )
+         {
+         if ( n < 0 && errno == EINTR )
+            continue;
+         pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+         printf("ERROR: SockRelayB(): Error in receiving message %d!\n", msg_num); fflush(stdout); return -1; 
+         }
+      RB_ptr->end += n;
       }
 
-   return 1;
+   pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+
+   return tot_bytes_relayed;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// Open up a client socket connection. Returns 0 on success and -1 if fails.
+// Request opcode names (the command strings older devices sent before the binary header). Indexed by opcode.
 
-int OpenSocketClient(int max_string_len, char *server_IP, int port_number, int *server_socket_desc_ptr)
+static const char *RequestOpcodeTable[REQ_NUM_OPCODES] = 
    {
-   struct sockaddr_in server_addr;
-   int result;
-
-//   printf("OpenSocketClient(): Creating a socket\n"); fflush(stdout); 
-   if ( (*server_socket_desc_ptr = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
-      { printf("ERROR: OpenSocketClient(): Could not create socket"); exit(EXIT_FAILURE); }
-        
-   server_addr.sin_addr.s_addr = inet_addr(server_IP);
-   server_addr.sin_family = AF_INET;
-   server_addr.sin_port = htons(port_number);
-   memset(server_addr.sin_zero, 0, 8); 
-
-// Connect to it. 9/14/2018: Changing this from 'exit' to return error.
-   if ( (result = connect(*server_socket_desc_ptr, (struct sockaddr *)&server_addr, sizeof(server_addr))) < 0 )
-      { printf("INFO: OpenSocketClient: Connect failed -- no listener\n"); fflush(stdout); }
-     
-//   printf("OpenSocketClient(): Connected\n"); fflush(stdout);
-
-// Close the socket if the connect fails.
-   if ( result < 0 )
-      close(*server_socket_desc_ptr);
+   "UNKNOWN",
+   "KEK-CHALLENGE-ENROLL",
+   "ZERO-TRUST-ENROLL",
+   "ZERO-TRUST-GET-ATS",
+   "WITHDRAW",
+   "TTP-AUTHENTICATION",
+   "ALICE-GET-TTP-IPS",
+   "ALICE-GET-CUSTOMER-IPS",
+   "TTP-MASTER-GET-TTP-IP-INFO",
+   "TTP-GET-DEVICE-IDS",
+   "CLIENT-AUTHENTICATION",
+   "CLIENT-SERVER-KEYGEN",
+   "ALICE-WITHDRAWAL",
+   "ALICE-ACCOUNT",
+   "TTP-CHANNEL-AUTHENTICATION"
+   };
+
+// Request IDs handed out by this process for the requests it sends. The sequence 
+// starts at a random value so a client does not reuse its IDs after a restart: the TTP records Alice's withdrawals under 
+// her request IDs (see PUFCashLedgerTxn) and treats a repeated one as a retry.
+static unsigned int NextRequestID;
+static pthread_once_t RequestIDOnce = PTHREAD_ONCE_INIT;
+
+static void SeedRequestID(void)
+   { GetRandomBytes((unsigned char *)&NextRequestID, sizeof(NextRequestID)); }
+
+static unsigned int NewRequestID(void)
+   {
+   pthread_once(&RequestIDOnce, SeedRequestID);
+   return __atomic_fetch_add(&NextRequestID, 1, __ATOMIC_RELAXED);
+   }
 
-   return result;
+const char *GetRequestName(int opcode)
+   {
+   if ( opcode <= REQ_OP_UNKNOWN || opcode >= REQ_NUM_OPCODES )
+      return RequestOpcodeTable[REQ_OP_UNKNOWN];
+   return RequestOpcodeTable[opcode];
    }
 
 
+
 // ========================================================================================================
 // ========================================================================================================
-// Open up a datagram socket for receiving broadcasts
+// Put one message back in front of the receive buffer of 'socket_desc' so the next SockGetB returns it. Used to hand 
+// the payload that came in with a request header to the handler, which reads it as a normal message.
 
-int OpenSocketServerUDP(int max_string_len, int *bcast_server_socket_desc_ptr, char *server_IP, int port_number, 
-   struct sockaddr_in *client_addr_ptr, int accept_only, int check_and_return, char *buff, char *bcast_subnet_IP)
+static int SockUngetB(unsigned char *buffer, int buffer_size, int socket_desc)
    {
-   struct sockaddr_in my_addr;
-   unsigned int sizeof_sock;
-   int opt = TRUE;
-   int broadcastEnable = 1;
+   SockRecvBufStruct *RB_ptr;
+   int num_bytes = buffer_size + 3;
 
-// Initialize the buffer to a NULL string.
-   buff[0] = '\0';
+   if ( (RB_ptr = GetSockRecvBuf(socket_desc)) == NULL )
+      { printf("ERROR: SockUngetB(): Socket %d has no receive buffer!\n", socket_desc); fflush(stdout); return -1; }
 
-// Create a socket and prepare the socket_in structure.
-   if ( accept_only == 0 )
+   pthread_mutex_lock(&(RB_ptr->buf_mutex));
+
+// Make room in front of the buffered bytes.
+   if ( RB_ptr->start < num_bytes )
       {
-      if ( (*bcast_server_socket_desc_ptr = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
-         { perror("ERROR: OpenSocketServerUDP(): Cannnot create DATAGRAM socket!"); exit(EXIT_FAILURE); }
+      if ( RB_ptr->end - RB_ptr->start + num_bytes > SOCK_RECV_BUF_SIZE )
+         {
+         pthread_mutex_unlock(&(RB_ptr->buf_mutex));
+         printf("ERROR: SockUngetB(): No room for %d bytes in receive buffer!\n", buffer_size); fflush(stdout); return -1; 
+         }
+      memmove(&(RB_ptr->data[num_bytes]), &(RB_ptr->data[RB_ptr->start]), RB_ptr->end - RB_ptr->start);
+      RB_ptr->end += num_bytes - RB_ptr->start;
+      RB_ptr->start = num_bytes;
+      }
 
-// Set master socket to allow multiple connections, this is just a good habit, it will work without this.
-      if( setsockopt(*bcast_server_socket_desc_ptr, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )
-         { perror("ERROR: OpenSocketServerUDP(): setsockopt to allow multiple connections"); exit(EXIT_FAILURE); }
+   RB_ptr->start -= num_bytes;
+   RB_ptr->data[RB_ptr->start] = (unsigned char)(buffer_size & 0x000000FF);
+   RB_ptr->data[RB_ptr->start + 1] = (unsigned char)((buffer_size & 0x0000FF00) >> 8);
+   RB_ptr->data[RB_ptr->start + 2] = (unsigned char)((buffer_size & 0x00FF0000) >> 16);
+   memcpy(&(RB_ptr->data[RB_ptr->start + 3]), buffer, buffer_size);
 
-// Enable reception of broadcast messages.
-      setsockopt(*bcast_server_socket_desc_ptr, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable));
+   pthread_mutex_unlock(&(RB_ptr->buf_mutex));
 
-// Do non-block fctrl call
-      if ( check_and_return == 1 )
-         {
-         struct timeval read_timeout;
-         read_timeout.tv_sec = 0;
-         read_timeout.tv_usec = 1000;
-         setsockopt(*bcast_server_socket_desc_ptr, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof(read_timeout));
+   return 0;
+   }
 
-//         int flags = fcntl(*bcast_server_socket_desc_ptr, F_GETFL, 0);
-//         if (flags < 0) return 0;
-//         flags = flags | O_NONBLOCK;
-//         if ( fcntl(*bcast_server_socket_desc_ptr, F_SETFL, flags) != 0 )
-//            { printf("ERROR: OpenSocketServerUDP(): Failed to set 'fcntl' flags to non-blocking!\n"); exit(EXIT_FAILURE); }
-         }
 
-// Prepare the sockaddr_in structure for the server. 
-      memset(&my_addr, '\0', sizeof(struct sockaddr_in));
-      my_addr.sin_family = AF_INET;
-      my_addr.sin_port = (in_port_t)htons(port_number+1);
-//      my_addr.sin_addr.s_addr = inet_addr(server_IP);
-      my_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-//      my_addr.sin_addr.s_addr = inet_addr(bcast_subnet_IP);
+// ========================================================================================================
+// ========================================================================================================
+// Send a request as a binary header. If 'payload' is not NULL, it is the first message of the operation and goes out in 
+// the same frame; the receiver's handler reads it with SockGetB as if it had been sent separately.
 
-      if ( bind(*bcast_server_socket_desc_ptr, (struct sockaddr *)&my_addr, sizeof(my_addr)) < 0 )
-         { perror("ERROR: OpenSockeServerUDP(): Failed to bind"); }
+int SockSendRequest(int socket_desc, int opcode, unsigned char *payload, int payload_num_bytes)
+   {
+   unsigned char *request;
+   unsigned int request_id;
+   int request_num_bytes, status;
 
-// No 'listen' call for UDP.
-      }
+   if ( opcode <= REQ_OP_UNKNOWN || opcode >= REQ_NUM_OPCODES )
+      { printf("ERROR: SockSendRequest(): Invalid opcode %d!\n", opcode); exit(EXIT_FAILURE); }
+
+   if ( payload == NULL )
+      payload_num_bytes = 0;
+
+   request_num_bytes = REQ_HDR_NUM_BYTES + payload_num_bytes;
+   request = Allocate1DUnsignedChar(request_num_bytes);
+
+   request_id = NewRequestID();
+
+   request[0] = REQ_HDR_MAGIC;
+   request[1] = REQ_HDR_VERSION;
+   request[2] = (unsigned char)opcode;
+   request[3] = payload_num_bytes > 0 ? REQ_FLAG_PAYLOAD : 0;
+   request[4] = (unsigned char)(request_id & 0x000000FF);
+   request[5] = (unsigned char)((request_id & 0x0000FF00) >> 8);
+   request[6] = (unsigned char)((request_id & 0x00FF0000) >> 16);
+   request[7] = (unsigned char)((request_id & 0xFF000000) >> 24);
+   if ( payload_num_bytes > 0 )
+      memcpy(&request[REQ_HDR_NUM_BYTES], payload, payload_num_bytes);
 
 #ifdef DEBUG
-printf("Checking\n"); fflush(stdout);
+printf("SockSendRequest(): Sending '%s' ID %u with %d payload bytes\n", GetRequestName(opcode), request_id, payload_num_bytes); fflush(stdout);
 #endif
 
-   sizeof_sock = sizeof(struct sockaddr_in);
-   recvfrom(*bcast_server_socket_desc_ptr, buff, max_string_len, 0, (struct sockaddr *)client_addr_ptr, &sizeof_sock);
+   status = SockSendB(request, request_num_bytes, socket_desc);
+   free(request);
 
-   return 1;
+   return status;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// This function is designed to buffer data but in kernel space. It allows binary data to be transmitted. 
-// To accomplish this, the first two bytes are interpreted as the length of the binary byte stream that follows.
+// Receive a request header, with an optional payload that is pushed back for the handler. Returns the opcode, REQ_OP_UNKNOWN 
+// for requests this version refuses (legacy command strings, other header versions, unknown opcodes), or -1 if the receive 
+// fails. A refused peer would select different challenges (see REQ_HDR_VERSION), so the caller closes the connection.
 
-int SockGetB(unsigned char *buffer, int buffer_size, int socket_desc)
+int SockGetRequest(int max_string_len, int socket_desc, RequestHeaderStruct *RH_ptr)
    {
-   int tot_bytes_received, target_num_bytes;
-   unsigned char buffer_num_bytes[4];
-
-// Call until two bytes are returned. The 2-byte buffer represents a number that is to be interpreted as the exact 
-// number of binary bytes that will follow in the socket.
-   target_num_bytes = 3;
-   tot_bytes_received = 0;
-   while ( tot_bytes_received < target_num_bytes )
-      if ( (tot_bytes_received += recv(socket_desc, &buffer_num_bytes[tot_bytes_received], target_num_bytes - tot_bytes_received, 0)) < 0 )
-         { printf("ERROR: SockGetB(): Error in receiving three byte cnt!\n"); fflush(stdout); return -1; }
+   unsigned char request[max_string_len];
+   int request_num_bytes;
 
-// Translate the binary bytes into an integer.
-   target_num_bytes = (int)(buffer_num_bytes[2] << 16) + (int)(buffer_num_bytes[1] << 8) + (int)buffer_num_bytes[0];
+   RH_ptr->opcode = REQ_OP_UNKNOWN;
+   RH_ptr->version = 0;
+   RH_ptr->flags = 0;
+   RH_ptr->request_id = 0;
 
-// DEBUG
-//printf("SockGetB(): fetching %d bytes from socket\n", target_num_bytes); fflush(stdout);
+   if ( (request_num_bytes = SockGetB(request, max_string_len, socket_desc)) < 0 )
+      return -1;
 
-// Sanity check.
-   if ( target_num_bytes > buffer_size )
-      { 
-      printf("ERROR: SockGetB(): 'target_num_bytes' %d is larger than buffer input size %d\n", 
-         target_num_bytes, buffer_size); fflush(stdout); return -1;
+// Legacy command string from a peer that predates the request header.
+   if ( request_num_bytes == 0 || request[0] != REQ_HDR_MAGIC )
+      {
+      request[request_num_bytes < max_string_len ? request_num_bytes : max_string_len - 1] = '\0';
+      printf("WARNING: SockGetRequest(): Refusing legacy request '%s' (peer predates request version %d)!\n", request, 
+         REQ_HDR_VERSION); fflush(stdout); 
+      return REQ_OP_UNKNOWN;
       }
 
-// Now start reading binary bytes from the socket
-   tot_bytes_received = 0;
-   while ( tot_bytes_received < target_num_bytes )
-      if ( (tot_bytes_received += recv(socket_desc, &buffer[tot_bytes_received], target_num_bytes - tot_bytes_received, 0)) < 0 )
-         { printf("ERROR: SockGetB(): Error in receiving transmitted data!\n"); fflush(stdout); return -1; }
+   if ( request_num_bytes < REQ_HDR_NUM_BYTES )
+      { printf("WARNING: SockGetRequest(): Truncated request header of %d bytes!\n", request_num_bytes); fflush(stdout); return REQ_OP_UNKNOWN; }
 
-// Sanity check
-   if ( tot_bytes_received != target_num_bytes )
+   RH_ptr->version = request[1];
+   RH_ptr->flags = request[3];
+   RH_ptr->request_id = (unsigned int)request[4] + ((unsigned int)request[5] << 8) + ((unsigned int)request[6] << 16) + 
+      ((unsigned int)request[7] << 24);
+
+   if ( RH_ptr->version != REQ_HDR_VERSION )
       { 
-      printf("ERROR: SockGetB(): Read more bytes then requested -- 'tot_bytes_received' %d is larger than target %d\n", 
-         tot_bytes_received, target_num_bytes); fflush(stdout); return -1; 
+      printf("WARNING: SockGetRequest(): Refusing request version %d (expected %d)!\n", RH_ptr->version, REQ_HDR_VERSION); 
+      fflush(stdout); 
+      return REQ_OP_UNKNOWN; 
       }
+   if ( request[2] <= REQ_OP_UNKNOWN || request[2] >= REQ_NUM_OPCODES )
+      { printf("WARNING: SockGetRequest(): Unknown request opcode %d!\n", request[2]); fflush(stdout); return REQ_OP_UNKNOWN; }
 
-// DEBUG
-//printf("SockGetB(): received %d bytes\n", tot_bytes_received); fflush(stdout);
+// Hand the payload to the handler as the next message on the socket.
+   if ( (RH_ptr->flags & REQ_FLAG_PAYLOAD) != 0 && 
+      SockUngetB(&request[REQ_HDR_NUM_BYTES], request_num_bytes - REQ_HDR_NUM_BYTES, socket_desc) < 0 )
+      return -1;
 
-   return tot_bytes_received;
+   RH_ptr->opcode = request[2];
+
+   return RH_ptr->opcode;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// This function sends binary or ASCII data of 'buffer_size' unsigned characters through the socket. It first 
-// sends two binary bytes that represent the length of the binary or ASCII byte stream that follows.
+// Per-opcode request statistics.
 
-int SockSendB(unsigned char *buffer, int buffer_size, int socket_desc)
+void InitRequestStats(RequestStatsStruct *RS_ptr)
    {
-   unsigned char num_bytes[3];
+   memset(RS_ptr, 0, sizeof(RequestStatsStruct));
+   pthread_mutex_init(&(RS_ptr->stats_mutex), NULL);
+   return;
+   }
 
-// Sanity check. Don't yet support transfers larger than 16,777,215 bytes.
-   if ( buffer_size > 16777215 )
-      { printf("ERROR: SockSendB(): Size of buffer %d larger than max (16777215)!\n", buffer_size); fflush(stdout); return -1; }
 
-   num_bytes[2] = (unsigned char)((buffer_size & 0x00FF0000) >> 16);
-   num_bytes[1] = (unsigned char)((buffer_size & 0x0000FF00) >> 8);
-   num_bytes[0] = (unsigned char)(buffer_size & 0x000000FF);
-   if ( send(socket_desc, num_bytes, 3, 0) < 0 )
-      { printf("ERROR: SockSendB(): Send 'num_bytes' %d failed\n", buffer_size); fflush(stdout); return -1; }
-   if ( send(socket_desc, buffer, buffer_size, 0) < 0 )
-      { printf("ERROR: SockSendB(): Send failed\n"); fflush(stdout); return -1; }
+void RecordRequestStats(RequestStatsStruct *RS_ptr, RequestHeaderStruct *RH_ptr, long elapsed_us)
+   {
+   int opcode = RH_ptr->opcode;
 
-   return 0;
+   if ( opcode < REQ_OP_UNKNOWN || opcode >= REQ_NUM_OPCODES )
+      opcode = REQ_OP_UNKNOWN;
+
+   pthread_mutex_lock(&(RS_ptr->stats_mutex));
+   RS_ptr->num_requests[opcode]++;
+   RS_ptr->total_us[opcode] += (double)elapsed_us;
+   if ( (double)elapsed_us > RS_ptr->max_us[opcode] )
+      RS_ptr->max_us[opcode] = (double)elapsed_us;
+   pthread_mutex_unlock(&(RS_ptr->stats_mutex));
+
+   return;
+   }
+
+
+void PrintRequestStats(RequestStatsStruct *RS_ptr)
+   {
+   int opcode;
+
+   pthread_mutex_lock(&(RS_ptr->stats_mutex));
+   for ( opcode = 0; opcode < REQ_NUM_OPCODES; opcode++ )
+      if ( RS_ptr->num_requests[opcode] > 0 )
+         printf("Requests: %-28s\tCount %ld\tTime ave %.1f us max %.1f us\n", RequestOpcodeTable[opcode], 
+            RS_ptr->num_requests[opcode], RS_ptr->total_us[opcode]/(double)RS_ptr->num_requests[opcode], RS_ptr->max_us[opcode]);
+   fflush(stdout);
+   pthread_mutex_unlock(&(RS_ptr->stats_mutex));
+
+   return;
    }
 
 
@@ -1724,8 +3094,15 @@ int JoinBytePackedBitStrings(int num_bits1, unsigned char **bs1_ptr, int num_bit
          { printf("ERROR: JoinBytePackedBitStrings(): Failed to realloc *bs1_ptr to new size!\n"); exit(EXIT_FAILURE); }
 
 // Now transfer the bits from bs2 to *bs1_ptr
-   for ( i = num_bits1, j = 0; i < new_num_bits; i++, j++ )
-      SetBitInByte(&((*bs1_ptr)[i/8]), GetBitFromByte(bs2[j/8], j % 8), i % 8);
+   if ( BitOpsMode == BIT_OPS_WORD )
+      {
+      for ( j = 0; j < num_bits2; j += 64 )
+         StoreBitWord(*bs1_ptr, num_bits1 + j, (num_bits2 - j < 64) ? num_bits2 - j : 64, 
+            LoadBitWord(bs2, j, (num_bits2 - j < 64) ? num_bits2 - j : 64));
+      }
+   else
+      for ( i = num_bits1, j = 0; i < new_num_bits; i++, j++ )
+         SetBitInByte(&((*bs1_ptr)[i/8]), GetBitFromByte(bs2[j/8], j % 8), i % 8);
 
    return new_num_bits;
    }
@@ -1761,6 +3138,17 @@ int EliminatePackedBitsFromBS(int num_bits, unsigned char *bs, int bit_pos)
    if ( new_bs_len < 0 )
       { printf("ERROR: EliminatePackedBitsFromBS(): New bitstring length is < 0!\n"); exit(EXIT_FAILURE); }
 
+// Word version: move 64 bits at a time. The source is always ahead of the destination so a forward copy never overwrites 
+// bits that have not been moved yet.
+   if ( BitOpsMode == BIT_OPS_WORD )
+      {
+      for ( i = 0; i < new_bs_len; i += 64 )
+         StoreBitWord(bs, i, (new_bs_len - i < 64) ? new_bs_len - i : 64, LoadBitWord(bs, bit_pos + i, (new_bs_len - i < 64) ? new_bs_len - i : 64));
+      for ( i = new_bs_len; i < num_bits; i += 64 )
+         StoreBitWord(bs, i, (num_bits - i < 64) ? num_bits - i : 64, 0);
+      return new_bs_len;
+      }
+
 // Now move the bits. If bit_pos == num_bits, this moves NOTHING.
    for ( i = 0, j = bit_pos; j < num_bits; i++, j++ )
       SetBitInByte(&(bs[i/8]), GetBitFromByte(bs[j/8], j % 8), i % 8);
@@ -1820,6 +3208,12 @@ int KEK_FSB_SKE(int max_bits, int XMR, unsigned char *SBG_SHD, unsigned char *SB
    int strong_bit, bit_to_match;
    int bit_num, strong_bit_num;
 
+// Use the 64-bit word version if selected. It produces the same outputs.
+   if ( BitOpsMode == BIT_OPS_WORD )
+      return KEK_FSB_SKE_Word(max_bits, XMR, SBG_SHD, SBG_SBS, XMR_SHD, num_nonce_bits, Nonce_or_XMR_SBS, enroll_or_regen, 
+         do_minority_bit_flip_analysis, num_minority_bit_flips_ptr, start_actual_bit_pos, KEK_enroll_key, true_minority_bit_flips_ptr, 
+         FSB_or_SKE, chip_num, TV_num);
+
 #ifdef DEBUG
 printf("Running KEK_FSB_SKE(): chip %d\tTV_num %d\n", chip_num, TV_num); fflush(stdout);
 #endif
@@ -2048,6 +3442,237 @@ printf("KEK_FSB_SKE(): returning!\n"); fflush(stdout);
    }
 
 
+// ===========================================================================================================
+// ===========================================================================================================
+// Append one bit to the Nonce_or_XMR_SBS output of KEK_FSB_SKE_Word. Bits are collected in *out_word_ptr and 
+// stored 64 at a time (or fewer when flush is 1).
+
+void AppendKEKOutputBit(unsigned char *bs, uint64_t *out_word_ptr, int *out_word_start_ptr, int *out_word_bits_ptr, 
+   int bit_val, int flush)
+   {
+   if ( flush == 0 )
+      {
+      *out_word_ptr |= (uint64_t)bit_val << *out_word_bits_ptr;
+      (*out_word_bits_ptr)++;
+      }
+
+   if ( *out_word_bits_ptr == 64 || (flush == 1 && *out_word_bits_ptr > 0) )
+      {
+      StoreBitWord(bs, *out_word_start_ptr, *out_word_bits_ptr, *out_word_ptr);
+      *out_word_start_ptr += *out_word_bits_ptr;
+      *out_word_ptr = 0;
+      *out_word_bits_ptr = 0;
+      }
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// 64-bit word version of KEK_FSB_SKE (see the description above). It has the same parameters and produces the 
+// same outputs. The helper data is processed a word at a time:
+//    - Regeneration: The raw bits at the strong (helper data '1') positions are gathered with ExtractBits64, 
+//      and the majority vote over each group of XMR copies is a popcount.
+//    - Enrollment: The strong bits are scattered back to their helper data positions with DepositBits64, so 
+//      the next strong bit that matches 'bit_to_match' is found with a count-trailing-zeros and the mismatching 
+//      strong bits in between are eliminated from the XMR_SHD together.
+
+int KEK_FSB_SKE_Word(int max_bits, int XMR, unsigned char *SBG_SHD, unsigned char *SBG_SBS, unsigned char *XMR_SHD, 
+   int num_nonce_bits, unsigned char *Nonce_or_XMR_SBS, int enroll_or_regen, int do_minority_bit_flip_analysis, 
+   int *num_minority_bit_flips_ptr, int start_actual_bit_pos, unsigned char *KEK_enroll_key, 
+   int *true_minority_bit_flips_ptr, int FSB_or_SKE, int chip_num, int TV_num)
+   {
+   int num_zeros, num_ones, XMR_copy_cnt, tot_wasted_strong, tot_strong, SBS_tracker;
+   int bit_num_of_last_fully_encoded_bit; 
+   int strong_bit, bit_to_match, strong_bit_num;
+   int word_bit_num, word_num_bits, num_strong_in_word, num_strong_used, num_take, pos, done;
+   uint64_t SHD_word, SBS_word, strong_word, keep_word, match_word, skipped_word;
+   uint64_t out_word;
+   int out_word_start, out_word_bits;
+   int cur_num_minority_bit_flips;
+
+#ifdef DEBUG
+printf("Running KEK_FSB_SKE_Word(): chip %d\tTV_num %d\n", chip_num, TV_num); fflush(stdout);
+#endif
+
+// Sanity check
+   if ( (XMR % 2) == 0 )
+      { printf("ERROR: KEK_FSB_SKE_Word(): XMR MUST BE odd %d\n", XMR); exit(EXIT_FAILURE); }
+
+   tot_wasted_strong = 0;
+   tot_strong = 0;
+
+   num_ones = 0;
+   XMR_copy_cnt = 0;
+   bit_to_match = -1;
+   strong_bit_num = 0;
+   SBS_tracker = 0;
+   bit_num_of_last_fully_encoded_bit = -1;
+   done = 0;
+
+   out_word = 0;
+   out_word_start = 0;
+   out_word_bits = 0;
+
+   for ( word_bit_num = 0; word_bit_num < max_bits && done == 0; word_bit_num += 64 )
+      {
+      word_num_bits = max_bits - word_bit_num;
+      if ( word_num_bits > 64 )
+         word_num_bits = 64;
+
+      SHD_word = LoadBitWord(SBG_SHD, word_bit_num, word_num_bits);
+      num_strong_in_word = PopCount64(SHD_word);
+
+// Regeneration. The raw bitstring has ALL bits (weak and strong), so the strong bits are at the helper data positions.
+      if ( enroll_or_regen == 1 )
+         {
+         strong_word = ExtractBits64(LoadBitWord(SBG_SBS, word_bit_num, word_num_bits), SHD_word);
+         num_strong_used = 0;
+         while ( num_strong_used < num_strong_in_word )
+            {
+
+// Take the remaining copies of the current XMR group, or whatever is left in this word.
+            num_take = XMR - XMR_copy_cnt;
+            if ( num_take > num_strong_in_word - num_strong_used )
+               num_take = num_strong_in_word - num_strong_used;
+
+            if ( num_take < 64 )
+               num_ones += PopCount64(strong_word & (((uint64_t)1 << num_take) - 1));
+            else
+               num_ones += PopCount64(strong_word);
+            strong_word = (num_take < 64) ? strong_word >> num_take : 0;
+
+            num_strong_used += num_take;
+            XMR_copy_cnt += num_take;
+            tot_strong += num_take;
+
+            if ( XMR_copy_cnt < XMR )
+               break;
+
+// Majority vote. NOTE: equality is NOT possible because XMR is ALWAYS odd. 
+            num_zeros = XMR - num_ones;
+            if ( num_zeros > num_ones ) 
+               { strong_bit = 0; }
+            else
+               { strong_bit = 1; }
+
+            AppendKEKOutputBit(Nonce_or_XMR_SBS, &out_word, &out_word_start, &out_word_bits, strong_bit, 0);
+
+// Minority bit flips, computed exactly as in KEK_FSB_SKE.
+            if ( do_minority_bit_flip_analysis == 1 )
+               {
+               if ( num_zeros < num_ones )
+                  cur_num_minority_bit_flips = XMR - num_ones;
+               else
+                  cur_num_minority_bit_flips = XMR - num_zeros; 
+               *num_minority_bit_flips_ptr += cur_num_minority_bit_flips;
+
+               if ( KEK_enroll_key != NULL )
+                  {
+                  if ( strong_bit == GetBitFromByte(KEK_enroll_key[(start_actual_bit_pos + strong_bit_num)/8], (start_actual_bit_pos + strong_bit_num) % 8) )
+                     *true_minority_bit_flips_ptr += cur_num_minority_bit_flips;
+                  else 
+                     *true_minority_bit_flips_ptr += (XMR - cur_num_minority_bit_flips);
+                  }
+               }
+
+            strong_bit_num++;
+
+// The last copy of the group is the num_strong_used'th strong bit in this word.
+            pos = __builtin_ctzll(DepositBits64((uint64_t)1 << (num_strong_used - 1), SHD_word));
+            bit_num_of_last_fully_encoded_bit = word_bit_num + pos;
+
+            if ( FSB_or_SKE == 1 && strong_bit_num == num_nonce_bits )
+               { done = 1; break; }
+
+            num_ones = 0;
+            XMR_copy_cnt = 0;
+            }
+         }
+
+// Enrollment. The SBS has ONLY the strong bits, so scatter them to the helper data positions. Strong bits that do not
+// match 'bit_to_match' are left out of keep_word, which becomes this word of the XMR_SHD.
+      else
+         {
+         SBS_word = DepositBits64(LoadBitWord(SBG_SBS, SBS_tracker, num_strong_in_word), SHD_word);
+         SBS_tracker += num_strong_in_word;
+
+         keep_word = 0;
+         while ( SHD_word != 0 )
+            {
+            if ( XMR_copy_cnt == 0 )
+               {
+               if ( FSB_or_SKE == 0 )
+                  bit_to_match = (int)((SBS_word >> __builtin_ctzll(SHD_word)) & 1);
+               else
+                  bit_to_match = GetBitFromByte(Nonce_or_XMR_SBS[strong_bit_num/8], strong_bit_num % 8);
+               }
+
+// Find the next strong bit that matches. All strong bits before it are wasted.
+            match_word = SHD_word & ((bit_to_match == 1) ? SBS_word : ~SBS_word);
+            if ( match_word == 0 )
+               {
+               tot_wasted_strong += PopCount64(SHD_word);
+               tot_strong += PopCount64(SHD_word);
+               break;
+               }
+            pos = __builtin_ctzll(match_word);
+            skipped_word = SHD_word & (((uint64_t)1 << pos) - 1);
+
+            tot_wasted_strong += PopCount64(skipped_word);
+            tot_strong += PopCount64(skipped_word) + 1;
+            keep_word |= (uint64_t)1 << pos;
+            SHD_word &= ~(skipped_word | ((uint64_t)1 << pos));
+
+            XMR_copy_cnt++;
+            if ( XMR_copy_cnt == XMR )
+               {
+               AppendKEKOutputBit(Nonce_or_XMR_SBS, &out_word, &out_word_start, &out_word_bits, bit_to_match, 0);
+               strong_bit_num++;
+               bit_num_of_last_fully_encoded_bit = word_bit_num + pos;
+               XMR_copy_cnt = 0;
+
+               if ( FSB_or_SKE == 1 && strong_bit_num == num_nonce_bits )
+                  { done = 1; break; }
+               }
+            }
+
+         StoreBitWord(XMR_SHD, word_bit_num, word_num_bits, keep_word);
+         }
+      }
+
+   AppendKEKOutputBit(Nonce_or_XMR_SBS, &out_word, &out_word_start, &out_word_bits, 0, 1);
+
+// Sanity check: Assuming we ALWAYS succeed in encoding at least a couple bits, this should NEVER BE -1.
+   if ( bit_num_of_last_fully_encoded_bit == -1 )
+      { printf("WARNING: KEK_FSB_SKE_Word(): 'bit_num_of_last_fully_encoded_bit' is -1!\n"); }
+
+// Zero the XMR_SHD beyond the last fully encoded bit (see KEK_FSB_SKE).
+   if ( enroll_or_regen == 0 )
+      for ( word_bit_num = bit_num_of_last_fully_encoded_bit + 1; word_bit_num < max_bits; word_bit_num += 64 )
+         StoreBitWord(XMR_SHD, word_bit_num, (max_bits - word_bit_num < 64) ? max_bits - word_bit_num : 64, 0);
+
+// Sanity check
+   if ( enroll_or_regen == 1 && tot_wasted_strong != 0 )
+      { printf("ERROR: KEK_FSB_SKE_Word(): Regeneration requires tot_wasted_strong %d MUST BE 0!\n", tot_wasted_strong); exit(EXIT_FAILURE); }
+
+// Sanity check
+   if ( enroll_or_regen == 1 && tot_strong/XMR != strong_bit_num )
+      { 
+      printf("ERROR: KEK_FSB_SKE_Word(): Regeneration requires total number of strong bits %d MUST BE equal to ALL strong bits div XMR %d!\n", 
+         strong_bit_num, tot_strong/XMR); exit(EXIT_FAILURE); 
+      }
+
+#ifdef DEBUG
+if ( XMR != 1 )
+   printf("\tKEK_FSB_SKE_Word(): Chip %d\tTV %d\tXMR %d\tTotal strong bits %d\tTot mismatches multiple of size ? %d\tMismatch normalized %.1f\tFinal size of strong bitstring %d\n", 
+      chip_num, TV_num, XMR, tot_strong, tot_wasted_strong, tot_wasted_strong/(float)(XMR-1), strong_bit_num); 
+printf("KEK_FSB_SKE_Word(): returning!\n"); fflush(stdout);
+#endif
+
+   return strong_bit_num;
+   }
+
+
 // ========================================================================================================
 // ========================================================================================================
 // Compute the number of bytes in the Chlng packet based on the mask.
@@ -28,6 +28,10 @@
 #include <arpa/inet.h> 
 #include <net/if.h> 
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 
 #include <time.h>
 #include <sys/time.h>
@@ -178,11 +182,96 @@
 // -----------------------------------
 
 // Number of devices that can simultaneously connect
-#define MAX_CLIENTS 100
+#define MAX_CLIENTS 1024
+
+// Epoll acceptor used by the Bank and TTP servers (see OpenEpollSocketServer): the listen backlog, the number of events 
+// collected per epoll_wait and the capacity of the queue that hands ready connections to the worker threads. The queue 
+// blocks the acceptor when full, so it bounds the number of requests waiting for a worker.
+#define SERVER_LISTEN_BACKLOG 512
+#define SERVER_MAX_EVENTS 64
+#define SERVER_CONN_QUEUE_SIZE 256
+
+// Worker thread pool of the Bank and TTP servers (see CreateThreadPool). The pool starts with the minimum number of workers 
+// and adds one whenever a request is queued and no worker is idle, up to the maximum. Workers above the minimum exit after 
+// sitting idle for the timeout. Per-worker data is allocated up front for the maximum.
+#define SERVER_MIN_THREADS 8
+#define SERVER_MAX_THREADS 64
+#define SERVER_THREAD_IDLE_TIMEOUT_MS 30000
+
+// Number of requests between queue-depth/wait-time reports (see PrintThreadPoolStats).
+#define SERVER_POOL_STATS_INTERVAL 1000
+
+// Number of persistent connections the TTP keeps to the Bank (see ChannelPoolStruct). The first is opened and authenticated 
+// at startup; the rest are opened when every open one is in use.
+#define BANK_MAX_CHANNELS 8
+
+// Size of the per-connection receive buffer used by SockGetB, and the largest socket descriptor that gets one. Reads on 
+// larger descriptors are not buffered.
+#define SOCK_RECV_BUF_SIZE 16384
+#define SOCK_RECV_BUF_MAX_FDS 4096
+
+// SockRelayB copies through a stack buffer of this size when the source socket has no receive buffer, and splices the rest of 
+// a message straight from socket to socket once at least this many bytes of it are still unread.
+#define SOCK_RELAY_CHUNK_SIZE 4096
+#define SOCK_RELAY_SPLICE_MIN_BYTES 4096
+
+// Binary request header (see SockSendRequest/SockGetRequest): magic, version, opcode, flags and a 32-bit request ID in 
+// little-endian order. With REQ_FLAG_PAYLOAD, the first message of the operation follows the header in the same frame. 
+// Version 2 peers select challenges from the seeded stream in SelectRandomSubset, which older peers (version 1 headers and 
+// legacy ASCII command strings, which never start with the magic byte) do not reproduce, so SockGetRequest refuses them 
+// before any exchange starts.
+#define REQ_HDR_MAGIC 0xA5
+#define REQ_HDR_VERSION 2
+#define REQ_HDR_NUM_BYTES 8
+#define REQ_FLAG_PAYLOAD 0x01
+
+// Request opcodes. RequestOpcodeTable in common.c maps each one to its name.
+#define REQ_OP_UNKNOWN 0
+#define REQ_OP_KEK_CHALLENGE_ENROLL 1
+#define REQ_OP_ZERO_TRUST_ENROLL 2
+#define REQ_OP_ZERO_TRUST_GET_ATS 3
+#define REQ_OP_WITHDRAW 4
+#define REQ_OP_TTP_AUTHENTICATION 5
+#define REQ_OP_ALICE_GET_TTP_IPS 6
+#define REQ_OP_ALICE_GET_CUSTOMER_IPS 7
+#define REQ_OP_TTP_MASTER_GET_TTP_IP_INFO 8
+#define REQ_OP_TTP_GET_DEVICE_IDS 9
+#define REQ_OP_CLIENT_AUTHENTICATION 10
+#define REQ_OP_CLIENT_SERVER_KEYGEN 11
+#define REQ_OP_ALICE_WITHDRAWAL 12
+#define REQ_OP_ALICE_ACCOUNT 13
+#define REQ_OP_TTP_CHANNEL_AUTHENTICATION 14
+#define REQ_NUM_OPCODES 15
 
 // Number of DA attempts that are allowed.
 #define MAX_DA_RETRIES 5
 
+// Number of worker threads the verifier uses to search the NAT database for the authenticating chip in KEK_DA_SKE_FindMatch, 
+// and the number of chips a worker claims at a time from the shared chip cursor. Setting the threads to 1 runs the search 
+// in the calling thread.
+#define DA_SCAN_NUM_THREADS 4
+#define DA_SCAN_CHUNK_SIZE 8
+
+// Number of worker threads that compute the PopOnly PNDc of the chips and their medians in ComputePxxSpreadFactors. Setting this to 1
+// runs the computation in the calling thread.
+#define PO_SF_NUM_THREADS 4
+
+// Number of best (smallest CC) chips kept by the chip search in KEK_DA_SKE_FindMatch. The PCC analysis uses the first 4.
+#define DA_SCAN_TOP_K 4
+
+// Candidate prefilter of the chip search in KEK_DA_SKE_FindMatch (see KEK_DA_SKE_RankCandidates). The chips are ranked by comparing 
+// a DA_PREFILTER_SKETCH_BITS bit sketch of their predicted raw bits with the bits the device's helper data implies, and only the 
+// DA_PREFILTER_NUM_CANDIDATES best are scored. If none of them authenticates (AE PCC of the candidates above PCC_SKE_AUTHEN_THRESHOLD), 
+// the remaining chips are scored too, as without the prefilter. Set the number of candidates to 0 to disable the prefilter and scan all 
+// chips in database order. The sketch bits MUST be a multiple of 64.
+#define DA_PREFILTER_NUM_CANDIDATES 32
+#define DA_PREFILTER_SKETCH_BITS 256
+
+// Memory budget of the verifier's LRU cache of normalized PNDc vectors (see CreatePNDcCache), shared by all threads. Set 
+// to 0 to disable the cache.
+#define PNDC_CACHE_BUDGET_BYTES (64*1024*1024)
+#define PNDC_CACHE_MAX_NAME_LEN 128
+
 // Absolute minimum size of any response bitstring generated by Alice, delivered by Bob and used by the Bank to transfer funds.
 #define MIN_RESPONSE_BSTRING_LEN 64
 
@@ -231,6 +320,137 @@
 #define LARGEST_POS_VAL ((16384/16) - 1)
 #define LARGEST_NEG_VAL -LARGEST_POS_VAL
 
+// =====================================================================================================================
+// =====================================================================================================================
+// Epoll acceptor. Slots in 'client_sockets' are 0 when free. Connections accepted by WaitEpollSocketServer are returned 
+// disarmed: the worker that services a connection either closes it (CloseEpollSocketServerClient) or asks for the next 
+// request on it (RearmEpollSocketServerClient), which replaces the old convention of writing -1 into client_sockets. 
+// epoll cannot see a request that SockGetB already read into a connection's receive buffer, so such connections are 
+// re-armed through 'ready_slots' and the eventfd 'wakeup_desc' instead.
+
+typedef struct
+   {
+   int listen_socket_desc;
+   int epoll_desc;
+   int max_clients;
+   int *client_sockets;
+   unsigned char *client_registered;
+   int *free_slots;
+   int num_free_slots;
+   int accept_pending;
+   int wakeup_desc;
+   int *ready_slots;
+   int num_ready_slots;
+   struct epoll_event *events;
+   int max_events;
+   int num_events;
+   int next_event;
+   pthread_mutex_t slot_mutex;
+   } EpollServerStruct;
+
+// A ready connection handed from the acceptor in main() to a worker thread. 'TTP_num' is -1 unless the Bank identified 
+// the connection as one of its persistent TTP channels.
+typedef struct
+   {
+   int socket_desc;
+   int client_index;
+   int iteration_cnt;
+   int TTP_num;
+   char client_IP[IP_LENGTH];
+   struct timeval queued_tv;
+   } ServerConnStruct;
+
+// Receive buffer of one connection (see SockGetB). Bytes in [start, end) have been read from the socket but not yet returned.
+// The mutex only matters for the TTP's Bank socket, which several threads share.
+typedef struct
+   {
+   unsigned char data[SOCK_RECV_BUF_SIZE];
+   int start;
+   int end;
+   pthread_mutex_t buf_mutex;
+   } SockRecvBufStruct;
+
+// Bounded multi-producer/multi-consumer queue of ServerConnStruct. Once 'shutdown' is set, Pop drains the remaining connections 
+// and then returns -1. The last fields are queue-depth and wait-time metrics.
+typedef struct
+   {
+   ServerConnStruct *conns;
+   int capacity;
+   int head;
+   int num_conns;
+   int shutdown;
+   pthread_mutex_t queue_mutex;
+   pthread_cond_t not_empty_cv;
+   pthread_cond_t not_full_cv;
+   int max_num_conns;
+   long num_pushed;
+   long num_full_waits;
+   double total_wait_us;
+   double max_wait_us;
+   } ServerConnQueueStruct;
+
+// Pool of worker threads that pull connections from a ServerConnQueueStruct. 'worker_args' points to 'max_workers' preallocated 
+// per-worker data structures of 'worker_arg_size' bytes each; worker i always runs with the i-th one, so scratch buffers stored 
+// there (e.g., the Bank's SRFAlgoParamsStruct) are reused when a worker is re-created after an idle exit.
+typedef struct
+   {
+   ServerConnQueueStruct *SCQ_ptr;
+   void *(*worker_func)(void *);
+   char *worker_args;
+   size_t worker_arg_size;
+   pthread_t *worker_ids;
+   unsigned char *worker_active;
+   int min_workers;
+   int max_workers;
+   int idle_timeout_ms;
+   int num_workers;
+   int num_idle_workers;
+   int max_num_workers;
+   int shutdown;
+   pthread_mutex_t pool_mutex;
+   } ThreadPoolStruct;
+
+// Persistent client connections to one server that worker threads share. A thread holds a channel for a whole request/response 
+// exchange, so exchanges never interleave on one socket. Slots with 'socket_descs' -1 have not been opened yet. Each channel 
+// opened by the pool is passed to 'authen_func' before it is used. The last fields are acquire/wait metrics.
+typedef struct
+   {
+   char server_IP[IP_LENGTH];
+   int port_number;
+   int (*authen_func)(void *, int);
+   void *authen_arg;
+   int *socket_descs;
+   int *channel_busy;
+   int max_channels;
+   int num_channels;
+   int num_busy;
+   long num_acquires;
+   long num_waits;
+   long num_discards;
+   double total_wait_us;
+   double max_wait_us;
+   pthread_mutex_t pool_mutex;
+   pthread_cond_t pool_cv;
+   } ChannelPoolStruct;
+
+// A decoded request.
+typedef struct
+   {
+   int opcode;
+   int version;
+   int flags;
+   unsigned int request_id;
+   } RequestHeaderStruct;
+
+// Per-opcode request counts and service times, updated by the worker threads.
+typedef struct
+   {
+   long num_requests[REQ_NUM_OPCODES];
+   double total_us[REQ_NUM_OPCODES];
+   double max_us[REQ_NUM_OPCODES];
+   pthread_mutex_t stats_mutex;
+   } RequestStatsStruct;
+
 // =====================================================================================================================
 // =====================================================================================================================
 void StringCreateAndCopy(char **dest, const char *src);
@@ -266,6 +486,33 @@ void GetMyIPAddr(int max_string_len, const char *target_interface_name, char **I
 int OpenMultipleSocketServer(int max_string_len, int *master_socket_ptr, char *server_IP, int port_number, char *client_IP, 
    int max_clients, int *client_sockets, int *client_index_ptr, int initialize);
 
+EpollServerStruct *OpenEpollSocketServer(char *server_IP, int port_number, int backlog, int max_clients);
+int AddEpollSocketServerClient(int max_string_len, EpollServerStruct *ESS_ptr, int socket_desc, int arm);
+int WaitEpollSocketServer(int max_string_len, EpollServerStruct *ESS_ptr, char *client_IP, int *client_index_ptr);
+void RearmEpollSocketServerClient(EpollServerStruct *ESS_ptr, int client_index);
+void CloseEpollSocketServerClient(EpollServerStruct *ESS_ptr, int client_index);
+
+ServerConnQueueStruct *CreateServerConnQueue(int capacity);
+void PushServerConnQueue(ServerConnQueueStruct *SCQ_ptr, ServerConnStruct *conn_ptr);
+int PopServerConnQueue(ServerConnQueueStruct *SCQ_ptr, ServerConnStruct *conn_ptr, int timeout_ms);
+void ShutdownServerConnQueue(ServerConnQueueStruct *SCQ_ptr);
+
+ThreadPoolStruct *CreateThreadPool(int min_workers, int max_workers, int idle_timeout_ms, int queue_size, 
+   void *(*worker_func)(void *), void *worker_args, size_t worker_arg_size);
+void StartThreadPool(ThreadPoolStruct *TP_ptr);
+void SubmitThreadPoolTask(ThreadPoolStruct *TP_ptr, ServerConnStruct *conn_ptr);
+int GetThreadPoolTask(ThreadPoolStruct *TP_ptr, int worker_num, ServerConnStruct *conn_ptr);
+void ShutdownThreadPool(ThreadPoolStruct *TP_ptr);
+void PrintThreadPoolStats(ThreadPoolStruct *TP_ptr);
+
+ChannelPoolStruct *CreateChannelPool(char *server_IP, int port_number, int first_socket_desc, int max_channels, 
+   int (*authen_func)(void *, int), void *authen_arg);
+int AcquireChannel(int max_string_len, ChannelPoolStruct *CP_ptr);
+void ReleaseChannel(ChannelPoolStruct *CP_ptr, int socket_desc);
+void DiscardChannel(ChannelPoolStruct *CP_ptr, int socket_desc);
+void CloseChannelPool(ChannelPoolStruct *CP_ptr);
+void PrintChannelPoolStats(ChannelPoolStruct *CP_ptr);
+
 int OpenSocketServer(int max_string_len, int *server_socket_desc_ptr, char *server_IP, int port_number, int *client_socket_desc_ptr, 
    struct sockaddr_in *client_addr_ptr, int accept_only, int check_and_return);
 
@@ -274,10 +521,25 @@ int OpenSocketClient(int max_string_len, char *server_IP, int port_number, int *
 int OpenSocketServerUDP(int max_string_len, int *bcast_server_socket_desc_ptr, char *server_IP, int port_number, 
    struct sockaddr_in *client_addr_ptr, int accept_only, int check_and_return, char *buff, char *bcast_subnet_IP);
 
+void InitSocketConnection(int socket_desc);
+void SockCork(int socket_desc, int cork);
+int SockRecvPending(int socket_desc);
+int SockClose(int socket_desc);
+
 int SockGetB(unsigned char *buffer, int buffer_size, int socket_desc);
 
 int SockSendB(unsigned char *buffer, int buffer_size, int socket_desc);
 
+int SockRelayB(int max_string_len, int from_socket_desc, int to_socket_desc, int num_msgs, int msg_num_bytes);
+
+const char *GetRequestName(int opcode);
+int SockSendRequest(int socket_desc, int opcode, unsigned char *payload, int payload_num_bytes);
+int SockGetRequest(int max_string_len, int socket_desc, RequestHeaderStruct *RH_ptr);
+
+void InitRequestStats(RequestStatsStruct *RS_ptr);
+void RecordRequestStats(RequestStatsStruct *RS_ptr, RequestHeaderStruct *RH_ptr, long elapsed_us);
+void PrintRequestStats(RequestStatsStruct *RS_ptr);
+
 void PrintHeaderAndHexVals(char *header_str, int num_vals, unsigned char *vals, int max_vals_per_row);
 
 void PrintHeaderAndBinVals(char *header_str, int num_vals, unsigned char *vals, int max_vals_per_row);
@@ -326,6 +588,14 @@ int KEK_FSB_SKE(int max_bits, int XMR, unsigned char *SBG_SHD, unsigned char *SB
    int *num_minority_bit_flips_ptr, int start_actual_bit_pos, unsigned char *KEK_enroll_key, 
    int *true_minority_bit_flips_ptr, int FSB_or_SKE, int chip_num, int TV_num);
 
+void AppendKEKOutputBit(unsigned char *bs, uint64_t *out_word_ptr, int *out_word_start_ptr, int *out_word_bits_ptr, 
+   int bit_val, int flush);
+
+int KEK_FSB_SKE_Word(int max_bits, int XMR, unsigned char *SBG_SHD, unsigned char *SBG_SBS, unsigned char *XMR_SHD, 
+   int num_nonce_bits, unsigned char *Nonce_or_XMR_SBS, int enroll_or_regen, int do_minority_bit_flip_analysis, 
+   int *num_minority_bit_flips_ptr, int start_actual_bit_pos, unsigned char *KEK_enroll_key, 
+   int *true_minority_bit_flips_ptr, int FSB_or_SKE, int chip_num, int TV_num);
+
 int ComputeChlngPacketSize(int max_string_len, int num_required_nonce_bytes, int num_required_PNDiffs,
    int num_SF_bytes, int CH_LLK_num_bytes, int num_iterations, unsigned char mask[2]);
 
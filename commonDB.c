@@ -29,6 +29,7 @@ const char *SQL_VecPairs_insert_into_cmd = "INSERT INTO VecPairs (R_F_str, VA, V
 const char *SQL_VecPairs_get_index_cmd = "SELECT id FROM VecPairs WHERE VA = ? AND VB = ? AND PUFDesign_id = ?;";
 
 const char *SQL_TimingVals_insert_into_cmd = "INSERT INTO TimingVals (VecPair, PO, Ave, TSig, PUFInstance) VALUES (?, ?, ?, ?, ?);";
+const char *SQL_TimingVals_bulk_load_cmd = "SELECT VecPair, PO, Ave FROM TimingVals WHERE PUFInstance = ? AND VecPair BETWEEN ? AND ? ORDER BY VecPair, PO;";
 
 const char *SQL_PathSelectMasks_insert_into_cmd = "INSERT INTO PathSelectMasks (vector_str) VALUES (?);";
 const char *SQL_PathSelectMasks_get_index_cmd = "SELECT id FROM PathSelectMasks WHERE vector_str = ?;";
@@ -92,6 +93,82 @@ int LoadOrSaveDb(sqlite3 *pInMemory, const char *zFilename, int isSave)
    }
 
 
+// ========================================================================================================
+// ========================================================================================================
+// Read the schema version recorded in the database header ('PRAGMA user_version', 0 for a database created 
+// by the SQLSchemaScripts before migrations existed).
+
+int GetSchemaVersion(sqlite3 *db)
+   {
+   sqlite3_stmt *pStmt;
+   int version = 0;
+
+   if ( sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &pStmt, 0) != SQLITE_OK )
+      { printf("ERROR: GetSchemaVersion(): 'sqlite3_prepare_v2' failed: %s\n", sqlite3_errmsg(db)); exit(EXIT_FAILURE); }
+   if ( sqlite3_step(pStmt) == SQLITE_ROW )
+      version = sqlite3_column_int(pStmt, 0);
+   sqlite3_finalize(pStmt);
+
+   return version;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Bring the schema of 'db' up to date by applying, in order, every migration whose version is larger than 
+// the one recorded in the database. Each migration runs in its own transaction together with the update of 
+// 'PRAGMA user_version', so a failed migration leaves the database at the previous version. 'migrations' 
+// MUST be sorted by increasing version. Returns the schema version of the database.
+
+int ApplySchemaMigrations(int max_string_len, sqlite3 *db, const char *DB_name, SchemaMigrationStruct *migrations, 
+   int num_migrations)
+   {
+   char sql_command_str[max_string_len];
+   char *zErrMsg = 0;
+   int version, migration_num;
+
+   version = GetSchemaVersion(db);
+
+   if ( num_migrations > 0 && version > migrations[num_migrations - 1].version )
+      { 
+      printf("WARNING: ApplySchemaMigrations(): '%s' has schema version %d, newer than the latest known %d!\n", DB_name, version, 
+         migrations[num_migrations - 1].version); fflush(stdout); 
+      }
+
+   for ( migration_num = 0; migration_num < num_migrations; migration_num++ )
+      {
+      if ( migrations[migration_num].version <= version )
+         continue;
+
+      printf("ApplySchemaMigrations(): '%s': Migrating schema from version %d to %d: %s\n", DB_name, version, 
+         migrations[migration_num].version, migrations[migration_num].description); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+      if ( sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, 0, &zErrMsg) != SQLITE_OK )
+         { printf("ERROR: ApplySchemaMigrations(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+
+      snprintf(sql_command_str, max_string_len, "PRAGMA user_version = %d;", migrations[migration_num].version);
+      if ( sqlite3_exec(db, migrations[migration_num].SQL_cmds, NULL, 0, &zErrMsg) != SQLITE_OK || 
+         sqlite3_exec(db, sql_command_str, NULL, 0, &zErrMsg) != SQLITE_OK )
+         { 
+         printf("ERROR: ApplySchemaMigrations(): '%s': Migration to version %d failed: %s\n", DB_name, migrations[migration_num].version, 
+            zErrMsg); 
+         sqlite3_free(zErrMsg); 
+         sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+         exit(EXIT_FAILURE); 
+         }
+
+      if ( sqlite3_exec(db, "COMMIT;", NULL, 0, &zErrMsg) != SQLITE_OK )
+         { printf("ERROR: ApplySchemaMigrations(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+
+      version = migrations[migration_num].version;
+      }
+
+   return version;
+   }
+
+
 // ========================================================================================================
 // ========================================================================================================
 // Get all IDs from the table. 
@@ -1099,7 +1176,787 @@ printf("InsertIntoTable(): SQL cmd %s\n", SQL_cmd); fflush(stdout);
    else 
       { printf("ERROR: InsertIntoTable(): Return code => %d for Table '%s'\n", rc, Table); exit(EXIT_FAILURE); }
 
-   return 1;
+   return 1;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Prepared statement cache. Each database connection gets its own registry of statements keyed by their SQL 
+// text, prepared once (at startup with PrepareSQLStmtCache or on first use) and reset after every use so the 
+// runtime queries are never re-parsed. Statements are never finalized until FinalizeSQLStmtCache is called 
+// for the connection, which MUST happen before sqlite3_close (which returns SQLITE_BUSY otherwise).
+
+static SQLStmtCacheStruct SQLStmtCacheArr[SQL_STMT_CACHE_MAX_DBS];
+static pthread_mutex_t SQLStmtCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Find the registry for this connection, claiming an empty one on first use. Caller MUST hold SQLStmtCacheMutex.
+static SQLStmtCacheStruct *LookupSQLStmtCache(sqlite3 *db)
+   {
+   SQLStmtCacheStruct *SC_ptr;
+   int cache_num;
+
+   for ( cache_num = 0; cache_num < SQL_STMT_CACHE_MAX_DBS; cache_num++ )
+      if ( SQLStmtCacheArr[cache_num].db == db )
+         return &(SQLStmtCacheArr[cache_num]);
+   for ( cache_num = 0; cache_num < SQL_STMT_CACHE_MAX_DBS; cache_num++ )
+      if ( SQLStmtCacheArr[cache_num].db == NULL )
+         {
+         SC_ptr = &(SQLStmtCacheArr[cache_num]);
+         SC_ptr->db = db;
+         SC_ptr->num_stmts = 0;
+         pthread_mutex_init(&(SC_ptr->txn_mutex), NULL);
+         return SC_ptr;
+         }
+
+   printf("ERROR: LookupSQLStmtCache(): No free statement cache for database (max %d)!\n", SQL_STMT_CACHE_MAX_DBS); exit(EXIT_FAILURE);
+   }
+
+// Find (or prepare) the cached statement for SQL_cmd on db. Caller MUST hold SQLStmtCacheMutex. Returns NULL if the 
+// statement fails to prepare and 'exit_on_error' is 0.
+static SQLStmtStruct *LookupSQLStmt(sqlite3 *db, const char *SQL_cmd, int exit_on_error)
+   {
+   SQLStmtCacheStruct *SC_ptr;
+   SQLStmtStruct *SQLStmt_ptr;
+   sqlite3_stmt *pStmt;
+   int stmt_num, rc;
+
+   SC_ptr = LookupSQLStmtCache(db);
+
+   for ( stmt_num = 0; stmt_num < SC_ptr->num_stmts; stmt_num++ )
+      if ( strcmp(sqlite3_sql(SC_ptr->stmts[stmt_num].pStmt), SQL_cmd) == 0 )
+         return &(SC_ptr->stmts[stmt_num]);
+
+   if ( SC_ptr->num_stmts == SQL_STMT_CACHE_MAX_STMTS )
+      { printf("ERROR: LookupSQLStmt(): Statement cache full (max %d) for '%s'!\n", SQL_STMT_CACHE_MAX_STMTS, SQL_cmd); exit(EXIT_FAILURE); }
+
+// SQLITE_PREPARE_PERSISTENT tells SQLite the statement is long-lived so it does not allocate it from the lookaside pool.
+   rc = sqlite3_prepare_v3(db, SQL_cmd, strlen(SQL_cmd) + 1, SQLITE_PREPARE_PERSISTENT, &pStmt, 0);
+   if ( rc != SQLITE_OK )
+      {
+      if ( exit_on_error == 0 )
+         return NULL;
+      printf("ERROR: LookupSQLStmt(): 'sqlite3_prepare_v3' failed with %d for '%s': %s\n", rc, SQL_cmd, sqlite3_errmsg(db)); 
+      exit(EXIT_FAILURE); 
+      }
+
+   SQLStmt_ptr = &(SC_ptr->stmts[SC_ptr->num_stmts]);
+   SQLStmt_ptr->pStmt = pStmt;
+   pthread_mutex_init(&(SQLStmt_ptr->stmt_mutex), NULL);
+   SC_ptr->num_stmts++;
+
+   return SQLStmt_ptr;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Get the cached statement for SQL_cmd on db, preparing it if this is its first use. The statement is locked 
+// for the caller until ReleaseSQLStmt, so threads sharing a connection never interleave binds and steps. 
+// NOTE: Do not hold two cached statements at once -- read what is needed and release before getting the next.
+
+SQLStmtStruct *GetSQLStmt(sqlite3 *db, const char *SQL_cmd)
+   {
+   SQLStmtStruct *SQLStmt_ptr;
+
+   pthread_mutex_lock(&SQLStmtCacheMutex);
+   SQLStmt_ptr = LookupSQLStmt(db, SQL_cmd, 1);
+   pthread_mutex_unlock(&SQLStmtCacheMutex);
+
+   pthread_mutex_lock(&(SQLStmt_ptr->stmt_mutex));
+
+#ifdef DEBUG
+printf("GetSQLStmt(): Got cached statement '%s'\n", SQL_cmd); fflush(stdout);
+#endif
+
+   return SQLStmt_ptr;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Reset the statement and clear its bindings (blobs are bound SQLITE_STATIC so the caller's buffers must not 
+// be referenced past this point) and hand it back to the cache.
+
+void ReleaseSQLStmt(SQLStmtStruct *SQLStmt_ptr)
+   {
+   sqlite3_reset(SQLStmt_ptr->pStmt);
+   sqlite3_clear_bindings(SQLStmt_ptr->pStmt);
+   pthread_mutex_unlock(&(SQLStmt_ptr->stmt_mutex));
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Typed bind helpers. Parameter numbers start at 1 as in sqlite3_bind_XXX. 
+
+void BindSQLStmtInt(SQLStmtStruct *SQLStmt_ptr, int param_num, int val)
+   {
+   int rc;
+
+   if ( (rc = sqlite3_bind_int(SQLStmt_ptr->pStmt, param_num, val)) != SQLITE_OK )
+      { 
+      printf("ERROR: BindSQLStmtInt(): Bind of parameter %d failed with %d for '%s'\n", param_num, rc, 
+         sqlite3_sql(SQLStmt_ptr->pStmt)); exit(EXIT_FAILURE); 
+      }
+   }
+
+void BindSQLStmtInt64(SQLStmtStruct *SQLStmt_ptr, int param_num, sqlite3_int64 val)
+   {
+   int rc;
+
+   if ( (rc = sqlite3_bind_int64(SQLStmt_ptr->pStmt, param_num, val)) != SQLITE_OK )
+      { 
+      printf("ERROR: BindSQLStmtInt64(): Bind of parameter %d failed with %d for '%s'\n", param_num, rc, 
+         sqlite3_sql(SQLStmt_ptr->pStmt)); exit(EXIT_FAILURE); 
+      }
+   }
+
+void BindSQLStmtBlob(SQLStmtStruct *SQLStmt_ptr, int param_num, unsigned char *blob, int num_bytes)
+   {
+   int rc;
+
+   if ( (rc = sqlite3_bind_blob(SQLStmt_ptr->pStmt, param_num, blob, num_bytes, SQLITE_STATIC)) != SQLITE_OK )
+      { 
+      printf("ERROR: BindSQLStmtBlob(): Bind of parameter %d failed with %d for '%s'\n", param_num, rc, 
+         sqlite3_sql(SQLStmt_ptr->pStmt)); exit(EXIT_FAILURE); 
+      }
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Step the statement once. Returns SQLITE_ROW, SQLITE_DONE or SQLITE_CONSTRAINT (so inserts can detect 
+// duplicates of UNIQUE columns). Any other return code is fatal.
+
+int StepSQLStmt(SQLStmtStruct *SQLStmt_ptr, char *calling_routine_str)
+   {
+   int rc;
+
+   rc = sqlite3_step(SQLStmt_ptr->pStmt);
+   if ( rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_CONSTRAINT )
+      { 
+      printf("ERROR: %s: 'sqlite3_step' failed with %d for '%s': %s\n", calling_routine_str, rc, sqlite3_sql(SQLStmt_ptr->pStmt), 
+         sqlite3_errmsg(sqlite3_db_handle(SQLStmt_ptr->pStmt))); exit(EXIT_FAILURE); 
+      }
+
+   return rc;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Step an (already bound) INSERT/UPDATE/DELETE and return the number of rows it changed, or -1 if it hit a 
+// constraint. The connection mutex is held across the step and sqlite3_changes so a statement run by another 
+// thread on the same connection can not slip in between and change the count.
+
+int StepSQLStmtChanges(SQLStmtStruct *SQLStmt_ptr, char *calling_routine_str)
+   {
+   sqlite3 *db = sqlite3_db_handle(SQLStmt_ptr->pStmt);
+   int rc, num_changes;
+
+   sqlite3_mutex_enter(sqlite3_db_mutex(db));
+   rc = StepSQLStmt(SQLStmt_ptr, calling_routine_str);
+   num_changes = sqlite3_changes(db);
+   sqlite3_mutex_leave(sqlite3_db_mutex(db));
+
+   if ( rc == SQLITE_CONSTRAINT )
+      return -1;
+   if ( rc != SQLITE_DONE )
+      { printf("ERROR: %s: Expected SQLITE_DONE from '%s' -- got %d!\n", calling_routine_str, sqlite3_sql(SQLStmt_ptr->pStmt), rc); exit(EXIT_FAILURE); }
+
+   return num_changes;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Step the (already bound) statement to completion collecting the integer in column 0 of each row. Same
+// contract as GetAllocateListOfInts: the caller frees int_struct->int_arr.
+
+void GetSQLStmtListOfInts(SQLStmtStruct *SQLStmt_ptr, char *calling_routine_str, SQLIntStruct *int_struct)
+   {
+   int max_ints = 0;
+
+   int_struct->int_arr = NULL;
+   int_struct->num_ints = 0;
+
+   while ( StepSQLStmt(SQLStmt_ptr, calling_routine_str) == SQLITE_ROW )
+      {
+      if ( int_struct->num_ints == max_ints )
+         {
+         max_ints = (max_ints == 0) ? 16 : 2*max_ints;
+         if ( (int_struct->int_arr = (int *)realloc(int_struct->int_arr, max_ints*sizeof(int))) == NULL )
+            { printf("ERROR: GetSQLStmtListOfInts(): Failed to realloc int_arr to %d ints!\n", max_ints); exit(EXIT_FAILURE); }
+         }
+      int_struct->int_arr[int_struct->num_ints] = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+      (int_struct->num_ints)++;
+      }
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Copy the blob in column 'col_num' of the current row into storage allocated here (caller frees it). The 
+// column pointer is owned by the statement and is only valid until the next step or reset. Returns the 
+// number of bytes.
+
+int GetSQLStmtColumnBlob(SQLStmtStruct *SQLStmt_ptr, int col_num, unsigned char **blob_ptr)
+   {
+   int num_bytes;
+
+   num_bytes = sqlite3_column_bytes(SQLStmt_ptr->pStmt, col_num);
+   if ( (*blob_ptr = (unsigned char *)calloc(num_bytes, sizeof(unsigned char))) == NULL )
+      { printf("ERROR: GetSQLStmtColumnBlob(): Failed to allocate storage for blob of %d bytes\n", num_bytes); exit(EXIT_FAILURE); }
+   if ( num_bytes > 0 )
+      memcpy(*blob_ptr, sqlite3_column_blob(SQLStmt_ptr->pStmt, col_num), num_bytes);
+
+   return num_bytes;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Explicit transactions on a connection shared by several threads. SQLite transactions belong to the 
+// connection, not the thread, so BeginSQLTransaction serializes them on the connection's 'txn_mutex' until
+// the matching CommitSQLTransaction. 'BEGIN IMMEDIATE' takes the write lock up front so a read followed by 
+// a write inside the transaction can not be interleaved with another writer. NOTE: Only code that opens a 
+// transaction takes 'txn_mutex'; plain statements from other threads still run (and, while a transaction is 
+// open, become part of it).
+
+void BeginSQLTransaction(sqlite3 *db)
+   {
+   SQLStmtCacheStruct *SC_ptr;
+   char *zErrMsg = 0;
+
+   pthread_mutex_lock(&SQLStmtCacheMutex);
+   SC_ptr = LookupSQLStmtCache(db);
+   pthread_mutex_unlock(&SQLStmtCacheMutex);
+
+   pthread_mutex_lock(&(SC_ptr->txn_mutex));
+   if ( sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, 0, &zErrMsg) != SQLITE_OK )
+      { printf("ERROR: BeginSQLTransaction(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+   }
+
+void CommitSQLTransaction(sqlite3 *db)
+   {
+   SQLStmtCacheStruct *SC_ptr;
+   char *zErrMsg = 0;
+
+   pthread_mutex_lock(&SQLStmtCacheMutex);
+   SC_ptr = LookupSQLStmtCache(db);
+   pthread_mutex_unlock(&SQLStmtCacheMutex);
+
+   if ( sqlite3_exec(db, "COMMIT;", NULL, 0, &zErrMsg) != SQLITE_OK )
+      { printf("ERROR: CommitSQLTransaction(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+   pthread_mutex_unlock(&(SC_ptr->txn_mutex));
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Prepare a list of statements for db at startup so the first request does not pay for parsing them. A 
+// statement whose tables do not exist in this database is skipped (with a warning) and will fail with an 
+// error only if it is actually used. Returns the number prepared.
+
+int PrepareSQLStmtCache(sqlite3 *db, const char **SQL_cmds, int num_cmds)
+   {
+   int cmd_num, num_prepared;
+
+   pthread_mutex_lock(&SQLStmtCacheMutex);
+   num_prepared = 0;
+   for ( cmd_num = 0; cmd_num < num_cmds; cmd_num++ )
+      if ( LookupSQLStmt(db, SQL_cmds[cmd_num], 0) != NULL )
+         num_prepared++;
+      else
+         { printf("WARNING: PrepareSQLStmtCache(): Failed to prepare '%s': %s\n", SQL_cmds[cmd_num], sqlite3_errmsg(db)); fflush(stdout); }
+   pthread_mutex_unlock(&SQLStmtCacheMutex);
+
+#ifdef DEBUG
+printf("PrepareSQLStmtCache(): Prepared %d of %d statements\n", num_prepared, num_cmds); fflush(stdout);
+#endif
+
+   return num_prepared;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Finalize all cached statements of db and free its registry. Call before sqlite3_close(db), with no other
+// thread still using the connection.
+
+void FinalizeSQLStmtCache(sqlite3 *db)
+   {
+   SQLStmtCacheStruct *SC_ptr;
+   int cache_num, stmt_num;
+
+   pthread_mutex_lock(&SQLStmtCacheMutex);
+   for ( cache_num = 0; cache_num < SQL_STMT_CACHE_MAX_DBS; cache_num++ )
+      if ( SQLStmtCacheArr[cache_num].db == db )
+         {
+         SC_ptr = &(SQLStmtCacheArr[cache_num]);
+         for ( stmt_num = 0; stmt_num < SC_ptr->num_stmts; stmt_num++ )
+            {
+            pthread_mutex_lock(&(SC_ptr->stmts[stmt_num].stmt_mutex));
+            sqlite3_finalize(SC_ptr->stmts[stmt_num].pStmt);
+            SC_ptr->stmts[stmt_num].pStmt = NULL;
+            pthread_mutex_unlock(&(SC_ptr->stmts[stmt_num].stmt_mutex));
+            pthread_mutex_destroy(&(SC_ptr->stmts[stmt_num].stmt_mutex));
+            }
+         SC_ptr->num_stmts = 0;
+         pthread_mutex_destroy(&(SC_ptr->txn_mutex));
+         SC_ptr->db = NULL;
+         break;
+         }
+   pthread_mutex_unlock(&SQLStmtCacheMutex);
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Write-back persistence of an in-memory database (see StartDBPersist). Every committed transaction that 
+// changes rows is appended to '<DB_name>.wbj' as one record '<seq> <num_bytes>\n<SQL>\n', where seq numbers 
+// the records and SQL is the expanded text (bound values inlined) of its write statements. The journal is 
+// fdatasync'ed at least every RPO_ms (on every commit if RPO_ms is 0), and every checkpoint_secs the database 
+// is copied back to DB_name with sqlite3_backup_step and the journal truncated. The copy carries the seq of 
+// the last record it contains (table DBPersist_Checkpoint). At startup the records of the journal left by a 
+// crash that come after that seq are replayed on top of the file copy.
+
+// Elapsed milliseconds since t0.
+static long DBPersistElapsedMS(struct timeval *t0)
+   {
+   struct timeval t1;
+
+   gettimeofday(&t1, 0);
+   return (t1.tv_sec - t0->tv_sec)*1000 + (t1.tv_usec - t0->tv_usec)/1000;
+   }
+
+// Append one transaction record to the journal. Caller MUST hold 'journal_mutex'.
+static void DBPersistWriteRecord(DBPersistStruct *DBP_ptr)
+   {
+   DBP_ptr->last_seq++;
+   fprintf(DBP_ptr->journal_fp, "%lld %d\n", DBP_ptr->last_seq, DBP_ptr->pending_len);
+   if ( fwrite(DBP_ptr->pending, 1, DBP_ptr->pending_len, DBP_ptr->journal_fp) != (size_t)DBP_ptr->pending_len || 
+      fputc('\n', DBP_ptr->journal_fp) == EOF || fflush(DBP_ptr->journal_fp) != 0 )
+      { printf("ERROR: DBPersistWriteRecord(): Failed to write journal '%s'!\n", DBP_ptr->journal_name); exit(EXIT_FAILURE); }
+
+   if ( DBP_ptr->RPO_ms == 0 )
+      fdatasync(fileno(DBP_ptr->journal_fp));
+   else
+      DBP_ptr->unsynced = 1;
+   DBP_ptr->num_since_checkpoint++;
+   DBP_ptr->pending_len = 0;
+   }
+
+// SQLITE_TRACE_PROFILE callback, invoked (with the connection mutex held) as each statement completes. Write 
+// statements that changed rows are added to 'pending', which is written out once the connection is back in 
+// autocommit mode, i.e., when the statement's (implicit or explicit) transaction has committed. The update of 
+// the checkpoint seq is not journaled. sqlite3_trace_v2 fixes the signature; the statement's run time (X) is 
+// not used.
+static int DBPersistTraceCallback(unsigned trace_type, void *context, void *P, void *X)
+   {
+   DBPersistStruct *DBP_ptr = (DBPersistStruct *)context;
+   sqlite3_stmt *pStmt = (sqlite3_stmt *)P;
+   int total_changes, SQL_len;
+   char *SQL_str;
+
+   (void)X;
+   if ( trace_type != SQLITE_TRACE_PROFILE )
+      return 0;
+
+   pthread_mutex_lock(&(DBP_ptr->journal_mutex));
+   total_changes = sqlite3_total_changes(DBP_ptr->db);
+   if ( DBP_ptr->writing_seq == 0 && sqlite3_stmt_readonly(pStmt) == 0 && total_changes != DBP_ptr->last_total_changes )
+      {
+      if ( (SQL_str = sqlite3_expanded_sql(pStmt)) == NULL )
+         { printf("ERROR: DBPersistTraceCallback(): Failed to expand '%s' for the journal!\n", sqlite3_sql(pStmt)); exit(EXIT_FAILURE); }
+      SQL_len = strlen(SQL_str);
+
+      if ( DBP_ptr->pending_len + SQL_len + 3 > DBP_ptr->pending_max )
+         {
+         DBP_ptr->pending_max = 2*(DBP_ptr->pending_len + SQL_len + 3);
+         if ( (DBP_ptr->pending = (char *)realloc(DBP_ptr->pending, DBP_ptr->pending_max)) == NULL )
+            { printf("ERROR: DBPersistTraceCallback(): Failed to realloc %d bytes!\n", DBP_ptr->pending_max); exit(EXIT_FAILURE); }
+         }
+      memcpy(DBP_ptr->pending + DBP_ptr->pending_len, SQL_str, SQL_len);
+      memcpy(DBP_ptr->pending + DBP_ptr->pending_len + SQL_len, ";\n", 2);
+      DBP_ptr->pending_len += SQL_len + 2;
+      sqlite3_free(SQL_str);
+      }
+   DBP_ptr->last_total_changes = total_changes;
+
+   if ( DBP_ptr->pending_len > 0 && sqlite3_get_autocommit(DBP_ptr->db) != 0 )
+      DBPersistWriteRecord(DBP_ptr);
+   pthread_mutex_unlock(&(DBP_ptr->journal_mutex));
+
+   return 0;
+   }
+
+// Rollback hook: the statements of the open transaction never happened.
+static void DBPersistRollbackHook(void *context)
+   {
+   DBPersistStruct *DBP_ptr = (DBPersistStruct *)context;
+
+   pthread_mutex_lock(&(DBP_ptr->journal_mutex));
+   DBP_ptr->pending_len = 0;
+   pthread_mutex_unlock(&(DBP_ptr->journal_mutex));
+   }
+
+
+// Store the seq of the last journal record the database contains. Caller MUST hold the connection mutex with no 
+// transaction open. Returns SQLITE_OK or the error code.
+static int DBPersistWriteSeq(DBPersistStruct *DBP_ptr, long long seq)
+   {
+   char sql_command_str[64];
+   int rc;
+
+   sprintf(sql_command_str, "UPDATE DBPersist_Checkpoint SET Seq = %lld;", seq);
+   DBP_ptr->writing_seq = 1;
+   rc = sqlite3_exec(DBP_ptr->db, sql_command_str, NULL, 0, NULL);
+   DBP_ptr->writing_seq = 0;
+
+   return rc;
+   }
+
+// The seq stored by the last checkpoint, or 0 if the database has none.
+static long long DBPersistReadSeq(DBPersistStruct *DBP_ptr)
+   {
+   sqlite3_stmt *pStmt;
+   long long seq;
+
+   seq = 0;
+   if ( sqlite3_prepare_v2(DBP_ptr->db, "SELECT Seq FROM DBPersist_Checkpoint;", -1, &pStmt, NULL) != SQLITE_OK )
+      return 0;
+   if ( sqlite3_step(pStmt) == SQLITE_ROW )
+      seq = sqlite3_column_int64(pStmt, 0);
+   sqlite3_finalize(pStmt);
+
+   return seq;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Copy the in-memory database to DB_name and truncate the journal. The copy is done in slices of 
+// pages_per_step pages while the connection stays available to the workers, for at most step_budget_ms. 
+// A commit during the copy restarts it (SQLite does this for in-memory sources), so the remaining pages are 
+// copied in one step at the end with the connection locked (no statement running and, through 'txn_mutex', 
+// no transaction open), which is also when the journal is truncated. The copy records the seq of the last 
+// journal record it holds, so a crash after the copy but before the truncation does not replay those records 
+// again. Returns 1 on success, 0 if the copy failed or was deferred (the journal is then kept).
+
+static int CheckpointDBPersist(DBPersistStruct *DBP_ptr)
+   {
+   SQLStmtCacheStruct *SC_ptr;
+   sqlite3_backup *pBackup;
+   sqlite3 *pFile;
+   struct timeval t0;
+   long long checkpoint_seq;
+   int rc, num_slices, checkpoint_done;
+
+   gettimeofday(&t0, 0);
+
+   pthread_mutex_lock(&SQLStmtCacheMutex);
+   SC_ptr = LookupSQLStmtCache(DBP_ptr->db);
+   pthread_mutex_unlock(&SQLStmtCacheMutex);
+
+   if ( sqlite3_open(DBP_ptr->DB_name, &pFile) != SQLITE_OK )
+      { 
+      printf("WARNING: CheckpointDBPersist(): Failed to open '%s': %s\n", DBP_ptr->DB_name, sqlite3_errmsg(pFile)); fflush(stdout); 
+      sqlite3_close(pFile);
+      return 0;
+      }
+   if ( (pBackup = sqlite3_backup_init(pFile, "main", DBP_ptr->db, "main")) == NULL )
+      { 
+      printf("WARNING: CheckpointDBPersist(): Failed to start backup to '%s': %s\n", DBP_ptr->DB_name, sqlite3_errmsg(pFile)); fflush(stdout); 
+      sqlite3_close(pFile);
+      return 0;
+      }
+
+// The first slice is taken locked since it may copy the whole database. Later slices run unlocked only while more than 
+// one slice remains, so an unlocked step can never complete the backup. The seq is written before the copy starts (all 
+// records so far are in the database) and nothing may be written while a transaction is open (it would join it).
+   pthread_mutex_lock(&(SC_ptr->txn_mutex));
+   sqlite3_mutex_enter(sqlite3_db_mutex(DBP_ptr->db));
+   checkpoint_seq = DBP_ptr->last_seq;
+   if ( sqlite3_get_autocommit(DBP_ptr->db) == 0 )
+      rc = SQLITE_BUSY;
+   else if ( (rc = DBPersistWriteSeq(DBP_ptr, checkpoint_seq)) == SQLITE_OK )
+      rc = sqlite3_backup_step(pBackup, DBP_ptr->pages_per_step);
+   num_slices = 1;
+   while ( rc == SQLITE_OK && sqlite3_backup_remaining(pBackup) > DBP_ptr->pages_per_step && 
+      DBPersistElapsedMS(&t0) < DBP_ptr->step_budget_ms )
+      {
+      sqlite3_mutex_leave(sqlite3_db_mutex(DBP_ptr->db));
+      pthread_mutex_unlock(&(SC_ptr->txn_mutex));
+
+      rc = sqlite3_backup_step(pBackup, DBP_ptr->pages_per_step);
+      num_slices++;
+      usleep(1000);
+
+      pthread_mutex_lock(&(SC_ptr->txn_mutex));
+      sqlite3_mutex_enter(sqlite3_db_mutex(DBP_ptr->db));
+      }
+
+// A transaction opened without BeginSQLTransaction may still be open. Copying now would persist its uncommitted changes, so try 
+// again at the next checkpoint. Records journaled during the unlocked slices are in the copy too, so the seq is brought up to 
+// date first. That restarts the copy, but so did the commits that wrote them.
+   if ( rc == SQLITE_OK && sqlite3_get_autocommit(DBP_ptr->db) == 0 )
+      rc = SQLITE_BUSY;
+   else if ( rc == SQLITE_OK )
+      {
+      if ( DBP_ptr->last_seq != checkpoint_seq )
+         {
+         checkpoint_seq = DBP_ptr->last_seq;
+         rc = DBPersistWriteSeq(DBP_ptr, checkpoint_seq);
+         }
+      if ( rc == SQLITE_OK )
+         rc = sqlite3_backup_step(pBackup, -1);
+      }
+   sqlite3_backup_finish(pBackup);
+
+   checkpoint_done = (rc == SQLITE_DONE);
+   if ( checkpoint_done == 1 )
+      {
+      pthread_mutex_lock(&(DBP_ptr->journal_mutex));
+      if ( (DBP_ptr->journal_fp != NULL && ftruncate(fileno(DBP_ptr->journal_fp), 0) != 0) || 
+         (DBP_ptr->journal_fp == NULL && truncate(DBP_ptr->journal_name, 0) != 0 && errno != ENOENT) )
+         { printf("ERROR: CheckpointDBPersist(): Failed to truncate journal '%s'!\n", DBP_ptr->journal_name); exit(EXIT_FAILURE); }
+      DBP_ptr->num_since_checkpoint = 0;
+      DBP_ptr->unsynced = 0;
+      pthread_mutex_unlock(&(DBP_ptr->journal_mutex));
+      }
+
+   sqlite3_mutex_leave(sqlite3_db_mutex(DBP_ptr->db));
+   pthread_mutex_unlock(&(SC_ptr->txn_mutex));
+   sqlite3_close(pFile);
+
+   if ( checkpoint_done == 0 )
+      { printf("WARNING: CheckpointDBPersist(): Checkpoint of '%s' NOT done (rc %d) -- keeping journal!\n", DBP_ptr->DB_name, rc); fflush(stdout); }
+
+#ifdef DEBUG
+printf("CheckpointDBPersist(): '%s': %d slices in %ld ms\n", DBP_ptr->DB_name, num_slices, DBPersistElapsedMS(&t0)); fflush(stdout);
+#endif
+
+   return checkpoint_done;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Replay the transactions in the journal left by a previous run on top of the database just loaded from the 
+// file. Records at or below the seq stored in the file are already in it (the run crashed between a checkpoint 
+// and the journal truncation) and are skipped. A torn record at the end (crash in the middle of a write) is 
+// dropped. Sets 'last_seq' to the last seq seen and returns the number replayed.
+
+static int ReplayDBPersistJournal(DBPersistStruct *DBP_ptr)
+   {
+   char len_str[64], *SQL_str, *zErrMsg = 0;
+   int num_replayed, num_skipped, SQL_len;
+   long long checkpoint_seq, seq;
+   FILE *fp;
+
+   checkpoint_seq = DBPersistReadSeq(DBP_ptr);
+   DBP_ptr->last_seq = checkpoint_seq;
+
+   if ( (fp = fopen(DBP_ptr->journal_name, "r")) == NULL )
+      return 0;
+
+   num_replayed = num_skipped = 0;
+   while ( fgets(len_str, sizeof(len_str), fp) != NULL && sscanf(len_str, "%lld %d", &seq, &SQL_len) == 2 && SQL_len > 0 )
+      {
+      if ( (SQL_str = (char *)malloc(SQL_len + 1)) == NULL )
+         { printf("ERROR: ReplayDBPersistJournal(): Failed to allocate %d bytes!\n", SQL_len + 1); exit(EXIT_FAILURE); }
+      if ( fread(SQL_str, 1, SQL_len, fp) != (size_t)SQL_len || fgetc(fp) != '\n' )
+         {
+         printf("WARNING: ReplayDBPersistJournal(): Dropping torn record %d at the end of '%s'\n", num_replayed, DBP_ptr->journal_name); 
+         fflush(stdout);
+         free(SQL_str);
+         break;
+         }
+      SQL_str[SQL_len] = '\0';
+      if ( seq > DBP_ptr->last_seq )
+         DBP_ptr->last_seq = seq;
+
+      if ( seq <= checkpoint_seq )
+         {
+         free(SQL_str);
+         num_skipped++;
+         continue;
+         }
+
+      sqlite3_exec(DBP_ptr->db, "BEGIN;", NULL, 0, NULL);
+      if ( sqlite3_exec(DBP_ptr->db, SQL_str, NULL, 0, &zErrMsg) != SQLITE_OK )
+         {
+         printf("WARNING: ReplayDBPersistJournal(): Record %d of '%s' failed and is skipped: %s\n", num_replayed, DBP_ptr->journal_name, 
+            zErrMsg); fflush(stdout);
+         sqlite3_free(zErrMsg);
+         zErrMsg = 0;
+         sqlite3_exec(DBP_ptr->db, "ROLLBACK;", NULL, 0, NULL);
+         }
+      else
+         sqlite3_exec(DBP_ptr->db, "COMMIT;", NULL, 0, NULL);
+      free(SQL_str);
+      num_replayed++;
+      }
+   fclose(fp);
+
+   if ( num_skipped > 0 )
+      { 
+      printf("ReplayDBPersistJournal(): Skipped %d records of '%s' already in the checkpoint (seq %lld)\n", num_skipped, 
+         DBP_ptr->journal_name, checkpoint_seq); fflush(stdout); 
+      }
+
+   return num_replayed;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Background thread: fdatasync the journal every RPO_ms and checkpoint every checkpoint_secs if anything was 
+// committed since the last checkpoint.
+
+static void *DBPersistThread(void *arg)
+   {
+   DBPersistStruct *DBP_ptr = (DBPersistStruct *)arg;
+   struct timeval last_checkpoint;
+   struct timespec deadline;
+   int wait_ms, do_checkpoint;
+
+   wait_ms = DBP_ptr->RPO_ms > 0 ? DBP_ptr->RPO_ms : 1000;
+   gettimeofday(&last_checkpoint, 0);
+
+   pthread_mutex_lock(&(DBP_ptr->journal_mutex));
+   while ( DBP_ptr->stop == 0 )
+      {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += wait_ms/1000;
+      deadline.tv_nsec += (long)(wait_ms % 1000)*1000000;
+      if ( deadline.tv_nsec >= 1000000000 )
+         { deadline.tv_sec++; deadline.tv_nsec -= 1000000000; }
+      pthread_cond_timedwait(&(DBP_ptr->stop_cv), &(DBP_ptr->journal_mutex), &deadline);
+
+      if ( DBP_ptr->unsynced == 1 )
+         {
+         fdatasync(fileno(DBP_ptr->journal_fp));
+         DBP_ptr->unsynced = 0;
+         }
+
+      do_checkpoint = DBP_ptr->stop == 0 && DBP_ptr->num_since_checkpoint > 0 && 
+         DBPersistElapsedMS(&last_checkpoint) >= 1000*(long)DBP_ptr->checkpoint_secs;
+      if ( do_checkpoint == 1 )
+         {
+         pthread_mutex_unlock(&(DBP_ptr->journal_mutex));
+         CheckpointDBPersist(DBP_ptr);
+         gettimeofday(&last_checkpoint, 0);
+         pthread_mutex_lock(&(DBP_ptr->journal_mutex));
+         }
+      }
+   pthread_mutex_unlock(&(DBP_ptr->journal_mutex));
+
+   return NULL;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Start write-back persistence of the in-memory database db, loaded from the file DB_name by LoadOrSaveDb. 
+// Replays (and folds into DB_name) the journal of a previous run first, so call it after the load and after 
+// any schema migrations, before the worker threads start. RPO_ms bounds the commits lost in a crash (0 syncs 
+// every commit), checkpoint_secs is the checkpoint interval, and pages_per_step/step_budget_ms size the 
+// incremental copy (see CheckpointDBPersist).
+
+DBPersistStruct *StartDBPersist(sqlite3 *db, const char *DB_name, int RPO_ms, int checkpoint_secs, int pages_per_step, 
+   int step_budget_ms)
+   {
+   DBPersistStruct *DBP_ptr;
+   int num_replayed;
+
+   if ( (DBP_ptr = (DBPersistStruct *)calloc(1, sizeof(DBPersistStruct))) == NULL )
+      { printf("ERROR: StartDBPersist(): Failed to allocate DBPersistStruct!\n"); exit(EXIT_FAILURE); }
+   if ( strlen(DB_name) + 5 > DB_PERSIST_MAX_NAME_LEN )
+      { printf("ERROR: StartDBPersist(): DB_name '%s' too long (max %d)!\n", DB_name, DB_PERSIST_MAX_NAME_LEN - 5); exit(EXIT_FAILURE); }
+   if ( RPO_ms < 0 || checkpoint_secs <= 0 || pages_per_step <= 0 || step_budget_ms < 0 )
+      { 
+      printf("ERROR: StartDBPersist(): Expected RPO_ms %d >= 0, checkpoint_secs %d > 0, pages_per_step %d > 0, step_budget_ms %d >= 0!\n", 
+         RPO_ms, checkpoint_secs, pages_per_step, step_budget_ms); exit(EXIT_FAILURE); 
+      }
+
+   DBP_ptr->db = db;
+   strcpy(DBP_ptr->DB_name, DB_name);
+   sprintf(DBP_ptr->journal_name, "%s.wbj", DB_name);
+   DBP_ptr->RPO_ms = RPO_ms;
+   DBP_ptr->checkpoint_secs = checkpoint_secs;
+   DBP_ptr->pages_per_step = pages_per_step;
+   DBP_ptr->step_budget_ms = step_budget_ms;
+   pthread_mutex_init(&(DBP_ptr->journal_mutex), NULL);
+   pthread_cond_init(&(DBP_ptr->stop_cv), NULL);
+
+// The checkpoint seq lives in the database itself so the file copy and its seq are always written together.
+   if ( sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS DBPersist_Checkpoint (Seq INTEGER NOT NULL); \
+INSERT INTO DBPersist_Checkpoint (Seq) SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM DBPersist_Checkpoint);", NULL, 0, NULL) != SQLITE_OK )
+      { printf("ERROR: StartDBPersist(): Failed to create DBPersist_Checkpoint in '%s': %s\n", DB_name, sqlite3_errmsg(db)); exit(EXIT_FAILURE); }
+
+// Recover the commits of a previous run that crashed before its last checkpoint. They MUST reach the file before new records are 
+// appended, otherwise a second crash would replay them twice. The checkpoint is done even with nothing to replay since changes made
+// before this call (e.g., schema migrations) are not in the journal.
+   if ( (num_replayed = ReplayDBPersistJournal(DBP_ptr)) > 0 )
+      { printf("StartDBPersist(): '%s': Replayed %d transactions from journal '%s'\n", DB_name, num_replayed, DBP_ptr->journal_name); fflush(stdout); }
+   if ( CheckpointDBPersist(DBP_ptr) == 0 )
+      { printf("ERROR: StartDBPersist(): Failed to checkpoint '%s'!\n", DB_name); exit(EXIT_FAILURE); }
+
+   if ( (DBP_ptr->journal_fp = fopen(DBP_ptr->journal_name, "a")) == NULL )
+      { printf("ERROR: StartDBPersist(): Failed to open journal '%s'!\n", DBP_ptr->journal_name); exit(EXIT_FAILURE); }
+
+   DBP_ptr->last_total_changes = sqlite3_total_changes(db);
+   sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, DBPersistTraceCallback, DBP_ptr);
+   sqlite3_rollback_hook(db, DBPersistRollbackHook, DBP_ptr);
+
+   if ( pthread_create(&(DBP_ptr->thread), NULL, DBPersistThread, DBP_ptr) != 0 )
+      { printf("ERROR: StartDBPersist(): Failed to create persistence thread for '%s'!\n", DB_name); exit(EXIT_FAILURE); }
+
+printf("StartDBPersist(): '%s': RPO %d ms\tCheckpoint every %d s\t%d pages per step\tStep budget %d ms\n", DB_name, 
+   RPO_ms, checkpoint_secs, pages_per_step, step_budget_ms); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   return DBP_ptr;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Stop the persistence thread, write the database back to its file a last time and free DBP_ptr. Call 
+// before FinalizeSQLStmtCache and sqlite3_close, with no other thread still using the connection.
+
+void StopDBPersist(DBPersistStruct *DBP_ptr)
+   {
+   pthread_mutex_lock(&(DBP_ptr->journal_mutex));
+   DBP_ptr->stop = 1;
+   pthread_cond_signal(&(DBP_ptr->stop_cv));
+   pthread_mutex_unlock(&(DBP_ptr->journal_mutex));
+   pthread_join(DBP_ptr->thread, NULL);
+
+   sqlite3_trace_v2(DBP_ptr->db, 0, NULL, NULL);
+   sqlite3_rollback_hook(DBP_ptr->db, NULL, NULL);
+
+   if ( DBP_ptr->num_since_checkpoint > 0 )
+      CheckpointDBPersist(DBP_ptr);
+   if ( DBP_ptr->unsynced == 1 )
+      fdatasync(fileno(DBP_ptr->journal_fp));
+   fclose(DBP_ptr->journal_fp);
+
+   pthread_cond_destroy(&(DBP_ptr->stop_cv));
+   pthread_mutex_destroy(&(DBP_ptr->journal_mutex));
+   if ( DBP_ptr->pending != NULL )
+      free(DBP_ptr->pending);
+   free(DBP_ptr);
+
+   return;
    }
 
 
@@ -2391,7 +3248,8 @@ int PathInfoRandomOrderNumberCompareFunc(const void *v1, const void *v2)
 
 void SelectRandomBruteForce(int max_string_len, int num_rise_qualified_PNs, int num_fall_qualified_PNs, 
    PathInfoStruct *qualified_path_info, int num_rise_required_PNs, int num_fall_required_PNs, int *rise_indexes, int *fall_indexes, 
-   int num_rising_vecpairs, int num_falling_vecpairs, int *bruteforce_num_rise_vecpairs_ptr, int *bruteforce_num_fall_vecpairs_ptr)
+   int num_rising_vecpairs, int num_falling_vecpairs, int *bruteforce_num_rise_vecpairs_ptr, int *bruteforce_num_fall_vecpairs_ptr, 
+   RandStreamStruct *RS_ptr)
    {
    int selected_falling_vectors[num_falling_vecpairs];
    int selected_rising_vectors[num_rising_vecpairs];
@@ -2415,7 +3273,7 @@ void SelectRandomBruteForce(int max_string_len, int num_rise_qualified_PNs, int
    num_selected_rising_vectors = 0;
    while ( PN_num < num_rise_required_PNs )
       {
-      temp_rand = rand() % num_rise_qualified_PNs;
+      temp_rand = (int)RandStreamUniform(RS_ptr, num_rise_qualified_PNs);
 
 // Sanity check
       if ( temp_rand >= num_rise_qualified_PNs + num_fall_qualified_PNs )
@@ -2454,7 +3312,7 @@ printf("Rise random index choosen %d (Max is %d)\n", temp_rand, num_rise_qualifi
    num_selected_falling_vectors = 0;
    while ( PN_num < num_fall_required_PNs )
       {
-      temp_rand = (rand() % num_fall_qualified_PNs) + num_rise_qualified_PNs;
+      temp_rand = (int)RandStreamUniform(RS_ptr, num_fall_qualified_PNs) + num_rise_qualified_PNs;
 
 // Sanity check
       if ( temp_rand >= num_rise_qualified_PNs + num_fall_qualified_PNs )
@@ -2513,7 +3371,7 @@ int SelectRandomOptVec(int max_string_len, int num_rise_qualified_PNs, int num_f
    PathInfoStruct *qualified_path_info, int num_rise_required_PNs, int num_fall_required_PNs, int *rise_indexes, 
    int *fall_indexes, int num_rising_vecpairs, int num_falling_vecpairs, int *optvec_num_rise_vecpairs_ptr, 
    int *optvec_num_fall_vecpairs_ptr, int NUM_QUAL_PATH_LOWER_BOUND, int FRACTION_TO_SELECT_LOWER_BOUND, 
-   int FRACTION_NUM_QUAL_PATH_LOWER_BOUND, int num_POs)
+   int FRACTION_NUM_QUAL_PATH_LOWER_BOUND, int num_POs, RandStreamStruct *RS_ptr)
    {
    int qpi_low_index, qpi_high_index, num_qualifying_for_vecpair, fraction_PNs_needed_for_vecpair;
    int PN_num, vec_pair, random_fraction, random_PN, succeed, i;
@@ -2602,7 +3460,7 @@ printf("INFO: SelectRandomOptVec(): RISING: Ran out of rising vecpairs before we
          }
 
 // Randomly select a rising vector.
-      vec_pair = rand() % num_rising_vecpairs;
+      vec_pair = (int)RandStreamUniform(RS_ptr, num_rising_vecpairs);
 
 // Check if this vector is already being used. If so, try another.
       for ( i = 0; i < num_selected_rising_vectors; i++ )
@@ -2681,7 +3539,7 @@ printf("INFO: SelectRandomOptVec(): RISING: Vecpair %d has %d qualifying paths -
          }
 
 // Randomly choose a percentage.
-      random_fraction = (rand() % (100 - FRACTION_TO_SELECT_LOWER_BOUND)) + FRACTION_TO_SELECT_LOWER_BOUND;
+      random_fraction = (int)RandStreamUniform(RS_ptr, 100 - FRACTION_TO_SELECT_LOWER_BOUND) + FRACTION_TO_SELECT_LOWER_BOUND;
       fraction_PNs_needed_for_vecpair = (int)(num_qualifying_for_vecpair*(float)random_fraction/100);
 
 #ifdef DEBUG
@@ -2718,7 +3576,7 @@ printf("INFO: SelectRandomOptVec(): RISING: Vecpair %d has %d qualifying paths r
       num_randomly_selected_for_vecpair = 0;
       while ( PN_num < num_rise_required_PNs && num_randomly_selected_for_vecpair < fraction_PNs_needed_for_vecpair )
          {
-         random_PN = (rand() % num_qualifying_for_vecpair) + qpi_low_index;
+         random_PN = (int)RandStreamUniform(RS_ptr, num_qualifying_for_vecpair) + qpi_low_index;
 
 // Check to make sure this index (path) is NOT already selected.
          for ( i = 0; i < PN_num; i++ )
@@ -2763,7 +3621,7 @@ printf("INFO: SelectRandomOptVec(): FALLING: Ran out of falling vecpairs before
          }
 
 // Randomly select a falling vector. Note that falling vectors following rising vectors and do NOT start at 0 but rather continue numbering.
-      vec_pair = (rand() % num_falling_vecpairs) + num_rising_vecpairs;
+      vec_pair = (int)RandStreamUniform(RS_ptr, num_falling_vecpairs) + num_rising_vecpairs;
 
 // Check if this vector is already being used. If so, try another.
       for ( i = 0; i < num_selected_falling_vectors; i++ )
@@ -2842,7 +3700,7 @@ printf("INFO: SelectRandomOptVec(): FALLING: Vecpair %d has %d qualifying paths
          }
 
 // Randomly choose a percentage.
-      random_fraction = (rand() % (100 - FRACTION_TO_SELECT_LOWER_BOUND)) + FRACTION_TO_SELECT_LOWER_BOUND;
+      random_fraction = (int)RandStreamUniform(RS_ptr, 100 - FRACTION_TO_SELECT_LOWER_BOUND) + FRACTION_TO_SELECT_LOWER_BOUND;
       fraction_PNs_needed_for_vecpair = (int)(num_qualifying_for_vecpair*(float)random_fraction/100);
 
 #ifdef DEBUG
@@ -2881,7 +3739,7 @@ printf("INFO: SelectRandomOptVec(): FALLING: Vecpair %d has %d qualifying paths
          {
 
 // qpi_low_index is an index of a qualified_path_info element and handles the offset needed.
-         random_PN = (rand() % num_qualifying_for_vecpair) + qpi_low_index; 
+         random_PN = (int)RandStreamUniform(RS_ptr, num_qualifying_for_vecpair) + qpi_low_index; 
 
 // Check to make sure this index (path) is NOT already selected.
          for ( i = 0; i < PN_num; i++ )
@@ -2927,8 +3785,8 @@ printf("\tNum selected rising vecpairs %d\tNum selected falling vecpairs %d\tTot
 
 // ===========================================================================================================
 // ===========================================================================================================
-// Randomly select a subset of 'num_xxx_required_PNs' from the number that is 'qualified' using a Seed parameter
-// to the C rand function.
+// Randomly select a subset of 'num_xxx_required_PNs' from the number that is 'qualified' using a random stream 
+// seeded with the Seed parameter (see RandStreamSeed), so the device, TTP and verifier select the same subset.
 
 int SelectRandomSubset(int max_string_len, unsigned int Seed, int num_rise_qualified_PNs, int num_fall_qualified_PNs, 
    PathInfoStruct *qualified_path_info, int num_rise_required_PNs, int num_fall_required_PNs, int *rise_indexes1, 
@@ -2941,6 +3799,7 @@ int SelectRandomSubset(int max_string_len, unsigned int Seed, int num_rise_quali
    int *rise_indexes_final, *fall_indexes_final;
    int PN_num_tested, PN_num_qualified;
    int optvec_succeed = 0;
+   RandStreamStruct RS;
 
 #ifdef DEBUG
 struct timeval t1, t2;
@@ -2952,7 +3811,7 @@ long elapsed;
    if ( num_rise_qualified_PNs < num_rise_required_PNs || num_fall_qualified_PNs < num_fall_required_PNs )
       { printf("ERROR: SelectRandomSubset(): Number of 'qualified_rise/fall_PNs LESS THAN the number required!\n"); exit(EXIT_FAILURE); }
 
-   srand(Seed);
+   RandStreamSeed(&RS, Seed);
 
 #ifdef DEBUG
 gettimeofday(&t2, 0);
@@ -2971,7 +3830,7 @@ gettimeofday(&t2, 0);
 
 // This is the original brute force algorithm that does NOT track vecpair usage. 
    SelectRandomBruteForce(max_string_len, num_rise_qualified_PNs, num_fall_qualified_PNs, qualified_path_info, num_rise_required_PNs, num_fall_required_PNs, 
-      rise_indexes1, fall_indexes1, num_rising_vecpairs, num_falling_vecpairs, &bruteforce_num_rise_vecpairs, &bruteforce_num_fall_vecpairs);
+      rise_indexes1, fall_indexes1, num_rising_vecpairs, num_falling_vecpairs, &bruteforce_num_rise_vecpairs, &bruteforce_num_fall_vecpairs, &RS);
    rise_indexes_final = rise_indexes1;
    fall_indexes_final = fall_indexes1;
 
@@ -2985,7 +3844,7 @@ gettimeofday(&t2, 0);
 // 3500 qualifying and 2048 need to be selected. 
    if ( (optvec_succeed = SelectRandomOptVec(max_string_len, num_rise_qualified_PNs, num_fall_qualified_PNs, qualified_path_info, num_rise_required_PNs, 
       num_fall_required_PNs, rise_indexes2, fall_indexes2, num_rising_vecpairs, num_falling_vecpairs, &optvec_num_rise_vecpairs,
-      &optvec_num_fall_vecpairs, NUM_QUAL_PATH_LOWER_BOUND, FRACTION_TO_SELECT_LOWER_BOUND, FRACTION_NUM_QUAL_PATH_LOWER_BOUND, num_POs)) == 1 )
+      &optvec_num_fall_vecpairs, NUM_QUAL_PATH_LOWER_BOUND, FRACTION_TO_SELECT_LOWER_BOUND, FRACTION_NUM_QUAL_PATH_LOWER_BOUND, num_POs, &RS)) == 1 )
       {
 
 // If we succeed, then check if number of vectors is smaller than brute force method. If so, use OptVec selected vectors.
@@ -3528,10 +4387,11 @@ int SQL_GetTimingValsOpt_callback(void *UserSpecifiedData, int argc, char **argv
 
 void GetPUFInstanceTimingInfoUsingVecPairPOStruct(int max_string_len, sqlite3 *db, int PUF_instance_index, int timing_or_tsig,
    VecPairPOStruct *vecpair_id_PO, int num_VPPO_eles, int allocate_float_arrs, float **PNR_TSig_ptr, float **PNF_TSig_ptr,
-   TimingValCacheStruct *TVC_arr, int num_TVC_arr, int use_TVC_cache, int TVC_chip_num)
+   TimingValCacheStruct *TVC, int use_TVC_cache, int TVC_chip_num)
    {
    int vppo_num, num_rise_PNs, num_fall_PNs, rise_fall_vec, doing_rise_PNs;
-   int TVC_arr_num;
+   int path_num;
+   float *chip_PNs = NULL;
 
 // Illegal combo
    if ( timing_or_tsig == 1 && use_TVC_cache == 1 )
@@ -3557,7 +4417,8 @@ printf("Getting %d PNR/PNF (or tsig) data for PUF_instance_index %d\n", num_VPPO
    num_rise_PNs = 0;
    num_fall_PNs = 0;
    doing_rise_PNs = 1;
-   TVC_arr_num = 0;
+   if ( use_TVC_cache == 1 )
+      chip_PNs = GetTimingValCacheChipPNs(TVC, TVC_chip_num);
    for ( vppo_num = 0; vppo_num < num_VPPO_eles; vppo_num++ )
       {
 
@@ -3636,28 +4497,22 @@ printf("PI %d\tVP %d\tPO %d\tAve %f\n", PUF_instance_index, vecpair_id_PO[vppo_n
             }
          }
 
-// The data stored in the TVC_arr is a super-set of the 2048 rise and 2048 fall PNs that are identifed by the vecpair_id_PO elements as participating
-// in the current challenge. The data in both arrays is ordered in the same fashion, from vecpair_id and then PO in ascending order. So we just need
-// to keep moving forward in the TVC_arr until we find the next element, i.e., we don't need to start the search from the beginning of the TVC_arr
-// on every iteration of this loop.
+// The data stored in the TVC is a super-set of the 2048 rise and 2048 fall PNs that are identifed by the vecpair_id_PO elements as participating
+// in the current challenge. Look up the path with the TVC hash index.
       else
          {
-
-// Increment TVC_arr_num forward until we find a match between vecpair_ids and PO_nums in the two data structures.
-         while ( TVC_arr_num < num_TVC_arr && 
-            !(TVC_arr[TVC_arr_num].vecpair_id == vecpair_id_PO[vppo_num].vecpair_id && TVC_arr[TVC_arr_num].PO_num == vecpair_id_PO[vppo_num].PO_num) )
-            TVC_arr_num++;
+         path_num = LookupTimingValCachePath(TVC, vecpair_id_PO[vppo_num].vecpair_id, vecpair_id_PO[vppo_num].PO_num);
 
 // Program error if this occurs.
-         if ( TVC_arr_num == num_TVC_arr )
+         if ( path_num == -1 )
             { 
-            printf("PROGRAM ERROR: GetPUFInstanceTimingInfoUsingVecPairPOStruct(): Failed to find vecpair_id %d and PO_num %d in TVC_arr (cache)!\n",
+            printf("PROGRAM ERROR: GetPUFInstanceTimingInfoUsingVecPairPOStruct(): Failed to find vecpair_id %d and PO_num %d in TVC (cache)!\n",
                vecpair_id_PO[vppo_num].vecpair_id, vecpair_id_PO[vppo_num].PO_num); 
             exit(EXIT_FAILURE); 
             }
 
 // Split the values into rise and fall timing value arrays.
-         if ( TVC_arr[TVC_arr_num].rise_or_fall == 0 )
+         if ( TVC->paths[path_num].rise_or_fall == 0 )
             {
             num_rise_PNs++;
 
@@ -3680,9 +4535,9 @@ printf("PI %d\tVP %d\tPO %d\tAve %f\n", PUF_instance_index, vecpair_id_PO[vppo_n
 
 // Transfer the timing value to the output arrays. NOTE: PUF_instance_index IS NOT a zero based index (counter).
          if ( doing_rise_PNs == 1 )
-            (*PNR_TSig_ptr)[num_rise_PNs - 1] = TVC_arr[TVC_arr_num].PNs[TVC_chip_num];
+            (*PNR_TSig_ptr)[num_rise_PNs - 1] = chip_PNs[path_num];
          else
-            (*PNF_TSig_ptr)[num_fall_PNs - 1] = TVC_arr[TVC_arr_num].PNs[TVC_chip_num];
+            (*PNF_TSig_ptr)[num_fall_PNs - 1] = chip_PNs[path_num];
          }
       }
 
@@ -3706,34 +4561,53 @@ printf("GetPUFInstanceTimingInfoUsingVecPairPOStruct(): DONE\n"); fflush(stdout)
 // Get a subset of the timing data for all (or a subset) of PUFInstances. The specific timing values are 
 // identified by an array of challenge_vecpair_id_PO_arr structures with (vecpair, PO) elements. These
 // are constructed by GenChallengeDB as the random challenge is generated and are guaranteed to match
-// the PN tested by these challenge vectors/masks.
+// the PN tested by these challenge vectors/masks. The PNR (and PNF) of all chips are stored in ONE contiguous 
+// block, chip-major, and (*PNR_ptr)[chip_num] points to the chip's row in that block. Use 
+// FreeAllTimingValsForChallenge to free them.
 
 void GetAllPUFInstanceTimingValsForChallenge(int max_string_len, sqlite3 *db, VecPairPOStruct *challenge_vecpair_id_PO_arr, 
    int num_challenge_vecpair_id_PO, char *PUF_instance_name_to_match, float ***PNR_ptr, float ***PNF_ptr, int *num_chips_ptr,
-   TimingValCacheStruct *TVC_arr, int num_TVC_arr, int use_TVC_cache)
+   TimingValCacheStruct *TVC, int use_TVC_cache)
    {
    SQLIntStruct PUF_instance_index_struct;
-   int chip_num;
-
-// We need to do this to compute population offsets below. Get timing data for all PUFInstances (or a subset).
-// First get the a list of PUFInstance IDs that match the string 'PUF_instance_name_to_match', which can be '%' to
-// match all. Use '%' for * and '_' for ?
-   GetPUFInstanceIDsForInstanceName(max_string_len, db, &PUF_instance_index_struct, PUF_instance_name_to_match);
+   int num_chips, num_PNs, chip_num;
+   float *PNR_block, *PNF_block;
+
+// With the cache, the chips are the ones stored in the cache (in the same order). Otherwise, get the a list of PUFInstance IDs 
+// that match the string 'PUF_instance_name_to_match', which can be '%' to match all. Use '%' for * and '_' for ?
+   PUF_instance_index_struct.int_arr = NULL;
+   PUF_instance_index_struct.num_ints = 0;
+   if ( use_TVC_cache == 1 )
+      num_chips = TVC->num_chips;
+   else
+      {
+      GetPUFInstanceIDsForInstanceName(max_string_len, db, &PUF_instance_index_struct, PUF_instance_name_to_match);
+      num_chips = PUF_instance_index_struct.num_ints;
+      }
 
 // Sanity check
-   if ( PUF_instance_index_struct.num_ints == 0 )
+   if ( num_chips == 0 )
       { printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): No PUFInstances match search string %s!\n", PUF_instance_name_to_match); exit(EXIT_FAILURE); }
 
 #ifdef DEBUG
-printf("GetAllPUFInstanceTimingValsForChallenge(): Number of PUFInstances fetched from database %d\n", 
-   PUF_instance_index_struct.num_ints); fflush(stdout);
+printf("GetAllPUFInstanceTimingValsForChallenge(): Number of PUFInstances %d\n", num_chips); fflush(stdout);
 #endif
 
-// Allocate arrays to add the new dynamically allocated subarrays, one pointer for each PUFInstance (chip).
-   if ( (*PNR_ptr = (float **)malloc(sizeof(float *) * PUF_instance_index_struct.num_ints)) == NULL )
+// Allocate arrays to add the chip rows, one pointer for each PUFInstance (chip), and the blocks that hold the rows.
+   num_PNs = num_challenge_vecpair_id_PO/2;
+   if ( (*PNR_ptr = (float **)malloc(sizeof(float *) * num_chips)) == NULL )
       { printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): Failed to allocate storage for PNR!\n"); exit(EXIT_FAILURE); }
-   if ( (*PNF_ptr = (float **)malloc(sizeof(float *) * PUF_instance_index_struct.num_ints)) == NULL )
+   if ( (*PNF_ptr = (float **)malloc(sizeof(float *) * num_chips)) == NULL )
       { printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): Failed to allocate storage for PNF!\n"); exit(EXIT_FAILURE); }
+   if ( (PNR_block = (float *)malloc(sizeof(float) * num_chips * num_PNs)) == NULL )
+      { printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): Failed to allocate storage for PNR_block!\n"); exit(EXIT_FAILURE); }
+   if ( (PNF_block = (float *)malloc(sizeof(float) * num_chips * num_PNs)) == NULL )
+      { printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): Failed to allocate storage for PNF_block!\n"); exit(EXIT_FAILURE); }
+   for ( chip_num = 0; chip_num < num_chips; chip_num++ )
+      {
+      (*PNR_ptr)[chip_num] = PNR_block + chip_num*num_PNs;
+      (*PNF_ptr)[chip_num] = PNF_block + chip_num*num_PNs;
+      }
 
 struct timeval t0, t1;
 long elapsed; 
@@ -3741,11 +4615,63 @@ gettimeofday(&t0, 0);
 #ifdef DEBUG
 #endif
 
-// Get dynamically allocated arrays, one for each PUF instance and add to PNR and PNF arrays.
-   for ( chip_num = 0; chip_num < PUF_instance_index_struct.num_ints; chip_num++ )
-      GetPUFInstanceTimingInfoUsingVecPairPOStruct(max_string_len, db, PUF_instance_index_struct.int_arr[chip_num],
-         0, challenge_vecpair_id_PO_arr, num_challenge_vecpair_id_PO, 1, &((*PNR_ptr)[chip_num]), &((*PNF_ptr)[chip_num]),
-         TVC_arr, num_TVC_arr, use_TVC_cache, chip_num);
+// With the cache, map each (vecpair, PO) of the challenge to its cache path ONCE, and then gather the PNR and PNF of each chip 
+// from the chip's row in the cache slab.
+   if ( use_TVC_cache == 1 )
+      {
+      int path_nums[num_challenge_vecpair_id_PO];
+      int vppo_num, num_rise_PNs, num_fall_PNs;
+      float *chip_PNs, *PNR, *PNF;
+
+      num_rise_PNs = 0;
+      num_fall_PNs = 0;
+      for ( vppo_num = 0; vppo_num < num_challenge_vecpair_id_PO; vppo_num++ )
+         {
+         path_nums[vppo_num] = LookupTimingValCachePath(TVC, challenge_vecpair_id_PO_arr[vppo_num].vecpair_id, 
+            challenge_vecpair_id_PO_arr[vppo_num].PO_num);
+
+// Program error if this occurs.
+         if ( path_nums[vppo_num] == -1 )
+            { 
+            printf("PROGRAM ERROR: GetAllPUFInstanceTimingValsForChallenge(): Failed to find vecpair_id %d and PO_num %d in TVC (cache)!\n",
+               challenge_vecpair_id_PO_arr[vppo_num].vecpair_id, challenge_vecpair_id_PO_arr[vppo_num].PO_num); 
+            exit(EXIT_FAILURE); 
+            }
+
+// Sanity check: ALL rise PNs MUST preceed ALL fall PNs, and half of them are rise PNs.
+         if ( TVC->paths[path_nums[vppo_num]].rise_or_fall == 0 )
+            {
+            if ( num_fall_PNs > 0 )
+               { printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): ALL Rise PNS MUST preceed ALL Fall PNS!\n"); exit(EXIT_FAILURE); }
+            num_rise_PNs++;
+            }
+         else
+            num_fall_PNs++;
+         }
+      if ( num_rise_PNs != num_PNs || num_fall_PNs != num_PNs )
+         { 
+         printf("ERROR: GetAllPUFInstanceTimingValsForChallenge(): Number of rise PNs %d or fall PNs %d not equal to expected %d!\n", num_rise_PNs, num_fall_PNs, num_PNs); 
+         exit(EXIT_FAILURE); 
+         }
+
+      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
+         {
+         chip_PNs = GetTimingValCacheChipPNs(TVC, chip_num);
+         PNR = (*PNR_ptr)[chip_num];
+         PNF = (*PNF_ptr)[chip_num];
+         for ( vppo_num = 0; vppo_num < num_PNs; vppo_num++ )
+            PNR[vppo_num] = chip_PNs[path_nums[vppo_num]];
+         for ( vppo_num = 0; vppo_num < num_PNs; vppo_num++ )
+            PNF[vppo_num] = chip_PNs[path_nums[num_PNs + vppo_num]];
+         }
+      }
+
+// Otherwise, fetch the rows from the database one chip at a time.
+   else
+      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
+         GetPUFInstanceTimingInfoUsingVecPairPOStruct(max_string_len, db, PUF_instance_index_struct.int_arr[chip_num],
+            0, challenge_vecpair_id_PO_arr, num_challenge_vecpair_id_PO, 0, &((*PNR_ptr)[chip_num]), &((*PNF_ptr)[chip_num]),
+            TVC, use_TVC_cache, chip_num);
          
 #ifdef DEBUG
 printf("HERE\n");
@@ -3763,8 +4689,12 @@ printf("GetAllPUFInstanceTimingValsForChallenge(): Fetched %d PNR and PNF Timing
    num_challenge_vecpair_id_PO/2); fflush(stdout);
 #endif
 
+// Free up integer array that holds PUFInstanceIDs.
+   if ( PUF_instance_index_struct.int_arr != NULL )
+      free(PUF_instance_index_struct.int_arr);
+
 // Return the number of timing data sets fetched from the database.
-   *num_chips_ptr = PUF_instance_index_struct.num_ints;
+   *num_chips_ptr = num_chips;
 
    return;
    }
@@ -3787,8 +4717,7 @@ printf("GetAllPUFInstanceTimingValsForChallenge(): Fetched %d PNR and PNF Timing
 
 int GenChallengeDB(int max_string_len, sqlite3 *db, int design_index, char *ChallengeSetName, unsigned int Seed, int save_vecs_masks, 
    char *outfile_vecs, char *outfile_masks, unsigned char ***vecs1_bin_ptr, unsigned char ***vecs2_bin_ptr, 
-   unsigned char ***masks_bin_ptr, int *num_vecs_masks_ptr, int *num_rise_vecs_masks_ptr, pthread_mutex_t *GenChallenge_mutex_ptr,
-   int *num_challenge_vecpair_id_PO_ptr, VecPairPOStruct **challenge_vecpair_id_PO_ptr)
+   unsigned char ***masks_bin_ptr, int *num_vecs_masks_ptr, int *num_rise_vecs_masks_ptr, int *num_challenge_vecpair_id_PO_ptr, VecPairPOStruct **challenge_vecpair_id_PO_ptr)
    {
    int challenge_index;
 
@@ -3943,29 +4872,14 @@ gettimeofday(&t2, 0);
 // field in tested_path_info array elements before returning so we know which tested_path_info are going to be used). 
 //   optvec_succeed = SelectRandomSubset(max_string_len, Seed, num_rise_qualified_PNs, num_fall_qualified_PNs, qualified_path_info, NUM_RISE_REQUIRED_PNS, 
 
-#ifdef DEBUG
-printf("Setting ChallengeDB mutex!\n");
-#endif
-
 // 10_31_2021: We are now using a seed to specify the vector sequence on the device, TTP and verifier. When challenges are selected, we depend
-// on the sequence returned by rand() to be the same no matter where this routine runs, device, TT or verifier. The verifier and TTP are multi-threaded
-// and therefore it is possible that multiple threads call this routine simultaneously, interrupting the sequence generated by rand() (rand is NOT re-entrant).
-// If this occurs, then the vector challenges used by the, e.g., verifier and device will be different and the security function will fail. When the device
-// calls this function, the mutex is NULL. This function is the only place where rand() is called.
-   if ( GenChallenge_mutex_ptr != NULL )
-      pthread_mutex_lock(GenChallenge_mutex_ptr);
-
+// on the random sequence being the same no matter where this routine runs, device, TTP or verifier. SelectRandomSubset draws it from its own 
+// stream seeded with Seed (see RandStreamSeed), so threads running this routine at the same time do not interfere and need no lock 
+// (they did when the sequence came from rand(), which is NOT re-entrant).
    SelectRandomSubset(max_string_len, Seed, num_rise_qualified_PNs, num_fall_qualified_PNs, qualified_path_info, NUM_RISE_REQUIRED_PNS, 
       NUM_FALL_REQUIRED_PNS, rise_indexes1, fall_indexes1, rise_indexes2, fall_indexes2, num_rising_vecpairs, num_falling_vecpairs, num_tested_PNs, tested_path_info, 
       NUM_QUAL_PATH_LOWER_BOUND, FRACTION_TO_SELECT_LOWER_BOUND, FRACTION_NUM_QUAL_PATH_LOWER_BOUND, num_POs);
 
-   if ( GenChallenge_mutex_ptr != NULL )
-      pthread_mutex_unlock(GenChallenge_mutex_ptr);
-
-#ifdef DEBUG
-printf("Releasing ChallengeDB mutex!\n");
-#endif
-
 #ifdef DEBUG
 gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; printf("\tELAPSED TIME: Select random subset %ld us\n\n", (long)elapsed);
 gettimeofday(&t2, 0);
@@ -4212,14 +5126,17 @@ void GetVecPairPOStructForBinaryVecsMasks(int max_string_len, sqlite3 *db, int n
 // ===========================================================================================================
 // This routine does what GenChallengeDB does initially, i.e., find all VecPairs that are 'qualified' by the
 // vectors and masks stored for the ChallengeSetName. It then retrieves all the TimingVal data for all PUFInstances
-// into an array for fast parsing by GetPUFInstanceTimingInfoUsingVecPairPOStruct routine, which appears to be
-// the bottleneck to runtime performance of the protocol (takes about 2.3 seconds if the data is retrieved directly
-// from the database).
+// into the chip-major slab of a TimingValCacheStruct (allocated here) for fast lookup by GetAllPUFInstanceTimingValsForChallenge 
+// and GetPUFInstanceTimingInfoUsingVecPairPOStruct, which appears to be the bottleneck to runtime performance of the 
+// protocol (takes about 2.3 seconds if the data is retrieved directly from the database). DB_filename is the database file 'db' was 
+// copied into memory from, or NULL (see LoadTimingValCacheFromDB).
 
-int CreateTimingValsCacheFromChallengeSet(int max_string_len, sqlite3 *db, int design_index, char *ChallengeSetName, 
-   char *PUF_instance_name_to_match, TimingValCacheStruct **TVC_arr_ptr, int *num_TVC_arr_ptr) 
+int CreateTimingValsCacheFromChallengeSet(int max_string_len, sqlite3 *db, char *DB_filename, int design_index, char *ChallengeSetName, 
+   char *PUF_instance_name_to_match, TimingValCacheStruct *prev_TVC, TimingValCacheStruct **TVC_ptr) 
    {
+   TimingValCacheStruct *TVC;
    int challenge_index;
+   int num_prev_chips, path_num;
 
    int num_vecpairs, num_rising_vecpairs, num_falling_vecpairs; 
    int num_qualified_PNs, num_rise_qualified_PNs, num_fall_qualified_PNs;
@@ -4234,7 +5151,7 @@ int CreateTimingValsCacheFromChallengeSet(int max_string_len, sqlite3 *db, int d
 
    SQLIntStruct PUF_instance_index_struct;
 
-   int qPN_num, chip_num; 
+   int qPN_num; 
 
 #ifdef DEBUG
 struct timeval t1, t2;
@@ -4276,9 +5193,14 @@ printf("\tGetting qualified paths\n\n");
       num_POs, NUM_RISE_REQUIRED_PNS, NUM_FALL_REQUIRED_PNS, num_rise_qualified_PNs, num_fall_qualified_PNs, &qualified_path_info, challenge_index, 
       &vecpair_ids);
 
-// Create the timing val cache structure, one element for each qualified PN.
-   if ( (*TVC_arr_ptr = (TimingValCacheStruct *)malloc(sizeof(TimingValCacheStruct) * num_qualified_PNs)) == NULL )
-      { printf("ERROR: CreateTimingValsCacheFromChallengeSet(): Failed to allocate storage for TVC structure array!\n"); exit(EXIT_FAILURE); }
+// Create the timing val cache structure with one path element for each qualified PN.
+   if ( (TVC = (TimingValCacheStruct *)malloc(sizeof(TimingValCacheStruct))) == NULL )
+      { printf("ERROR: CreateTimingValsCacheFromChallengeSet(): Failed to allocate storage for TVC structure!\n"); exit(EXIT_FAILURE); }
+   if ( (TVC->paths = (TimingValCachePathStruct *)malloc(sizeof(TimingValCachePathStruct) * num_qualified_PNs)) == NULL )
+      { printf("ERROR: CreateTimingValsCacheFromChallengeSet(): Failed to allocate storage for TVC paths array!\n"); exit(EXIT_FAILURE); }
+   TVC->num_paths = num_qualified_PNs;
+   TVC->snapshot_base = NULL;
+   TVC->snapshot_len = 0;
    
 // Get the a list of PUFInstance IDs that match the string 'PUF_instance_name_to_match', which can be '%' to match all. Note: The cache stores data
 // in the order of the PUFInstance ID returned by this routine.
@@ -4293,62 +5215,59 @@ printf("CreateTimingValsCacheFromChallengeSet(): Number of PUFInstances fetched
    PUF_instance_index_struct.num_ints); fflush(stdout);
 #endif
 
-// For each vecpair, allocate an array of floats, one float for each chip.
-   for ( qPN_num = 0; qPN_num < num_qualified_PNs; qPN_num++ )
-      if ( ((*TVC_arr_ptr)[qPN_num].PNs = (float *)malloc(sizeof(float) * PUF_instance_index_struct.num_ints)) == NULL )
-         { printf("ERROR: CreateTimingValsCacheFromChallengeSet(): Failed to allocate storage for PNR!\n"); exit(EXIT_FAILURE); }
-
-// Store information in the TVC array that allows us to get subsets of this data very quickly in GetPUFInstanceTimingInfoUsingVecPairPOStruct by
-// parsing this array from top-to-bottom in vecpair_id followed by PO order, both low-to-high.
+// Store the path information in the TVC paths array in vecpair_id followed by PO order, both low-to-high, and build the (vecpair_id, PO_num) 
+// index BEFORE loading the data since the bulk loader uses it to place each row in the slab. 
    for ( qPN_num = 0; qPN_num < num_qualified_PNs; qPN_num++ )
       {
 
-if ( ((qPN_num + 1) % 100) == 0 )
-printf("CreateTimingValsCacheFromChallengeSet(): Reading %d PNR/PNF from DB of %d\n", qPN_num, num_qualified_PNs); 
-fflush(stdout);
-#ifdef DEBUG
-#endif
-
 // FindQualifyingPaths creates one vecpair_id for each vector pair that is part of the challenge set. It actual vecpair id is found using the vecpair_num
 // field of the qualified_path_info structure.
-      (*TVC_arr_ptr)[qPN_num].vecpair_id = vecpair_ids[qualified_path_info[qPN_num].vecpair_num];
-      (*TVC_arr_ptr)[qPN_num].PO_num = qualified_path_info[qPN_num].PO_num;
-      (*TVC_arr_ptr)[qPN_num].rise_or_fall = qualified_path_info[qPN_num].rise_or_fall;
-      for ( chip_num = 0; chip_num < PUF_instance_index_struct.num_ints; chip_num++ )
+      TVC->paths[qPN_num].vecpair_id = vecpair_ids[qualified_path_info[qPN_num].vecpair_num];
+      TVC->paths[qPN_num].PO_num = qualified_path_info[qPN_num].PO_num;
+      TVC->paths[qPN_num].rise_or_fall = qualified_path_info[qPN_num].rise_or_fall;
+      }
+   BuildTimingValCacheIndex(TVC);
+
+// Allocate the slab, one row of num_qualified_PNs floats for each chip.
+   TVC->num_chips = PUF_instance_index_struct.num_ints;
+   if ( (TVC->PN_slab = (float *)malloc(sizeof(float) * TVC->num_chips * num_qualified_PNs)) == NULL )
+      { printf("ERROR: CreateTimingValsCacheFromChallengeSet(): Failed to allocate storage for PN_slab!\n"); exit(EXIT_FAILURE); }
+
+// If a previous cache of this challenge is given (e.g., a snapshot written before more chips were enrolled) and it has the same paths and its 
+// chips are the first chips of this one, copy its rows. The timing values of an enrolled chip do not change, so only the added chips need to 
+// be read from the database.
+   num_prev_chips = 0;
+   if ( prev_TVC != NULL && prev_TVC->num_paths == TVC->num_paths && prev_TVC->num_chips <= TVC->num_chips && 
+      memcmp(prev_TVC->PUF_instance_ids, PUF_instance_index_struct.int_arr, sizeof(int) * prev_TVC->num_chips) == 0 )
+      {
+      for ( path_num = 0; path_num < TVC->num_paths; path_num++ )
+         if ( prev_TVC->paths[path_num].vecpair_id != TVC->paths[path_num].vecpair_id || prev_TVC->paths[path_num].PO_num != TVC->paths[path_num].PO_num || 
+            prev_TVC->paths[path_num].rise_or_fall != TVC->paths[path_num].rise_or_fall )
+            break;
+      if ( path_num == TVC->num_paths )
          {
-         char sql_command_str[max_string_len];
-         char *zErrMsg = 0;
-         float ave_val;
-         int fc;
-
-// Look up the timing value for this PUF instance. This is the slow operation that we do ONLY once at the beginning of the protocol run
-// for a given ChallengeSetName. NOTE: THIS ROUTINE SCALES the FIXED POINT data in the database by dividing by 16 to create a floating
-// point value from the stored integer before returning.
-//         (*TVC_arr_ptr)[qPN_num].PNs[chip_num] = GetTimingValsAveField(max_string_len, db, PUF_instance_index_struct.int_arr[chip_num], 
-//            (*TVC_arr_ptr)[qPN_num].vecpair_id, (*TVC_arr_ptr)[qPN_num].PO_num);
-
-         ave_val = -50000.0;
-         sprintf(sql_command_str, "SELECT Ave FROM TimingVals WHERE PUFInstance = %d AND VecPair = %d AND PO = %d;",
-            PUF_instance_index_struct.int_arr[chip_num], (*TVC_arr_ptr)[qPN_num].vecpair_id, (*TVC_arr_ptr)[qPN_num].PO_num);
-         fc = sqlite3_exec(db, sql_command_str, SQL_GetTimingValsOpt_callback, &ave_val, &zErrMsg);
-         if ( fc != SQLITE_OK )
-            { printf("SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
-         (*TVC_arr_ptr)[qPN_num].PNs[chip_num] = ave_val;
+         num_prev_chips = prev_TVC->num_chips;
+         memcpy(TVC->PN_slab, prev_TVC->PN_slab, sizeof(float) * (size_t)num_prev_chips * num_qualified_PNs);
+printf("CreateTimingValsCacheFromChallengeSet(): Reusing %d chips of the previous cache, loading %d added chips\n", num_prev_chips, 
+   TVC->num_chips - num_prev_chips); fflush(stdout);
+#ifdef DEBUG
+#endif
          }
       }
 
-// Return the size of the array of TVC structures for sanity checks.
-   *num_TVC_arr_ptr = num_qualified_PNs;
+// Bulk load the timing values of the (remaining) chips into the slab. This is the slow operation that we do ONLY once at the beginning of the 
+// protocol run for a given ChallengeSetName. 
+   LoadTimingValCacheFromDB(db, DB_filename, TVC, PUF_instance_index_struct.int_arr, num_prev_chips, TVC_LOAD_NUM_THREADS);
+
+// The cache keeps the PUFInstance IDs (freed in FreeTimingValsCache).
+   TVC->PUF_instance_ids = PUF_instance_index_struct.int_arr;
+   *TVC_ptr = TVC;
 
    free(tested_path_info); 
    free(qualified_path_info);
    free(vecpair_ids);
 
-// Free up integer array that holds PUFInstanceIDs.
-   if ( PUF_instance_index_struct.int_arr != NULL )
-      free(PUF_instance_index_struct.int_arr);
-
-printf("\n\nCreated PN cache with %d values for each of %d chips\n\n", *num_TVC_arr_ptr, PUF_instance_index_struct.num_ints); fflush(stdout);
+printf("\n\nCreated PN cache with %d values for each of %d chips\n\n", TVC->num_paths, TVC->num_chips); fflush(stdout);
 #ifdef DEBUG
 #endif
 
@@ -4359,3 +5278,547 @@ gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv
 // Return number of chips.
    return PUF_instance_index_struct.num_ints;
    }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Load the TimingVals rows of chips first_chip_num to last_chip_num-1 into the TVC slab. One prepared statement fetches ALL rows of a chip
+// in the VecPair range of the challenge and each row is placed in the slab using the TVC index (rows for unqualified paths are skipped). 
+// If DB_filename is not NULL, the rows are read over a private read-only connection to the database file, otherwise over 'db'.
+
+void LoadTimingValCacheChips(TVCLoadThreadStruct *TLT_ptr)
+   {
+   TimingValCacheStruct *TVC = TLT_ptr->TVC;
+   sqlite3_stmt *stmt;
+   sqlite3 *db;
+   int chip_num, path_num, rc;
+   float *PN_row;
+
+   if ( TLT_ptr->DB_filename != NULL )
+      {
+      if ( sqlite3_open_v2(TLT_ptr->DB_filename, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK )
+         { printf("ERROR: LoadTimingValCacheChips(): Failed to open Database '%s': %s!\n", TLT_ptr->DB_filename, sqlite3_errmsg(db)); exit(EXIT_FAILURE); }
+      }
+   else
+      db = TLT_ptr->db;
+
+   if ( sqlite3_prepare_v2(db, SQL_TimingVals_bulk_load_cmd, -1, &stmt, 0) != SQLITE_OK )
+      { printf("ERROR: LoadTimingValCacheChips(): Failed to prepare bulk load statement: %s!\n", sqlite3_errmsg(db)); exit(EXIT_FAILURE); }
+
+   TLT_ptr->num_rows = 0;
+   TLT_ptr->num_PNs = 0;
+   for ( chip_num = TLT_ptr->first_chip_num; chip_num < TLT_ptr->last_chip_num; chip_num++ )
+      {
+      PN_row = TVC->PN_slab + (size_t)chip_num*TVC->num_paths;
+      for ( path_num = 0; path_num < TVC->num_paths; path_num++ )
+         PN_row[path_num] = -50000.0;
+
+      sqlite3_reset(stmt);
+      sqlite3_bind_int(stmt, 1, TLT_ptr->PUF_instance_ids[chip_num]);
+      sqlite3_bind_int(stmt, 2, TLT_ptr->min_vecpair_id);
+      sqlite3_bind_int(stmt, 3, TLT_ptr->max_vecpair_id);
+
+      while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW )
+         {
+         TLT_ptr->num_rows++;
+         if ( (path_num = LookupTimingValCachePath(TVC, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1))) == -1 )
+            continue;
+
+// Sanity check. Each path MUST match at most one row for a chip.
+         if ( PN_row[path_num] != -50000.0 )
+            { 
+            printf("ERROR: LoadTimingValCacheChips(): More than 1 row matched for PUFInstance %d, VecPair %d and PO %d!\n", 
+               TLT_ptr->PUF_instance_ids[chip_num], TVC->paths[path_num].vecpair_id, TVC->paths[path_num].PO_num); 
+            exit(EXIT_FAILURE); 
+            }
+
+// Divide the database stored integer value by 16 to make it a FIXED POINT value.
+         PN_row[path_num] = (float)sqlite3_column_double(stmt, 2)/16.0;
+         TLT_ptr->num_PNs++;
+         }
+      if ( rc != SQLITE_DONE )
+         { printf("ERROR: LoadTimingValCacheChips(): Failed to step bulk load statement: %s!\n", sqlite3_errmsg(db)); exit(EXIT_FAILURE); }
+      }
+
+   sqlite3_finalize(stmt);
+   if ( TLT_ptr->DB_filename != NULL )
+      sqlite3_close(db);
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Thread wrapper for LoadTimingValCacheChips.
+
+void *LoadTimingValCacheThread(void *arg)
+   {
+   LoadTimingValCacheChips((TVCLoadThreadStruct *)arg);
+   return NULL;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Fill the TVC slab rows of chips first_chip_num to TVC->num_chips-1 (PUFInstance IDs in PUF_instance_ids) by splitting them into contiguous 
+// ranges across num_threads threads, each reading over its own connection. An in-memory database cannot be opened by a second connection, 
+// so for one the threads read the database file DB_filename it was copied from. The chip list still comes from 'db' and the timing data 
+// of an enrolled chip is the same in both. If 'db' is in-memory and DB_filename is NULL, the calling thread loads it over 'db'. Reports 
+// the number of rows read per second so the startup cost can be tracked as the chip population grows.
+
+void LoadTimingValCacheFromDB(sqlite3 *db, const char *DB_filename, TimingValCacheStruct *TVC, int *PUF_instance_ids, int first_chip_num, 
+   int num_threads)
+   {
+   TVCLoadThreadStruct *TLT_arr;
+   pthread_t *threads;
+   const char *main_filename;
+   int min_vecpair_id, max_vecpair_id;
+   int path_num, thread_num, chip_num, num_load_chips;
+   long num_rows, num_PNs;
+   struct timeval t1, t2;
+   long elapsed; 
+
+   gettimeofday(&t2, 0);
+
+// Restrict the query to the VecPairs of the challenge.
+   min_vecpair_id = max_vecpair_id = TVC->paths[0].vecpair_id;
+   for ( path_num = 1; path_num < TVC->num_paths; path_num++ )
+      {
+      if ( TVC->paths[path_num].vecpair_id < min_vecpair_id )
+         min_vecpair_id = TVC->paths[path_num].vecpair_id;
+      if ( TVC->paths[path_num].vecpair_id > max_vecpair_id )
+         max_vecpair_id = TVC->paths[path_num].vecpair_id;
+      }
+
+// sqlite3_db_filename returns an empty string (or NULL) for an in-memory database.
+   main_filename = sqlite3_db_filename(db, "main");
+   if ( main_filename != NULL && main_filename[0] != '\0' )
+      DB_filename = main_filename;
+   if ( DB_filename == NULL )
+      num_threads = 1;
+   num_load_chips = TVC->num_chips - first_chip_num;
+   if ( num_threads > num_load_chips )
+      num_threads = num_load_chips;
+   if ( num_threads < 1 )
+      num_threads = 1;
+
+   if ( (TLT_arr = (TVCLoadThreadStruct *)malloc(sizeof(TVCLoadThreadStruct) * num_threads)) == NULL )
+      { printf("ERROR: LoadTimingValCacheFromDB(): Failed to allocate storage for TLT_arr!\n"); exit(EXIT_FAILURE); }
+   if ( (threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads)) == NULL )
+      { printf("ERROR: LoadTimingValCacheFromDB(): Failed to allocate storage for threads!\n"); exit(EXIT_FAILURE); }
+
+   for ( thread_num = 0; thread_num < num_threads; thread_num++ )
+      {
+      TLT_arr[thread_num].TVC = TVC;
+      TLT_arr[thread_num].db = db;
+      TLT_arr[thread_num].DB_filename = num_threads > 1 ? DB_filename : NULL;
+      TLT_arr[thread_num].PUF_instance_ids = PUF_instance_ids;
+      TLT_arr[thread_num].first_chip_num = first_chip_num + (int)(((long)num_load_chips * thread_num)/num_threads);
+      TLT_arr[thread_num].last_chip_num = first_chip_num + (int)(((long)num_load_chips * (thread_num + 1))/num_threads);
+      TLT_arr[thread_num].min_vecpair_id = min_vecpair_id;
+      TLT_arr[thread_num].max_vecpair_id = max_vecpair_id;
+      }
+
+// With one thread, load in the caller over the caller's connection.
+   if ( num_threads == 1 )
+      LoadTimingValCacheChips(&(TLT_arr[0]));
+   else
+      {
+      for ( thread_num = 0; thread_num < num_threads; thread_num++ )
+         if ( pthread_create(&(threads[thread_num]), NULL, LoadTimingValCacheThread, (void *)&(TLT_arr[thread_num])) != 0 )
+            { printf("ERROR: LoadTimingValCacheFromDB(): Failed to create thread %d!\n", thread_num); exit(EXIT_FAILURE); }
+      for ( thread_num = 0; thread_num < num_threads; thread_num++ )
+         pthread_join(threads[thread_num], NULL);
+      }
+
+   num_rows = num_PNs = 0;
+   for ( thread_num = 0; thread_num < num_threads; thread_num++ )
+      {
+      num_rows += TLT_arr[thread_num].num_rows;
+      num_PNs += TLT_arr[thread_num].num_PNs;
+      }
+
+// Sanity check. Report chips that are missing timing values for qualified paths (these remain at -50000.0 in the slab).
+   if ( num_PNs != (long)num_load_chips * TVC->num_paths )
+      for ( chip_num = first_chip_num; chip_num < TVC->num_chips; chip_num++ )
+         for ( path_num = 0; path_num < TVC->num_paths; path_num++ )
+            if ( TVC->PN_slab[(size_t)chip_num*TVC->num_paths + path_num] == -50000.0 )
+               printf("WARNING: LoadTimingValCacheFromDB(): No timing value for PUFInstance %d, VecPair %d and PO %d!\n", 
+                  PUF_instance_ids[chip_num], TVC->paths[path_num].vecpair_id, TVC->paths[path_num].PO_num);
+
+   gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; 
+   printf("LoadTimingValCacheFromDB(): Read %ld rows (%ld PNs) for %d chips with %d threads in %ld us (%.0f rows/s)\n", 
+      num_rows, num_PNs, num_load_chips, num_threads, elapsed, elapsed > 0 ? (double)num_rows*1000000.0/elapsed : 0.0); fflush(stdout);
+
+   free(TLT_arr);
+   free(threads);
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Hash slot of a (vecpair_id, PO_num) key in the TVC index.
+
+int HashTimingValCacheKey(TimingValCacheStruct *TVC, int vecpair_id, int PO_num)
+   { return (int)(((unsigned int)vecpair_id * 2654435761u ^ (unsigned int)PO_num * 40503u) & (unsigned int)(TVC->num_hash_slots - 1)); }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Build the open-addressed (linear probing) hash index that maps (vecpair_id, PO_num) to the path index in the 
+// TVC. The table has at least twice as many slots as paths to keep the probe sequences short.
+
+void BuildTimingValCacheIndex(TimingValCacheStruct *TVC)
+   {
+   int path_num, slot_num;
+
+   TVC->num_hash_slots = 1;
+   while ( TVC->num_hash_slots < 2*TVC->num_paths )
+      TVC->num_hash_slots *= 2;
+
+   if ( (TVC->hash_slots = (int *)malloc(sizeof(int) * TVC->num_hash_slots)) == NULL )
+      { printf("ERROR: BuildTimingValCacheIndex(): Failed to allocate storage for hash_slots!\n"); exit(EXIT_FAILURE); }
+   for ( slot_num = 0; slot_num < TVC->num_hash_slots; slot_num++ )
+      TVC->hash_slots[slot_num] = -1;
+
+   for ( path_num = 0; path_num < TVC->num_paths; path_num++ )
+      {
+
+// Sanity check
+      if ( LookupTimingValCachePath(TVC, TVC->paths[path_num].vecpair_id, TVC->paths[path_num].PO_num) != -1 )
+         { 
+         printf("ERROR: BuildTimingValCacheIndex(): Duplicate vecpair_id %d and PO_num %d in TVC!\n", TVC->paths[path_num].vecpair_id, 
+            TVC->paths[path_num].PO_num); 
+         exit(EXIT_FAILURE); 
+         }
+
+      slot_num = HashTimingValCacheKey(TVC, TVC->paths[path_num].vecpair_id, TVC->paths[path_num].PO_num);
+      while ( TVC->hash_slots[slot_num] != -1 )
+         slot_num = (slot_num + 1) & (TVC->num_hash_slots - 1);
+      TVC->hash_slots[slot_num] = path_num;
+      }
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Return the path index in the TVC of (vecpair_id, PO_num), or -1 if the path is not in the cache.
+
+int LookupTimingValCachePath(TimingValCacheStruct *TVC, int vecpair_id, int PO_num)
+   {
+   int slot_num, path_num;
+
+   slot_num = HashTimingValCacheKey(TVC, vecpair_id, PO_num);
+   while ( (path_num = TVC->hash_slots[slot_num]) != -1 )
+      {
+      if ( TVC->paths[path_num].vecpair_id == vecpair_id && TVC->paths[path_num].PO_num == PO_num )
+         return path_num;
+      slot_num = (slot_num + 1) & (TVC->num_hash_slots - 1);
+      }
+
+   return -1;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Return a pointer to the PNs of chip_num in the TVC slab, num_paths values in the order of the TVC paths array. 
+// The values are NOT copied -- this points into the cache and is READ-ONLY.
+
+float *GetTimingValCacheChipPNs(TimingValCacheStruct *TVC, int chip_num)
+   {
+
+// Sanity check
+   if ( chip_num < 0 || chip_num >= TVC->num_chips )
+      { printf("ERROR: GetTimingValCacheChipPNs(): chip_num %d out of range (%d chips)!\n", chip_num, TVC->num_chips); exit(EXIT_FAILURE); }
+
+   return TVC->PN_slab + (size_t)chip_num*TVC->num_paths;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Free a TVC created by CreateTimingValsCacheFromChallengeSet.
+
+void FreeTimingValsCache(TimingValCacheStruct **TVC_ptr)
+   {
+   if ( *TVC_ptr == NULL )
+      return;
+
+// A cache mapped from a snapshot owns only the mapping.
+   if ( (*TVC_ptr)->snapshot_base != NULL )
+      {
+      munmap((*TVC_ptr)->snapshot_base, (*TVC_ptr)->snapshot_len);
+      free(*TVC_ptr);
+      *TVC_ptr = NULL;
+      return;
+      }
+
+   free((*TVC_ptr)->PUF_instance_ids);
+   free((*TVC_ptr)->paths);
+   free((*TVC_ptr)->PN_slab);
+   free((*TVC_ptr)->hash_slots);
+   free(*TVC_ptr);
+   *TVC_ptr = NULL;
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Name of the TVC snapshot file for the database file DB_filename and challenge ChallengeSetName.
+
+void GetTimingValsCacheSnapshotName(int max_string_len, char *DB_filename, char *ChallengeSetName, char *snapshot_filename)
+   {
+   if ( (int)(strlen(DB_filename) + strlen(ChallengeSetName) + 6) > max_string_len )
+      { printf("ERROR: GetTimingValsCacheSnapshotName(): Snapshot filename for '%s' and '%s' too long!\n", DB_filename, ChallengeSetName); exit(EXIT_FAILURE); }
+   sprintf(snapshot_filename, "%s.%s.tvc", DB_filename, ChallengeSetName);
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Fill in the identifying fields of a snapshot header: the layout version, the parameters the cache is built from and the size 
+// and modification time of the database file (the staleness check). The array offsets and checksum are left zero.
+
+void FillTimingValsCacheSnapshotHeader(TVCSnapshotHeaderStruct *header_ptr, char *DB_filename, int design_index, 
+   char *ChallengeSetName, char *PUF_instance_name_to_match)
+   {
+   struct stat DB_stat;
+
+   if ( stat(DB_filename, &DB_stat) != 0 )
+      { printf("ERROR: FillTimingValsCacheSnapshotHeader(): Failed to stat database file '%s'!\n", DB_filename); exit(EXIT_FAILURE); }
+   if ( strlen(ChallengeSetName) >= TVC_SNAPSHOT_MAX_NAME_LEN || strlen(PUF_instance_name_to_match) >= TVC_SNAPSHOT_MAX_NAME_LEN )
+      { printf("ERROR: FillTimingValsCacheSnapshotHeader(): ChallengeSetName or PUF_instance_name_to_match too long!\n"); exit(EXIT_FAILURE); }
+
+// Zero the whole header (including padding) so identical caches produce identical files.
+   memset(header_ptr, 0, sizeof(TVCSnapshotHeaderStruct));
+   memcpy(header_ptr->magic, TVC_SNAPSHOT_MAGIC, 8);
+   header_ptr->version = TVC_SNAPSHOT_VERSION;
+   header_ptr->header_size = (int)sizeof(TVCSnapshotHeaderStruct);
+   header_ptr->design_index = design_index;
+   header_ptr->DB_file_size = (long long)DB_stat.st_size;
+   header_ptr->DB_mtime = (long long)DB_stat.st_mtime;
+   strcpy(header_ptr->ChallengeSetName, ChallengeSetName);
+   strcpy(header_ptr->PUF_instance_name_to_match, PUF_instance_name_to_match);
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Write the TVC to its snapshot file: header, chip list, paths, hash index and PN slab. The file is written under a temporary 
+// name and renamed into place so a verifier starting concurrently never maps a partially written snapshot. Returns 0 on 
+// success and -1 if the file could not be written (the snapshot is an optimization only, so this is NOT fatal).
+
+int SaveTimingValsCacheSnapshot(int max_string_len, TimingValCacheStruct *TVC, char *DB_filename, int design_index, 
+   char *ChallengeSetName, char *PUF_instance_name_to_match)
+   {
+   char snapshot_filename[max_string_len], temp_filename[max_string_len + 16];
+   TVCSnapshotHeaderStruct header;
+   unsigned char *file_buf;
+   long long offset;
+   FILE *OUTFILE;
+   int path_num;
+
+   GetTimingValsCacheSnapshotName(max_string_len, DB_filename, ChallengeSetName, snapshot_filename);
+   FillTimingValsCacheSnapshotHeader(&header, DB_filename, design_index, ChallengeSetName, PUF_instance_name_to_match);
+   header.num_paths = TVC->num_paths;
+   header.num_chips = TVC->num_chips;
+   header.num_hash_slots = TVC->num_hash_slots;
+
+// Lay out the arrays after the header, each aligned.
+   offset = sizeof(TVCSnapshotHeaderStruct);
+   offset = (offset + TVC_SNAPSHOT_ALIGN - 1) & ~(long long)(TVC_SNAPSHOT_ALIGN - 1);
+   header.PUF_instance_ids_offset = offset;
+   offset += sizeof(int) * (long long)TVC->num_chips;
+   offset = (offset + TVC_SNAPSHOT_ALIGN - 1) & ~(long long)(TVC_SNAPSHOT_ALIGN - 1);
+   header.paths_offset = offset;
+   offset += sizeof(TimingValCachePathStruct) * (long long)TVC->num_paths;
+   offset = (offset + TVC_SNAPSHOT_ALIGN - 1) & ~(long long)(TVC_SNAPSHOT_ALIGN - 1);
+   header.hash_slots_offset = offset;
+   offset += sizeof(int) * (long long)TVC->num_hash_slots;
+   offset = (offset + TVC_SNAPSHOT_ALIGN - 1) & ~(long long)(TVC_SNAPSHOT_ALIGN - 1);
+   header.PN_slab_offset = offset;
+   offset += sizeof(float) * (long long)TVC->num_chips * TVC->num_paths;
+   header.file_size = offset;
+
+// Build the file image. The paths are copied field by field so the struct padding is zero.
+   if ( (file_buf = (unsigned char *)calloc(header.file_size, 1)) == NULL )
+      { printf("ERROR: SaveTimingValsCacheSnapshot(): Failed to allocate storage for file_buf!\n"); exit(EXIT_FAILURE); }
+   memcpy(file_buf + header.PUF_instance_ids_offset, TVC->PUF_instance_ids, sizeof(int) * TVC->num_chips);
+   for ( path_num = 0; path_num < TVC->num_paths; path_num++ )
+      {
+      TimingValCachePathStruct *path_ptr = (TimingValCachePathStruct *)(file_buf + header.paths_offset) + path_num;
+
+      path_ptr->vecpair_id = TVC->paths[path_num].vecpair_id;
+      path_ptr->PO_num = TVC->paths[path_num].PO_num;
+      path_ptr->rise_or_fall = TVC->paths[path_num].rise_or_fall;
+      }
+   memcpy(file_buf + header.hash_slots_offset, TVC->hash_slots, sizeof(int) * TVC->num_hash_slots);
+   memcpy(file_buf + header.PN_slab_offset, TVC->PN_slab, sizeof(float) * (size_t)TVC->num_chips * TVC->num_paths);
+
+   header.checksum = Checksum64(file_buf + sizeof(TVCSnapshotHeaderStruct), header.file_size - sizeof(TVCSnapshotHeaderStruct));
+   memcpy(file_buf, &header, sizeof(TVCSnapshotHeaderStruct));
+
+   sprintf(temp_filename, "%s.%d", snapshot_filename, (int)getpid());
+   if ( (OUTFILE = fopen(temp_filename, "wb")) == NULL )
+      { 
+      printf("WARNING: SaveTimingValsCacheSnapshot(): Could not open '%s' for writing -- snapshot NOT saved!\n", temp_filename); 
+      free(file_buf); 
+      return -1; 
+      }
+   if ( fwrite(file_buf, 1, header.file_size, OUTFILE) != (size_t)header.file_size || fclose(OUTFILE) != 0 || rename(temp_filename, snapshot_filename) != 0 )
+      { 
+      printf("WARNING: SaveTimingValsCacheSnapshot(): Failed to write '%s' -- snapshot NOT saved!\n", snapshot_filename); 
+      unlink(temp_filename); 
+      free(file_buf); 
+      return -1; 
+      }
+   free(file_buf);
+
+printf("SaveTimingValsCacheSnapshot(): Wrote TVC snapshot '%s' (%lld bytes)\n", snapshot_filename, header.file_size); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   return 0;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Map the snapshot of the TVC for DB_filename and ChallengeSetName read-only and return a TVC whose arrays point into the mapping
+// (shared by all threads, and through the page cache by all verifier processes on the host). Returns NULL if the snapshot does not 
+// exist, was written by a different layout version, is stale (database file size or modification time changed, different build 
+// parameters or a different list of PUFInstances in 'db') or fails the checksum. If prev_TVC_ptr is not NULL and the snapshot is 
+// only stale because the database or its list of PUFInstances changed (e.g., chips were enrolled), the mapped snapshot is returned 
+// in *prev_TVC_ptr (otherwise NULL) so CreateTimingValsCacheFromChallengeSet can reuse it. The caller frees it.
+
+TimingValCacheStruct *MapTimingValsCacheSnapshot(int max_string_len, sqlite3 *db, char *DB_filename, int design_index, 
+   char *ChallengeSetName, char *PUF_instance_name_to_match, TimingValCacheStruct **prev_TVC_ptr)
+   {
+   char snapshot_filename[max_string_len];
+   TVCSnapshotHeaderStruct expected_header, *header_ptr;
+   SQLIntStruct PUF_instance_index_struct;
+   TimingValCacheStruct *TVC;
+   struct stat snapshot_stat;
+   unsigned char *base;
+   int fd, is_stale, is_reusable;
+
+   if ( prev_TVC_ptr != NULL )
+      *prev_TVC_ptr = NULL;
+
+   GetTimingValsCacheSnapshotName(max_string_len, DB_filename, ChallengeSetName, snapshot_filename);
+   if ( (fd = open(snapshot_filename, O_RDONLY)) < 0 )
+      return NULL;
+   if ( fstat(fd, &snapshot_stat) != 0 || snapshot_stat.st_size < (off_t)sizeof(TVCSnapshotHeaderStruct) )
+      { close(fd); return NULL; }
+   if ( (base = (unsigned char *)mmap(NULL, snapshot_stat.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED )
+      { close(fd); return NULL; }
+   close(fd);
+   header_ptr = (TVCSnapshotHeaderStruct *)base;
+
+// Staleness checks. A snapshot of this layout and build parameters is reusable (for an incremental rebuild) even if the database changed.
+   FillTimingValsCacheSnapshotHeader(&expected_header, DB_filename, design_index, ChallengeSetName, PUF_instance_name_to_match);
+   is_stale = memcmp(header_ptr->magic, expected_header.magic, 8) != 0 || header_ptr->version != expected_header.version || 
+      header_ptr->header_size != expected_header.header_size || header_ptr->file_size != (long long)snapshot_stat.st_size || 
+      header_ptr->design_index != expected_header.design_index || strcmp(header_ptr->ChallengeSetName, expected_header.ChallengeSetName) != 0 || 
+      strcmp(header_ptr->PUF_instance_name_to_match, expected_header.PUF_instance_name_to_match) != 0;
+
+// Sanity check. The arrays must lie inside the file.
+   if ( is_stale == 0 )
+      is_stale = header_ptr->num_chips < 0 || header_ptr->num_paths < 0 || header_ptr->num_hash_slots < 0 ||
+         header_ptr->PUF_instance_ids_offset + (long long)sizeof(int) * header_ptr->num_chips > header_ptr->file_size || 
+         header_ptr->paths_offset + (long long)sizeof(TimingValCachePathStruct) * header_ptr->num_paths > header_ptr->file_size || 
+         header_ptr->hash_slots_offset + (long long)sizeof(int) * header_ptr->num_hash_slots > header_ptr->file_size || 
+         header_ptr->PN_slab_offset + (long long)sizeof(float) * header_ptr->num_chips * header_ptr->num_paths > header_ptr->file_size;
+   is_reusable = (is_stale == 0);
+   if ( is_stale == 0 )
+      is_stale = header_ptr->DB_file_size != expected_header.DB_file_size || header_ptr->DB_mtime != expected_header.DB_mtime;
+
+// The database may have been trimmed in memory (see 'max_chips' in the verifier), so compare the chip list too.
+   if ( is_stale == 0 )
+      {
+      GetPUFInstanceIDsForInstanceName(max_string_len, db, &PUF_instance_index_struct, PUF_instance_name_to_match);
+      is_stale = PUF_instance_index_struct.num_ints != header_ptr->num_chips || 
+         memcmp(PUF_instance_index_struct.int_arr, base + header_ptr->PUF_instance_ids_offset, sizeof(int) * header_ptr->num_chips) != 0;
+      if ( PUF_instance_index_struct.int_arr != NULL )
+         free(PUF_instance_index_struct.int_arr);
+      }
+
+   if ( is_stale == 1 && (is_reusable == 0 || prev_TVC_ptr == NULL) )
+      {
+      printf("MapTimingValsCacheSnapshot(): TVC snapshot '%s' is stale -- ignoring it\n", snapshot_filename); fflush(stdout);
+      munmap(base, snapshot_stat.st_size);
+      return NULL;
+      }
+
+   if ( Checksum64(base + sizeof(TVCSnapshotHeaderStruct), snapshot_stat.st_size - sizeof(TVCSnapshotHeaderStruct)) != header_ptr->checksum )
+      {
+      printf("WARNING: MapTimingValsCacheSnapshot(): TVC snapshot '%s' failed checksum -- ignoring it\n", snapshot_filename); fflush(stdout);
+      munmap(base, snapshot_stat.st_size);
+      return NULL;
+      }
+
+   if ( (TVC = (TimingValCacheStruct *)malloc(sizeof(TimingValCacheStruct))) == NULL )
+      { printf("ERROR: MapTimingValsCacheSnapshot(): Failed to allocate storage for TVC structure!\n"); exit(EXIT_FAILURE); }
+   TVC->num_paths = header_ptr->num_paths;
+   TVC->num_chips = header_ptr->num_chips;
+   TVC->num_hash_slots = header_ptr->num_hash_slots;
+   TVC->PUF_instance_ids = (int *)(base + header_ptr->PUF_instance_ids_offset);
+   TVC->paths = (TimingValCachePathStruct *)(base + header_ptr->paths_offset);
+   TVC->hash_slots = (int *)(base + header_ptr->hash_slots_offset);
+   TVC->PN_slab = (float *)(base + header_ptr->PN_slab_offset);
+   TVC->snapshot_base = base;
+   TVC->snapshot_len = snapshot_stat.st_size;
+
+   if ( is_stale == 1 )
+      {
+      printf("MapTimingValsCacheSnapshot(): TVC snapshot '%s' is stale -- reusing it to update the cache\n", snapshot_filename); fflush(stdout);
+      *prev_TVC_ptr = TVC;
+      return NULL;
+      }
+
+printf("MapTimingValsCacheSnapshot(): Mapped TVC snapshot '%s' with %d values for each of %d chips\n", snapshot_filename, 
+   TVC->num_paths, TVC->num_chips); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   return TVC;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Get the TVC for ChallengeSetName, mapping it from its snapshot file if there is a valid one, otherwise building it from 'db' with
+// CreateTimingValsCacheFromChallengeSet (incrementally from a stale snapshot when chips were only added) and writing the snapshot for 
+// the next start if use_snapshot is 1. DB_filename is the database file 'db' was opened from (or copied into memory from). If it is 
+// NULL, the cache is always built from 'db' without a snapshot. Returns the number of chips.
+
+int GetTimingValsCache(int max_string_len, sqlite3 *db, char *DB_filename, int use_snapshot, int design_index, char *ChallengeSetName, 
+   char *PUF_instance_name_to_match, TimingValCacheStruct **TVC_ptr)
+   {
+   TimingValCacheStruct *prev_TVC = NULL;
+
+   if ( DB_filename != NULL && use_snapshot == 1 )
+      if ( (*TVC_ptr = MapTimingValsCacheSnapshot(max_string_len, db, DB_filename, design_index, ChallengeSetName, 
+         PUF_instance_name_to_match, &prev_TVC)) != NULL )
+         return (*TVC_ptr)->num_chips;
+
+   CreateTimingValsCacheFromChallengeSet(max_string_len, db, DB_filename, design_index, ChallengeSetName, PUF_instance_name_to_match, 
+      prev_TVC, TVC_ptr);
+   FreeTimingValsCache(&prev_TVC);
+
+   if ( DB_filename != NULL && use_snapshot == 1 )
+      SaveTimingValsCacheSnapshot(max_string_len, *TVC_ptr, DB_filename, design_index, ChallengeSetName, PUF_instance_name_to_match);
+
+   return (*TVC_ptr)->num_chips;
+   }
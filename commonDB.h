@@ -16,9 +16,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>  
+#include <errno.h>
 #include <sys/mman.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <arpa/inet.h> 
 #include <netdb.h> 
@@ -39,6 +41,25 @@
 #define NUM_RISE_REQUIRED_PNS (NUM_REQUIRED_PNDIFFS)
 #define NUM_FALL_REQUIRED_PNS (NUM_REQUIRED_PNDIFFS)
 
+// Number of threads used to bulk load the TimingVals of the chips into the TVC slab in CreateTimingValsCacheFromChallengeSet. Each 
+// thread reads over its own read-only connection to the database file (for an in-memory database, the file it was copied from).
+#define TVC_LOAD_NUM_THREADS 4
+
+// Binary snapshot of a TVC, written next to the NAT database as '<DB file>.<ChallengeSetName>.tvc'. Bump the version when the layout of 
+// the header or of any of the arrays (including TimingValCachePathStruct) changes.
+#define TVC_SNAPSHOT_MAGIC "PUFTVC01"
+#define TVC_SNAPSHOT_VERSION 1
+#define TVC_SNAPSHOT_ALIGN 64
+#define TVC_SNAPSHOT_MAX_NAME_LEN 128
+
+// Prepared statement cache (see GetSQLStmt). One registry per database connection, each holding up to SQL_STMT_CACHE_MAX_STMTS 
+// statements keyed by their SQL text.
+#define SQL_STMT_CACHE_MAX_DBS 8
+#define SQL_STMT_CACHE_MAX_STMTS 64
+
+// Write-back persistence of in-memory databases (see StartDBPersist). The journal is '<DB file>.wbj'.
+#define DB_PERSIST_MAX_NAME_LEN 1024
+
 extern const char *SQL_PUFDesign_get_index_cmd;
 extern const char *SQL_PUFDesign_insert_into_cmd;
 
@@ -54,6 +75,7 @@ extern const char *SQL_VecPairs_insert_into_cmd;
 extern const char *SQL_VecPairs_get_index_cmd;
 
 extern const char *SQL_TimingVals_insert_into_cmd;
+extern const char *SQL_TimingVals_bulk_load_cmd;
 
 extern const char *SQL_PathSelectMasks_insert_into_cmd;
 extern const char *SQL_PathSelectMasks_get_index_cmd;
@@ -100,10 +122,101 @@ typedef struct
    int vecpair_id;
    int PO_num;
    } VecPairPOStruct; 
+
+// Work assignment of one TVC bulk load thread: chips first_chip_num to last_chip_num-1.
+typedef struct
+   {
+   TimingValCacheStruct *TVC;
+   sqlite3 *db;
+   const char *DB_filename;
+   int *PUF_instance_ids;
+   int first_chip_num;
+   int last_chip_num;
+   int min_vecpair_id;
+   int max_vecpair_id;
+   long num_rows;
+   long num_PNs;
+   } TVCLoadThreadStruct;
+
+// Header of a TVC snapshot file. The arrays follow at the given (TVC_SNAPSHOT_ALIGN aligned) file offsets. DB_file_size and DB_mtime 
+// record the state of the database file the cache was built from, and checksum covers every byte after the header.
+typedef struct
+   {
+   char magic[8];
+   int version;
+   int header_size;
+   int design_index;
+   int num_paths;
+   int num_chips;
+   int num_hash_slots;
+   long long DB_file_size;
+   long long DB_mtime;
+   char ChallengeSetName[TVC_SNAPSHOT_MAX_NAME_LEN];
+   char PUF_instance_name_to_match[TVC_SNAPSHOT_MAX_NAME_LEN];
+   long long PUF_instance_ids_offset;
+   long long paths_offset;
+   long long hash_slots_offset;
+   long long PN_slab_offset;
+   long long file_size;
+   uint64_t checksum;
+   } TVCSnapshotHeaderStruct;
+
+// A cached prepared statement. 'stmt_mutex' is held from GetSQLStmt until ReleaseSQLStmt.
+typedef struct
+   {
+   sqlite3_stmt *pStmt;
+   pthread_mutex_t stmt_mutex;
+   } SQLStmtStruct;
+
+typedef struct
+   {
+   sqlite3 *db;
+   SQLStmtStruct stmts[SQL_STMT_CACHE_MAX_STMTS];
+   int num_stmts;
+   pthread_mutex_t txn_mutex;
+   } SQLStmtCacheStruct;
+
+// One step of a schema migration (see ApplySchemaMigrations). 'SQL_cmds' may hold several ';' separated statements.
+typedef struct
+   {
+   int version;
+   const char *description;
+   const char *SQL_cmds;
+   } SchemaMigrationStruct;
+
+// Write-back persistence state of one in-memory database. 'journal_mutex' protects the journal and the fields below it. 
+// 'last_seq' is the sequence number of the last journal record; 'writing_seq' is set while the checkpoint stores it in the 
+// database (see CheckpointDBPersist).
+typedef struct
+   {
+   sqlite3 *db;
+   char DB_name[DB_PERSIST_MAX_NAME_LEN];
+   char journal_name[DB_PERSIST_MAX_NAME_LEN];
+   int RPO_ms;
+   int checkpoint_secs;
+   int pages_per_step;
+   int step_budget_ms;
+   pthread_t thread;
+   pthread_mutex_t journal_mutex;
+   pthread_cond_t stop_cv;
+   FILE *journal_fp;
+   char *pending;
+   int pending_len;
+   int pending_max;
+   int last_total_changes;
+   int unsynced;
+   int num_since_checkpoint;
+   long long last_seq;
+   int writing_seq;
+   int stop;
+   } DBPersistStruct;
 #define DATABASE_STRUCTS
 #endif
 
 int LoadOrSaveDb(sqlite3 *pInMemory, const char *zFilename, int isSave);
+int GetSchemaVersion(sqlite3 *db);
+int ApplySchemaMigrations(int max_string_len, sqlite3 *db, const char *DB_name, SchemaMigrationStruct *migrations, 
+   int num_migrations);
 
 void Get_IDs(int max_string_len, sqlite3 *db, char *table_name, SQLIntStruct *index_struct_ptr);
 void Delete_ForID(int max_string_len, sqlite3 *db, char *table_name, int index);
@@ -148,6 +261,23 @@ int InsertIntoTable(int max_string_len, sqlite3 *db, char *Table, const char *SQ
    int vector_size_bytes, char *text1, char *text2, char *text3, char *text4, char *text5, int int1, int int2, 
    int int3, int int4, int int5, float float1, float float2);
 
+SQLStmtStruct *GetSQLStmt(sqlite3 *db, const char *SQL_cmd);
+void ReleaseSQLStmt(SQLStmtStruct *SQLStmt_ptr);
+void BindSQLStmtInt(SQLStmtStruct *SQLStmt_ptr, int param_num, int val);
+void BindSQLStmtInt64(SQLStmtStruct *SQLStmt_ptr, int param_num, sqlite3_int64 val);
+void BindSQLStmtBlob(SQLStmtStruct *SQLStmt_ptr, int param_num, unsigned char *blob, int num_bytes);
+int StepSQLStmt(SQLStmtStruct *SQLStmt_ptr, char *calling_routine_str);
+int StepSQLStmtChanges(SQLStmtStruct *SQLStmt_ptr, char *calling_routine_str);
+void GetSQLStmtListOfInts(SQLStmtStruct *SQLStmt_ptr, char *calling_routine_str, SQLIntStruct *int_struct);
+int GetSQLStmtColumnBlob(SQLStmtStruct *SQLStmt_ptr, int col_num, unsigned char **blob_ptr);
+void BeginSQLTransaction(sqlite3 *db);
+void CommitSQLTransaction(sqlite3 *db);
+int PrepareSQLStmtCache(sqlite3 *db, const char **SQL_cmds, int num_cmds);
+void FinalizeSQLStmtCache(sqlite3 *db);
+DBPersistStruct *StartDBPersist(sqlite3 *db, const char *DB_name, int RPO_ms, int checkpoint_secs, int pages_per_step, 
+   int step_budget_ms);
+void StopDBPersist(DBPersistStruct *DBP_ptr);
+
 void DetermineNumSelectedPOsInMask(char *mask, int num_POs, int *num_no_trans_ptr, int *num_hard_selected_ptr,
    int *num_unqual_selected_ptr, int *num_qual_selected_ptr);
 
@@ -185,16 +315,15 @@ void CreateVecsMasks(int max_string_len, sqlite3 *db, char *outfile_vecs, char *
 
 void GetPUFInstanceTimingInfoUsingVecPairPOStruct(int max_string_len, sqlite3 *db, int PUF_instance_index, int timing_or_tsig,
    VecPairPOStruct *vecpair_id_PO, int num_VPPO_eles, int allocate_float_arrs, float **PNR_TSig_ptr, float **PNF_TSig_ptr,
-   TimingValCacheStruct *TVC_arr, int num_TVC_arr, int use_TVC_cache, int TVC_chip_num);
+   TimingValCacheStruct *TVC, int use_TVC_cache, int TVC_chip_num);
 
 void GetAllPUFInstanceTimingValsForChallenge(int max_string_len, sqlite3 *db, VecPairPOStruct *challenge_vecpair_id_PO_arr, 
    int num_challenge_vecpair_id_PO, char *PUF_instance_name_to_match, float ***PNR_ptr, float ***PNF_ptr, int *num_chips_ptr,
-   TimingValCacheStruct *TVC_arr, int num_TVC_arr, int use_TVC_cache);
+   TimingValCacheStruct *TVC, int use_TVC_cache);
 
 int GenChallengeDB(int max_string_len, sqlite3 *db, int design_index, char *ChallengeSetName, unsigned int Seed, int save_vecs_masks, 
    char *outfile_vecs, char *outfile_masks, unsigned char ***vecs1_bin_ptr, unsigned char ***vecs2_bin_ptr, 
-   unsigned char ***masks_bin_ptr, int *num_vecs_masks_ptr, int *num_rise_vecs_masks_ptr, pthread_mutex_t *GenChallenge_mutex_ptr,
-   int *num_challenge_vecpair_id_PO_ptr, VecPairPOStruct **challenge_vecpair_id_PO_ptr);
+   unsigned char ***masks_bin_ptr, int *num_vecs_masks_ptr, int *num_rise_vecs_masks_ptr, int *num_challenge_vecpair_id_PO_ptr, VecPairPOStruct **challenge_vecpair_id_PO_ptr);
 
 void GetVectorAndVecPairIndexesForBinaryVectors(int max_string_len, sqlite3 *db, int design_index, int vec_len_bytes, 
    unsigned char *first_vecs_b, unsigned char *second_vecs_b, int *first_vec_index_ptr, int *second_vec_index_ptr, 
@@ -204,5 +333,26 @@ void GetVecPairPOStructForBinaryVecsMasks(int max_string_len, sqlite3 *db, int n
    unsigned char **vecs1_bin, unsigned char **vecs2_bin, unsigned char **masks_bin, int num_vecs_masks, 
    int num_rise_vecs_masks, int *num_challenge_vecpair_id_PO_ptr, VecPairPOStruct **challenge_vecpair_id_PO_ptr);
 
-int CreateTimingValsCacheFromChallengeSet(int max_string_len, sqlite3 *db, int design_index, char *ChallengeSetName, 
-   char *PUF_instance_name_to_match, TimingValCacheStruct **TVC_ptr, int *num_TVC_ptr);
+int CreateTimingValsCacheFromChallengeSet(int max_string_len, sqlite3 *db, char *DB_filename, int design_index, char *ChallengeSetName, 
+   char *PUF_instance_name_to_match, TimingValCacheStruct *prev_TVC, TimingValCacheStruct **TVC_ptr);
+
+void LoadTimingValCacheChips(TVCLoadThreadStruct *TLT_ptr);
+void *LoadTimingValCacheThread(void *arg);
+void LoadTimingValCacheFromDB(sqlite3 *db, const char *DB_filename, TimingValCacheStruct *TVC, int *PUF_instance_ids, int first_chip_num, 
+   int num_threads);
+
+int HashTimingValCacheKey(TimingValCacheStruct *TVC, int vecpair_id, int PO_num);
+void BuildTimingValCacheIndex(TimingValCacheStruct *TVC);
+int LookupTimingValCachePath(TimingValCacheStruct *TVC, int vecpair_id, int PO_num);
+float *GetTimingValCacheChipPNs(TimingValCacheStruct *TVC, int chip_num);
+void FreeTimingValsCache(TimingValCacheStruct **TVC_ptr);
+
+void GetTimingValsCacheSnapshotName(int max_string_len, char *DB_filename, char *ChallengeSetName, char *snapshot_filename);
+void FillTimingValsCacheSnapshotHeader(TVCSnapshotHeaderStruct *header_ptr, char *DB_filename, int design_index, 
+   char *ChallengeSetName, char *PUF_instance_name_to_match);
+int SaveTimingValsCacheSnapshot(int max_string_len, TimingValCacheStruct *TVC, char *DB_filename, int design_index, 
+   char *ChallengeSetName, char *PUF_instance_name_to_match);
+TimingValCacheStruct *MapTimingValsCacheSnapshot(int max_string_len, sqlite3 *db, char *DB_filename, int design_index, 
+   char *ChallengeSetName, char *PUF_instance_name_to_match, TimingValCacheStruct **prev_TVC_ptr);
+int GetTimingValsCache(int max_string_len, sqlite3 *db, char *DB_filename, int use_snapshot, int design_index, char *ChallengeSetName, 
+   char *PUF_instance_name_to_match, TimingValCacheStruct **TVC_ptr);
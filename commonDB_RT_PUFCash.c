@@ -45,17 +45,118 @@ WHERE DesignIndex = %d AND InstanceName = %s AND Placement = %s;";
 // ZeroTrust PROTOCOL
 const char *SQL_ZeroTrustAuthenToken_insert_into_cmd = "INSERT INTO ZeroTrustAuthenToken (ChipNum, CH_LLK, n_x, Chlng_num, Status) VALUES (?, ?, ?, ?, ?);";
 const char *SQL_ZeroTrustAuthenToken_get_index_cmd = "SELECT ID FROM ZeroTrustAuthenToken WHERE CH_LLK = ?;";
+const char *SQL_ZeroTrustAuthenToken_count_unused_cmd = "SELECT COUNT(*) FROM ZeroTrustAuthenToken WHERE STATUS = 0;";
+const char *SQL_ZeroTrustAuthenToken_count_customer_unused_cmd = "SELECT COUNT(*) FROM ZeroTrustAuthenToken WHERE STATUS = 0 AND ChipNum = ?;";
+const char *SQL_ZeroTrustAuthenToken_count_unused_customers_cmd = "SELECT COUNT(DISTINCT ChipNum) FROM ZeroTrustAuthenToken WHERE STATUS = 0;";
+const char *SQL_ZeroTrustAuthenToken_read_unused_cmd = "SELECT ID, ChipNum, Chlng_num, CH_LLK, n_x FROM ZeroTrustAuthenToken WHERE STATUS = 0 ORDER BY ID;";
+const char *SQL_ZeroTrustAuthenToken_read_customer_unused_cmd = "SELECT ID, ChipNum, Chlng_num, CH_LLK, n_x FROM ZeroTrustAuthenToken \
+WHERE STATUS = 0 AND ChipNum = ? ORDER BY ID LIMIT 1;";
 
 
 // PUFCash V3.0 PROTOCOL
 const char *SQL_PUFCash_WRec_insert_into_cmd = "INSERT INTO PUFCash_WRec (AnonChipNum, LLK, eCt, heCt, num_eCt, Status) VALUES (?, ?, ?, ?, ?, ?);";
 const char *SQL_PUFCash_WRec_get_index_cmd = "SELECT ID FROM PUFCash_WRec WHERE eCt = ?;";
+const char *SQL_PUFCash_WRec_get_ids_cmd = "SELECT ID FROM PUFCash_WRec WHERE AnonChipNum = ?;";
+const char *SQL_PUFCash_WRec_read_num_eCt_cmd = "SELECT num_eCt FROM PUFCash_WRec WHERE ID = ?;";
+const char *SQL_PUFCash_WRec_read_blobs_cmd = "SELECT eCt, heCt FROM PUFCash_WRec WHERE ID = ?;";
+const char *SQL_PUFCash_WRec_delete_cmd = "DELETE FROM PUFCash_WRec WHERE ID = ?;";
+const char *SQL_PUFCash_WRec_update_cmd = "UPDATE PUFCash_WRec SET num_eCt = ?, eCt = ?, heCt = ? WHERE ID = ?;";
 
 const char *SQL_PUFCash_Account_insert_into_cmd = "INSERT INTO PUFCash_Account (ChipNum, TID, Amount) VALUES (?, ?, ?);";
 const char *SQL_PUFCash_Account_get_index_cmd = "SELECT ID FROM PUFCash_Account WHERE (ChipNum = ?);";
+const char *SQL_PUFCash_Account_get_TID_index_cmd = "SELECT ID FROM PUFCash_Account WHERE (ChipNum = ? AND TID = ?);";
+const char *SQL_PUFCash_Account_read_cmd = "SELECT ID, TID, Amount FROM PUFCash_Account WHERE ChipNum = ?;";
+const char *SQL_PUFCash_Account_update_amount_cmd = "UPDATE PUFCash_Account SET Amount = ? WHERE ID = ?;";
+const char *SQL_PUFCash_Account_debit_cmd = "UPDATE PUFCash_Account SET Amount = Amount - ? WHERE ChipNum = ? AND Amount >= ?;";
+const char *SQL_PUFCash_Account_credit_cmd = "UPDATE PUFCash_Account SET Amount = Amount + ? WHERE ChipNum = ?;";
+const char *SQL_PUFCash_Ledger_insert_into_cmd = "INSERT INTO PUFCash_Ledger (TxnID, ChipNum, Amount, Status) VALUES (?, ?, ?, ?);";
+const char *SQL_PUFCash_Ledger_read_status_cmd = "SELECT Status FROM PUFCash_Ledger WHERE ChipNum = ? AND TxnID = ?;";
 
 const char *SQL_PUFCash_LLK_insert_into_cmd = "INSERT INTO PUFCash_LLK (ChipNum, AnonChipNum, mask, Chlng, Status) VALUES (?, ?, ?, ?, ?);";
 const char *SQL_PUFCash_LLK_get_index_cmd = "SELECT ID FROM PUFCash_LLK WHERE Status = ?;";
+const char *SQL_PUFCash_LLK_delete_cmd = "DELETE FROM PUFCash_LLK WHERE Status = ?;";
+const char *SQL_PUFCash_LLK_read_ints_cmd = "SELECT ChipNum, AnonChipNum, mask FROM PUFCash_LLK WHERE ID = ?;";
+const char *SQL_PUFCash_LLK_read_Chlng_cmd = "SELECT Chlng FROM PUFCash_LLK WHERE ID = ?;";
+
+
+// Schema migrations of the runtime databases, applied by the Bank and TTP at startup (see ApplySchemaMigrations). Append new 
+// versions at the end, NEVER edit one that has shipped. Version 1 adds the covering indexes for the runtime queries above, which 
+// otherwise scan the tables (the SQLSchemaScripts only index ID).
+static SchemaMigrationStruct ZeroTrust_migrations[] = 
+   {
+   { 1, "ZeroTrustAuthenToken (STATUS, ChipNum, Chlng_num) index", 
+      "CREATE INDEX IF NOT EXISTS ZTAT_Status_index ON ZeroTrustAuthenToken (STATUS, ChipNum, Chlng_num);" }
+   };
+
+static SchemaMigrationStruct PUFCash_migrations[] = 
+   {
+   { 1, "PUFCash_Account (ChipNum, TID, Amount), PUFCash_WRec (AnonChipNum) and PUFCash_LLK (Status) indexes", 
+      "CREATE INDEX IF NOT EXISTS Account_ChipNum_index ON PUFCash_Account (ChipNum, TID, Amount); \
+CREATE INDEX IF NOT EXISTS WRec_AnonChipNum_index ON PUFCash_WRec (AnonChipNum); \
+CREATE INDEX IF NOT EXISTS LLK_Status_index ON PUFCash_LLK (Status);" },
+   { 2, "PUFCash_Ledger table of applied account transactions (see PUFCashLedgerTxn)", 
+      "CREATE TABLE IF NOT EXISTS PUFCash_Ledger (TxnID INTEGER PRIMARY KEY, ChipNum INTEGER NOT NULL, \
+Amount INTEGER NOT NULL, Status INTEGER NOT NULL);" },
+   { 3, "PUFCash_Ledger keyed by (ChipNum, TxnID), since the transaction IDs are the customers' request IDs", 
+      "CREATE TABLE PUFCash_Ledger_v3 (ChipNum INTEGER NOT NULL, TxnID INTEGER NOT NULL, Amount INTEGER NOT NULL, \
+Status INTEGER NOT NULL, PRIMARY KEY (ChipNum, TxnID)); \
+INSERT INTO PUFCash_Ledger_v3 (ChipNum, TxnID, Amount, Status) SELECT ChipNum, TxnID, Amount, Status FROM PUFCash_Ledger; \
+DROP TABLE PUFCash_Ledger; \
+ALTER TABLE PUFCash_Ledger_v3 RENAME TO PUFCash_Ledger;" }
+   };
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Bring the schema of the ZeroTrust (DB_Trust_AT) and PUF-Cash (DB_PUFCash_V3) databases up to date. Call 
+// before preparing their statements so the plans use the new indexes.
+
+int MigrateZeroTrustSchema(int max_string_len, sqlite3 *DB_Trust_AT, const char *DB_name)
+   { 
+   return ApplySchemaMigrations(max_string_len, DB_Trust_AT, DB_name, ZeroTrust_migrations, 
+      sizeof(ZeroTrust_migrations)/sizeof(SchemaMigrationStruct)); 
+   }
+
+int MigratePUFCashSchema(int max_string_len, sqlite3 *DB_PUFCash_V3, const char *DB_name)
+   { 
+   return ApplySchemaMigrations(max_string_len, DB_PUFCash_V3, DB_name, PUFCash_migrations, 
+      sizeof(PUFCash_migrations)/sizeof(SchemaMigrationStruct)); 
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Prepare the runtime statements of the ZeroTrust (DB_Trust_AT) and PUF-Cash (DB_PUFCash_V3) databases at 
+// startup, see GetSQLStmt in commonDB.c. Statements on tables a database does not have are skipped.
+
+void PrepareZeroTrustSQLStmts(sqlite3 *DB_Trust_AT)
+   {
+   const char *SQL_cmds[] = 
+      {
+      SQL_ZeroTrustAuthenToken_insert_into_cmd, SQL_ZeroTrustAuthenToken_get_index_cmd, SQL_ZeroTrustAuthenToken_count_unused_cmd, 
+      SQL_ZeroTrustAuthenToken_count_customer_unused_cmd, SQL_ZeroTrustAuthenToken_count_unused_customers_cmd, 
+      SQL_ZeroTrustAuthenToken_read_unused_cmd, SQL_ZeroTrustAuthenToken_read_customer_unused_cmd
+      };
+
+   PrepareSQLStmtCache(DB_Trust_AT, SQL_cmds, sizeof(SQL_cmds)/sizeof(const char *));
+   }
+
+void PreparePUFCashSQLStmts(sqlite3 *DB_PUFCash_V3)
+   {
+   const char *SQL_cmds[] = 
+      {
+      SQL_PUFCash_WRec_insert_into_cmd, SQL_PUFCash_WRec_get_index_cmd, SQL_PUFCash_WRec_get_ids_cmd, 
+      SQL_PUFCash_WRec_read_num_eCt_cmd, SQL_PUFCash_WRec_read_blobs_cmd, SQL_PUFCash_WRec_delete_cmd, 
+      SQL_PUFCash_WRec_update_cmd, 
+      SQL_PUFCash_Account_insert_into_cmd, SQL_PUFCash_Account_get_index_cmd, SQL_PUFCash_Account_get_TID_index_cmd, 
+      SQL_PUFCash_Account_read_cmd, SQL_PUFCash_Account_update_amount_cmd, SQL_PUFCash_Account_debit_cmd, 
+      SQL_PUFCash_Account_credit_cmd, SQL_PUFCash_Ledger_insert_into_cmd, SQL_PUFCash_Ledger_read_status_cmd, 
+      SQL_PUFCash_LLK_insert_into_cmd, SQL_PUFCash_LLK_get_index_cmd, SQL_PUFCash_LLK_delete_cmd, 
+      SQL_PUFCash_LLK_read_ints_cmd, SQL_PUFCash_LLK_read_Chlng_cmd
+      };
+
+   PrepareSQLStmtCache(DB_PUFCash_V3, SQL_cmds, sizeof(SQL_cmds)/sizeof(const char *));
+   }
 
 
 // ========================================================================================================
@@ -65,18 +166,18 @@ const char *SQL_PUFCash_LLK_get_index_cmd = "SELECT ID FROM PUFCash_LLK WHERE St
 int GetIndexFromTable_RT(int max_string_len, sqlite3 *db, char *Table, const char *SQL_cmd, unsigned char *blob, 
    int blob_size_bytes, char *text1, char *text2, char *text3, char *text4, int int1, int int2, int int3)
    {
+   SQLStmtStruct *SQLStmt_ptr;
    sqlite3_stmt *pStmt;
-   int rc, fc;
+   int rc;
    int index;
 
 #ifdef DEBUG
 printf("GetIndexFromTable(): SQL cmd %s\n", SQL_cmd); fflush(stdout);
 #endif
 
-// Prepare 'pStmt' with SQL query.
-   rc = sqlite3_prepare_v2(db, SQL_cmd, strlen(SQL_cmd) + 1, &pStmt, 0);
-   if( rc != SQLITE_OK )
-      { printf("ERROR: GetIndexFromTable(): 'sqlite3_prepare_v2' failed with %d\n", rc); exit(EXIT_FAILURE); }
+// Get the cached 'pStmt' for the SQL query (prepared once per connection).
+   SQLStmt_ptr = GetSQLStmt(db, SQL_cmd);
+   pStmt = SQLStmt_ptr->pStmt;
 
 // Bind the variables to '?' in 'SQL_cmd'.
    if ( strcmp(Table, "ListB") == 0 )
@@ -126,8 +227,7 @@ printf("GetIndexFromTable(): Table '%s', Column type %d => Integer type %d\n", T
 
    index = sqlite3_column_int64(pStmt, 0);
 
-   if ( (fc = sqlite3_finalize(pStmt)) != 0 )
-      { printf("ERROR: GetIndexFromTable(): Finalize failed %d for Table '%s'\n", fc, Table); exit(EXIT_FAILURE); }
+   ReleaseSQLStmt(SQLStmt_ptr);
 
 // Classify the return code. 'DONE' means search failed while 'ROW' means it found the item.
    if ( rc == SQLITE_DONE )
@@ -156,17 +256,17 @@ int InsertIntoTable_RT(int max_string_len, sqlite3 *db, char *Table, const char
    char *text2, char *text3, char *text4, char *text5, int int1, int int2, int int3, int int4, int int5, 
    int int6)
    {
+   SQLStmtStruct *SQLStmt_ptr;
    sqlite3_stmt *pStmt;
-   int rc, fc;
+   int rc;
 
 #ifdef DEBUG
 printf("InsertIntoTable_RT(): SQL cmd %s\n", SQL_cmd); fflush(stdout);
 #endif
 
-// Prepare 'pStmt' with SQL query.
-   rc = sqlite3_prepare_v2(db, SQL_cmd, strlen(SQL_cmd) + 1, &pStmt, 0);
-   if( rc != SQLITE_OK )
-      { printf("ERROR: InsertIntoTable_RT(): 'sqlite3_prepare_v2' failed with %d\n", rc); exit(EXIT_FAILURE); }
+// Get the cached 'pStmt' for the SQL query (prepared once per connection).
+   SQLStmt_ptr = GetSQLStmt(db, SQL_cmd);
+   pStmt = SQLStmt_ptr->pStmt;
 
 // Insert the n2 block into ListB
    if ( strcmp(Table, "ListB") == 0 )
@@ -233,8 +333,7 @@ printf("InsertIntoTable_RT(): SQL cmd %s\n", SQL_cmd); fflush(stdout);
 
    rc = sqlite3_step(pStmt);
 
-   if ( (fc = sqlite3_finalize(pStmt)) != 0 && fc != SQLITE_CONSTRAINT )
-      { printf("ERROR: InsertIntoTable_RT(): Finalize failed %d for Table '%s'\n", fc, Table); exit(EXIT_FAILURE); }
+   ReleaseSQLStmt(SQLStmt_ptr);
 
 // 'DONE' means insertion succeeded while 'CONSTRAINT' means the element already exists (only occurs if UNIQUE 
 // is set, I think).
@@ -318,6 +417,76 @@ printf("ZeroTrustAddCustomerATs(): DONE!\tAdded ZeroTrustAuthenToken record with
    }
 
 
+// ========================================================================================================
+// ZeroTrustAuthenToken
+// ========================================================================================================
+// Small open-addressing set of chip numbers used by ZeroTrustGetCustomerATs to keep one AT per customer. 
+// 'num_slots' is a power of 2 at least twice the number of keys inserted.
+
+typedef struct
+   {
+   int *keys;
+   char *used;
+   unsigned int mask;
+   } ChipNumSetStruct;
+
+static void CreateChipNumSet(ChipNumSetStruct *CNS_ptr, int max_keys)
+   {
+   unsigned int num_slots = 16;
+
+   while ( num_slots < 2*(unsigned int)max_keys )
+      num_slots <<= 1;
+   if ( (CNS_ptr->keys = (int *)malloc(num_slots*sizeof(int))) == NULL || 
+      (CNS_ptr->used = (char *)calloc(num_slots, sizeof(char))) == NULL )
+      { printf("ERROR: CreateChipNumSet(): Failed to allocate %u slots!\n", num_slots); exit(EXIT_FAILURE); }
+   CNS_ptr->mask = num_slots - 1;
+   }
+
+// Returns 1 if chip_num was added, 0 if it was already in the set.
+static int AddToChipNumSet(ChipNumSetStruct *CNS_ptr, int chip_num)
+   {
+   unsigned int slot = ((unsigned int)chip_num * 2654435761u) & CNS_ptr->mask;
+
+   while ( CNS_ptr->used[slot] == 1 )
+      {
+      if ( CNS_ptr->keys[slot] == chip_num )
+         return 0;
+      slot = (slot + 1) & CNS_ptr->mask;
+      }
+   CNS_ptr->used[slot] = 1;
+   CNS_ptr->keys[slot] = chip_num;
+   return 1;
+   }
+
+static void FreeChipNumSet(ChipNumSetStruct *CNS_ptr)
+   {
+   free(CNS_ptr->keys);
+   free(CNS_ptr->used);
+   }
+
+
+// ========================================================================================================
+// ZeroTrustAuthenToken
+// ========================================================================================================
+// Run a cached 'SELECT COUNT(...)' on the ZeroTrust table, binding 'chip_num' to the first parameter if it is
+// not -1.
+
+static int ZeroTrustCountATs(sqlite3 *DB_Trust_AT, const char *SQL_cmd, int chip_num)
+   {
+   SQLStmtStruct *SQLStmt_ptr;
+   int num_ATs = 0;
+
+   SQLStmt_ptr = GetSQLStmt(DB_Trust_AT, SQL_cmd);
+   if ( chip_num != -1 )
+      BindSQLStmtInt(SQLStmt_ptr, 1, chip_num);
+   if ( StepSQLStmt(SQLStmt_ptr, "ZeroTrustCountATs()") == SQLITE_ROW )
+      num_ATs = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+   ReleaseSQLStmt(SQLStmt_ptr);
+
+   return num_ATs;
+   }
+
+
 // ========================================================================================================
 // ZeroTrustAuthenToken
 // ========================================================================================================
@@ -326,25 +495,23 @@ printf("ZeroTrustAddCustomerATs(): DONE!\tAdded ZeroTrustAuthenToken record with
 // sends the set of ATs to Alice. The ATs are stored in the ZeroTrust table, which includes the chip_num, KEK 
 // challenge information used to generate them (Chlng_num), the ZHK_A_nonce (keyed hashed LLK key bitstring) 
 // and corresponding nonce. When Alice/TTP calls this routine, she uses it to get ATs for peers.
+//
+// The ATs are fetched set-based: the output is allocated up front from the number of distinct customers with
+// a 'NOT USED' AT, one SELECT returns every column of those ATs (oldest first), a hash set on ChipNum keeps 
+// the first AT of each customer, and the chosen ATs are marked USED by a single 'UPDATE ... WHERE ID IN (...)'.
+// The SELECT and UPDATE run in one transaction (serialized across the threads sharing the connection, see 
+// BeginSQLTransaction), so two requests can never be handed the same AT.
 
-int ZeroTrustGetCustomerATs(int max_string_len, sqlite3 *DB_Trust_AT, int **chip_num_arr_ptr, 
+int ZeroTrustGetCustomerATs(sqlite3 *DB_Trust_AT, int **chip_num_arr_ptr, 
    int **chlng_num_arr_ptr, int ZHK_A_num_bytes, unsigned char ***ZHK_A_nonce_arr_ptr, 
    unsigned char ***nonce_arr_ptr, int get_only_customer_AT, int customer_chip_num, 
    int return_customer_AT_info, int report_tot_num_ATs_only, int *num_one_customer_ATs_ptr)
    {
-   int AT_num, AT_index, chip_num, chlng_num, status, num_customers, blob_num_bytes, success;
-   SQLIntStruct AT_index_struct; 
-
-   SQLRowStringsStruct row_strings_struct;
-   char sql_command_str[max_string_len];
-   char *col1_name = "ChipNum";
-   char *col2_name = "Chlng_num";
-   char *col3_name = "STATUS";
-
-// STATUS of 0 means NOT USED.
-   char *SQL_ATs_cmd = "SELECT ID FROM ZeroTrustAuthenToken WHERE STATUS = 0;";
-   char *SQL_PT_read_ZHK_A_nonce_cmd = "SELECT CH_LLK FROM ZeroTrustAuthenToken WHERE ID = ?;";
-   char *SQL_PT_read_nonce_cmd = "SELECT n_x FROM ZeroTrustAuthenToken WHERE ID = ?;";
+   int AT_index, chip_num, num_customers, max_customers, blob_num_bytes;
+   int *AT_indexes;
+   ChipNumSetStruct chip_num_set;
+   SQLStmtStruct *SQLStmt_ptr;
+   char *zErrMsg = 0;
 
 #ifdef DEBUG
 printf("\nZeroTrustGetCustomerATs(): BEGIN\n"); fflush(stdout);
@@ -358,8 +525,7 @@ if ( get_only_customer_AT == 1 )
 // Set only when 'get_only_customer_AT' == 1 AND return_customer_AT_info == 0, otherwise it remains at 0 (INVALID).
    *num_one_customer_ATs_ptr = 0;
 
-// Make sure these are NULL since we use realloc below to add to the array. I pass NULL in for these on some calls so don't
-// try to write NULL to them in this case.
+// Make sure these are NULL. I pass NULL in for these on some calls so don't try to write NULL to them in this case.
    if ( chip_num_arr_ptr != NULL )
       *chip_num_arr_ptr = NULL;
    if ( chlng_num_arr_ptr != NULL )
@@ -370,140 +536,128 @@ if ( get_only_customer_AT == 1 )
       *nonce_arr_ptr = NULL;
 
 // ==============================================
-// First thing to do is get a list of customer ID (chip_num_arr) that are currently in the ZeroTrust table.
-   GetAllocateListOfInts(max_string_len, DB_Trust_AT, SQL_ATs_cmd, &AT_index_struct);
-
-// Sanity check. We should always have at least one AT. 
-   if ( AT_index_struct.num_ints == 0 || report_tot_num_ATs_only == 1 )
-      { 
-      if ( AT_index_struct.int_arr != NULL )
-         free(AT_index_struct.int_arr);
-      AT_index_struct.int_arr = NULL;
-
-      if ( AT_index_struct.num_ints == 0 )
+// Counting only: the total number of 'NOT USED' ATs (STATUS 0), or the number for one customer. Both are answered from the 
+// (STATUS, ChipNum, Chlng_num) index without touching the table.
+   if ( report_tot_num_ATs_only == 1 || (get_only_customer_AT == 0 && return_customer_AT_info == 0) )
+      {
+      num_customers = ZeroTrustCountATs(DB_Trust_AT, SQL_ZeroTrustAuthenToken_count_unused_cmd, -1);
+      if ( num_customers == 0 )
          { printf("ZeroTrustGetCustomerATs(): No IDs found in database!\n"); fflush(stdout); }
-      return AT_index_struct.num_ints;
+      return num_customers;
+      }
+   if ( return_customer_AT_info == 0 )
+      {
+      *num_one_customer_ATs_ptr = ZeroTrustCountATs(DB_Trust_AT, SQL_ZeroTrustAuthenToken_count_customer_unused_cmd, customer_chip_num);
+      return (*num_one_customer_ATs_ptr > 0);
       }
 
 // ==============================================
-// Loop through the 'NOT USED' AT records. 
-   num_customers = 0;
-   success = 0;
-   for ( AT_num = 0; AT_num < AT_index_struct.num_ints; AT_num++ )
-      {
+// Fetch one AT for customer_chip_num or one for every customer, and mark them USED.
+   BeginSQLTransaction(DB_Trust_AT);
 
-// Get the integer data associated with the AT table entry for the ID 
-      AT_index = AT_index_struct.int_arr[AT_num];
-      sprintf(sql_command_str, "SELECT %s, %s, %s FROM ZeroTrustAuthenToken WHERE ID = %d;", col1_name, col2_name, col3_name, AT_index);
-      GetStringsDataForRow(max_string_len, DB_Trust_AT, sql_command_str, &row_strings_struct);
-      GetRowResultInt(&row_strings_struct, "ZeroTrustGetCustomerATs()", 3, 0, col1_name, &chip_num);
-      GetRowResultInt(&row_strings_struct, "ZeroTrustGetCustomerATs()", 3, 1, col2_name, &chlng_num);
-      GetRowResultInt(&row_strings_struct, "ZeroTrustGetCustomerATs()", 3, 2, col3_name, &status);
-      FreeStringsDataForRow(&row_strings_struct);
+   if ( get_only_customer_AT == 1 )
+      max_customers = 1;
+   else
+      max_customers = ZeroTrustCountATs(DB_Trust_AT, SQL_ZeroTrustAuthenToken_count_unused_customers_cmd, -1);
 
-#ifdef DEBUG
-printf("\tZeroTrustGetCustomerATs(): Fetched ZeroTrust AT with chip_num %d\tchlng_num %d\tstatus %d!\n", chip_num, chlng_num, status); fflush(stdout);
-#endif
+   if ( max_customers == 0 )
+      {
+      CommitSQLTransaction(DB_Trust_AT);
+      printf("ZeroTrustGetCustomerATs(): No IDs found in database!\n"); fflush(stdout);
+      return 0;
+      }
 
-// If status is not 'NOT USED' (0), then this is an error since the query specifies 'NOT USED' only.
-      if ( status != 0 )
-         { printf("ERROR: ZeroTrustGetCustomerATs(): Query was ONLY supposed to fetch ATs that are 'NOT USED'!\n"); exit(EXIT_FAILURE); }
+// Preallocate the output for every customer that has an AT. NOTE: THESE ARRAY pointers are NOT NULL when return_customer_AT_info is 1.
+   *chip_num_arr_ptr = (int *)malloc(max_customers*sizeof(int));
+   *chlng_num_arr_ptr = (int *)malloc(max_customers*sizeof(int));
+   *ZHK_A_nonce_arr_ptr = (unsigned char **)malloc(max_customers*sizeof(unsigned char *));
+   *nonce_arr_ptr = (unsigned char **)malloc(max_customers*sizeof(unsigned char *));
+   AT_indexes = (int *)malloc(max_customers*sizeof(int));
+   if ( *chip_num_arr_ptr == NULL || *chlng_num_arr_ptr == NULL || *ZHK_A_nonce_arr_ptr == NULL || *nonce_arr_ptr == NULL || AT_indexes == NULL )
+      { printf("ERROR: ZeroTrustGetCustomerATs(): Failed to allocate output for %d customers!\n", max_customers); exit(EXIT_FAILURE); }
+   CreateChipNumSet(&chip_num_set, max_customers);
+
+// One pass over the 'NOT USED' ATs, oldest first. The blobs of ATs skipped as duplicates are never copied.
+   if ( get_only_customer_AT == 1 )
+      {
+      SQLStmt_ptr = GetSQLStmt(DB_Trust_AT, SQL_ZeroTrustAuthenToken_read_customer_unused_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, customer_chip_num);
+      }
+   else
+      SQLStmt_ptr = GetSQLStmt(DB_Trust_AT, SQL_ZeroTrustAuthenToken_read_unused_cmd);
 
-// If Alice calls this routine to get a customer AT given by customer_chip_num, and the current chip_num is for a different customer,
-// skip this AT.
-      if ( get_only_customer_AT == 1 && customer_chip_num != chip_num )
-         continue;
- 
-// Check if we already have an AT for this customer. If so, skip it. NOTE: chip_num_arr_ptr MAY BE NULL on some calls. We ensure in this routine 
-// that num_customers is ALWAYS 0 if get_only_customer_AT == 1 (b/c we only iterate once -- see below) but protecting this here just in case.
-// ALSO, when we want the NUMBER of ATs for a customer (get_only_customer_AT == 1 && return_customer_AT_info == 0), we loop multiple times here
-// BUT WE DO NOT increment num_customers, so we actually count the number of ATs available for ONE customer when these conditions are met.
-      int i;
-      for ( i = 0; i < num_customers; i++ )
-         if ( chip_num_arr_ptr != NULL && chip_num == (*chip_num_arr_ptr)[i] )
-            break;
-      if ( i < num_customers )
+   num_customers = 0;
+   while ( num_customers < max_customers && StepSQLStmt(SQLStmt_ptr, "ZeroTrustGetCustomerATs()") == SQLITE_ROW )
+      {
+      AT_index = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+      chip_num = sqlite3_column_int(SQLStmt_ptr->pStmt, 1);
+
+// Check if we already have an AT for this customer. If so, skip it.
+      if ( AddToChipNumSet(&chip_num_set, chip_num) == 0 )
          continue;
 
 #ifdef DEBUG
-printf("\t\tZeroTrustGetCustomerATs(): VALID AT with chip_num %d\tchlng_num %d\tstatus %d!\n", chip_num, chlng_num, status); fflush(stdout);
+printf("\t\tZeroTrustGetCustomerATs(): VALID AT with ID %d\tchip_num %d!\n", AT_index, chip_num); fflush(stdout);
 #endif
 
-// Allocate storage for the AT and assign chip_num and chlng_num components of the AT if the calls requests it. NOTE: THESE ARRAY pointers
-// may be NULL on some calls to this routine.
-      if ( return_customer_AT_info == 1 )
-         {
-         if ( (*chip_num_arr_ptr = (int *)realloc(*chip_num_arr_ptr, (num_customers + 1)*sizeof(int))) == NULL )
-            { printf("ERROR: ZeroTrustGetCustomerATs(): Failed to realloc *chip_num_arr_ptr!\n"); exit(EXIT_FAILURE); }
-         (*chip_num_arr_ptr)[num_customers] = chip_num;
-         if ( (*chlng_num_arr_ptr = (int *)realloc(*chlng_num_arr_ptr, (num_customers + 1)*sizeof(int))) == NULL )
-            { printf("ERROR: ZeroTrustGetCustomerATs(): Failed to realloc *chlng_num_arr_ptr!\n"); exit(EXIT_FAILURE); }
-         (*chlng_num_arr_ptr)[num_customers] = chlng_num;
-
-// Get the ZHK_A_nonce and n_x components.
-
-// ReadBinaryBlob will assign to pre-allocated space in the 4th arg, checking that the value read from the DB matches the number of
-// bytes given by the 5th arg, if the 6th arg is 0. Otherwise if 6th arg is 1, it allocates space, fills it in with DB data and assigns 
-// a pointer to that space to the last arg.
-         if ( (*ZHK_A_nonce_arr_ptr = (unsigned char **)realloc(*ZHK_A_nonce_arr_ptr, (num_customers + 1)*sizeof(unsigned char *))) == NULL )
-            { printf("ERROR: ZeroTrustGetCustomerATs(): Failed to realloc *ZHK_A_nonce_arr_ptr!\n"); exit(EXIT_FAILURE); }
-         blob_num_bytes = ReadBinaryBlob(DB_Trust_AT, SQL_PT_read_ZHK_A_nonce_cmd, AT_index, NULL, 0, 1, &((*ZHK_A_nonce_arr_ptr)[num_customers]));
+      AT_indexes[num_customers] = AT_index;
+      (*chip_num_arr_ptr)[num_customers] = chip_num;
+      (*chlng_num_arr_ptr)[num_customers] = sqlite3_column_int(SQLStmt_ptr->pStmt, 2);
+
+// Get the ZHK_A_nonce and n_x components. GetSQLStmtColumnBlob allocates space, fills it in with DB data and assigns a pointer to 
+// that space to the last arg.
+      blob_num_bytes = GetSQLStmtColumnBlob(SQLStmt_ptr, 3, &((*ZHK_A_nonce_arr_ptr)[num_customers]));
 
 // Sanity check
-         if ( ZHK_A_num_bytes != blob_num_bytes )
-            { 
-            printf("ERROR: ZeroTrustGetCustomerATs(): Number of bytes read from DB for ZHK_A_nonce_arr %d not equal to %d!\n", 
-               ZHK_A_num_bytes, blob_num_bytes); exit(EXIT_FAILURE); 
-            }
+      if ( ZHK_A_num_bytes != blob_num_bytes )
+         { 
+         printf("ERROR: ZeroTrustGetCustomerATs(): Number of bytes read from DB for ZHK_A_nonce_arr %d not equal to %d!\n", 
+            ZHK_A_num_bytes, blob_num_bytes); exit(EXIT_FAILURE); 
+         }
 
-         if ( (*nonce_arr_ptr = (unsigned char **)realloc(*nonce_arr_ptr, (num_customers + 1)*sizeof(unsigned char *))) == NULL )
-            { printf("ERROR: ZeroTrustGetCustomerATs(): Failed to realloc *nonce_arr_ptr!\n"); exit(EXIT_FAILURE); }
-         blob_num_bytes = ReadBinaryBlob(DB_Trust_AT, SQL_PT_read_nonce_cmd, AT_index, NULL, 0, 1, &((*nonce_arr_ptr)[num_customers]));
+      blob_num_bytes = GetSQLStmtColumnBlob(SQLStmt_ptr, 4, &((*nonce_arr_ptr)[num_customers]));
 
 // Sanity check (n_x MUST be the same size as CH_LLK).
-         if ( ZHK_A_num_bytes != blob_num_bytes )
-            { 
-            printf("ERROR: ZeroTrustGetCustomerATs(): Number of bytes read from DB for nonce_arr %d not equal to %d!\n", 
-               ZHK_A_num_bytes, blob_num_bytes); exit(EXIT_FAILURE); 
-            }
-
-// Mark the status of the AT as USED, but ONLY IF WE ACTUALLY FETCHED the data and returned it in this call.
-         char *zErrMsg = 0;
-         int fc;
-         sprintf(sql_command_str, "UPDATE ZeroTrustAuthenToken SET status = 1 WHERE ID = %d;", AT_index);
-         fc = sqlite3_exec(DB_Trust_AT, sql_command_str, NULL, 0, &zErrMsg);
-         if ( fc != SQLITE_OK )
-            { printf("SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+      if ( ZHK_A_num_bytes != blob_num_bytes )
+         { 
+         printf("ERROR: ZeroTrustGetCustomerATs(): Number of bytes read from DB for nonce_arr %d not equal to %d!\n", 
+            ZHK_A_num_bytes, blob_num_bytes); exit(EXIT_FAILURE); 
          }
 
+      num_customers++;
+      }
+   ReleaseSQLStmt(SQLStmt_ptr);
+   FreeChipNumSet(&chip_num_set);
 
-// If Alice calls this routine to check or get a customer AT given by customer_chip_num, then break out of the loop because we found one if 
-// we get here. But only break out if we are ALSO fetching an AT for this customer. If we are NOT fetching an AT, then keep counting
-// the number of ATs associated with this customer. When we want the NUMBER of ATs for a customer (get_only_customer_AT == 1 && 
-// return_customer_AT_info == 0), we loop multiple times here BUT WE DO NOT increment num_customers, so we actually count the number of 
-// ATs available for ONE customer when these conditions are met.
-      success = 1;
-      if ( get_only_customer_AT == 1 )
-         {
-         if ( return_customer_AT_info == 1 )
-            break;
-         else
-            (*num_one_customer_ATs_ptr)++;
-         }
-
-// If we are counting the number of valid ATs in the database for ALL customers, increment num_customers.
-      else
-         num_customers++;
+// Mark the status of the ATs as USED, but ONLY THOSE WE ACTUALLY FETCHED and return in this call, with one UPDATE. The ID list 
+// varies with every call so this statement is not cached.
+   if ( num_customers > 0 )
+      {
+      char *update_command_str, *str_ptr;
+      int customer_num;
+
+      Allocate1DString(&update_command_str, 12*num_customers + 100);
+      str_ptr = update_command_str + sprintf(update_command_str, "UPDATE ZeroTrustAuthenToken SET STATUS = 1 WHERE ID IN (");
+      for ( customer_num = 0; customer_num < num_customers; customer_num++ )
+         str_ptr += sprintf(str_ptr, "%s%d", (customer_num == 0) ? "" : ",", AT_indexes[customer_num]);
+      strcpy(str_ptr, ");");
+
+      if ( sqlite3_exec(DB_Trust_AT, update_command_str, NULL, 0, &zErrMsg) != SQLITE_OK )
+         { printf("ERROR: ZeroTrustGetCustomerATs(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+      free(update_command_str);
       }
 
-// See above, we do NOT increment num_customers in the above loop because we want to count ALL ATs available for ONE customer when
-// get_only_customer_AT == 1 AND return_customer_AT_info == 0.
-   if ( success == 1 && get_only_customer_AT == 1 )
-      num_customers = 1;
+// Customer had no AT. Nothing to hand back.
+   else
+      {
+      free(*chip_num_arr_ptr); *chip_num_arr_ptr = NULL;
+      free(*chlng_num_arr_ptr); *chlng_num_arr_ptr = NULL;
+      free(*ZHK_A_nonce_arr_ptr); *ZHK_A_nonce_arr_ptr = NULL;
+      free(*nonce_arr_ptr); *nonce_arr_ptr = NULL;
+      }
+   free(AT_indexes);
 
-   if ( AT_index_struct.int_arr != NULL )
-      free(AT_index_struct.int_arr);
-   AT_index_struct.int_arr = NULL;
+   CommitSQLTransaction(DB_Trust_AT);
 
 #ifdef DEBUG
 printf("\nZeroTrustGetCustomerATs(): DONE!\n"); fflush(stdout);
@@ -567,14 +721,11 @@ printf("PUFCashAdd_WRec_Data(): DONE: Added WRec index %d\tnum_eCt %d\teCt_tot_b
 // for the database records, or she gets the eCt, heCt blobs that are associated with a particular WRec. 
 // NOTE: Updates to the withdrawal records are NOT done here -- see below.
 
-int PUFCashGet_WRec_Data(int max_string_len, sqlite3 *DB_PUFCash_V3, int AnonChipNum, 
+int PUFCashGet_WRec_Data(sqlite3 *DB_PUFCash_V3, int AnonChipNum, 
    int get_ids_or_eCt_blobs, int **WRec_ids_ptr, int WRec_id, unsigned char **eCt_buffer_ptr, 
    unsigned char **heCt_buffer_ptr, int *num_eCt_ptr)
    {
-   SQLRowStringsStruct row_strings_struct;
-   char sql_command_str[max_string_len];
-   char *col1_name = "num_eCt";
-
+   SQLStmtStruct *SQLStmt_ptr;
    SQLIntStruct ID_index_struct; 
 
    int eCt_tot_bytes, heCt_tot_bytes;
@@ -588,8 +739,10 @@ printf("PUFCashGet_WRec_Data(): CALLED!\n"); fflush(stdout);
 // Get a list of the database IDs of Alice withdrawals that are non-zero.
    if ( get_ids_or_eCt_blobs == 0 )
       {
-      sprintf(sql_command_str, "SELECT ID FROM PUFCash_WRec WHERE (AnonChipNum = %d);", AnonChipNum);
-      GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &ID_index_struct);
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_get_ids_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, AnonChipNum);
+      GetSQLStmtListOfInts(SQLStmt_ptr, "PUFCashGet_WRec_Data()", &ID_index_struct);
+      ReleaseSQLStmt(SQLStmt_ptr);
 
       if ( ID_index_struct.num_ints == 0 )
          { 
@@ -607,40 +760,29 @@ printf("PUFCashGet_WRec_Data(): CALLED!\n"); fflush(stdout);
 // Else get num_eCt or the eCt/heCt blobs
    int ret_val = 0;
 
-   sprintf(sql_command_str, "SELECT ID FROM PUFCash_WRec WHERE (id = %d);", WRec_id);
-   GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &ID_index_struct);
-
-   if ( ID_index_struct.num_ints != 1 )
-      { 
-      printf("ERROR: PUFCashGet_WRec_Data(): WRec_id %d MUST have ONLY ONE DB record -- FOUND %d!\n", 
-         WRec_id, ID_index_struct.num_ints); exit(EXIT_FAILURE); 
-      }
-
-// Get the index of Alice's withdrawal packet. 
-   withdraw_index = ID_index_struct.int_arr[0];
-
-   if ( ID_index_struct.int_arr != NULL )
-      free(ID_index_struct.int_arr);
-   ID_index_struct.int_arr = NULL;
-
-// Get the num_eCt associated with one of the WRec ids returned above in the first call.
-   sprintf(sql_command_str, "SELECT %s FROM PUFCash_WRec WHERE ID = %d;", col1_name, withdraw_index);
-   GetStringsDataForRow(max_string_len, DB_PUFCash_V3, sql_command_str, &row_strings_struct);
-   GetRowResultInt(&row_strings_struct, "PUFCashGet_WRec_Data()", 1, 0, col1_name, num_eCt_ptr);
-   FreeStringsDataForRow(&row_strings_struct);
+// Get the num_eCt associated with one of the WRec ids returned above in the first call. ID is the primary key so there is at most 
+// one row.
+   withdraw_index = WRec_id;
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_read_num_eCt_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, withdraw_index);
+   if ( StepSQLStmt(SQLStmt_ptr, "PUFCashGet_WRec_Data()") != SQLITE_ROW )
+      { printf("ERROR: PUFCashGet_WRec_Data(): WRec_id %d MUST have ONLY ONE DB record -- FOUND 0!\n", WRec_id); exit(EXIT_FAILURE); }
+   *num_eCt_ptr = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+   ReleaseSQLStmt(SQLStmt_ptr);
    ret_val = 1;
 
 // Also get the eCt and heCt blobs if requested.
    if ( get_ids_or_eCt_blobs == 2 )
       {
 
-// Fetch eCt and heCt. Allocate storage. 
-      char *SQL_get_Alice_eCt = "SELECT eCt FROM PUFCash_WRec WHERE ID = ?;";
-      int allocate_storage = 1;
-      eCt_tot_bytes = ReadBinaryBlob(DB_PUFCash_V3, SQL_get_Alice_eCt, withdraw_index, NULL, -1, allocate_storage, eCt_buffer_ptr);
-
-      char *SQL_get_Alice_heCt = "SELECT heCt FROM PUFCash_WRec WHERE ID = ?;";
-      heCt_tot_bytes = ReadBinaryBlob(DB_PUFCash_V3, SQL_get_Alice_heCt, withdraw_index, NULL, -1, allocate_storage, heCt_buffer_ptr);
+// Fetch eCt and heCt from the one row. Allocate storage. 
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_read_blobs_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, withdraw_index);
+      if ( StepSQLStmt(SQLStmt_ptr, "PUFCashGet_WRec_Data()") != SQLITE_ROW )
+         { printf("ERROR: PUFCashGet_WRec_Data(): WRec_id %d NOT FOUND reading eCt/heCt!\n", WRec_id); exit(EXIT_FAILURE); }
+      eCt_tot_bytes = GetSQLStmtColumnBlob(SQLStmt_ptr, 0, eCt_buffer_ptr);
+      heCt_tot_bytes = GetSQLStmtColumnBlob(SQLStmt_ptr, 1, heCt_buffer_ptr);
+      ReleaseSQLStmt(SQLStmt_ptr);
 
       if ( eCt_tot_bytes != heCt_tot_bytes )
          { 
@@ -667,107 +809,183 @@ printf("PUFCashGet_WRec_Data(): DONE\tNumber of eCt %d\n", *num_eCt_ptr); fflush
 // PUFCash_WRec
 // ========================================================================================================
 // Alice/Bob: updates a withdrawal record, identified as WRec. The update will be to delete the record WRec if 
-// the eCt_tot_bytes is 0.
+// the num_eCt is 0. The eCt and heCt are bound as BLOB parameters on the cached UPDATE, and the existence 
+// check and the update/delete run in one transaction.
 
-int PUFCashUpdate_WRec_Data(int max_string_len, sqlite3 *DB_PUFCash_V3, int WRec_id, unsigned char *eCt_buffer,
+int PUFCashUpdate_WRec_Data(sqlite3 *DB_PUFCash_V3, int WRec_id, unsigned char *eCt_buffer,
    unsigned char *heCt_buffer, int eCt_tot_bytes, int num_eCt)
    {
-   char sql_command_str[max_string_len];
-   SQLIntStruct ID_index_struct; 
-   char *zErrMsg = 0;
-   int fc;
+   SQLStmtStruct *SQLStmt_ptr;
 
-   int WRec_num;
+   int WRec_found;
 
 printf("PUFCashUpdate_WRec_Data(): CALLED!\n"); fflush(stdout);
 #ifdef DEBUG
 #endif
 
-// Sanity check. Check for the existance of the record.
-   sprintf(sql_command_str, "SELECT ID FROM PUFCash_WRec;");
-   GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &ID_index_struct);
+   BeginSQLTransaction(DB_PUFCash_V3);
 
-   if ( ID_index_struct.num_ints == 0 )
-      { printf("ERROR: PUFCashUpdate_WRec_Data(): Did NOT find any eCt records in the PUFCash_WRec DB!\n"); exit(EXIT_FAILURE); }
+// Sanity check. Check for the existance of the record specified as a parameter. ERROR if the WRec_id is NOT found.
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_read_num_eCt_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, WRec_id);
+   WRec_found = (StepSQLStmt(SQLStmt_ptr, "PUFCashUpdate_WRec_Data()") == SQLITE_ROW);
+   ReleaseSQLStmt(SQLStmt_ptr);
 
-// Find the record specified as a parameter.
-   for ( WRec_num = 0; WRec_num < ID_index_struct.num_ints; WRec_num++ )
-      if ( ID_index_struct.int_arr[WRec_num] == WRec_id )
-         break;
-
-// ERROR if the WRec_id is NOT found.
-   if ( WRec_num == ID_index_struct.num_ints )
+   if ( WRec_found == 0 )
       { printf("ERROR: PUFCashUpdate_WRec_Data(): Failed to find WRec_id %d in PUFCash_WRec DB!\n", WRec_id); exit(EXIT_FAILURE); }
 
 // If no eCt remain, delete the WRec.
    if ( num_eCt == 0 )
       {
-      sprintf(sql_command_str, "DELETE FROM PUFCash_WRec WHERE ID = %d;", WRec_id);
-      fc = sqlite3_exec(DB_PUFCash_V3, sql_command_str, NULL, 0, &zErrMsg);
-      if ( fc != SQLITE_OK )
-         { printf("PUFCashUpdate_WRec_Data(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_delete_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, WRec_id);
+      StepSQLStmt(SQLStmt_ptr, "PUFCashUpdate_WRec_Data()");
+      ReleaseSQLStmt(SQLStmt_ptr);
       }
    else
       {
-      char *eCt_hex = NULL, *heCt_hex = NULL, hex_byte[3];
-      char *long_command_str = NULL;
+      if ( eCt_tot_bytes <= 0 )
+         { printf("ERROR: PUFCashUpdate_WRec_Data(): Expected eCt_tot_bytes > 0 when num_eCt %d > 0!\n", num_eCt); exit(EXIT_FAILURE); }
+
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_update_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, num_eCt);
+      BindSQLStmtBlob(SQLStmt_ptr, 2, eCt_buffer, eCt_tot_bytes);
+      BindSQLStmtBlob(SQLStmt_ptr, 3, heCt_buffer, eCt_tot_bytes);
+      BindSQLStmtInt(SQLStmt_ptr, 4, WRec_id);
+      StepSQLStmt(SQLStmt_ptr, "PUFCashUpdate_WRec_Data()");
+      ReleaseSQLStmt(SQLStmt_ptr);
+      }
+
+   CommitSQLTransaction(DB_PUFCash_V3);
 
+printf("PUFCashUpdate_WRec_Data(): DONE!\n"); fflush(stdout);
 #ifdef DEBUG
-printf("PUFCashUpdate_WRec_Data(): Allocating 2X storage + 1 bytes %d for HEX strings\n", 2*eCt_tot_bytes+1); fflush(stdout);
 #endif
 
-      Allocate1DString((char **)(&eCt_hex), 2*eCt_tot_bytes+1);
-      Allocate1DString((char **)(&heCt_hex), 2*eCt_tot_bytes+1);
-      Allocate1DString((char **)(&long_command_str), 4*eCt_tot_bytes+200);
+   return 1;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Alice/Bob: appends one or more eCt/heCt (eCt_num_bytes each for eCt and heCt) to an existing WRec and adds 
+// num_eCt_added to its num_eCt. The read of the current blobs and the update are done in one transaction so 
+// a concurrent update of the same WRec can not be lost. The blobs are concatenated here rather than with SQL 
+// '||', which yields TEXT. Returns the new num_eCt.
 
+int PUFCashAppend_WRec_Data(sqlite3 *DB_PUFCash_V3, int WRec_id, unsigned char *eCt_buffer,
+   unsigned char *heCt_buffer, int eCt_num_bytes, int num_eCt_added)
+   {
+   unsigned char *old_eCt = NULL, *old_heCt = NULL, *new_eCt, *new_heCt;
+   int old_eCt_bytes, old_heCt_bytes, num_eCt;
+   SQLStmtStruct *SQLStmt_ptr;
+
+printf("PUFCashAppend_WRec_Data(): CALLED: WRec_id %d\tnum_eCt_added %d\n", WRec_id, num_eCt_added); fflush(stdout);
 #ifdef DEBUG
-printf("PUFCashUpdate_WRec_Data(): Converting eCt/heCt buffers to HEX strings\n"); fflush(stdout);
 #endif
 
-// Make it a zero-length string so we can use strcat below.
-      eCt_hex[0] = '\0';
-      heCt_hex[0] = '\0';
-      hex_byte[2] = '\0';
-      int i;
-      for ( i = 0; i < eCt_tot_bytes; i++ )
-         {
+   if ( eCt_num_bytes <= 0 || num_eCt_added <= 0 )
+      { printf("ERROR: PUFCashAppend_WRec_Data(): Expected eCt_num_bytes > 0 and num_eCt_added > 0!\n"); exit(EXIT_FAILURE); }
 
-// Print each byte as a 2 hex char string.
-         sprintf(hex_byte, "%02X", eCt_buffer[i]);
-         strcat(eCt_hex, hex_byte);
-         sprintf(hex_byte, "%02X", heCt_buffer[i]);
-         strcat(heCt_hex, hex_byte);
-         }
+   BeginSQLTransaction(DB_PUFCash_V3);
+
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_read_num_eCt_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, WRec_id);
+   if ( StepSQLStmt(SQLStmt_ptr, "PUFCashAppend_WRec_Data()") != SQLITE_ROW )
+      { printf("ERROR: PUFCashAppend_WRec_Data(): Failed to find WRec_id %d in PUFCash_WRec DB!\n", WRec_id); exit(EXIT_FAILURE); }
+   num_eCt = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+   ReleaseSQLStmt(SQLStmt_ptr);
+
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_read_blobs_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, WRec_id);
+   if ( StepSQLStmt(SQLStmt_ptr, "PUFCashAppend_WRec_Data()") != SQLITE_ROW )
+      { printf("ERROR: PUFCashAppend_WRec_Data(): WRec_id %d NOT FOUND reading eCt/heCt!\n", WRec_id); exit(EXIT_FAILURE); }
+   old_eCt_bytes = GetSQLStmtColumnBlob(SQLStmt_ptr, 0, &old_eCt);
+   old_heCt_bytes = GetSQLStmtColumnBlob(SQLStmt_ptr, 1, &old_heCt);
+   ReleaseSQLStmt(SQLStmt_ptr);
+
+   if ( old_eCt_bytes != old_heCt_bytes )
+      { 
+      printf("ERROR: PUFCashAppend_WRec_Data(): WRec_id %d: number of bytes for eCt %d and heCt %d MUST BE the same!\n", 
+         WRec_id, old_eCt_bytes, old_heCt_bytes); exit(EXIT_FAILURE); 
+      }
 
-// NULL terminate so we can treat this as a NULL-terminated string below.
-      eCt_hex[2*eCt_tot_bytes] = '\0';
-      heCt_hex[2*eCt_tot_bytes] = '\0';
+   if ( (new_eCt = (unsigned char *)malloc(old_eCt_bytes + eCt_num_bytes)) == NULL ||
+      (new_heCt = (unsigned char *)malloc(old_eCt_bytes + eCt_num_bytes)) == NULL )
+      { printf("ERROR: PUFCashAppend_WRec_Data(): Failed to allocate %d bytes!\n", old_eCt_bytes + eCt_num_bytes); exit(EXIT_FAILURE); }
 
+   if ( old_eCt_bytes > 0 )
+      {
+      memcpy(new_eCt, old_eCt, old_eCt_bytes);
+      memcpy(new_heCt, old_heCt, old_eCt_bytes);
+      }
+   memcpy(new_eCt + old_eCt_bytes, eCt_buffer, eCt_num_bytes);
+   memcpy(new_heCt + old_eCt_bytes, heCt_buffer, eCt_num_bytes);
+   num_eCt += num_eCt_added;
+
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_WRec_update_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, num_eCt);
+   BindSQLStmtBlob(SQLStmt_ptr, 2, new_eCt, old_eCt_bytes + eCt_num_bytes);
+   BindSQLStmtBlob(SQLStmt_ptr, 3, new_heCt, old_eCt_bytes + eCt_num_bytes);
+   BindSQLStmtInt(SQLStmt_ptr, 4, WRec_id);
+   StepSQLStmt(SQLStmt_ptr, "PUFCashAppend_WRec_Data()");
+   ReleaseSQLStmt(SQLStmt_ptr);
+
+   CommitSQLTransaction(DB_PUFCash_V3);
+
+   if ( old_eCt != NULL )
+      free(old_eCt);
+   if ( old_heCt != NULL )
+      free(old_heCt);
+   free(new_eCt);
+   free(new_heCt);
+
+printf("PUFCashAppend_WRec_Data(): DONE: WRec_id %d now has num_eCt %d\n", WRec_id, num_eCt); fflush(stdout);
 #ifdef DEBUG
-printf("PUFCashUpdate_WRec_Data(): eCt_buffer as hex string '%s'\n", eCt_hex); fflush(stdout);
-printf("PUFCashUpdate_WRec_Data(): heCt_buffer as hex string '%s'\n", heCt_hex); fflush(stdout);
 #endif
 
-      sprintf(long_command_str, "UPDATE PUFCash_WRec SET num_eCt = %d, eCt = X'%s', heCt = X'%s' WHERE ID = %d;", 
-         num_eCt, eCt_hex, heCt_hex, WRec_id);
+   return num_eCt;
+   }
 
-      fc = sqlite3_exec(DB_PUFCash_V3, long_command_str, NULL, 0, &zErrMsg);
-      if ( fc != SQLITE_OK )
-         { printf("SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
 
-      if ( eCt_hex != NULL )
-         free(eCt_hex); 
-      if ( heCt_hex != NULL )
-         free(heCt_hex); 
-      if ( long_command_str != NULL )
-         free(long_command_str); 
+// ========================================================================================================
+// ========================================================================================================
+// Alice/Bob: adds num_WRecs withdrawal records in one transaction, so the journal is synced once for the batch 
+// rather than once per record. The per-record arguments are the same as PUFCashAdd_WRec_Data. Returns the 
+// number of records actually inserted (records whose eCt already exists are skipped).
+
+int PUFCashAddBatch_WRec_Data(int max_string_len, sqlite3 *DB_PUFCash_V3, int num_WRecs, int *AnonChipNums, 
+   unsigned char **LLKs, int LLK_num_bytes, unsigned char **eCt_buffers, unsigned char **heCt_buffers, 
+   int *eCt_tot_bytes, int *num_eCts)
+   {
+   int WRec_num, num_inserted;
+
+printf("PUFCashAddBatch_WRec_Data(): BEGIN: %d WRecs!\n", num_WRecs); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   BeginSQLTransaction(DB_PUFCash_V3);
+
+   num_inserted = 0;
+   for ( WRec_num = 0; WRec_num < num_WRecs; WRec_num++ )
+      {
+      if ( eCt_tot_bytes[WRec_num] <= 0 )
+         { printf("ERROR: PUFCashAddBatch_WRec_Data(): Expected eCt_tot_bytes > 0 for WRec %d!\n", WRec_num); exit(EXIT_FAILURE); }
+
+// Set status to NOT used (0) 
+      num_inserted += InsertIntoTable_RT(max_string_len, DB_PUFCash_V3, "PUFCash_WRec", SQL_PUFCash_WRec_insert_into_cmd, 
+         LLKs[WRec_num], LLK_num_bytes, eCt_buffers[WRec_num], eCt_tot_bytes[WRec_num], heCt_buffers[WRec_num], 
+         eCt_tot_bytes[WRec_num], NULL, 0, NULL, 0, NULL, NULL, NULL, NULL, NULL, AnonChipNums[WRec_num], 
+         num_eCts[WRec_num], 0, -1, -1, -1);
       }
 
-printf("PUFCashUpdate_WRec_Data(): DONE!\n"); fflush(stdout);
+   CommitSQLTransaction(DB_PUFCash_V3);
+
+printf("PUFCashAddBatch_WRec_Data(): DONE: Added %d of %d WRecs\n", num_inserted, num_WRecs); fflush(stdout);
 #ifdef DEBUG
 #endif
 
-   return 1;
+   return num_inserted;
    }
 
 
@@ -780,8 +998,8 @@ printf("PUFCashUpdate_WRec_Data(): DONE!\n"); fflush(stdout);
 int PUFCashAddAcctRec(int max_string_len, sqlite3 *DB_PUFCash_V3, int Alice_chip_num, int TID, 
    int num_eCt, int min_withdraw_increment)
    {
+   SQLStmtStruct *SQLStmt_ptr;
    SQLIntStruct ID_index_struct; 
-   char sql_command_str[max_string_len];
 
    int acct_ID;
 
@@ -800,8 +1018,11 @@ printf("PUFCashAddAcctRec(): CALLED!\n"); fflush(stdout);
       }
 
 // Get the index of the relevant element. Right now, we assume Alice has only one entry.
-   sprintf(sql_command_str, "SELECT ID FROM PUFCash_Account WHERE (ChipNum = %d AND TID = %d);", Alice_chip_num, TID);
-   GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &ID_index_struct);
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Account_get_TID_index_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, Alice_chip_num);
+   BindSQLStmtInt(SQLStmt_ptr, 2, TID);
+   GetSQLStmtListOfInts(SQLStmt_ptr, "PUFCashAddAcctRec()", &ID_index_struct);
+   ReleaseSQLStmt(SQLStmt_ptr);
 
    if ( ID_index_struct.int_arr != NULL )
       free(ID_index_struct.int_arr);
@@ -846,18 +1067,11 @@ printf("PUFCashAddAcctRec(): DONE: Added Alice's Account record with Alice_chip_
 // TTP: Get and/or update an account record from the PUFCash_V3 Account Table for Alice, using her Alice_chip_num.
 // Assume there is only one transaction ID (TID) record in the DB at this point.
 
-int PUFCashGetAcctRec(int max_string_len, sqlite3 *DB_PUFCash_V3, int Alice_chip_num, int *TID_ptr, 
+int PUFCashGetAcctRec(sqlite3 *DB_PUFCash_V3, int Alice_chip_num, int *TID_ptr, 
    int *num_eCt_ptr, int do_update, int update_amt)
    {
-   SQLIntStruct ID_index_struct; 
-
-   SQLRowStringsStruct row_strings_struct;
-   char sql_command_str[max_string_len];
-   char *col1_name = "TID";
-   char *col2_name = "Amount";
-
-   char *zErrMsg = 0;
-   int fc;
+   SQLStmtStruct *SQLStmt_ptr;
+   int num_rows;
 
    int Acct_index;
 
@@ -865,27 +1079,26 @@ printf("PUFCashGetAcctRec(): BEGIN for Alice_chip_num %d\n", Alice_chip_num); ff
 #ifdef DEBUG
 #endif
 
-// Get the index of the relevant element. Right now, we assume Alice has only one entry.
-//   sprintf(sql_command_str, "SELECT ID FROM PUFCash_Account WHERE (DeviceID = %d AND TID = %d);", Alice_chip_num, *TID_ptr);
-   sprintf(sql_command_str, "SELECT ID FROM PUFCash_Account WHERE ChipNum = %d;", Alice_chip_num);
-   GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &ID_index_struct);
-
-   if ( ID_index_struct.num_ints != 1 )
-      { printf("ERROR: PUFCashGetAcctRec(): Only 1 entry is allowed for Alice -- FOUND %d!\n", ID_index_struct.num_ints); exit(EXIT_FAILURE); }
-
-// Get the index of Alice's withdrawal packet. 
-   Acct_index = ID_index_struct.int_arr[0];
-
-   if ( ID_index_struct.int_arr != NULL )
-      free(ID_index_struct.int_arr);
-   ID_index_struct.int_arr = NULL;
+// Get the index, TID and num_eCt (Amount) of the relevant element. Right now, we assume Alice has only one entry so we count the
+// rows and keep the first.
+   Acct_index = -1;
+   num_rows = 0;
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Account_read_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, Alice_chip_num);
+   while ( StepSQLStmt(SQLStmt_ptr, "PUFCashGetAcctRec()") == SQLITE_ROW )
+      {
+      if ( num_rows == 0 )
+         {
+         Acct_index = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+         *TID_ptr = sqlite3_column_int(SQLStmt_ptr->pStmt, 1);
+         *num_eCt_ptr = sqlite3_column_int(SQLStmt_ptr->pStmt, 2);
+         }
+      num_rows++;
+      }
+   ReleaseSQLStmt(SQLStmt_ptr);
 
-// Now get the TID and num_eCt (Amount).
-   sprintf(sql_command_str, "SELECT %s, %s FROM PUFCash_Account WHERE ID = %d;", col1_name, col2_name, Acct_index);
-   GetStringsDataForRow(max_string_len, DB_PUFCash_V3, sql_command_str, &row_strings_struct);
-   GetRowResultInt(&row_strings_struct, "PUFCashGetAcctRec()", 2, 0, col1_name, TID_ptr);
-   GetRowResultInt(&row_strings_struct, "PUFCashGetAcctRec()", 2, 1, col2_name, num_eCt_ptr);
-   FreeStringsDataForRow(&row_strings_struct);
+   if ( num_rows != 1 )
+      { printf("ERROR: PUFCashGetAcctRec(): Only 1 entry is allowed for Alice -- FOUND %d!\n", num_rows); exit(EXIT_FAILURE); }
 
 printf("PUFCashGetAcctRec(): Alice_chip_num %d\tGot TID %d and num_eCt %d for ID %d in PUFCash_Account Table!\n", 
    Alice_chip_num, *TID_ptr, *num_eCt_ptr, Acct_index); fflush(stdout);
@@ -907,10 +1120,11 @@ printf("PUFCashAddAcctRec(): Updating Amount from %d to %d\n", *num_eCt_ptr, upd
 #ifdef DEBUG
 #endif
 
-      sprintf(sql_command_str, "UPDATE PUFCash_Account SET Amount = %d WHERE ID = %d;", update_amt, Acct_index);
-      fc = sqlite3_exec(DB_PUFCash_V3, sql_command_str, NULL, 0, &zErrMsg);
-      if ( fc != SQLITE_OK )
-         { printf("SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Account_update_amount_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, update_amt);
+      BindSQLStmtInt(SQLStmt_ptr, 2, Acct_index);
+      StepSQLStmt(SQLStmt_ptr, "PUFCashGetAcctRec()");
+      ReleaseSQLStmt(SQLStmt_ptr);
       }
 
 printf("PUFCashAddAcctRec(): DONE\n"); fflush(stdout);
@@ -921,6 +1135,113 @@ printf("PUFCashAddAcctRec(): DONE\n"); fflush(stdout);
    }
 
 
+// ========================================================================================================
+// PUFCash_Account ledger
+// ========================================================================================================
+// TTP: credit (amount > 0) or debit (amount < 0) Alice's account in one conditional UPDATE, so the balance 
+// check and the write can not be separated by another withdrawal and no application mutex is needed. A debit 
+// only applies if the balance covers it. If txn_id >= 0 (Alice's request ID) the outcome is recorded in PUFCash_Ledger 
+// under her chip and txn_id (in the same transaction as the UPDATE) and a replay of the same txn_id returns the recorded 
+// outcome without touching the balance again. Returns LEDGER_APPLIED, LEDGER_INSUFFICIENT_FUNDS or LEDGER_NO_ACCOUNT. 
+// If balance_ptr is not NULL, it is set to the balance after the call.
+
+int PUFCashLedgerTxn(sqlite3 *DB_PUFCash_V3, int Alice_chip_num, long long txn_id, int amount, 
+   int *balance_ptr)
+   {
+   SQLStmtStruct *SQLStmt_ptr;
+   int status, replayed, num_changes, acct_found, balance;
+
+printf("PUFCashLedgerTxn(): BEGIN for Alice_chip_num %d\ttxn_id %lld\tamount %d\n", Alice_chip_num, txn_id, amount); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   if ( amount == 0 )
+      { printf("ERROR: PUFCashLedgerTxn(): Expected a non-zero amount!\n"); exit(EXIT_FAILURE); }
+
+   if ( txn_id >= 0 )
+      BeginSQLTransaction(DB_PUFCash_V3);
+
+// Replay of a transaction already recorded: return its outcome.
+   replayed = 0;
+   num_changes = 0;
+   status = LEDGER_APPLIED;
+   if ( txn_id >= 0 )
+      {
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Ledger_read_status_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, Alice_chip_num);
+      BindSQLStmtInt64(SQLStmt_ptr, 2, txn_id);
+      if ( StepSQLStmt(SQLStmt_ptr, "PUFCashLedgerTxn()") == SQLITE_ROW )
+         {
+         status = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+         replayed = 1;
+         }
+      ReleaseSQLStmt(SQLStmt_ptr);
+
+      if ( replayed == 1 )
+         {
+         printf("\t\tINFO: PUFCashLedgerTxn(): txn_id %lld already recorded with status %d -- NOT applying again!\n", txn_id, status); 
+         fflush(stdout);
+         }
+      }
+
+   if ( replayed == 0 )
+      {
+      if ( amount < 0 )
+         {
+         SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Account_debit_cmd);
+         BindSQLStmtInt(SQLStmt_ptr, 1, -amount);
+         BindSQLStmtInt(SQLStmt_ptr, 2, Alice_chip_num);
+         BindSQLStmtInt(SQLStmt_ptr, 3, -amount);
+         }
+      else
+         {
+         SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Account_credit_cmd);
+         BindSQLStmtInt(SQLStmt_ptr, 1, amount);
+         BindSQLStmtInt(SQLStmt_ptr, 2, Alice_chip_num);
+         }
+      num_changes = StepSQLStmtChanges(SQLStmt_ptr, "PUFCashLedgerTxn()");
+      ReleaseSQLStmt(SQLStmt_ptr);
+
+      if ( num_changes > 1 )
+         { printf("ERROR: PUFCashLedgerTxn(): Only 1 entry is allowed for Alice -- UPDATED %d!\n", num_changes); exit(EXIT_FAILURE); }
+      }
+
+// Look up the balance. Also tells a missing account apart from insufficient funds when the UPDATE changed nothing.
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Account_read_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, Alice_chip_num);
+   acct_found = (StepSQLStmt(SQLStmt_ptr, "PUFCashLedgerTxn()") == SQLITE_ROW);
+   balance = acct_found ? sqlite3_column_int(SQLStmt_ptr->pStmt, 2) : 0;
+   ReleaseSQLStmt(SQLStmt_ptr);
+
+   if ( replayed == 0 && num_changes == 0 )
+      status = acct_found ? LEDGER_INSUFFICIENT_FUNDS : LEDGER_NO_ACCOUNT;
+
+   if ( txn_id >= 0 )
+      {
+      if ( replayed == 0 )
+         {
+         SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_Ledger_insert_into_cmd);
+         BindSQLStmtInt64(SQLStmt_ptr, 1, txn_id);
+         BindSQLStmtInt(SQLStmt_ptr, 2, Alice_chip_num);
+         BindSQLStmtInt(SQLStmt_ptr, 3, amount);
+         BindSQLStmtInt(SQLStmt_ptr, 4, status);
+         StepSQLStmt(SQLStmt_ptr, "PUFCashLedgerTxn()");
+         ReleaseSQLStmt(SQLStmt_ptr);
+         }
+      CommitSQLTransaction(DB_PUFCash_V3);
+      }
+
+   if ( balance_ptr != NULL )
+      *balance_ptr = balance;
+
+printf("PUFCashLedgerTxn(): DONE: status %d\tbalance %d\n", status, balance); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+   return status;
+   }
+
+
 // ========================================================================================================
 // PUFCash_LLK
 // ========================================================================================================
@@ -931,10 +1252,8 @@ printf("PUFCashAddAcctRec(): DONE\n"); fflush(stdout);
 int PUFCashAddLLKChlngInfo(int max_string_len, sqlite3 *DB_PUFCash_V3, int chip_num, int anon_chip_num, 
    unsigned char *Chlng_blob, int Chlng_blob_num_bytes, unsigned char mask[2], int LLK_type, int allow_only_one)
    {
-   char sql_command_str[max_string_len];
+   SQLStmtStruct *SQLStmt_ptr;
    SQLIntStruct ID_index_struct;
-   char *zErrMsg = 0;
-   int fc;
 
    int LLK_index;
 
@@ -957,17 +1276,19 @@ printf("PUFCashAddLLKChlngInfo(): CALLED!\n"); fflush(stdout);
 // 7_2_2022: If we find more than one element of the given LLK_type, delete them. 
    if ( allow_only_one == 1 )
       {
-      sprintf(sql_command_str, "SELECT ID FROM PUFCash_LLK WHERE status = %d;", LLK_type);
-      GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &ID_index_struct);
+      SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_LLK_get_index_cmd);
+      BindSQLStmtInt(SQLStmt_ptr, 1, LLK_type);
+      GetSQLStmtListOfInts(SQLStmt_ptr, "PUFCashAddLLKChlngInfo()", &ID_index_struct);
+      ReleaseSQLStmt(SQLStmt_ptr);
 
       if ( ID_index_struct.num_ints > 0 )
          { 
          printf("PUFCashAddLLKChlngInfo(): Found %d existing DB elements -- deleting them!\n", ID_index_struct.num_ints); fflush(stdout);
 
-         sprintf(sql_command_str, "DELETE FROM PUFCash_LLK WHERE status = %d;", LLK_type);
-         fc = sqlite3_exec(DB_PUFCash_V3, sql_command_str, NULL, 0, &zErrMsg);
-         if ( fc != SQLITE_OK )
-            { printf("PUFCashAddLLKChlngInfo(): SQL ERROR: %s\n", zErrMsg); sqlite3_free(zErrMsg); exit(EXIT_FAILURE); }
+         SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_LLK_delete_cmd);
+         BindSQLStmtInt(SQLStmt_ptr, 1, LLK_type);
+         StepSQLStmt(SQLStmt_ptr, "PUFCashAddLLKChlngInfo()");
+         ReleaseSQLStmt(SQLStmt_ptr);
          }
       if ( ID_index_struct.int_arr != NULL )
          free(ID_index_struct.int_arr);
@@ -1007,20 +1328,14 @@ printf("PUFCashAddLLKChlngInfo(): DONE!\n"); fflush(stdout);
 // KEK FSB algorithm to regenerate the LLK. Note that this routine supports fetching of the LLK or Chlng 
 // information needed to generate the LLK (which is NOT stored). Alice and Bob use the latter functionality.
 
-int PUFCashGetLLKChlngInfo(int max_string_len, sqlite3 *DB_PUFCash_V3, int *chip_num_ptr,
+int PUFCashGetLLKChlngInfo(sqlite3 *DB_PUFCash_V3, int *chip_num_ptr,
    int *anon_chip_num_ptr, unsigned char **Chlng_blob_ptr, int *Chlng_blob_num_bytes_ptr,
    int allow_multiple_LLK, int *Chlng_index_ptr, int status, int check_exists_only, unsigned char mask[2])
    {
    SQLIntStruct Chlng_ID_index_struct; 
    int Chlng_index;
 
-   SQLRowStringsStruct row_strings_struct;
-   char sql_command_str[max_string_len];
-   char *col1_name = "ChipNum";
-   char *col2_name = "AnonChipNum";
-   char *col3_name = "mask";
-
-   char *SQL_read_Chlng_cmd = "SELECT Chlng FROM PUFCash_LLK WHERE ID = ?;";
+   SQLStmtStruct *SQLStmt_ptr;
 
    int mask_int = 0;
    int index_to_use = 0;
@@ -1030,8 +1345,10 @@ printf("\nPUFCashGetLLKChlngInfo(): CALLED!\n"); fflush(stdout);
 #endif
 
 // If enrollment has been done, then we will succeed in finding a DB record. Note that Status here is really LLK_type.
-   sprintf(sql_command_str, "SELECT ID FROM PUFCash_LLK WHERE Status = %d;", status);
-   GetAllocateListOfInts(max_string_len, DB_PUFCash_V3, sql_command_str, &Chlng_ID_index_struct);
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_LLK_get_index_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, status);
+   GetSQLStmtListOfInts(SQLStmt_ptr, "PUFCashGetLLKChlngInfo()", &Chlng_ID_index_struct);
+   ReleaseSQLStmt(SQLStmt_ptr);
 
 // If no records exist, return 0
    if ( Chlng_ID_index_struct.num_ints == 0 )
@@ -1068,12 +1385,14 @@ printf("PUFCashGetLLKChlngInfo(): Found %d Chlngs with LLK_type (status) field s
 #endif
 
 // Get the integer data associated with a particular DB record. 
-   sprintf(sql_command_str, "SELECT %s, %s, %s FROM PUFCash_LLK WHERE ID = %d;", col1_name, col2_name, col3_name, Chlng_index);
-   GetStringsDataForRow(max_string_len, DB_PUFCash_V3, sql_command_str, &row_strings_struct);
-   GetRowResultInt(&row_strings_struct, "PUFCashGetLLKChlngInfo()", 3, 0, col1_name, chip_num_ptr);
-   GetRowResultInt(&row_strings_struct, "PUFCashGetLLKChlngInfo()", 3, 1, col2_name, anon_chip_num_ptr);
-   GetRowResultInt(&row_strings_struct, "PUFCashGetLLKChlngInfo()", 3, 2, col3_name, &mask_int);
-   FreeStringsDataForRow(&row_strings_struct);
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_LLK_read_ints_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, Chlng_index);
+   if ( StepSQLStmt(SQLStmt_ptr, "PUFCashGetLLKChlngInfo()") != SQLITE_ROW )
+      { printf("ERROR: PUFCashGetLLKChlngInfo(): LLK index %d NOT FOUND!\n", Chlng_index); exit(EXIT_FAILURE); }
+   *chip_num_ptr = sqlite3_column_int(SQLStmt_ptr->pStmt, 0);
+   *anon_chip_num_ptr = sqlite3_column_int(SQLStmt_ptr->pStmt, 1);
+   mask_int = sqlite3_column_int(SQLStmt_ptr->pStmt, 2);
+   ReleaseSQLStmt(SQLStmt_ptr);
 
 #ifdef DEBUG
 printf("PUFCashGetLLKChlngInfo(): Mask [%02X][%02X]\t chip_num %d\tanon_chip_num %d\tfor LLK index %d\n", 
@@ -1089,7 +1408,12 @@ printf("PUFCashGetLLKChlngInfo(): Mask [%02X][%02X]\t chip_num %d\tanon_chip_num
       { printf("ERROR: PUFCashGetLLKChlngInfo(): DB mask_int %d != to expected mask %d!\n", mask_int, mask_expected); exit(EXIT_FAILURE); }
 
 // Read the Chlng_blob from the DB
-   *Chlng_blob_num_bytes_ptr = ReadBinaryBlob(DB_PUFCash_V3, SQL_read_Chlng_cmd, Chlng_index, NULL, 0, 1, Chlng_blob_ptr);
+   SQLStmt_ptr = GetSQLStmt(DB_PUFCash_V3, SQL_PUFCash_LLK_read_Chlng_cmd);
+   BindSQLStmtInt(SQLStmt_ptr, 1, Chlng_index);
+   if ( StepSQLStmt(SQLStmt_ptr, "PUFCashGetLLKChlngInfo()") != SQLITE_ROW )
+      { printf("ERROR: PUFCashGetLLKChlngInfo(): Chlng for LLK index %d NOT FOUND!\n", Chlng_index); exit(EXIT_FAILURE); }
+   *Chlng_blob_num_bytes_ptr = GetSQLStmtColumnBlob(SQLStmt_ptr, 0, Chlng_blob_ptr);
+   ReleaseSQLStmt(SQLStmt_ptr);
 
 #ifdef DEBUG
 if ( *XOR_nonce_ptr != NULL )
@@ -340,7 +340,7 @@ printf("ExchangeIDsConfirmATExists(): Alice sending chip_num %d to Bob!\n", chip
 // If Alice does NOT have an AT for Bob's Alice_Bob_chip_num, then this routine returns 0. Send 0 to Bob for 'NO'. Also, with parameters 
 // 'get_only_customer_AT' set to 1 and 'return_customer_AT_info' to 0, this routine ONLY counts the number of ATs for Alice, i.e., it does 
 // NOT fetch the AT and return it's fields. 
-      if ( (*local_AT_status_ptr = ZeroTrustGetCustomerATs(max_string_len, SHP_ptr->DB_Trust_AT, NULL, NULL, 0, NULL, NULL,
+      if ( (*local_AT_status_ptr = ZeroTrustGetCustomerATs(SHP_ptr->DB_Trust_AT, NULL, NULL, 0, NULL, NULL,
          get_only_customer_AT, Alice_Bob_chip_num, return_customer_AT_info, report_tot_num_ATs_only, &num_ATs)) == 0 )
          sprintf(request_str, "0");
       else
@@ -378,7 +378,7 @@ printf("ExchangeIDsConfirmATExists(): Connected to Alice!\n"); fflush(stdout);
          { printf("ERROR: ExchangeIDsConfirmATExists(): Bob received Alice's ID but is NOT assigned %d!\n", Alice_Bob_chip_num); exit(EXIT_FAILURE); }
 
 // If Bob does NOT have an AT for Alice's Alice_Bob_chip_num, then this routine returns 0. Send 0 to Alice for 'NO'
-      if ( (*local_AT_status_ptr = ZeroTrustGetCustomerATs(max_string_len, SHP_ptr->DB_Trust_AT, NULL, NULL, 0, NULL, NULL,
+      if ( (*local_AT_status_ptr = ZeroTrustGetCustomerATs(SHP_ptr->DB_Trust_AT, NULL, NULL, 0, NULL, NULL,
          get_only_customer_AT, Alice_Bob_chip_num, return_customer_AT_info, report_tot_num_ATs_only, &num_ATs)) == 0 )
          sprintf(request_str, "%d 0", SHP_ptr->chip_num);
       else
@@ -455,7 +455,7 @@ printf("ZeroTrustGenSharedKey(): BEGIN!\n"); fflush(stdout);
 
 // If Alice/Bob/TTP does NOT have an AT for other_party_chip_num, then this routine returns 0. Fetch the AT and mark
 // it as used.
-   if ( ZeroTrustGetCustomerATs(MAX_STRING_LEN, SHP_ptr->DB_Trust_AT, &chip_num_arr, &chlng_num_arr, SHP_ptr->ZHK_A_num_bytes, 
+   if ( ZeroTrustGetCustomerATs(SHP_ptr->DB_Trust_AT, &chip_num_arr, &chlng_num_arr, SHP_ptr->ZHK_A_num_bytes, 
       &ZHK_A_nonce_arr, &nonce_arr, get_only_customer_AT, other_party_chip_num, return_customer_AT_info, 
       report_tot_num_ATs_only, &num_ATs) == 0 )
       return 0;
@@ -1120,7 +1120,7 @@ int GoGetVectors(int max_string_len, int num_POs, int num_PIs, int verifier_sock
    int *has_masks_ptr, unsigned char ***first_vecs_b_ptr, unsigned char ***second_vecs_b_ptr, 
    unsigned char ***masks_b_ptr, int send_GO, int use_database_chlngs, sqlite3 *DB, int DB_design_index,
    char *DB_ChallengeSetName, int gen_or_use_challenge_seed, unsigned int *DB_ChallengeGen_seed_ptr, 
-   pthread_mutex_t *GenChallenge_mutex_ptr, int debug_flag)
+   int debug_flag)
    {
    int num_vecs;
 
@@ -1186,8 +1186,7 @@ fflush(stdout);
 // challenges. It returns a set of binary vectors and masks as well as a data structure that allows the enrollment timing values 
 // that are tested by these vectors to be looked up by the caller.
       GenChallengeDB(max_string_len, DB, DB_design_index, DB_ChallengeSetName, *DB_ChallengeGen_seed_ptr, 0, NULL, NULL, 
-         first_vecs_b_ptr, second_vecs_b_ptr, masks_b_ptr, &num_vecs, num_rise_vecs_ptr, GenChallenge_mutex_ptr,
-         &num_challenge_vecpair_id_PO, &challenge_vecpair_id_PO_arr);
+         first_vecs_b_ptr, second_vecs_b_ptr, masks_b_ptr, &num_vecs, num_rise_vecs_ptr, &num_challenge_vecpair_id_PO, &challenge_vecpair_id_PO_arr);
 
 // We always generate masks during the database vector selection process.
       *has_masks_ptr = 1;
@@ -1382,7 +1381,7 @@ printf("\tGetKEKChlngInfoProvisionOrReplace(): Sending 'KEK-CHALLENGE-ENROLL' to
 #ifdef DEBUG
 #endif
 
-      if ( SockSendB((unsigned char *)"KEK-CHALLENGE-ENROLL", strlen("KEK-CHALLENGE-ENROLL") + 1, Bank_socket_desc) < 0 )
+      if ( SockSendRequest(Bank_socket_desc, REQ_OP_KEK_CHALLENGE_ENROLL, NULL, 0) < 0 )
          { printf("ERROR: GetKEKChlngInfoProvisionOrReplace(): Failed to send 'KEK-CHALLENGE-ENROLL' to Bank!\n"); exit(EXIT_FAILURE); }
 
 // Mutually authenticate and generate a session key. KEK_Enroll is also used to generate a session key. NOTE: We do not store challenge 
@@ -1433,7 +1432,7 @@ exit(EXIT_SUCCESS);
 
 // Only close socket descriptor if we are a customer (Alice). TTPs keep their socket connection open permanently.
    if ( open_socket == 1 )
-      close(Bank_socket_desc);
+      SockClose(Bank_socket_desc);
 
 gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; printf("\tTOTAL EXEC TIME %ld us\n\n", (long)elapsed);
 #ifdef DEBUG
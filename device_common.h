@@ -188,8 +188,6 @@ typedef struct
    int total_bits; 
    int iteration; 
 
-   pthread_mutex_t *GenChallenge_mutex_ptr;
-
    int do_COBRA;
 
    int DUMP_BITSTRINGS; 
@@ -235,7 +233,7 @@ int GoGetVectors(int max_string_len, int num_POs, int num_PIs, int verifier_sock
    int *has_masks_ptr, unsigned char ***first_vecs_b_ptr, unsigned char ***second_vecs_b_ptr, 
    unsigned char ***masks_b_ptr, int send_GO, int use_database_chlngs, sqlite3 *DB, int DB_design_index,
    char *DB_ChallengeSetName, int gen_or_use_challenge_seed, unsigned int *DB_ChallengeGen_seed_ptr, 
-   pthread_mutex_t *GenChallenge_mutex_ptr, int debug_flag);
+   int debug_flag);
 
 
 int ReadFileHexASCIIToUnsignedChar(int max_string_len, char *file_name, unsigned char **bin_arr_ptr);
@@ -1169,7 +1169,7 @@ void CommonCore(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int verifi
    SHP_ptr->num_vecs = GoGetVectors(max_string_len, SHP_ptr->num_POs, SHP_ptr->num_PIs, verifier_socket_desc, &(SHP_ptr->num_rise_vecs),
       &(SHP_ptr->has_masks), &(SHP_ptr->first_vecs_b), &(SHP_ptr->second_vecs_b), &(SHP_ptr->masks_b), send_GO_request, 
       SHP_ptr->use_database_chlngs, SHP_ptr->DB_Challenges, SHP_ptr->DB_design_index, SHP_ptr->DB_ChallengeSetName, gen_or_use_challenge_seed,
-      &(SHP_ptr->DB_ChallengeGen_seed), SHP_ptr->GenChallenge_mutex_ptr, SHP_ptr->DEBUG_FLAG);
+      &(SHP_ptr->DB_ChallengeGen_seed), SHP_ptr->DEBUG_FLAG);
 
 #ifdef DEBUG
 SaveASCIIVectors(max_string_len, SHP_ptr->num_vecs, SHP_ptr->first_vecs_b, SHP_ptr->second_vecs_b, SHP_ptr->num_PIs, 
@@ -2978,7 +2978,7 @@ int GenLLK(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int open_socket
 // in the database. If no LLK records exist, PUFCashGetLLKChlngInfo returns 0. PUFCashGetLLKChlngInfo allocates space 
 // for the Chlng_blob. 
    int check_exists_only = 0;
-   if ( PUFCashGetLLKChlngInfo(max_string_len, SHP_ptr->DB_PUFCash_V3, &(SHP_ptr->chip_num), &(SHP_ptr->anon_chip_num), 
+   if ( PUFCashGetLLKChlngInfo(SHP_ptr->DB_PUFCash_V3, &(SHP_ptr->chip_num), &(SHP_ptr->anon_chip_num), 
       &Chlng_blob, &Chlng_blob_num_bytes, allow_multiple_LLK, &Chlng_index, LLK_type, check_exists_only, mask) == 1 )
       {
 
@@ -3011,7 +3011,7 @@ printf("GenLLK(): Called GenLLK() and FOUND a KEK Chlng_blob. Also fetched chip_
       SHP_ptr->KEK_num_vecs = GoGetVectors(max_string_len, SHP_ptr->num_POs, SHP_ptr->num_PIs, 0, &(SHP_ptr->KEK_num_rise_vecs),
          &(SHP_ptr->KEK_has_masks), &(SHP_ptr->KEK_first_vecs_b), &(SHP_ptr->KEK_second_vecs_b), &(SHP_ptr->KEK_masks_b), send_GO_request, 
          SHP_ptr->use_database_chlngs, SHP_ptr->DB_Challenges, SHP_ptr->DB_design_index, SHP_ptr->DB_ChallengeSetName, gen_or_use_challenge_seed,
-         &(SHP_ptr->DB_ChallengeGen_seed), SHP_ptr->GenChallenge_mutex_ptr, SHP_ptr->DEBUG_FLAG);
+         &(SHP_ptr->DB_ChallengeGen_seed), SHP_ptr->DEBUG_FLAG);
 
 // Run KEK regeneration
       KEK_Regen(max_string_len, SHP_ptr, do_minority_bit_flip_analysis);
@@ -3142,7 +3142,7 @@ printf("\n\nZeroTrust_Enroll(): CALLED!\n"); fflush(stdout);
          }
       }
 
-   if ( SockSendB((unsigned char *)"ZERO-TRUST-ENROLL", strlen("ZERO-TRUST-ENROLL") + 1, Bank_socket_desc) < 0 )
+   if ( SockSendRequest(Bank_socket_desc, REQ_OP_ZERO_TRUST_ENROLL, NULL, 0) < 0 )
       { printf("ERROR: ZeroTrust_Enroll(): Failed to send 'ZERO-TRUST-ENROLL' to Bank!\n"); exit(EXIT_FAILURE); }
 
 // Mutually authenticate and generate a session key. KEK_Enroll is also used to generate the session key. 
@@ -3330,7 +3330,7 @@ printf("ZeroTrust_Enroll(): Waiting on ACK from IA\n"); fflush(stdout);
 // Close the socket and free the session key but ONLY if we are NOT the TTP.
    if ( is_TTP == 0 )
       {
-      close(Bank_socket_desc);
+      SockClose(Bank_socket_desc);
       if ( session_key != NULL )
          free(session_key);
       }
@@ -3406,7 +3406,7 @@ printf("ZeroTrust_GetATs(): CALLED!\n"); fflush(stdout);
 
 // ********************************************************************************************************************
 // *** ZeroTrust Get ATs PART I: Send command
-   if ( SockSendB((unsigned char *)"ZERO-TRUST-GET-ATS", strlen("ZERO-TRUST-GET-ATS") + 1, Bank_socket_desc) < 0 )
+   if ( SockSendRequest(Bank_socket_desc, REQ_OP_ZERO_TRUST_GET_ATS, NULL, 0) < 0 )
       { printf("ERROR: ZeroTrust_GetATs(): Failed to send 'ZERO-TRUST-GET-ATS' to Bank!\n"); exit(EXIT_FAILURE); }
 
 // If Alice, mutually authenticate with Bank, and generate session key. TTP does NOT do this.
@@ -3551,7 +3551,7 @@ printf("ZeroTrust_GetATs(): Inserting customer data into DB for %d customers!\n"
 // Close the socket and free the session key, but ONLY IF this is NOT a TTP calling this function.
    if ( is_TTP == 0 )
       {
-      close(Bank_socket_desc);
+      SockClose(Bank_socket_desc);
       if ( session_key != NULL )
          free(session_key); 
       }
@@ -63,12 +63,8 @@ printf("\nAliceWithdrawal(): BEGIN\n\n"); fflush(stdout);
       }
 
 // ==============================
-// Tell TTP we want to make a withdrawal. This will start the authentication process before the withdrawal.
-   if ( SockSendB((unsigned char *)"ALICE-WITHDRAWAL", strlen("ALICE-WITHDRAWAL") + 1, TTP_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): Failed to send 'WITHDRAW' to TTP!\n"); exit(EXIT_FAILURE); }
-
-// ==============================
-// Alice sends TTP her chip number. TTP uses this to fetch an AT from the Bank for Alice's transaction. 
+// Tell TTP we want to make a withdrawal. This will start the authentication process before the withdrawal. The request 
+// carries Alice's chip number. TTP uses this to fetch an AT from the Bank for Alice's transaction.
 // NOTE: Unlike Alice and Bob, the TTP does NOT fetch AT in advance (Alice and Bob do it with a menu option).
 
 printf("\tAliceWithdrawal(): Alice sending TTP 'chip_num' so TTP can decide if it has an AT for Alice!\n"); fflush(stdout);
@@ -77,8 +73,8 @@ printf("\tAliceWithdrawal(): Alice sending TTP 'chip_num' so TTP can decide if i
 
    char Alice_chip_num_str[max_string_len];
    sprintf(Alice_chip_num_str, "%d", SHP_ptr->chip_num);
-   if ( SockSendB((unsigned char *)Alice_chip_num_str, strlen(Alice_chip_num_str)+1, TTP_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): Failed to send 'Alice_chip_num' to TTP!\n"); exit(EXIT_FAILURE); }
+   if ( SockSendRequest(TTP_socket_desc, REQ_OP_ALICE_WITHDRAWAL, (unsigned char *)Alice_chip_num_str, strlen(Alice_chip_num_str)+1) < 0 )
+      { printf("ERROR: AliceWithdrawal(): Failed to send 'ALICE-WITHDRAWAL' and 'Alice_chip_num' to TTP!\n"); exit(EXIT_FAILURE); }
 
 // ==============================
 // Do ZeroTrust authentication and key generation between Alice and the TTP.
@@ -224,7 +220,7 @@ encrypt_256(SK_FA, SHP_ptr->AES_IV, Alice_chip_num_str_encrypt, AES_INPUT_NUM_BY
    int dummy;
 
 
-   PUFCashGet_WRec_Data(max_string_len, SHP_ptr->DB_PUFCash_V3, SHP_ptr->chip_num, 1, &dummy, 1, NULL, NULL, &num_ect);
+   PUFCashGet_WRec_Data(SHP_ptr->DB_PUFCash_V3, SHP_ptr->chip_num, 1, &dummy, 1, NULL, NULL, &num_ect);
    /////////////////////////////Aisha/////////////////////////
    int cents = num_ect % 100;
    int dollars = num_ect / 100;
@@ -236,7 +232,7 @@ encrypt_256(SK_FA, SHP_ptr->AES_IV, Alice_chip_num_str_encrypt, AES_INPUT_NUM_BY
 
    ///////////////////////////////////////////
 
-   close(TTP_socket_desc);
+   SockClose(TTP_socket_desc);
 
 printf("\nAliceWithdrawal(): DONE\n\n"); fflush(stdout);
 #ifdef DEBUG
@@ -290,13 +286,8 @@ printf("\nAliceAccount(): BEGIN\n\n"); fflush(stdout);
       }
 
 // ==============================
-// Tell TTP we want to make a withdrawal. This will start the authentication process before the withdrawal.
-   if ( SockSendB((unsigned char *)"ALICE-ACCOUNT", strlen("ALICE-ACCOUNT") + 1, TTP_socket_desc) < 0 )
-      { printf("ERROR: AliceAccount(): Failed to send 'WITHDRAW' to TTP!\n"); exit(EXIT_FAILURE); }
-
-
-// ==============================
-// Alice sends TTP her chip number. TTP uses this to fetch an AT from the Bank for Alice's transaction. 
+// Tell TTP we want to make a withdrawal. This will start the authentication process before the withdrawal. The request 
+// carries Alice's chip number. TTP uses this to fetch an AT from the Bank for Alice's transaction.
 // NOTE: Unlike Alice and Bob, the TTP does NOT fetch AT in advance (Alice and Bob do it with a menu option).
 
 printf("AliceAccount(): Alice sending TTP 'chip_num' so TTP can decide if it has an AT for Alice!\n"); fflush(stdout);
@@ -305,8 +296,8 @@ printf("AliceAccount(): Alice sending TTP 'chip_num' so TTP can decide if it has
 
    char Alice_chip_num_str[max_string_len];
    sprintf(Alice_chip_num_str, "%d", SHP_ptr->chip_num);
-   if ( SockSendB((unsigned char *)Alice_chip_num_str, strlen(Alice_chip_num_str)+1, TTP_socket_desc) < 0 )
-      { printf("ERROR: AliceAccount(): Failed to send 'Alice_chip_num' to TTP!\n"); exit(EXIT_FAILURE); }
+   if ( SockSendRequest(TTP_socket_desc, REQ_OP_ALICE_ACCOUNT, (unsigned char *)Alice_chip_num_str, strlen(Alice_chip_num_str)+1) < 0 )
+      { printf("ERROR: AliceAccount(): Failed to send 'ALICE-ACCOUNT' and 'Alice_chip_num' to TTP!\n"); exit(EXIT_FAILURE); }
 
 // ==============================
 // Do ZeroTrust authentication and key generation between Alice and the TTP.
@@ -335,7 +326,7 @@ else {
    int num_ect_local = 0;
    int dummy;
 
-   PUFCashGet_WRec_Data(max_string_len, SHP_ptr->DB_PUFCash_V3, SHP_ptr->chip_num, 1, &dummy, 1, NULL, NULL, &num_ect_local);
+   PUFCashGet_WRec_Data(SHP_ptr->DB_PUFCash_V3, SHP_ptr->chip_num, 1, &dummy, 1, NULL, NULL, &num_ect_local);
    printf("num_ect we got = %d\n", num_ect_local);
 
 
@@ -345,7 +336,7 @@ else {
    printf("Alice's Balance: $%d.%02d\n", dollars, cents);
 
 
-   close(TTP_socket_desc);
+   SockClose(TTP_socket_desc);
 
 printf("\nAliceAccount(): DONE\n\n"); fflush(stdout);
 #ifdef DEBUG
@@ -390,9 +381,9 @@ printf("AliceGetClient_IPs(): START!\n"); fflush(stdout);
          }
 
 // Tell Bank we want the TTP or customer device information that it knows about. 
-      if ( set_num == 0 && SockSendB((unsigned char *)"ALICE-GET-TTP-IPS", strlen("ALICE-GET-TTP-IPS") + 1, Bank_socket_desc) < 0 )
+      if ( set_num == 0 && SockSendRequest(Bank_socket_desc, REQ_OP_ALICE_GET_TTP_IPS, NULL, 0) < 0 )
          { printf("ERROR: AliceGetClient_IPs(): Failed to send 'ALICE-GET-TTP-IPS' to Bank!\n"); exit(EXIT_FAILURE); }
-      if ( set_num == 1 && SockSendB((unsigned char *)"ALICE-GET-CUSTOMER-IPS", strlen("ALICE-GET-CUSTOMER-IPS") + 1, Bank_socket_desc) < 0 )
+      if ( set_num == 1 && SockSendRequest(Bank_socket_desc, REQ_OP_ALICE_GET_CUSTOMER_IPS, NULL, 0) < 0 )
          { printf("ERROR: AliceGetClient_IPs(): Failed to send 'ALICE-GET-CUSTOMER-IPS' to Bank!\n"); exit(EXIT_FAILURE); }
 
 // Generate session key with Bank. 
@@ -443,7 +434,7 @@ printf("AliceGetClient_IPs(): Bank returned %d Customer IPs!\n", *num_customers_
 
       if ( Alice_session_key != NULL )
          free(Alice_session_key);
-      close(Bank_socket_desc);
+      SockClose(Bank_socket_desc);
       }
 
 #ifdef DEBUG
@@ -674,11 +665,11 @@ printf("AliceTransferDriver(): BEGIN!\n"); fflush(stdout);
       My_index) == 0 )
       {
       printf("ERROR: AliceTransferDriver(): Alice FAILED with Peer/Zero Trust to authenticate Bob -- Aborting transaction!\n"); 
-      close(Bob_socket_desc);
+      SockClose(Bob_socket_desc);
       return 0;
       }
 
-   close(Bob_socket_desc);
+   SockClose(Bob_socket_desc);
 
 
 //   while ( OpenSocketClient(max_string_len, Client_CIArr[Bob_index].IP, port_number, &Bob_socket_desc) < 0 )
@@ -698,7 +689,7 @@ printf("AliceTransferDriver(): BEGIN!\n"); fflush(stdout);
 //      Bob_socket_desc);
 
 // Close Bob's socket descriptor.
-//   close(Bob_socket_desc);
+//   SockClose(Bob_socket_desc);
 
 
 printf("AliceTransferDriver(): DONE!\n"); fflush(stdout);
@@ -837,6 +828,10 @@ int main(int argc, char *argv[])
 
    strcpy(DB_name_PUFCash_V3, "PUFCash_V3.db");
 
+// Use the 64-bit word versions of the bitstring routines (KEK_FSB_SKE, EliminatePackedBitsFromBS, etc). Set to BIT_OPS_BYTE 
+// to run the original bit-at-a-time versions.
+   SelectBitOps(BIT_OPS_DEFAULT);
+
 // Must be set to 0 until I fully integrate this into all of the primitives.
    use_database_chlngs = 0;
    ChallengeGen_seed = 1;
@@ -981,6 +976,10 @@ printf("Reading filesystem database '%s' into memory!\n", DB_name_Challenges); f
    if ( LoadOrSaveDb(DB_PUFCash_V3, DB_name_PUFCash_V3, 0) != 0 )
       { printf("Failed to open and copy into memory '%s': ERR: %s\n", DB_name_PUFCash_V3, sqlite3_errmsg(DB_PUFCash_V3)); sqlite3_close(DB_PUFCash_V3); exit(EXIT_FAILURE); }
 
+// Prepare the runtime statements once, now that the tables have been loaded.
+   PrepareZeroTrustSQLStmts(DB_Trust_AT);
+   PreparePUFCashSQLStmts(DB_PUFCash_V3);
+
 // =========================
 // Set some of the params in the data structure.
    SHP.CtrlRegA = CtrlRegA;
@@ -1171,13 +1170,6 @@ else
    SHP.total_bits = 0; 
    SHP.iteration = 0;
 
-// 10_31_2021: We are now using a seed to specify the vector sequence on the device, TTP and verifier. When challenges are selected, we depend
-// on the sequence returned by rand() to be the same no matter where this routine runs, device, TT or verifier. The verifier and TTP are multi-threaded
-// and therefore it is possible that multiple threads call this routine simultaneously, interrupting the sequence generated by rand() (rand is NOT re-entrant).
-// If this occurs, then the vector challenges used by the, e.g., verifier and device will be different and the security function will fail. When the device
-// calls this function, the mutex is NULL. 
-   SHP.GenChallenge_mutex_ptr = NULL;
-
    SHP.do_COBRA = DO_COBRA;
 
    SHP.DUMP_BITSTRINGS = DUMP_BITSTRINGS;
@@ -1237,7 +1229,7 @@ printf("\nMyChip NON-ANONYMOUS server ID %d\n", SHP.chip_num); fflush(stdout);
    int is_TTP = 0;
    Bank_socket_desc = 0;
    unsigned char *session_key = NULL;
-   if ( ZeroTrustGetCustomerATs(MAX_STRING_LEN, SHP.DB_Trust_AT, &chip_num_arr, &chlng_num_arr, SHP.ZHK_A_num_bytes, 
+   if ( ZeroTrustGetCustomerATs(SHP.DB_Trust_AT, &chip_num_arr, &chlng_num_arr, SHP.ZHK_A_num_bytes, 
       &ZHK_A_nonce_arr, &nonce_arr, get_only_customer_AT, customer_chip_num, return_customer_AT_info, report_tot_num_ATs_only, &unused) == 0 )
       {
 printf("No customer ATs found! Enrolling\n"); fflush(stdout);
@@ -1395,7 +1387,7 @@ printf("Connect client IP %s\n", inet_ntoa(AliceBob_addr.sin_addr)); fflush(stdo
 
 // Close socket descriptor.
          if ( keep_socket_open == 0 )
-            close(AliceBob_socket_desc);
+            SockClose(AliceBob_socket_desc);
          continue;
          }
 
@@ -1533,11 +1525,13 @@ printf("\tALICE ACCOUNT\n"); fflush(stdout);
    printf("Saving 'in memory' '%s' to filesystem!\n", SHP.DB_name_Trust_AT); fflush(stdout);
    if ( LoadOrSaveDb(SHP.DB_Trust_AT, SHP.DB_name_Trust_AT, 1) != 0 )
       { printf("Failed to store 'in memory' database to %s: %s\n", SHP.DB_name_Trust_AT, sqlite3_errmsg(SHP.DB_Trust_AT)); sqlite3_close(SHP.DB_Trust_AT); exit(EXIT_FAILURE); }
+   FinalizeSQLStmtCache(SHP.DB_Trust_AT);
    sqlite3_close(SHP.DB_Trust_AT);
 
    printf("Saving 'in memory' '%s' to filesystem!\n", SHP.DB_name_PUFCash_V3); fflush(stdout);
    if ( LoadOrSaveDb(SHP.DB_PUFCash_V3, SHP.DB_name_PUFCash_V3, 1) != 0 )
       { printf("Failed to store 'in memory' database to %s: %s\n", SHP.DB_name_PUFCash_V3, sqlite3_errmsg(SHP.DB_PUFCash_V3)); sqlite3_close(SHP.DB_PUFCash_V3); exit(EXIT_FAILURE); }
+   FinalizeSQLStmtCache(SHP.DB_PUFCash_V3);
    sqlite3_close(SHP.DB_PUFCash_V3);
 
    fflush(stdout);
@@ -37,14 +37,15 @@ typedef struct
    int iteration_cnt;
    char *history_file_name;
    SRFHardwareParamsStruct *SHP_ptr;
-   int Bank_socket_desc; 
+   ChannelPoolStruct *BCP_ptr;
    int Device_socket_desc; 
    char customer_IP[16];
    unsigned char *TTP_session_key;
    int port_number;
-   int in_use;
    int client_index;
-   int *client_sockets; 
+   EpollServerStruct *ESS_ptr;
+   ThreadPoolStruct *TP_ptr;
+   RequestStatsStruct *RS_ptr;
    int num_TTPs;
    int max_string_len; 
    int max_TTP_connect_attempts; 
@@ -53,8 +54,6 @@ typedef struct
    int exclude_self; 
    int RANDOM;
    int num_eCt_nonce_bytes;
-   pthread_mutex_t Thread_mutex;
-   pthread_cond_t Thread_cv;
    } ThreadDataType;
 
 
@@ -79,7 +78,7 @@ printf("\nGetCustomerChipNums(): BEGIN!\n"); fflush(stdout);
       { printf("ERROR: Default deposit Amt %d MUST be divisible by %d!\n", deposit_amt, MIN_WITHDRAW_INCREMENT); exit(EXIT_FAILURE); }
 
 // Tell Bank we want a list of customer chip_nums
-   if ( SockSendB((unsigned char *)"TTP-GET-DEVICE-IDS", strlen("TTP-GET-DEVICE-IDS") + 1, Bank_socket_desc) < 0 )
+   if ( SockSendRequest(Bank_socket_desc, REQ_OP_TTP_GET_DEVICE_IDS, NULL, 0) < 0 )
       { printf("ERROR: Failed to send 'TTP-GET-DEVICE-IDS' to Bank!\n"); exit(EXIT_FAILURE); }
 
 // Get and decrypt the number of chip_nums first.
@@ -159,41 +158,33 @@ printf("AliceTTPBankSessionKeyGen(): 'use_database_chlngs' %d\tnum_PIs %d\tnum_P
 
 // -------------------------------------------
 // verifier_regeneration.c/GenChlngDeliverSpreadFactorsToDevice()/CommonCore(), Part 1 -> GoSendVectors()
-   if ( SockGetB((unsigned char *)request_str, MAX_STRING_LEN, Alice_socket_desc) != 3 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'GO' from Alice!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB((unsigned char *)request_str, strlen(request_str)+1, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'GO' to Bank!\n"); exit(EXIT_FAILURE); }
+// Messages the TTP does not need to look at are relayed with SockRelayB, which streams them between the sockets without 
+// storing them here.
+   if ( SockRelayB(max_string_len, Alice_socket_desc, Bank_socket_desc, 1, 3) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'GO' from Alice to Bank!\n"); exit(EXIT_FAILURE); }
 
 #ifdef DEBUG
-printf("AliceTTPBankSessionKeyGen(): Got and Sent 'GO' '%s'!\n", request_str); fflush(stdout);
+printf("AliceTTPBankSessionKeyGen(): Relayed 'GO'!\n"); fflush(stdout);
 #endif
 
 // -------------------------------------------
 // verifier_regeneration.c/common.c/GoSendVectors()
 // the LFSR seed used by the server.  Always send the seed independent of whether we are generating and sending 
 // vectors from the server (here) or if the device will generate them using only the DB_ChallengeGen_seed.
-   if ( SockGetB((unsigned char *)request_str, MAX_STRING_LEN, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'DB_ChallengeGen_seed_str' from Bank!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB((unsigned char *)request_str, strlen(request_str)+1, Alice_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'DB_ChallengeGen_seed_str' to Alice!\n"); exit(EXIT_FAILURE); }
+   if ( SockRelayB(MAX_STRING_LEN, Bank_socket_desc, Alice_socket_desc, 1, 0) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'DB_ChallengeGen_seed_str' from Bank to Alice!\n"); exit(EXIT_FAILURE); }
 
 #ifdef DEBUG
-printf("AliceTTPBankSessionKeyGen(): Got and Sent 'DB_ChallengeGen_seed_str' '%s'!\n", request_str); fflush(stdout);
+printf("AliceTTPBankSessionKeyGen(): Relayed 'DB_ChallengeGen_seed_str'!\n"); fflush(stdout);
 #endif
 
 // -------------------------------------------
 // verifier_regeneration.c/common.c/SendVectorsAndMask()
 // If the server (and Alice) are NOT using client-side database-generated challenges, then we must get the vectors and
 // re-transmit them.
-   unsigned char *vec = NULL;
-   unsigned char *mask = NULL;
    if ( use_database_chlngs == 0 )
       {
       int num_vecs, num_rise_vecs, has_masks;
-      int vec_num;
-
-      vec = Allocate1DUnsignedChar(num_PIs/8);
-      mask = Allocate1DUnsignedChar(num_POs/8);
 
 // Get num_vecs 
       if ( SockGetB((unsigned char *)request_str, MAX_STRING_LEN, Bank_socket_desc) < 0 )
@@ -210,23 +201,24 @@ printf("AliceTTPBankSessionKeyGen(): use_database_chlngs is 0 %d\tnum_vecs %d\tn
    use_database_chlngs, num_vecs, num_rise_vecs, has_masks); fflush(stdout);
 #endif
 
-// Send first_vecs and second_vecs to remote server.
-      for ( vec_num = 0; vec_num < num_vecs; vec_num++ )
+// Send first_vecs and second_vecs (and masks) to remote server. They are streamed to Alice as one run of messages; with masks
+// each vector pair is followed by a mask, which is a different size, so the messages are then relayed one at a time.
+      if ( has_masks == 0 )
          {
-         if ( SockGetB(vec, num_PIs/8, Bank_socket_desc) != num_PIs/8 )
-            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'first_vec[%d]' from Bank!\n", vec_num); exit(EXIT_FAILURE); }
-         if ( SockSendB(vec, num_PIs/8, Alice_socket_desc) < 0 )
-            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'first_vec[%d]' to Alice!\n", vec_num); exit(EXIT_FAILURE); }
-
-         if ( SockGetB(vec, num_PIs/8, Bank_socket_desc) != num_PIs/8 )
-            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'second_vec[%d]' from Bank!\n", vec_num); exit(EXIT_FAILURE); }
-         if ( SockSendB(vec, num_PIs/8, Alice_socket_desc) < 0 )
-            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'second_vec[%d]' to Alice!\n", vec_num); exit(EXIT_FAILURE); }
-
-         if ( has_masks == 1 && SockGetB(mask, num_POs/8, Bank_socket_desc) != num_POs/8 )
-            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'mask[%d]' from Bank!\n", vec_num); exit(EXIT_FAILURE); }
-         if ( has_masks == 1 && SockSendB(mask, num_POs/8, Alice_socket_desc) < 0 )
-            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'mask[%d]' to Alice!\n", vec_num); exit(EXIT_FAILURE); }
+         if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 2*num_vecs, num_PIs/8) < 0 )
+            { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'first_vecs/second_vecs' from Bank to Alice!\n"); exit(EXIT_FAILURE); }
+         }
+      else
+         {
+         int vec_num;
+
+         for ( vec_num = 0; vec_num < num_vecs; vec_num++ )
+            {
+            if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 2, num_PIs/8) < 0 )
+               { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'first_vec/second_vec[%d]' from Bank to Alice!\n", vec_num); exit(EXIT_FAILURE); }
+            if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 1, num_POs/8) < 0 )
+               { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'mask[%d]' from Bank to Alice!\n", vec_num); exit(EXIT_FAILURE); }
+            }
          }
 
 #ifdef DEBUG
@@ -237,39 +229,30 @@ printf("AliceTTPBankSessionKeyGen(): Got and Sent server-side vectors (use_datab
 // -------------------------------------------
 // verifier_regeneration.c/GenChlngDeliverSpreadFactorsToDevice()/CommonCore(), Part 1
 // XOR_nonce exchange
-   unsigned char *nonce = Allocate1DUnsignedChar(SHP_ptr->num_required_nonce_bytes);
 
 #ifdef DEBUG
-printf("AliceTTPBankSessionKeyGen(): Get/Send 'verifier_n2/XOR_nonce'!\n"); fflush(stdout);
+printf("AliceTTPBankSessionKeyGen(): Relay 'verifier_n2/XOR_nonce'!\n"); fflush(stdout);
 #endif
 
-   if ( SockGetB(nonce, SHP_ptr->num_required_nonce_bytes, Bank_socket_desc) != SHP_ptr->num_required_nonce_bytes )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'verifier_n2' from Bank!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB(nonce, SHP_ptr->num_required_nonce_bytes, Alice_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'verifier_n2' to Alice!\n"); exit(EXIT_FAILURE); }
-
-   if ( SockGetB(nonce, SHP_ptr->num_required_nonce_bytes, Alice_socket_desc) != SHP_ptr->num_required_nonce_bytes )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'XOR_nonce' from Alice!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB(nonce, SHP_ptr->num_required_nonce_bytes, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'XOR_nonce' to Bank!\n"); exit(EXIT_FAILURE); }
+   if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 1, SHP_ptr->num_required_nonce_bytes) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'verifier_n2' from Bank to Alice!\n"); exit(EXIT_FAILURE); }
+   if ( SockRelayB(max_string_len, Alice_socket_desc, Bank_socket_desc, 1, SHP_ptr->num_required_nonce_bytes) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'XOR_nonce' from Alice to Bank!\n"); exit(EXIT_FAILURE); }
 
 // -------------------------------------------
 // verifier_regeneration.c/GenChlngDeliverSpreadFactorsToDevice()/CommonCore(), Part 2
-// SelectParams (nothing), ComputeSendSpreadFactors(), KEK_SessionKey ALWAYS sends SF (independent of mode).
-   unsigned char *SF = Allocate1DUnsignedChar(SHP_ptr->num_SF_bytes);
-
+// SelectParams (nothing), ComputeSendSpreadFactors(), KEK_SessionKey ALWAYS sends SF (independent of mode). The TTP reads 
+// Alice's reply since it ends the loop.
    int target_attempts = 0;
    while (1)
       {
 
 #ifdef DEBUG
-printf("AliceTTPBankSessionKeyGen(): Get/Send 'SF'\tTarget attempts %d!\n", target_attempts); fflush(stdout);
+printf("AliceTTPBankSessionKeyGen(): Relay 'SF'\tTarget attempts %d!\n", target_attempts); fflush(stdout);
 #endif
 
-      if ( SockGetB(SF, SHP_ptr->num_SF_bytes, Bank_socket_desc) != SHP_ptr->num_SF_bytes )
-         { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'SF' from Bank!\n"); exit(EXIT_FAILURE); }
-      if ( SockSendB(SF, SHP_ptr->num_SF_bytes, Alice_socket_desc) < 0 )
-         { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'SF' to Alice!\n"); exit(EXIT_FAILURE); }
+      if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 1, SHP_ptr->num_SF_bytes) < 0 )
+         { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'SF' from Bank to Alice!\n"); exit(EXIT_FAILURE); }
 
       if ( SockGetB((unsigned char *)request_str, max_string_len, Alice_socket_desc) < 0 )
          { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'SPREAD_FACTORS DONE' string from Alice!\n"); exit(EXIT_FAILURE); }
@@ -290,48 +273,27 @@ printf("AliceTTPBankSessionKeyGen(): DONE 'SF'\tFINAL Target attempts %d!\n", ta
 // Get/Send the XMR_SHD generated by Alice to the Bank.
 
 #ifdef DEBUG
-printf("AliceTTPBankSessionKeyGen(): Get/Send 'XHD'!\n"); fflush(stdout);
+printf("AliceTTPBankSessionKeyGen(): Relay 'XHD'!\n"); fflush(stdout);
 #endif
 
    int XMR_num_bytes = target_attempts * SHP_ptr->num_required_PNDiffs/8;
-   unsigned char *XMR_SHD = Allocate1DUnsignedChar(XMR_num_bytes);
 
-   if ( SockGetB(XMR_SHD, XMR_num_bytes, Alice_socket_desc) != XMR_num_bytes )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'XMR_SHD' from Alice!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB(XMR_SHD, XMR_num_bytes, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'XMR_SHD' to Bank!\n"); exit(EXIT_FAILURE); }
+   if ( SockRelayB(max_string_len, Alice_socket_desc, Bank_socket_desc, 1, XMR_num_bytes) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'XMR_SHD' from Alice to Bank!\n"); exit(EXIT_FAILURE); }
 
 // -------------------------------------------
 // verifier_regeneration.c/KEK_SessionKeyGen()
 // Trial encryption
-   unsigned char *trial_encryption = Allocate1DUnsignedChar(AES_INPUT_NUM_BITS/8);
 
 #ifdef DEBUG
-printf("AliceTTPBankSessionKeyGen(): Get/Send 'trial_encryption'!\n"); fflush(stdout);
+printf("AliceTTPBankSessionKeyGen(): Relay 'trial_encryption'!\n"); fflush(stdout);
 #endif
 
-   if ( SockGetB(trial_encryption, AES_INPUT_NUM_BITS/8, Bank_socket_desc) != AES_INPUT_NUM_BITS/8 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'trial_encryption' from Bank!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB(trial_encryption, AES_INPUT_NUM_BITS/8, Alice_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'trial_encryption' to Alice!\n"); exit(EXIT_FAILURE); }
-
-   if ( SockGetB((unsigned char *)request_str, max_string_len, Alice_socket_desc) != 5 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to get 'PASS/FAIL' string from Alice!\n"); exit(EXIT_FAILURE); }
-   if ( SockSendB((unsigned char *)request_str, strlen(request_str)+1, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to send 'PASS/FAIL' string to Bank!\n"); exit(EXIT_FAILURE); }
-
-   if ( vec != NULL )
-      free(vec); 
-   if ( mask != NULL )
-      free(mask); 
-   if ( nonce != NULL )
-      free(nonce); 
-   if ( SF != NULL )
-      free(SF); 
-   if ( XMR_SHD != NULL )
-      free(XMR_SHD); 
-   if ( trial_encryption != NULL )
-      free(trial_encryption); 
+   if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 1, AES_INPUT_NUM_BITS/8) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'trial_encryption' from Bank to Alice!\n"); exit(EXIT_FAILURE); }
+
+   if ( SockRelayB(max_string_len, Alice_socket_desc, Bank_socket_desc, 1, 5) < 0 )
+      { printf("ERROR: AliceTTPBankSessionKeyGen(): Failed to relay 'PASS/FAIL' string from Alice to Bank!\n"); exit(EXIT_FAILURE); }
 
 printf("AliceTTPBankSessionKeyGen(): DONE!\n"); fflush(stdout);
 #ifdef DEBUG
@@ -345,12 +307,13 @@ printf("AliceTTPBankSessionKeyGen(): DONE!\n"); fflush(stdout);
 // ========================================================================================================
 // Alice withdrawal operation. Alice authenticates and generates session key with TTP using zero trust. 
 // She sends her withdrawal amount. TTP maintains Bank account and checks her balance. If okay, TTP 
-// forwards request to Bank.
+// forwards request to Bank. Returns 0 if the exchange with the Bank failed part way, in which case the caller must discard 
+// the Bank channel, and 1 otherwise.
 
-void AliceWithdrawal(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int Alice_socket_desc,
-   pthread_mutex_t *PUFCash_Account_DB_mutex_ptr, pthread_mutex_t *ZeroTrust_AuthenToken_DB_mutex_ptr, 
+int AliceWithdrawal(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int Alice_socket_desc,
+   pthread_mutex_t *ZeroTrust_AuthenToken_DB_mutex_ptr, 
    unsigned char *SK_TF, int min_withdraw_increment, int Bank_socket_desc, int port_number, int num_CIArr, 
-   ClientInfoStruct *Client_CIArr, int My_TTP_index)
+   ClientInfoStruct *Client_CIArr, int My_TTP_index, long long txn_id)
    {
    char request_str[max_string_len];
 
@@ -392,7 +355,7 @@ void AliceWithdrawal(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int A
    if ( remote_AT_status == -1 || local_AT_status == -1 )
       {
       printf("WARNING: AliceWithdrawal(): Alice does NOT have an AT for the TTP: remote_AT_status is 0 => %d!\n", remote_AT_status); fflush(stdout);
-      return; 
+      return 1; 
       }
 
 // Sanity checks.
@@ -408,7 +371,7 @@ void AliceWithdrawal(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int A
    else
       { 
       printf("TTP FAILED in authenticating Alice and generating a shared key!\n"); fflush(stdout); 
-      return;
+      return 1;
       }
 
 // Get Alice-TTP shared key for ZeroTrust.
@@ -446,15 +409,16 @@ void AliceWithdrawal(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int A
 // ===============================
 // 3) TTP checks Alice's Bank account and confirms she is allowed to withdraw this amount. NOTE: Use Alice's chip_num
 // here (NOT her anonymous chip_num). The Bank gets the anonymous value if you decide to send it. Currently, only 
-// one TID allowed at this point.
-   int fail_or_pass; 
-   int TID_DB, num_eCt_DB;
-   int do_update = 0;
-   int update_amt = 0;
+// one TID allowed at this point. The balance check and the debit are one conditional UPDATE (PUFCashLedgerTxn) so 
+// concurrent withdrawals can not both pass the check, and no application lock is needed. The debit is recorded in the 
+// ledger under the request ID of Alice's ALICE-WITHDRAWAL request (txn_id), so a retry of that request is not debited 
+// twice.
+   int ledger_status, num_eCt_DB;
 
-   pthread_mutex_lock(PUFCash_Account_DB_mutex_ptr);
-   PUFCashGetAcctRec(max_string_len, SHP_ptr->DB_PUFCash_V3, Alice_chip_num_encrypted, &TID_DB, &num_eCt_DB, do_update, update_amt); 
-   pthread_mutex_unlock(PUFCash_Account_DB_mutex_ptr);
+   ledger_status = PUFCashLedgerTxn(SHP_ptr->DB_PUFCash_V3, Alice_chip_num_encrypted, txn_id, -num_eCt, &num_eCt_DB); 
+
+   if ( ledger_status == LEDGER_NO_ACCOUNT )
+      { printf("ERROR: AliceWithdrawal(): No PUFCash_Account record for Alice_chip_num %d!\n", Alice_chip_num_encrypted); exit(EXIT_FAILURE); }
 
 // 4) Check request against balance, send ISF or HSF to Alice.
 // ****************************
@@ -462,29 +426,17 @@ void AliceWithdrawal(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int A
 
 //////////////////AishaNEW///////////////////////
 printf("NUM_ECT_DB = %d\n", num_eCt_DB);
-if(num_eCt > num_eCt_DB) {
+if ( ledger_status == LEDGER_INSUFFICIENT_FUNDS ) {
    if ( SockSendB((unsigned char *)"ISF", strlen("ISF")+1, Alice_socket_desc) < 0 )
       { printf("ERROR: AliceWithdrawal(): Failed to send ISF to Alice!\n"); exit(EXIT_FAILURE); }
 }
 else {
    if ( SockSendB((unsigned char *)"HSF", strlen("HSF")+1, Alice_socket_desc) < 0 )
       { printf("ERROR: AliceWithdrawal(): Failed to send HSF to Alice!\n"); exit(EXIT_FAILURE); }
-
-       do_update = 1;
-       update_amt = num_eCt_DB - num_eCt;
-
-      printf("UPDATING HERE\n");
-      pthread_mutex_lock(PUFCash_Account_DB_mutex_ptr);
-      PUFCashGetAcctRec(max_string_len, SHP_ptr->DB_PUFCash_V3, Alice_chip_num_encrypted, &TID_DB, &num_eCt_DB, do_update, update_amt); 
-      pthread_mutex_unlock(PUFCash_Account_DB_mutex_ptr);
 }
 /////////////////////////// ****************************
 
 // 5) Start Bank transaction by sending Alice's request amount and chip_num (or anonomous chip_num).
-   if ( SockSendB((unsigned char *)"WITHDRAW", strlen("WITHDRAW") + 1, Bank_socket_desc) < 0 ) {
-      printf("ERROR: AliceWithdrawal(): Failed to send 'WITHDRAW' to Bank!\n"); exit(EXIT_FAILURE);
-   }
-
 // 6) Encrypt eID_amt with SK_TF
 // ****************************
 // ADD CODE 
@@ -496,8 +448,9 @@ unsigned char *eID_amt_encrypted = Allocate1DUnsignedChar(AES_INPUT_NUM_BYTES);
 
 encrypt_256(SK_TF, SHP_ptr->AES_IV, Alice_request_str, AES_INPUT_NUM_BYTES, eID_amt_encrypted);
 
-if ( SockSendB((unsigned char *)eID_amt, AES_INPUT_NUM_BYTES, Bank_socket_desc) < 0 )
-   { printf("ERROR: AliceWithdrawal(): TTP failed to send encrypted eID_amt to BANK\n"); exit(EXIT_FAILURE); }
+// The WITHDRAW request and eID_amt go to the Bank in one message.
+if ( SockSendRequest(Bank_socket_desc, REQ_OP_WITHDRAW, eID_amt, AES_INPUT_NUM_BYTES) < 0 )
+   { printf("ERROR: AliceWithdrawal(): TTP failed to send 'WITHDRAW' and encrypted eID_amt to BANK\n"); return 0; }
 
 ////////////////////////////////////////////////////
 
@@ -517,18 +470,18 @@ if ( SockSendB((unsigned char *)eID_amt, AES_INPUT_NUM_BYTES, Bank_socket_desc)
 
 
     if ( SockSendB((unsigned char *)LLK, SHP_ptr->ZHK_A_num_bytes, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): TTP failed to send ZeroTrust_LLK to Bank!\n"); exit(EXIT_FAILURE); }
+      { printf("ERROR: AliceWithdrawal(): TTP failed to send ZeroTrust_LLK to Bank!\n"); return 0; }
    //////////////////////////////////////////////////////////////
 
 
 // ===============================
 // 8) Get ACK/NAK from Bank
    if ( SockGetB((unsigned char *)request_str, max_string_len, Bank_socket_desc) != 4 )
-      { printf("ERROR: AliceWithdrawal(): Failed to get 'ACK/NAK' from Bank!\n"); exit(EXIT_FAILURE); }
+      { printf("ERROR: AliceWithdrawal(): Failed to get 'ACK/NAK' from Bank!\n"); return 0; }
    if ( strcmp(request_str, "NAK") == 0 )
       { 
       printf("WARNING: AliceWithdrawal(): Bank sent NAK -- cancelling transaction!\n"); 
-      return; 
+      return 1; 
       }
 
 // 9) Get eeCt and heeCt and forward to Alice.
@@ -539,33 +492,19 @@ if ( SockSendB((unsigned char *)eID_amt, AES_INPUT_NUM_BYTES, Bank_socket_desc)
    ////////////////////////Rachel/////////////////////
    int eCt_tot_bytes = num_eCt * HASH_IN_LEN_BYTES;
 
-   unsigned char *eeCt_buffer = Allocate1DUnsignedChar(eCt_tot_bytes);
-   unsigned char *eheCt_buffer = Allocate1DUnsignedChar(eCt_tot_bytes);
-
-
    printf("num_eCt in TTP = %d\n", num_eCt);
    printf("SIZE OF eCt_tot_bytes = %d\n", eCt_tot_bytes);
 
-   //get eeCt and eheCt from bank
-   printf("--------WAITING FOR eeCt/eheCT--------\n");
+// The TTP cannot read eeCt and eheCt (they are encrypted for Alice), so they are streamed from the Bank to Alice without 
+// being stored here.
+   printf("--------RELAYING eeCt/eheCT--------\n");
 
-   if ( SockGetB((unsigned char *)eeCt_buffer, eCt_tot_bytes, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): Failed to get 'eeCt_buffer' from Bank!\n"); exit(EXIT_FAILURE); }
-
-   if ( SockGetB((unsigned char *)eheCt_buffer, eCt_tot_bytes, Bank_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): Failed to get 'eheCt_buffer' from Bank!\n"); exit(EXIT_FAILURE); }
-
-
-   //send eeCt and eheCt to Alice
-   if ( SockSendB((unsigned char *)eeCt_buffer, eCt_tot_bytes, Alice_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): TTP failed to send encrypted eeCt_buffer to Alice\n"); exit(EXIT_FAILURE); }
-
-   if ( SockSendB((unsigned char *)eheCt_buffer, eCt_tot_bytes, Alice_socket_desc) < 0 )
-      { printf("ERROR: AliceWithdrawal(): TTP failed to send encrypted eheCt_buffer to Alice\n"); exit(EXIT_FAILURE); }
-      printf("--------DONE WAITING FOR eeCt/eheCT--------\n");
+   if ( SockRelayB(max_string_len, Bank_socket_desc, Alice_socket_desc, 2, eCt_tot_bytes) < 0 )
+      { printf("ERROR: AliceWithdrawal(): Failed to relay 'eeCt_buffer/eheCt_buffer' from Bank to Alice!\n"); return 0; }
+      printf("--------DONE RELAYING eeCt/eheCT--------\n");
 
   /////////////////////////////////////////////////////////
-   return;
+   return 1;
    }
 
 
@@ -583,7 +522,7 @@ if ( SockSendB((unsigned char *)eID_amt, AES_INPUT_NUM_BYTES, Bank_socket_desc)
 
 /////////////////////Aisha/////////////////////////////
 void AliceAccount(int max_string_len, SRFHardwareParamsStruct *SHP_ptr, int Alice_socket_desc,
-   pthread_mutex_t *PUFCash_Account_DB_mutex_ptr, pthread_mutex_t *ZeroTrust_AuthenToken_DB_mutex_ptr, 
+   pthread_mutex_t *ZeroTrust_AuthenToken_DB_mutex_ptr, 
    unsigned char *SK_TF, int min_withdraw_increment, int Bank_socket_desc, int port_number, int num_CIArr, 
    ClientInfoStruct *Client_CIArr, int My_TTP_index)
    {
@@ -677,7 +616,7 @@ int TID = 0;
 int num_eCt = 0;
 
 // Only allow one record to exist for each customer at this point.
-      if ( PUFCashGetAcctRec(max_string_len, SHP_ptr->DB_PUFCash_V3, Alice_chip_num, &TID, 
+      if ( PUFCashGetAcctRec(SHP_ptr->DB_PUFCash_V3, Alice_chip_num, &TID, 
          &num_eCt, 0, 0) == 0 ) {
 
          return;
@@ -712,36 +651,63 @@ printf("AliceAccount(): DONE!\n"); fflush(stdout);
 ////////////////////////////////////////////////////////////
 // ========================================================================================================
 // ========================================================================================================
-// TTP thread.
+// Authenticate a Bank channel opened by the channel pool (see CreateChannelPool). This is the mutual authentication the TTP 
+// carries out on its startup connection (TTP-AUTHENTICATION) but without session key generation, so the TTP_session_key the 
+// threads use stays valid. 'arg' is the SRFHardwareParamsStruct, which all the threads share, so authentications are serialized.
+
+int AuthenBankChannel(void *arg, int Bank_socket_desc)
+   {
+   SRFHardwareParamsStruct *SHP_ptr = (SRFHardwareParamsStruct *)arg;
+   int gen_session_key, status;
+
+   static pthread_mutex_t ChannelAuthen_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+   if ( SockSendRequest(Bank_socket_desc, REQ_OP_TTP_CHANNEL_AUTHENTICATION, NULL, 0) < 0 )
+      { printf("ERROR: AuthenBankChannel(): Failed to send 'TTP-CHANNEL-AUTHENTICATION' to Bank!\n"); return 0; }
+
+   pthread_mutex_lock(&ChannelAuthen_mutex);
+   gen_session_key = 0;
+   status = KEK_ClientServerAuthenKeyGen(MAX_STRING_LEN, SHP_ptr, Bank_socket_desc, gen_session_key);
+   pthread_mutex_unlock(&ChannelAuthen_mutex);
+
+   return status;
+   }
+
+
+////////////////////////////////////////////////////////////
+// ========================================================================================================
+// ========================================================================================================
+// TTP thread. 'arg' is the thread's ThreadDataType entry (see CreateThreadPool).
 
-void TTPThread(ThreadDataType *ThreadDataPtr)
+void *TTPThread(void *arg)
    {
+   ThreadDataType *ThreadDataPtr = (ThreadDataType *)arg;
    SRFHardwareParamsStruct *SHP_ptr;
    int Device_socket_desc;
    unsigned char *SK_TF;
    int Bank_socket_desc;
+   int Bank_channel_ok;
    int client_index;
-   int *client_sockets;
+   ServerConnStruct conn;
    int max_string_len;
 
-   char command_str[MAX_STRING_LEN];
+   RequestHeaderStruct command;
 
-   static pthread_mutex_t PUFCash_Account_DB_mutex = PTHREAD_MUTEX_INITIALIZER;
    static pthread_mutex_t ZeroTrust_AuthenToken_DB_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 printf("TTPThread: CREATED!\t(Task %d\tIterationCnt %d)\n", ThreadDataPtr->task_num, ThreadDataPtr->iteration_cnt); fflush(stdout);
 #ifdef DEBUG
 #endif
 
-   while (1)
+// Sleep waiting for the main program to receive connect request from Alice or a TTP, and submit it with its Device_socket_desc.
+// No CPU cycles are wasted here in a busy wait, which is important when we query TTPs for performance information. The thread
+// returns when the pool shrinks or shuts down.
+   while ( GetThreadPoolTask(ThreadDataPtr->TP_ptr, ThreadDataPtr->task_num, &conn) == 1 )
       {
-
-// Sleep waiting for the main program to receive connect request from Alice or a TTP, and assign a Device_socket_desc
-// No CPU cycles are wasted here in a busy wait, which is important when we query TTPs for performance information.
-      pthread_mutex_lock(&(ThreadDataPtr->Thread_mutex));
-      while ( ThreadDataPtr->in_use == 0 )
-         pthread_cond_wait(&(ThreadDataPtr->Thread_cv), &(ThreadDataPtr->Thread_mutex));
-      pthread_mutex_unlock(&(ThreadDataPtr->Thread_mutex));
+      ThreadDataPtr->Device_socket_desc = conn.socket_desc;
+      strcpy(ThreadDataPtr->customer_IP, conn.client_IP);
+      ThreadDataPtr->client_index = conn.client_index;
+      ThreadDataPtr->iteration_cnt = conn.iteration_cnt;
 
 struct timeval t1, t2;
 long elapsed; 
@@ -756,9 +722,7 @@ gettimeofday(&t2, 0);
       SHP_ptr = ThreadDataPtr->SHP_ptr;
       Device_socket_desc = ThreadDataPtr->Device_socket_desc;
       SK_TF = ThreadDataPtr->TTP_session_key;
-      Bank_socket_desc = ThreadDataPtr->Bank_socket_desc;
       client_index = ThreadDataPtr->client_index;
-      client_sockets = ThreadDataPtr->client_sockets;
       max_string_len = ThreadDataPtr->max_string_len;
 
 printf("\nTASK BEGIN: ID %d\tClient index %d\tDevice socket descriptor %d\tIterationCnt %d\n", ThreadDataPtr->task_num, 
@@ -775,29 +739,44 @@ printf("\nTASK BEGIN: ID %d\tClient index %d\tDevice socket descriptor %d\tItera
          exit(EXIT_FAILURE); 
          }
 
-// All socket activity is from Alice or TTP (none ever from the Bank). Get the COMMAND string. 
+// All socket activity is from Alice or TTP (none ever from the Bank). Get the COMMAND as a binary request header.
 #ifdef DEBUG
 printf("Alice request!\n"); fflush(stdout); 
 #endif
-      if ( SockGetB((unsigned char *)command_str, max_string_len, Device_socket_desc) < 0 )
-         { printf("ERROR: TTPThread(): Error receiving 'command_str' from Alice!\n"); exit(EXIT_FAILURE); }
+      if ( SockGetRequest(max_string_len, Device_socket_desc, &command) < 0 )
+         { printf("ERROR: TTPThread(): Error receiving 'command' from Alice!\n"); exit(EXIT_FAILURE); }
 
-printf("\tProcessing command '%s'\tID %d\tITERATION %d\n", command_str, ThreadDataPtr->task_num, ThreadDataPtr->iteration_cnt); fflush(stdout);
+// SockGetRequest has already reported why a request was refused (e.g., an Alice older than REQ_HDR_VERSION). Drop the 
+// connection before taking a Bank channel.
+      if ( command.opcode == REQ_OP_UNKNOWN )
+         {
+         printf("WARNING: TTPThread(): Refused command -- closing Device socket %d!\n", Device_socket_desc); fflush(stdout);
+         CloseEpollSocketServerClient(ThreadDataPtr->ESS_ptr, client_index);
+         continue;
+         }
+
+printf("\tProcessing command '%s'\tRequest ID %u\tID %d\tITERATION %d\n", GetRequestName(command.opcode), command.request_id, 
+   ThreadDataPtr->task_num, ThreadDataPtr->iteration_cnt); fflush(stdout);
 #ifdef DEBUG
 #endif
 
+// Both commands talk to the Bank. Take a Bank channel for the whole exchange so requests from different threads never 
+// interleave on one socket.
+      Bank_socket_desc = AcquireChannel(max_string_len, ThreadDataPtr->BCP_ptr);
+
 // =========================
 // =========================
 // PUF-Cash 3.0: Alice withdrawal. 
-      if ( strcmp(command_str, "ALICE-WITHDRAWAL") == 0 )
-         AliceWithdrawal(max_string_len, SHP_ptr, Device_socket_desc, &PUFCash_Account_DB_mutex, &ZeroTrust_AuthenToken_DB_mutex, SK_TF, 
+      Bank_channel_ok = 1;
+      if ( command.opcode == REQ_OP_ALICE_WITHDRAWAL )
+         Bank_channel_ok = AliceWithdrawal(max_string_len, SHP_ptr, Device_socket_desc, &ZeroTrust_AuthenToken_DB_mutex, SK_TF, 
             MIN_WITHDRAW_INCREMENT, Bank_socket_desc, ThreadDataPtr->port_number, ThreadDataPtr->num_TTPs, ThreadDataPtr->Client_CIArr, 
-            ThreadDataPtr->my_IP_pos);
+            ThreadDataPtr->my_IP_pos, (long long)command.request_id);
 // Aisha
 // PUF-Cash 3.0: Alice account. 
-      else if ( strcmp(command_str, "ALICE-ACCOUNT") == 0 ) {
+      else if ( command.opcode == REQ_OP_ALICE_ACCOUNT ) {
          // printf("Here in condition 2"); fflush(stdout);
-         AliceAccount(max_string_len, SHP_ptr, Device_socket_desc, &PUFCash_Account_DB_mutex, &ZeroTrust_AuthenToken_DB_mutex, SK_TF, 
+         AliceAccount(max_string_len, SHP_ptr, Device_socket_desc, &ZeroTrust_AuthenToken_DB_mutex, SK_TF, 
             MIN_WITHDRAW_INCREMENT, Bank_socket_desc, ThreadDataPtr->port_number, ThreadDataPtr->num_TTPs, ThreadDataPtr->Client_CIArr, 
             ThreadDataPtr->my_IP_pos);
       }
@@ -806,8 +785,13 @@ printf("\tProcessing command '%s'\tID %d\tITERATION %d\n", command_str, ThreadDa
 // =========================
 // Unknown message type
       else
-         { printf("Unknown message '%s'\n", command_str); exit(EXIT_FAILURE); }
+         { printf("Unknown message '%s'\n", GetRequestName(command.opcode)); exit(EXIT_FAILURE); }
 
+// A channel whose exchange broke off may still hold part of a Bank message, so it is closed instead of handed to another thread.
+      if ( Bank_channel_ok == 1 )
+         ReleaseChannel(ThreadDataPtr->BCP_ptr, Bank_socket_desc);
+      else
+         DiscardChannel(ThreadDataPtr->BCP_ptr, Bank_socket_desc);
 
 // ====================================================================================================
 // Close the socket descriptor from another TTP or from Alice, BUT DO NOT CLOSE THE Bank socket descriptor at index 0.
@@ -818,34 +802,24 @@ printf("Closing Device socket %d\n", Device_socket_desc); fflush(stdout);
 #ifdef DEBUG
 #endif
 
-         close(Device_socket_desc);
-
-// Restore activity on this client_socket_descriptor. Note this is a shared array among the threads but no semaphore needed here because 
-// each thread updates a unique element given by client_index.
-         client_sockets[client_index] = 0;
+// Closing also returns the slot given by client_index to the acceptor.
+         CloseEpollSocketServerClient(ThreadDataPtr->ESS_ptr, client_index);
          }
 
-// Else restore the Bank socket descriptor on client socket 0. We assigned -1 to it when the thread was created to prevent main() 
-// OpenMultipleSocketServer() from processing activity while we service the request.
-      else
-         client_sockets[client_index] = Bank_socket_desc;
+// The Bank socket descriptor in slot 0 is never armed in the acceptor since the threads use it (as Bank channel 0) for their own 
+// requests to the Bank.
 
-gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; printf("\tElapsed: Command '%s'\tID %d\tITERATION %d\t%ld us\n\n", 
-   command_str, ThreadDataPtr->task_num, ThreadDataPtr->iteration_cnt, (long)elapsed); fflush(stdout);
+gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; printf("\tElapsed: Command '%s'\tRequest ID %u\tID %d\tITERATION %d\t%ld us\n\n", 
+   GetRequestName(command.opcode), command.request_id, ThreadDataPtr->task_num, ThreadDataPtr->iteration_cnt, (long)elapsed); fflush(stdout);
 #ifdef DEBUG
 #endif
-
-// Indicate to the parent that this thread is available for reassignment.
-      pthread_mutex_lock(&(ThreadDataPtr->Thread_mutex));
-      ThreadDataPtr->in_use = 0;
-      pthread_mutex_unlock(&(ThreadDataPtr->Thread_mutex));
+      RecordRequestStats(ThreadDataPtr->RS_ptr, &command, elapsed);
       }
 
-// Nope -- this generates some type of library required message -- an error. I'm not destroying threads any longer -- they get created and run forever.
+// Nope -- this generates some type of library required message -- an error. Returning hands the thread back to the pool.
 //   pthread_exit(NULL);
 
-// We never return;
-   return;
+   return NULL;
    }
 
 
@@ -855,31 +829,10 @@ gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv
 // MEM LEAK
 //#include <mcheck.h>
 
-#define MAX_THREADS 20
 SRFHardwareParamsStruct SHP[1];
 
-ThreadDataType ThreadDataArr[MAX_THREADS] = {
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, NULL, 0, 0, "", NULL, 0, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   };
+// Per-worker data is allocated in main() for the pool's maximum number of workers.
+ThreadDataType *ThreadDataArr;
 
 int main(int argc, char *argv[]) 
    {
@@ -892,9 +845,16 @@ int main(int argc, char *argv[])
    char *history_file_name;
    char *Bank_IP;
    char *client_IP;
-   int *client_sockets;
 
-   int TTP_socket_desc = 0;
+// Epoll acceptor and the queue that hands its connections to the worker threads.
+   EpollServerStruct *ESS_ptr;
+   ThreadPoolStruct *TP_ptr;
+   ServerConnStruct conn;
+   ChannelPoolStruct *BCP_ptr;
+
+// Per-opcode request counts and service times reported with the pool statistics.
+   RequestStatsStruct RequestStats;
+   int num_threads = SERVER_MAX_THREADS;
    int Device_socket_desc = 0;
    char *TTP_IP;
 
@@ -1004,7 +964,6 @@ int main(int argc, char *argv[])
 //   GetMyIPAddr(MAX_STRING_LEN, "eth0", &TTP_IP);
 
    Allocate1DString(&client_IP, MAX_STRING_LEN);
-   client_sockets = Allocate1DIntArray(MAX_CLIENTS);
 
    Allocate1DString((char **)(&Netlist_name), MAX_STRING_LEN);
    Allocate1DString((char **)(&Synthesis_name), MAX_STRING_LEN);
@@ -1020,6 +979,10 @@ int main(int argc, char *argv[])
 
    strcpy(DB_name_PUFCash_V3, "PUFCash_V3.db");
 
+// Use the 64-bit word versions of the bitstring routines (KEK_FSB_SKE, EliminatePackedBitsFromBS, etc). Set to BIT_OPS_BYTE 
+// to run the original bit-at-a-time versions.
+   SelectBitOps(BIT_OPS_DEFAULT);
+
 // Must be set to 0 until I fully integrate this into all of the primitives.
    use_database_chlngs = 0;
    ChallengeGen_seed = 1;
@@ -1189,19 +1152,16 @@ printf("Reading filesystem database '%s' into memory!\n", DB_name_PUFCash_V3); f
    if ( LoadOrSaveDb(DB_PUFCash_V3, DB_name_PUFCash_V3, 0) != 0 )
       { printf("Failed to open and copy into memory '%s': ERR: %s\n", DB_name_PUFCash_V3, sqlite3_errmsg(DB_PUFCash_V3)); sqlite3_close(DB_PUFCash_V3); exit(EXIT_FAILURE); }
 
+// Bring the schemas up to date, then prepare the runtime statements once, now that the tables have been loaded.
+   MigrateZeroTrustSchema(MAX_STRING_LEN, DB_Trust_AT, DB_name_Trust_AT);
+   MigratePUFCashSchema(MAX_STRING_LEN, DB_PUFCash_V3, DB_name_PUFCash_V3);
+   PrepareZeroTrustSQLStmts(DB_Trust_AT);
+   PreparePUFCashSQLStmts(DB_PUFCash_V3);
+
 // ================================================================================================================================
 // ================================================================================================================================
    SHP_ptr = &(SHP[0]);
 
-// NOTE: WE MUST DO THIS IN THE PARENT because we use it below.
-   static pthread_mutex_t GenChallenge_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// If we set 'use_database_chlngs' to 1, then we can NOT allow more than one thread to run GenChallengeDB() at the same time because we
-// call rand(). If the device or TTP is going to get the same set of random numbers as this verifier is than after srand() is seeded with 
-// 'DB_ChallengeGen_seed', we must block other threads until the vector sequence is completely generated, i.e., rand() is NOT re-entrant!
-// We can do this in main() or here once we've initialized the GenChallenge_mutex mutex above (it is static and therefore global to all threads).
-   SHP_ptr->GenChallenge_mutex_ptr = &GenChallenge_mutex;
-
 
 // =========================
 // Set some of the params in the data structure. NOTE: This structure is not really used AFTER the authentication and session key generation
@@ -1416,13 +1376,19 @@ printf("Bank_socket_descriptor %d\n", Bank_socket_desc); fflush(stdout);
 #endif
 
 // ========================================================
-// Initialize all client_sockets to 0. We do NOT DO THIS any longer in the call to OpenMultipleSocketServer below.
-   int client_num;
-   for ( client_num = 0; client_num < MAX_CLIENTS; client_num++) 
-      { client_sockets[client_num] = 0; }
+// Open the listening socket now so the worker threads started below can close connections through ESS_ptr. 
+   ESS_ptr = OpenEpollSocketServer(TTP_IP, port_number, SERVER_LISTEN_BACKLOG, MAX_CLIENTS);
 
-// Add the TTP socket to the client_sockets list so we can monitor activity on it. 
-   client_sockets[0] = Bank_socket_desc;
+// Reserve slot 0 for the Bank socket. It is never armed: the threads use it for their own requests to the Bank, so activity 
+// on it must not be dispatched as a new request.
+   if ( AddEpollSocketServerClient(MAX_STRING_LEN, ESS_ptr, Bank_socket_desc, 0) != 0 )
+      { printf("ERROR: Bank socket descriptor MUST be stored at client index 0!\n"); exit(EXIT_FAILURE); }
+
+   if ( (ThreadDataArr = (ThreadDataType *)calloc(num_threads, sizeof(ThreadDataType))) == NULL )
+      { printf("ERROR: Failed to allocate storage for %d ThreadDataArr elements!\n", num_threads); exit(EXIT_FAILURE); }
+   TP_ptr = CreateThreadPool(SERVER_MIN_THREADS, num_threads, SERVER_THREAD_IDLE_TIMEOUT_MS, SERVER_CONN_QUEUE_SIZE, 
+      TTPThread, (void *)ThreadDataArr, sizeof(ThreadDataType));
+   InitRequestStats(&RequestStats);
 
 
 // ================================================================================================
@@ -1448,7 +1414,7 @@ printf("Bank_socket_descriptor %d\n", Bank_socket_desc); fflush(stdout);
 // We must have a session key generated. We will do authentication twice ONLY one time when the AuthenticationToken.db is overwritten.
 
 // Mutually authenticate and generate TTP_session_key with the Bank. NOTE: KEK_DeviceAuthentication() return chip_num = -1 IF IT FAILS. 
-   if ( SockSendB((unsigned char *)"TTP-AUTHENTICATION", strlen("TTP-AUTHENTICATION") + 1, Bank_socket_desc) < 0 )
+   if ( SockSendRequest(Bank_socket_desc, REQ_OP_TTP_AUTHENTICATION, NULL, 0) < 0 )
       { printf("ERROR: main(): Failed to send 'TTP-AUTHENTICATION' to Bank!\n"); exit(EXIT_FAILURE); }
    gen_session_key = 1;
    if ( KEK_ClientServerAuthenKeyGen(MAX_STRING_LEN, SHP_ptr, Bank_socket_desc, gen_session_key) == 0 )
@@ -1488,7 +1454,7 @@ printf("Bank_socket_descriptor %d\n", Bank_socket_desc); fflush(stdout);
    unsigned char **nonce_arr = NULL;
    int unused;
    int is_TTP = 1;
-   if ( ZeroTrustGetCustomerATs(MAX_STRING_LEN, SHP_ptr->DB_Trust_AT, &chip_num_arr, &chlng_num_arr, SHP_ptr->ZHK_A_num_bytes, 
+   if ( ZeroTrustGetCustomerATs(SHP_ptr->DB_Trust_AT, &chip_num_arr, &chlng_num_arr, SHP_ptr->ZHK_A_num_bytes, 
       &ZHK_A_nonce_arr, &nonce_arr, get_only_customer_AT, customer_chip_num, return_customer_AT_info, report_tot_num_ATs_only, &unused) == 0 )
       {
 printf("No customer ATs found! Enrolling\n"); fflush(stdout);
@@ -1502,7 +1468,7 @@ printf("No customer ATs found! Enrolling\n"); fflush(stdout);
 // Get list of (TTP) IPs from Bank. This just checks that the Bank TTP IP matches the one used by this device (which runs as a TTP).
 
 // Tell Bank we want the TTP IP information that it stores on the TTPs.
-   if ( SockSendB((unsigned char *)"TTP-MASTER-GET-TTP-IP-INFO", strlen("TTP-MASTER-GET-TTP-IP-INFO") + 1, Bank_socket_desc) < 0 )
+   if ( SockSendRequest(Bank_socket_desc, REQ_OP_TTP_MASTER_GET_TTP_IP_INFO, NULL, 0) < 0 )
       { printf("ERROR: Failed to send 'TTP-MASTER-GET-TTP-IP-INFO' to Bank!\n"); exit(EXIT_FAILURE); }
 
 // This call checks to determine that the Bank has the correct TTP IP (the one used here must match the one sent by the Bank).
@@ -1526,10 +1492,17 @@ printf("main(): Bank returned num_TTPs %d!\n", num_TTPs); fflush(stdout);
    if ( GetCustomerChipNums(MAX_STRING_LEN, SHP_ptr, TTP_session_key, Bank_socket_desc, TID, default_deposit_amt) == 0 )
       exit(EXIT_FAILURE);
    
+// ========================================================
+// Persistent Bank channels shared by the threads. The authenticated startup connection is channel 0; more connections are 
+// opened under load, authenticated with the Bank (AuthenBankChannel) and kept open, so a withdrawal never waits on a TCP 
+// handshake to the Bank once the pool has grown.
+   BCP_ptr = CreateChannelPool(Bank_IP, port_number, Bank_socket_desc, BANK_MAX_CHANNELS, AuthenBankChannel, 
+      (void *)SHP_ptr);
+
 // ========================================================
 // THREADS:
-// Load up data structure for the thread. Do this here so the threads can share the Bank socket descriptor. 
-   for ( thread_num = 0; thread_num < MAX_THREADS; thread_num++ )
+// Load up data structure for the thread. Do this here so the threads can share the Bank channels. 
+   for ( thread_num = 0; thread_num < num_threads; thread_num++ )
       {
       ThreadDataArr[thread_num].history_file_name = history_file_name;
       ThreadDataArr[thread_num].task_num = thread_num;
@@ -1539,13 +1512,14 @@ printf("main(): Bank returned num_TTPs %d!\n", num_TTPs); fflush(stdout);
       ThreadDataArr[thread_num].SHP_ptr = &(SHP[0]);
 
 
-      ThreadDataArr[thread_num].Bank_socket_desc = Bank_socket_desc;
+      ThreadDataArr[thread_num].BCP_ptr = BCP_ptr;
       ThreadDataArr[thread_num].Device_socket_desc = -1;
       ThreadDataArr[thread_num].TTP_session_key = TTP_session_key;
       ThreadDataArr[thread_num].port_number = port_number;
-      ThreadDataArr[thread_num].in_use = 0;
       ThreadDataArr[thread_num].client_index = -1;
-      ThreadDataArr[thread_num].client_sockets = client_sockets;
+      ThreadDataArr[thread_num].ESS_ptr = ESS_ptr;
+      ThreadDataArr[thread_num].TP_ptr = TP_ptr;
+      ThreadDataArr[thread_num].RS_ptr = &RequestStats;
       ThreadDataArr[thread_num].num_TTPs = num_TTPs;
       ThreadDataArr[thread_num].max_string_len = MAX_STRING_LEN;
       ThreadDataArr[thread_num].max_TTP_connect_attempts = MAX_CONNECT_ATTEMPTS;
@@ -1558,38 +1532,15 @@ printf("main(): Bank returned num_TTPs %d!\n", num_TTPs); fflush(stdout);
       ThreadDataArr[thread_num].exclude_self = exclude_self;
       ThreadDataArr[thread_num].RANDOM = RANDOM;
       ThreadDataArr[thread_num].num_eCt_nonce_bytes = num_eCt_nonce_bytes;
+      }
 
 // ******************************************************
-// Create a set of static threads -- thread memory management on the Cora/Zybo seems to have problems. Pass to each a copy
-// of DeviceDataArr structure. The loop below will update Device_socket_desc, client_index and in_use. The Thread will use
-// the Device_socket_desc as the new communication channel. The client_index refers to the element in the client_sockets
-// array that is in use during the message processing -- the processing thread will set this back to client_sockets[client_index]
-// back to 0 before finishing. The Threads are in an infinit loop testing the in_use field. The parent here sets this to 1
-// when a new message is to be processed.
-//
-// We need to call pthread_cancel() to have the pthread free resources (I think pthread_detach also frees resources). If I
-// try to use pthread_cancel, I get a library complaint that some part of the thread library is missing -- need a newer version,
-// or whatever. Since I create all these threads statically I don't need to create and destroy them so no need for these functions
-// anyway.
-
-// Allocate all threads. 
-      int err;
-      pthread_t thread_id;
-      if ( (err = pthread_create((pthread_t *)&thread_id, NULL, (void *)TTPThread, (void *)&(ThreadDataArr[thread_num]))) != 0 )
-         { printf("Failed to create thread: %d\n", err); fflush(stdout); }
-
-// Detach thread since we don't need to synchronize with it (no 'join' required). Also allows resources to be freed when thread 
-// terminates.
-//      pthread_detach(thread_id);
-
-#ifdef DEBUG
-printf("Thread ID %lu\n", (unsigned long int)thread_id); fflush(stdout);
-#endif
-
-printf("Number of threads created: %d\n", thread_num + 1); fflush(stdout);
-#ifdef DEBUG
-#endif
-      }
+// Start the worker threads. Thread memory management on the Cora/Zybo seems to have problems, so the pool reuses the 
+// ThreadDataArr element of a worker slot instead of allocating one per thread. The loop below submits each new connection 
+// to the pool and an idle thread takes it. The Thread will use the Device_socket_desc as the new communication channel. The 
+// client_index refers to the slot in the epoll acceptor that is in use during the message processing -- the processing 
+// thread closes it before finishing. 
+   StartThreadPool(TP_ptr);
 
 // Now that we've made copies of Client_CIArr, we can NULL out the original array. Memory leak on session_keys, etc.
 // but not important since we do this exactly once at startup.
@@ -1602,38 +1553,18 @@ printf("Number of threads created: %d\n", thread_num + 1); fflush(stdout);
 // ===========================================================================================================================
    int num_iterations;
    int iteration;
-   int first_time = 1;
 
    num_iterations = -1;
    for ( iteration = 0; (iteration < num_iterations || num_iterations == -1) && keepRunning == 1; iteration++ )
       {
 
-// Note: If NOT a new connection, 'client_IP' is NOT filled in by OpenMultipleSocketServer(). 'client_IP' is NOT filled in
-// for repeated communications from the Bank since we do NOT close this socket. NOTE: On FIRST call, client_sockets array is
-// NO LONGER initialized to ALL zeros so we preserve assignment above.
-      strcpy(client_IP, "");
-      client_index = -1;
+// Note: 'client_IP' is filled in by WaitEpollSocketServer() for new connections. The Bank socket in slot 0 is never armed, so 
+// its activity is not reported here. Connections beyond MAX_CLIENTS are refused inside WaitEpollSocketServer(), so 'client_index' 
+// is -1 only when epoll_wait was interrupted by a signal, e.g., Ctrl-C, and the loop test picks up 'keepRunning'.
       Device_socket_desc = 0;
-      SD = OpenMultipleSocketServer(MAX_STRING_LEN, &TTP_socket_desc, TTP_IP, port_number, client_IP, MAX_CLIENTS, client_sockets, 
-         &client_index, first_time);
-      first_time = 0;
-
-// Interesting but I hadn't realized that my OpenMultipleSocketServer() routine will return every time something happens on an
-// open socket, with SD = 0 and client_IP = 0.0.0.0, and with 'client_index' and 'client_sockets[client_index]' set to the open socket.
-// And not just on socket connection requests! I hadn't seen this before because I would not call OpenMultipleSocketServer() again until 
-// after all packets were processed by the code that used to run sequentially below but is now in a thread. With this spun off into a 
-// thread, OpenMultipleSocketServer() gets called immediately after the thread is created (the whole point of using threads is to allow 
-// parallelism). For sockets that are open already and have threads serving them, SD is 0. Let's ignore these. The Bank also sends
-// messages here since it stays permanently connected. 
-//      if ( SD == 0 )
-//         continue;
-// 5/6/2020: FIXED THIS when I created verifier_regeneration_pT.c. Changed ../PROTOCOL/common.c OpenMultipleSocketServer. BUT STILL
-// NEED this to filter spurious Bank events. 
-      if ( client_index == 0 )
-         { 
-//         printf("WARNING: SKIPPING 'spurious' Bank descriptor activity!\n"); fflush(stdout);
+      SD = WaitEpollSocketServer(MAX_STRING_LEN, ESS_ptr, client_IP, &client_index);
+      if ( client_index == -1 )
          continue;
-         }
 
 #ifdef DEBUG
 struct timeval t1, t2;
@@ -1641,13 +1572,9 @@ long elapsed;
 gettimeofday(&t2, 0);
 #endif
 
-// Sanity check
-      if ( client_index == -1 )
-         { printf("ERROR: Failed to find an empty slot in client_sockets -- increase MAX_CLIENTS!\n"); exit(EXIT_FAILURE); }
-
-printf("SD and Client_IP returned by OpenMultipleSocketServer %d and %s, stored at client_index %d in client_sockets %d!\n", SD, client_IP, 
-   client_index, client_sockets[client_index]); fflush(stdout);
-printf("\tBank SD and Bank_IP %d and %s, stored at client_index 0 in client_sockets[0] => %d!\n", Bank_socket_desc, Bank_IP, client_sockets[0]); fflush(stdout);
+printf("SD and Client_IP returned by WaitEpollSocketServer %d and %s, stored at client_index %d in client_sockets %d!\n", SD, client_IP, 
+   client_index, ESS_ptr->client_sockets[client_index]); fflush(stdout);
+printf("\tBank SD and Bank_IP %d and %s, stored at client_index 0 in client_sockets[0] => %d!\n", Bank_socket_desc, Bank_IP, ESS_ptr->client_sockets[0]); fflush(stdout);
 #ifdef DEBUG
 #endif
 
@@ -1661,40 +1588,25 @@ printf("\nITERATION %d\n", iteration);
 #ifdef DEBUG
 #endif
 
-// Search for a thread that is available. Note that I reserve the last thread as a periodic history printing thread so
-// it is never available. Note that there is a loop above that also eliminates this tread so if you add it back, change 
-// it above too.
-      int found_one = 0;
-      while ( found_one == 0 )
-         {
-         for ( thread_num = 0; thread_num < MAX_THREADS - 1; thread_num++ )
-            {
-            pthread_mutex_lock(&(ThreadDataArr[thread_num].Thread_mutex));
-            if ( ThreadDataArr[thread_num].in_use == 0 )
-               {
-               ThreadDataArr[thread_num].Device_socket_desc = Device_socket_desc;
-               strcpy(ThreadDataArr[thread_num].customer_IP, client_IP);
-               ThreadDataArr[thread_num].client_index = client_index;
-               ThreadDataArr[thread_num].iteration_cnt = iteration;
-               ThreadDataArr[thread_num].in_use = 1;
-               found_one = 1;
-
-// Make further activity on this socket descriptors ignored by OpenMultipleSocketServer() until the thread restores the 
-// client_socket value when it completes communication with a TTP.
-               client_sockets[client_index] = -1;
-
-               pthread_cond_signal(&(ThreadDataArr[thread_num].Thread_cv));
-               }
-            pthread_mutex_unlock(&(ThreadDataArr[thread_num].Thread_mutex));
-            if ( found_one == 1 )
-               break;
-            }
-         }
-       
-printf("\tTasking Thread %d\n", thread_num); fflush(stdout);
+// Hand the connection to the first idle thread. Blocks only when SERVER_CONN_QUEUE_SIZE requests are already waiting for a thread.
+      conn.socket_desc = Device_socket_desc;
+      conn.client_index = client_index;
+      conn.iteration_cnt = iteration;
+      conn.TTP_num = -1;
+      strcpy(conn.client_IP, client_IP);
+      SubmitThreadPoolTask(TP_ptr, &conn);
+
 #ifdef DEBUG
+printf("\tQueued client index %d\n", client_index); fflush(stdout);
 #endif
 
+      if ( (iteration + 1) % SERVER_POOL_STATS_INTERVAL == 0 )
+         {
+         PrintThreadPoolStats(TP_ptr);
+         PrintRequestStats(&RequestStats);
+         PrintChannelPoolStats(BCP_ptr);
+         }
+
 // Used this to find the bug with thread memory management. I used to create and destroy threads here dynamically. Instead creating them statically
 // above and putting them in a forever loop.
 //      TTPThread(&(ThreadDataArr[thread_num]));
@@ -1708,20 +1620,29 @@ gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv
 #endif
       }
 
+// Let the workers finish the requests already queued before the database is saved.
+   ShutdownThreadPool(TP_ptr);
+   PrintThreadPoolStats(TP_ptr);
+   PrintRequestStats(&RequestStats);
+   PrintChannelPoolStats(BCP_ptr);
+
 // I do saves periodically in the threads without closing it. This is likely never called b/c we hit Ctrl-C. 
    printf("Saving 'in memory' '%s' to filesystem!\n", SHP_ptr->DB_name_Trust_AT); fflush(stdout);
    if ( LoadOrSaveDb(SHP_ptr->DB_Trust_AT, SHP_ptr->DB_name_Trust_AT, 1) != 0 )
       { printf("Failed to store 'in memory' database to %s: %s\n", SHP_ptr->DB_name_Trust_AT, sqlite3_errmsg(SHP_ptr->DB_Trust_AT)); sqlite3_close(SHP_ptr->DB_Trust_AT); exit(EXIT_FAILURE); }
+   FinalizeSQLStmtCache(SHP_ptr->DB_Trust_AT);
    sqlite3_close(SHP_ptr->DB_Trust_AT);
 
    printf("Saving 'in memory' '%s' to filesystem!\n", SHP_ptr->DB_name_PUFCash_V3); fflush(stdout);
    if ( LoadOrSaveDb(SHP_ptr->DB_PUFCash_V3, SHP_ptr->DB_name_PUFCash_V3, 1) != 0 )
       { printf("Failed to store 'in memory' database to %s: %s\n", SHP_ptr->DB_name_PUFCash_V3, sqlite3_errmsg(SHP_ptr->DB_PUFCash_V3)); sqlite3_close(SHP_ptr->DB_PUFCash_V3); exit(EXIT_FAILURE); }
+   FinalizeSQLStmtCache(SHP_ptr->DB_PUFCash_V3);
    sqlite3_close(SHP_ptr->DB_PUFCash_V3);
 
    free(TTP_session_key);
 
-   close(Bank_socket_desc);
+// Closes Bank_socket_desc (channel 0) too.
+   CloseChannelPool(BCP_ptr);
    return 0;
    }
 
@@ -100,6 +100,284 @@ float ComputeMedian(int num_vals, float *vals)
    }
 
 
+// ===========================================================================================================
+// ===========================================================================================================
+// Return the k'th smallest (0-based) of num_vals integers using Hoare's selection algorithm (quickselect). 
+// Average O(num_vals), no sort. NOTE: The array is PARTIALLY REORDERED in place, so pass a scratch copy.
+
+int SelectKthSmallestInt(int num_vals, int *vals, int k)
+   {
+   int low, high, i, j;
+   int pivot, temp;
+
+   if ( k < 0 || k >= num_vals )
+      { printf("ERROR: SelectKthSmallestInt(): k %d must be >= 0 and < %d!\n", k, num_vals); exit(EXIT_FAILURE); }
+
+   low = 0;
+   high = num_vals - 1;
+   while ( low < high )
+      {
+
+// Middle element as pivot. Partition [low, high] into values <= pivot and >= pivot.
+      pivot = vals[low + (high - low)/2];
+      i = low;
+      j = high;
+      while ( i <= j )
+         {
+         while ( vals[i] < pivot )
+            i++;
+         while ( vals[j] > pivot )
+            j--;
+         if ( i <= j )
+            {
+            temp = vals[i]; vals[i] = vals[j]; vals[j] = temp;
+            i++;
+            j--;
+            }
+         }
+
+// Continue in the partition that contains k. Elements between j and i are equal to the pivot.
+      if ( k <= j )
+         high = j;
+      else if ( k >= i )
+         low = i;
+      else
+         return vals[k];
+      }
+
+   return vals[k];
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Float version of SelectKthSmallestInt. NOTE: The array is PARTIALLY REORDERED in place: on return, vals[0..k-1] 
+// are <= vals[k] <= vals[k+1..num_vals-1].
+
+float SelectKthSmallestFloat(int num_vals, float *vals, int k)
+   {
+   int low, high, i, j;
+   float pivot, temp;
+
+   if ( k < 0 || k >= num_vals )
+      { printf("ERROR: SelectKthSmallestFloat(): k %d must be >= 0 and < %d!\n", k, num_vals); exit(EXIT_FAILURE); }
+
+   low = 0;
+   high = num_vals - 1;
+   while ( low < high )
+      {
+      pivot = vals[low + (high - low)/2];
+      i = low;
+      j = high;
+      while ( i <= j )
+         {
+         while ( vals[i] < pivot )
+            i++;
+         while ( vals[j] > pivot )
+            j--;
+         if ( i <= j )
+            {
+            temp = vals[i]; vals[i] = vals[j]; vals[j] = temp;
+            i++;
+            j--;
+            }
+         }
+
+      if ( k <= j )
+         high = j;
+      else if ( k >= i )
+         low = i;
+      else
+         return vals[k];
+      }
+
+   return vals[k];
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Median of num_vals values, identical to ComputeMedian (average of the two middle values if num_vals is even) 
+// but by selection instead of a sort. The values must be in a scratch array: it is PARTIALLY REORDERED.
+
+static float SelectMedianFloat(int num_vals, float *vals)
+   {
+   float upper, lower;
+   int i;
+
+   upper = SelectKthSmallestFloat(num_vals, vals, num_vals/2);
+   if ( num_vals % 2 == 1 )
+      return upper;
+
+// The lower middle value is the largest of the values left of num_vals/2 after the selection.
+   lower = vals[0];
+   for ( i = 1; i < num_vals/2; i++ )
+      if ( vals[i] > lower )
+         lower = vals[i];
+
+   return (lower + upper)/2;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Median by counting, for values quantized to 1/MEDIAN_QUANTUM_INV (the PNDc are, see GPEVCal) whose range spans 
+// at most MEDIAN_HIST_MAX_BINS quanta. 'hist' must have MEDIAN_HIST_MAX_BINS entries and is left zeroed. Returns 
+// 0 (and touches nothing) if the values do not qualify, in which case use SelectMedianFloat.
+
+static int HistogramMedianFloat(int num_vals, float *vals, int *hist, float *median_ptr)
+   {
+   int i, q, q_min, q_max, k_low, k_high, q_low, q_high, cnt;
+   float scaled;
+
+   q_min = q_max = 0;
+   for ( i = 0; i < num_vals; i++ )
+      {
+      scaled = vals[i]*(float)MEDIAN_QUANTUM_INV;
+      if ( scaled != floorf(scaled) || fabsf(scaled) > 16777216.0 )
+         return 0;
+      q = (int)scaled;
+      if ( i == 0 || q < q_min )
+         q_min = q;
+      if ( i == 0 || q > q_max )
+         q_max = q;
+      }
+   if ( q_max - q_min >= MEDIAN_HIST_MAX_BINS )
+      return 0;
+
+   for ( i = 0; i < num_vals; i++ )
+      hist[(int)(vals[i]*(float)MEDIAN_QUANTUM_INV) - q_min]++;
+
+// Walk the counts to the (0-based) ranks of the two middle values, which are the same if num_vals is odd.
+   k_low = (num_vals - 1)/2;
+   k_high = num_vals/2;
+   q_low = q_high = q_min;
+   cnt = 0;
+   for ( q = 0; q <= q_max - q_min; q++ )
+      {
+      if ( cnt <= k_low && cnt + hist[q] > k_low )
+         q_low = q + q_min;
+      if ( cnt <= k_high && cnt + hist[q] > k_high )
+         q_high = q + q_min;
+      cnt += hist[q];
+      hist[q] = 0;
+      }
+
+   if ( num_vals % 2 == 1 )
+      *median_ptr = (float)q_high/(float)MEDIAN_QUANTUM_INV;
+   else
+      *median_ptr = ((float)q_low/(float)MEDIAN_QUANTUM_INV + (float)q_high/(float)MEDIAN_QUANTUM_INV)/2;
+
+   return 1;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Median of each column of a row-major num_rows x num_cols matrix (rows[row][col], e.g., chip-major PNDc), 
+// same result as ComputeMedian on each column. The matrix is read once, MEDIAN_BLOCK_COLS columns at a time, 
+// into a column-major scratch block that is reused for every block, and each column takes the counting path 
+// if 'use_histogram' is 1 and its values qualify (see HistogramMedianFloat), else quickselect. Average 
+// O(num_rows) per column instead of the O(num_rows log num_rows) of the sort.
+
+void ComputeColumnMedians(int num_rows, int num_cols, float **rows, float *medians, int use_histogram)
+   {
+   int row, col, block_col, num_block_cols;
+   float *block, *col_vals;
+   int *hist;
+
+   if ( num_rows <= 0 )
+      { printf("ERROR: ComputeColumnMedians(): Number of rows MUST be > 0!\n"); exit(EXIT_FAILURE); }
+
+   if ( (block = (float *)malloc(sizeof(float) * num_rows * MEDIAN_BLOCK_COLS)) == NULL )
+      { printf("ERROR: ComputeColumnMedians(): Malloc FAILED!\n"); exit(EXIT_FAILURE); }
+   hist = NULL;
+   if ( use_histogram == 1 && (hist = (int *)calloc(MEDIAN_HIST_MAX_BINS, sizeof(int))) == NULL )
+      { printf("ERROR: ComputeColumnMedians(): Calloc FAILED!\n"); exit(EXIT_FAILURE); }
+
+   for ( col = 0; col < num_cols; col += MEDIAN_BLOCK_COLS )
+      {
+      num_block_cols = (num_cols - col < MEDIAN_BLOCK_COLS) ? num_cols - col : MEDIAN_BLOCK_COLS;
+
+// Transpose the block so each column is contiguous.
+      for ( row = 0; row < num_rows; row++ )
+         for ( block_col = 0; block_col < num_block_cols; block_col++ )
+            block[block_col*num_rows + row] = rows[row][col + block_col];
+
+      for ( block_col = 0; block_col < num_block_cols; block_col++ )
+         {
+         col_vals = &(block[block_col*num_rows]);
+         if ( hist == NULL || HistogramMedianFloat(num_rows, col_vals, hist, &(medians[col + block_col])) == 0 )
+            medians[col + block_col] = SelectMedianFloat(num_rows, col_vals);
+         }
+      }
+
+   if ( hist != NULL )
+      free(hist);
+   free(block);
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// qsort: order WeightedValStruct by value.
+
+static int WeightedValCompareFunc(const void *v1, const void *v2)
+   {
+   float val1 = ((WeightedValStruct *)v1)->val, val2 = ((WeightedValStruct *)v2)->val;
+
+   return (val1 > val2) - (val1 < val2);
+   }
+
+// Weighted percentile: the smallest value v such that the values <= v carry at least 'percentile' (0.0 to 1.0) 
+// of the total weight. With equal weights and percentile 0.5 this is the LOWER median (no averaging). Weights 
+// MUST be >= 0 with a positive sum. 'vals' and 'weights' are not modified.
+
+float ComputeWeightedPercentile(int num_vals, float *vals, float *weights, float percentile)
+   {
+   WeightedValStruct *wvals;
+   double tot_weight, target, cum_weight;
+   float result;
+   int i;
+
+   if ( num_vals <= 0 || percentile < 0.0 || percentile > 1.0 )
+      { printf("ERROR: ComputeWeightedPercentile(): num_vals %d MUST be > 0 and percentile %f in [0, 1]!\n", num_vals, percentile); exit(EXIT_FAILURE); }
+
+   if ( (wvals = (WeightedValStruct *)malloc(num_vals*sizeof(WeightedValStruct))) == NULL )
+      { printf("ERROR: ComputeWeightedPercentile(): Malloc FAILED!\n"); exit(EXIT_FAILURE); }
+
+   tot_weight = 0.0;
+   for ( i = 0; i < num_vals; i++ )
+      {
+      if ( weights[i] < 0.0 )
+         { printf("ERROR: ComputeWeightedPercentile(): Weight %d is negative %f!\n", i, weights[i]); exit(EXIT_FAILURE); }
+      wvals[i].val = vals[i];
+      wvals[i].weight = weights[i];
+      tot_weight += weights[i];
+      }
+   if ( tot_weight <= 0.0 )
+      { printf("ERROR: ComputeWeightedPercentile(): Sum of weights MUST be > 0!\n"); exit(EXIT_FAILURE); }
+
+   qsort(wvals, num_vals, sizeof(WeightedValStruct), WeightedValCompareFunc);
+
+   target = percentile*tot_weight;
+   cum_weight = 0.0;
+   result = wvals[num_vals - 1].val;
+   for ( i = 0; i < num_vals; i++ )
+      {
+      cum_weight += wvals[i].weight;
+      if ( cum_weight >= target && wvals[i].weight > 0.0 )
+         { result = wvals[i].val; break; }
+      }
+
+   free(wvals);
+
+   return result;
+   }
+
+
 // ===========================================================================================================
 // ===========================================================================================================
 
@@ -143,6 +421,232 @@ void SetBitInByte(unsigned char *byte_ptr, int bit_val, int bit_pos)
    }
 
 
+// ===========================================================================================================
+// ===========================================================================================================
+// Word-level bitstring support. Byte-packed bitstrings store bit i in bit position (i % 8) of byte i/8, so 
+// 64 consecutive bits starting at any bit position can be loaded into a uint64_t with bit i of the bitstring
+// in bit 0 of the word. BitOpsMode selects between the original bit-at-a-time routines (BIT_OPS_BYTE) and the
+// 64-bit word versions (BIT_OPS_WORD). The word versions use the BMI2 pext/pdep instructions when the CPU 
+// supports them, and a portable loop otherwise (e.g., on the ARM devices).
+
+int BitOpsMode = BIT_OPS_DEFAULT;
+int BitOpsHaveBMI2 = 0;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+__attribute__((target("bmi2"))) uint64_t ExtractBits64BMI2(uint64_t word, uint64_t mask)
+   { return _pext_u64(word, mask); }
+
+__attribute__((target("bmi2"))) uint64_t DepositBits64BMI2(uint64_t word, uint64_t mask)
+   { return _pdep_u64(word, mask); }
+#endif
+
+// Select the bitstring engine. Call this once at startup before any threads are created.
+void SelectBitOps(int bit_ops_mode)
+   {
+   if ( bit_ops_mode != BIT_OPS_BYTE && bit_ops_mode != BIT_OPS_WORD )
+      { printf("ERROR: SelectBitOps(): Unknown bit ops mode %d!\n", bit_ops_mode); exit(EXIT_FAILURE); }
+   BitOpsMode = bit_ops_mode;
+
+   BitOpsHaveBMI2 = 0;
+#if defined(__x86_64__) && defined(__GNUC__)
+   __builtin_cpu_init();
+   if ( __builtin_cpu_supports("bmi2") )
+      BitOpsHaveBMI2 = 1;
+#endif
+
+#ifdef DEBUG
+printf("SelectBitOps(): Bit ops mode %d\tBMI2 %d\n", BitOpsMode, BitOpsHaveBMI2); fflush(stdout);
+#endif
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Number of '1' bits in a word.
+
+int PopCount64(uint64_t word)
+   { return __builtin_popcountll(word); }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Gather the bits of 'word' at the positions of the '1's in 'mask' into the low order bits of the result (pext).
+
+uint64_t ExtractBits64(uint64_t word, uint64_t mask)
+   {
+   uint64_t result, bit;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+   if ( BitOpsHaveBMI2 == 1 )
+      return ExtractBits64BMI2(word, mask);
+#endif
+
+   result = 0;
+   for ( bit = 1; mask != 0; bit <<= 1 )
+      {
+      if ( (word & mask & -mask) != 0 )
+         result |= bit;
+      mask &= mask - 1;
+      }
+   return result;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Scatter the low order bits of 'word' to the positions of the '1's in 'mask' (pdep).
+
+uint64_t DepositBits64(uint64_t word, uint64_t mask)
+   {
+   uint64_t result, bit;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+   if ( BitOpsHaveBMI2 == 1 )
+      return DepositBits64BMI2(word, mask);
+#endif
+
+   result = 0;
+   for ( bit = 1; mask != 0; bit <<= 1 )
+      {
+      if ( (word & bit) != 0 )
+         result |= mask & -mask;
+      mask &= mask - 1;
+      }
+   return result;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Load 'num_bits' (0 to 64) bits starting at bit position 'bit_pos' of the byte-packed bitstring 'bs'. Only the 
+// bytes holding these bits are read. Bits above num_bits in the result are 0.
+
+uint64_t LoadBitWord(unsigned char *bs, int bit_pos, int num_bits)
+   {
+   int first_byte, last_byte, byte_num, shift;
+   uint64_t word;
+
+   if ( num_bits <= 0 )
+      return 0;
+
+   first_byte = bit_pos/8;
+   last_byte = (bit_pos + num_bits - 1)/8;
+   shift = bit_pos % 8;
+
+   word = (uint64_t)bs[first_byte] >> shift;
+   for ( byte_num = first_byte + 1; byte_num <= last_byte; byte_num++ )
+      word |= (uint64_t)bs[byte_num] << ((byte_num - first_byte)*8 - shift);
+
+   if ( num_bits < 64 )
+      word &= ((uint64_t)1 << num_bits) - 1;
+   return word;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Store the low order 'num_bits' (0 to 64) bits of 'word' starting at bit position 'bit_pos' of the byte-packed 
+// bitstring 'bs'. Bits outside this range are preserved.
+
+void StoreBitWord(unsigned char *bs, int bit_pos, int num_bits, uint64_t word)
+   {
+   int byte_num, bit_in_byte, bits_in_byte;
+   unsigned char byte_mask;
+
+   while ( num_bits > 0 )
+      {
+      byte_num = bit_pos/8;
+      bit_in_byte = bit_pos % 8;
+      bits_in_byte = 8 - bit_in_byte;
+      if ( bits_in_byte > num_bits )
+         bits_in_byte = num_bits;
+
+      byte_mask = (unsigned char)(((1 << bits_in_byte) - 1) << bit_in_byte);
+      bs[byte_num] = (bs[byte_num] & ~byte_mask) | ((unsigned char)(word << bit_in_byte) & byte_mask);
+
+      word >>= bits_in_byte;
+      bit_pos += bits_in_byte;
+      num_bits -= bits_in_byte;
+      }
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Hamming distance between 'num_bits' bits of bs1 starting at bit position start1 and bs2 starting at start2. 
+// If stop_at_first is 1, stop at the first mismatch. *num_compared_ptr is set to the number of bit positions 
+// compared BEFORE the loop stopped, i.e., the position of the first mismatch when stopping early, otherwise 
+// num_bits.
+
+int HammingDistanceBS(int num_bits, unsigned char *bs1, int start1, unsigned char *bs2, int start2, int stop_at_first,
+   int *num_compared_ptr)
+   {
+   int bit_num, num_mismatches, chunk_bits;
+   uint64_t diff;
+
+   num_mismatches = 0;
+   if ( BitOpsMode == BIT_OPS_BYTE )
+      {
+      for ( bit_num = 0; bit_num < num_bits; bit_num++ )
+         if ( GetBitFromByte(bs1[(start1 + bit_num)/8], (start1 + bit_num) % 8) != 
+            GetBitFromByte(bs2[(start2 + bit_num)/8], (start2 + bit_num) % 8) )
+            {
+            num_mismatches++;
+            if ( stop_at_first == 1 )
+               break;
+            }
+      *num_compared_ptr = bit_num;
+      return num_mismatches;
+      }
+
+   for ( bit_num = 0; bit_num < num_bits; bit_num += 64 )
+      {
+      chunk_bits = num_bits - bit_num;
+      if ( chunk_bits > 64 )
+         chunk_bits = 64;
+
+      diff = LoadBitWord(bs1, start1 + bit_num, chunk_bits) ^ LoadBitWord(bs2, start2 + bit_num, chunk_bits);
+      if ( diff != 0 && stop_at_first == 1 )
+         {
+         *num_compared_ptr = bit_num + __builtin_ctzll(diff);
+         return 1;
+         }
+      num_mismatches += PopCount64(diff);
+      }
+
+   *num_compared_ptr = num_bits;
+   return num_mismatches;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// 64-bit FNV-1a style checksum of a buffer, consumed 8 bytes at a time (the tail is zero padded). Used to detect 
+// corrupted or truncated snapshot files, NOT for security.
+
+uint64_t Checksum64(unsigned char *buf, size_t num_bytes)
+   {
+   uint64_t hash, word;
+   size_t byte_num;
+
+   hash = 14695981039346656037ULL;
+   for ( byte_num = 0; byte_num + 8 <= num_bytes; byte_num += 8 )
+      {
+      memcpy(&word, buf + byte_num, 8);
+      hash = (hash ^ word) * 1099511628211ULL;
+      }
+   if ( byte_num < num_bytes )
+      {
+      word = 0;
+      memcpy(&word, buf + byte_num, num_bytes - byte_num);
+      hash = (hash ^ word) * 1099511628211ULL;
+      }
+
+   return hash ^ (uint64_t)num_bytes;
+   }
+
 // ========================================================================================================
 // ========================================================================================================
 // ASCII '0'/'1' string to binary.
@@ -286,3 +790,265 @@ void WriteASCIIBitstringToFile(int max_string_len, char *outfile_name, int creat
 
    return;
    }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// ChaCha20 block function (RFC 8439) over the 16-word state. Writes 64 bytes of keystream to out.
+
+static void ChaCha20Block(uint32_t *state, unsigned char *out)
+   {
+   uint32_t x[16];
+   int i;
+
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d) \
+   a += b; d ^= a; d = CHACHA_ROTL(d, 16); c += d; b ^= c; b = CHACHA_ROTL(b, 12); \
+   a += b; d ^= a; d = CHACHA_ROTL(d, 8); c += d; b ^= c; b = CHACHA_ROTL(b, 7);
+
+   for ( i = 0; i < 16; i++ )
+      x[i] = state[i];
+   for ( i = 0; i < 10; i++ )
+      {
+      CHACHA_QR(x[0], x[4], x[8], x[12]) CHACHA_QR(x[1], x[5], x[9], x[13]) CHACHA_QR(x[2], x[6], x[10], x[14]) CHACHA_QR(x[3], x[7], x[11], x[15])
+      CHACHA_QR(x[0], x[5], x[10], x[15]) CHACHA_QR(x[1], x[6], x[11], x[12]) CHACHA_QR(x[2], x[7], x[8], x[13]) CHACHA_QR(x[3], x[4], x[9], x[14])
+      }
+   for ( i = 0; i < 16; i++ )
+      {
+      x[i] += state[i];
+      out[4*i] = (unsigned char)x[i];
+      out[4*i + 1] = (unsigned char)(x[i] >> 8);
+      out[4*i + 2] = (unsigned char)(x[i] >> 16);
+      out[4*i + 3] = (unsigned char)(x[i] >> 24);
+      }
+
+#undef CHACHA_QR
+#undef CHACHA_ROTL
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// (Re)key a random stream with 32 key bytes and 8 nonce bytes and empty its buffer.
+
+static void RandStreamKey(RandStreamStruct *RS_ptr, unsigned char *key_nonce)
+   {
+   uint32_t word[10];
+   int i;
+
+// "expand 32-byte k"
+   RS_ptr->state[0] = 0x61707865; RS_ptr->state[1] = 0x3320646e; RS_ptr->state[2] = 0x79622d32; RS_ptr->state[3] = 0x6b206574;
+   for ( i = 0; i < 10; i++ )
+      word[i] = (uint32_t)key_nonce[4*i] | ((uint32_t)key_nonce[4*i + 1] << 8) | ((uint32_t)key_nonce[4*i + 2] << 16) | 
+         ((uint32_t)key_nonce[4*i + 3] << 24);
+
+// Key in words 4-11, 64-bit block counter in words 12-13 and nonce in words 14-15.
+   for ( i = 0; i < 8; i++ )
+      RS_ptr->state[4 + i] = word[i];
+   RS_ptr->state[12] = 0;
+   RS_ptr->state[13] = 0;
+   RS_ptr->state[14] = word[8];
+   RS_ptr->state[15] = word[9];
+   RS_ptr->buf_pos = RAND_STREAM_BUF_BYTES;
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Refill the buffer of a random stream with RAND_STREAM_BUF_BYTES of keystream. The first 32 bytes replace the
+// key (the nonce is kept) so output already handed out can not be recomputed from the state (fast key erasure).
+
+static void RandStreamRefill(RandStreamStruct *RS_ptr)
+   {
+   unsigned char key_nonce[40];
+   int block_num;
+
+   for ( block_num = 0; block_num < RAND_STREAM_BUF_BYTES/64; block_num++ )
+      {
+      ChaCha20Block(RS_ptr->state, RS_ptr->buf + 64*block_num);
+      if ( ++RS_ptr->state[12] == 0 )
+         RS_ptr->state[13]++;
+      }
+
+   memcpy(key_nonce, RS_ptr->buf, 32);
+   memcpy(key_nonce + 32, &(RS_ptr->state[14]), 8);
+   RandStreamKey(RS_ptr, key_nonce);
+   memset(RS_ptr->buf, 0, 32);
+   RS_ptr->buf_pos = 32;
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Seed a random stream from a 32-bit seed. The stream is deterministic, so all parties that seed with the same 
+// value draw the same numbers. This is NOT secret randomness -- use GetRandomBytes for nonces and keys.
+
+void RandStreamSeed(RandStreamStruct *RS_ptr, unsigned int Seed)
+   {
+   unsigned char key_nonce[40];
+
+   memset(key_nonce, 0, 40);
+   key_nonce[0] = (unsigned char)Seed;
+   key_nonce[1] = (unsigned char)(Seed >> 8);
+   key_nonce[2] = (unsigned char)(Seed >> 16);
+   key_nonce[3] = (unsigned char)(Seed >> 24);
+   RandStreamKey(RS_ptr, key_nonce);
+   RS_ptr->fork_generation = 0;
+   RS_ptr->num_since_reseed = 0;
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Copy num_bytes from a random stream into buf.
+
+void RandStreamBytes(RandStreamStruct *RS_ptr, unsigned char *buf, int num_bytes)
+   {
+   int num_copy;
+
+   while ( num_bytes > 0 )
+      {
+      if ( RS_ptr->buf_pos == RAND_STREAM_BUF_BYTES )
+         RandStreamRefill(RS_ptr);
+      num_copy = RAND_STREAM_BUF_BYTES - RS_ptr->buf_pos;
+      if ( num_copy > num_bytes )
+         num_copy = num_bytes;
+      memcpy(buf, RS_ptr->buf + RS_ptr->buf_pos, num_copy);
+      memset(RS_ptr->buf + RS_ptr->buf_pos, 0, num_copy);
+      RS_ptr->buf_pos += num_copy;
+      buf += num_copy;
+      num_bytes -= num_copy;
+      }
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Uniform integer in [0, bound) from a random stream, without the modulo bias of 'rand() % bound'. Returns 0 
+// when bound is 0.
+
+unsigned int RandStreamUniform(RandStreamStruct *RS_ptr, unsigned int bound)
+   {
+   uint32_t r, threshold;
+
+   if ( bound <= 1 )
+      return 0;
+
+// Reject the values below 2^32 mod bound so every residue is hit equally often.
+   threshold = (uint32_t)(-bound) % bound;
+   do
+      RandStreamBytes(RS_ptr, (unsigned char *)&r, 4);
+   while ( r < threshold );
+
+   return r % bound;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Read num_bytes of entropy from the kernel, with getrandom() when available and /dev/urandom otherwise.
+
+static void ReadKernelEntropy(unsigned char *buf, int num_bytes)
+   {
+   int num_read, fd;
+
+#ifdef SYS_getrandom
+   while ( num_bytes > 0 )
+      {
+      if ( (num_read = (int)syscall(SYS_getrandom, buf, (size_t)num_bytes, 0)) < 0 )
+         {
+         if ( errno == EINTR )
+            continue;
+         break;
+         }
+      buf += num_read;
+      num_bytes -= num_read;
+      }
+   if ( num_bytes == 0 )
+      return;
+#endif
+
+   if ( (fd = open("/dev/urandom", O_RDONLY)) == -1 )
+      { printf("ERROR: ReadKernelEntropy(): Could not open /dev/urandom!\n"); exit(EXIT_FAILURE); }
+   while ( num_bytes > 0 )
+      {
+      if ( (num_read = (int)read(fd, buf, num_bytes)) <= 0 )
+         {
+         if ( num_read < 0 && errno == EINTR )
+            continue;
+         printf("ERROR: ReadKernelEntropy(): Read /dev/urandom failed!\n"); exit(EXIT_FAILURE);
+         }
+      buf += num_read;
+      num_bytes -= num_read;
+      }
+   close(fd);
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// The calling thread's random stream, seeded from the kernel on first use, in a forked child and after every 
+// RAND_RESEED_BYTES bytes of output. No locks and, apart from the reseeds, no system calls. A fork is detected 
+// with a pthread_atfork child handler that bumps RandForkGeneration (generation 0 means 'never seeded').
+
+static __thread RandStreamStruct ThreadRandStream;
+static volatile unsigned int RandForkGeneration = 1;
+static pthread_once_t RandForkOnce = PTHREAD_ONCE_INIT;
+
+static void RandForkChild(void)
+   { RandForkGeneration++; }
+
+static void RandForkRegister(void)
+   { pthread_atfork(NULL, NULL, RandForkChild); }
+
+static RandStreamStruct *GetThreadRandStream(int num_bytes)
+   {
+   RandStreamStruct *RS_ptr = &ThreadRandStream;
+   unsigned char key_nonce[40];
+
+   if ( RS_ptr->fork_generation != RandForkGeneration || RS_ptr->num_since_reseed + (long)num_bytes > RAND_RESEED_BYTES )
+      {
+      pthread_once(&RandForkOnce, RandForkRegister);
+      ReadKernelEntropy(key_nonce, 40);
+      RandStreamKey(RS_ptr, key_nonce);
+      memset(key_nonce, 0, 40);
+      RS_ptr->fork_generation = RandForkGeneration;
+      RS_ptr->num_since_reseed = 0;
+      }
+   RS_ptr->num_since_reseed += num_bytes;
+
+   return RS_ptr;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Fill buf with num_bytes of cryptographically secure random bytes from the calling thread's stream.
+
+void GetRandomBytes(unsigned char *buf, int num_bytes)
+   {
+   RandStreamBytes(GetThreadRandStream(num_bytes), buf, num_bytes);
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Uniform, cryptographically secure integer in [0, bound) from the calling thread's stream.
+
+unsigned int GetRandomUniform(unsigned int bound)
+   {
+   return RandStreamUniform(GetThreadRandStream(4), bound);
+   }
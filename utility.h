@@ -18,6 +18,10 @@
 #include <string.h>  
 #include <sys/mman.h>
 #include <math.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <pthread.h>
 
 #ifndef TIMING_STRUCTS
 typedef struct
@@ -25,24 +29,98 @@ typedef struct
    int vecpair_id;
    int PO_num;
    char rise_or_fall;
-   float *PNs;
+   } TimingValCachePathStruct;
+
+// PN cache. The PNs of all qualified paths for all chips are stored in ONE chip-major slab, so chip_num's PNs are the 
+// num_paths floats starting at PN_slab[chip_num*num_paths] in the order of the paths array (vecpair_id and then PO_num, 
+// both ascending). The (vecpair_id, PO_num) -> path index lookup is an open-addressed hash table with num_hash_slots 
+// (a power of 2) slots holding a path index or -1. PUF_instance_ids[chip_num] is the PUFInstance ID of each chip. If the 
+// cache was mapped from a snapshot file, all arrays point into the read-only mapping at snapshot_base (snapshot_len bytes).
+typedef struct
+   {
+   int num_paths;
+   int num_chips;
+   TimingValCachePathStruct *paths;
+   float *PN_slab;
+   int num_hash_slots;
+   int *hash_slots;
+   int *PUF_instance_ids;
+   void *snapshot_base;
+   size_t snapshot_len;
    } TimingValCacheStruct;
+
+// Value and weight for ComputeWeightedPercentile.
+typedef struct
+   {
+   float val;
+   float weight;
+   } WeightedValStruct;
+
+// ChaCha20 random stream (see RandStreamSeed and GetRandomBytes). buf holds RAND_STREAM_BUF_BYTES (a multiple of 64) of 
+// keystream of which the bytes from buf_pos on are unused. fork_generation and num_since_reseed are only used by the per-thread 
+// streams.
+#define RAND_STREAM_BUF_BYTES 1024
+typedef struct
+   {
+   uint32_t state[16];
+   unsigned char buf[RAND_STREAM_BUF_BYTES];
+   int buf_pos;
+   unsigned int fork_generation;
+   long num_since_reseed;
+   } RandStreamStruct;
 #define TIMING_STRUCTS
 #endif
 
+// ComputeColumnMedians: columns transposed per block, and the counting path for values quantized to 1/MEDIAN_QUANTUM_INV 
+// whose range is at most MEDIAN_HIST_MAX_BINS quanta.
+#define MEDIAN_BLOCK_COLS 64
+#define MEDIAN_QUANTUM_INV 16
+#define MEDIAN_HIST_MAX_BINS 16384
+
+// Number of bytes a per-thread random stream returns before it is reseeded from the kernel.
+#define RAND_RESEED_BYTES 1048576
+
 // Scratch pad string size
 #define MAX_STRING_LEN 2048
 
 // HELP currently uses 2048 PNR and 2048 PNF to create 2048 PNDiffs. 
 #define NUM_REQUIRED_PNDIFFS 2048
 
+// Bitstring engines used by KEK_FSB_SKE, SingleHelpBitGen, EliminatePackedBitsFromBS and the mismatch counts: one bit at a 
+// time (BIT_OPS_BYTE) or 64 bits at a time with popcount and pext/pdep (BIT_OPS_WORD). See SelectBitOps.
+#define BIT_OPS_BYTE 0
+#define BIT_OPS_WORD 1
+#define BIT_OPS_DEFAULT BIT_OPS_WORD
+
+extern int BitOpsMode;
+
 float Round(float d);
 float ComputeMean(int num_vals, float *vals);
 float ComputeMedian(int num_vals, float *vals);
+int SelectKthSmallestInt(int num_vals, int *vals, int k);
+float SelectKthSmallestFloat(int num_vals, float *vals, int k);
+void ComputeColumnMedians(int num_rows, int num_cols, float **rows, float *medians, int use_histogram);
+float ComputeWeightedPercentile(int num_vals, float *vals, float *weights, float percentile);
 float ComputeStdDev(int num_vals, float mean, float *vals);
 int GetBitFromByte(unsigned char byte, int bit_pos);
 void SetBitInByte(unsigned char *byte_ptr, int bit_val, int bit_pos);
 
+void SelectBitOps(int bit_ops_mode);
+int PopCount64(uint64_t word);
+uint64_t ExtractBits64(uint64_t word, uint64_t mask);
+uint64_t DepositBits64(uint64_t word, uint64_t mask);
+uint64_t LoadBitWord(unsigned char *bs, int bit_pos, int num_bits);
+void StoreBitWord(unsigned char *bs, int bit_pos, int num_bits, uint64_t word);
+int HammingDistanceBS(int num_bits, unsigned char *bs1, int start1, unsigned char *bs2, int start2, int stop_at_first,
+   int *num_compared_ptr);
+uint64_t Checksum64(unsigned char *buf, size_t num_bytes);
+
+void RandStreamSeed(RandStreamStruct *RS_ptr, unsigned int Seed);
+void RandStreamBytes(RandStreamStruct *RS_ptr, unsigned char *buf, int num_bytes);
+unsigned int RandStreamUniform(RandStreamStruct *RS_ptr, unsigned int bound);
+void GetRandomBytes(unsigned char *buf, int num_bytes);
+unsigned int GetRandomUniform(unsigned int bound);
+
 void ASCIIByteToBin(unsigned char *binary_byte_ptr, char *ascii_str);
 void BinByteToASCII(unsigned char binary_byte, char *ascii_str);
 
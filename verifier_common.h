@@ -20,6 +20,60 @@
 
 #ifndef SRFAlgoStruct 
 
+// Key of a PNDc vector in the PNDc cache. The PNR/PNF of a chip are fixed by the challenge (ChallengeSetName and the seed 
+// given to GenChallengeDB), and the PNDc by the two LFSR seeds and the RangeConstant.
+typedef struct
+   {
+   char ChallengeSetName[PNDC_CACHE_MAX_NAME_LEN];
+   unsigned int challenge_seed;
+   unsigned int LFSR_seed_low;
+   unsigned int LFSR_seed_high;
+   unsigned int RangeConstant;
+   int chip_num;
+   } PNDcCacheKeyStruct;
+
+typedef struct
+   {
+   PNDcCacheKeyStruct key;
+   int hash_next;
+   int LRU_prev;
+   int LRU_next;
+   } PNDcCacheEntryStruct;
+
+// LRU cache of PNDc vectors (num_PNDiffs floats each, stored in PNDc_slab at entry_num*num_PNDiffs). Entries are chained 
+// in hash buckets and in a doubly linked LRU list (LRU_head is the most recently used). All fields are protected by mutex.
+typedef struct
+   {
+   pthread_mutex_t mutex;
+   int num_PNDiffs;
+   int max_entries;
+   int num_entries;
+   PNDcCacheEntryStruct *entries;
+   float *PNDc_slab;
+   int num_buckets;
+   int *buckets;
+   int LRU_head;
+   int LRU_tail;
+   long num_hits;
+   long num_misses;
+   long num_evictions;
+   } PNDcCacheStruct;
+
+// Counters of the chip search candidate prefilter (see KEK_DA_SKE_FindMatch), shared by all threads and protected by mutex. A search 
+// is pruned when a candidate authenticated and the other chips were skipped, otherwise it fell back to scanning all chips. The candidate 
+// rank of every authenticated chip is recorded, so the recall of the prefilter is num_auth_in_candidates/num_auth.
+typedef struct
+   {
+   pthread_mutex_t mutex;
+   long num_searches;
+   long num_pruned;
+   long num_fallback;
+   long num_auth;
+   long num_auth_in_candidates;
+   long sum_auth_rank;
+   int max_auth_rank;
+   } DAPrefilterStatsStruct;
+
 typedef struct
    {
    int SBS_num_bits;
@@ -29,6 +83,21 @@ typedef struct
    unsigned char *SHD;
    } HelpBitstringStruct;
 
+// Reusable workspace of the parallel PopOnly SpreadFactor stage (see ComputePopPNDcMedians). PNDc_rows[chip_num] points into the 
+// chip-major PNDc_block (max_chips x num_PNDiffs). Each of the num_threads workers has num_PNDiffs floats and ints of SRF scratch 
+// and max_chips row pointers in fPND_scratch, int_scratch and col_rows. Grown as needed and kept for the life of the SAP.
+typedef struct
+   {
+   int num_threads;
+   int max_chips;
+   float *PNDc_block;
+   float **PNDc_rows;
+   unsigned short *LFSR_pair_map;
+   float *fPND_scratch;
+   int *int_scratch;
+   float **col_rows;
+   } PopSFWorkspaceStruct;
+
 typedef struct
    {
    char *DB_name_NAT;
@@ -39,7 +108,6 @@ typedef struct
 
    pthread_mutex_t *RT_DB_mutex_ptr;
    pthread_mutex_t *FileStat_mutex_ptr;
-   pthread_mutex_t *GenChallenge_mutex_ptr; 
    pthread_mutex_t *Authentication_mutex_ptr; 
 
    pthread_mutex_t *PUFCash_WRec_DB_mutex_ptr;
@@ -132,6 +200,17 @@ typedef struct
 
    int num_chips; 
 
+// Number of worker threads used to search the chips during device authentication.
+   int num_DA_scan_threads; 
+
+// Number of chips the candidate prefilter of the device authentication search keeps (0 disables it), and its shared counters.
+   int num_DA_prefilter_candidates; 
+   DAPrefilterStatsStruct *DA_prefilter_stats;
+
+// Number of worker threads and workspace of the PopOnly SpreadFactor computation (see ComputePopPNDcMedians).
+   int num_PO_SF_threads; 
+   PopSFWorkspaceStruct *PopSF_ptr;
+
    int num_vecs;
    int num_rise_vecs;
    int has_masks;
@@ -156,10 +235,11 @@ typedef struct
    int do_PO_dist_flip; 
 
    int use_TVC_cache;
-   TimingValCacheStruct *TVC_arr_NAT;
-   int num_TVC_arr_NAT;
-   TimingValCacheStruct *TVC_arr_AT;
-   int num_TVC_arr_AT;
+   TimingValCacheStruct *TVC_NAT;
+   TimingValCacheStruct *TVC_AT;
+
+// Shared cache of normalized PNDc vectors used by the device authentication chip search (NULL disables it).
+   PNDcCacheStruct *PNDc_cache;
 
    HelpBitstringStruct *HBS_arr;
 
@@ -31,6 +31,74 @@ typedef struct
    float CC;
    } AuthenDataStruct;
 
+// A chip ranked by the candidate prefilter (see KEK_DA_SKE_RankCandidates). sketch_dist is the number of sketch bits that 
+// disagree with the bits implied by the device's helper data.
+typedef struct
+   {
+   int chip_num;
+   int sketch_dist;
+   } DACandidateStruct;
+
+// Shared state of the parallel chip search in KEK_DA_SKE_FindMatch. The next_chip_num cursor is only accessed with the 
+// atomic builtins. The top-k list (the DA_SCAN_TOP_K chips with the smallest CC, ascending), the CC sum and 
+// num_chips_scored are protected by top_mutex. The cursor runs up to num_chips. When candidates is not NULL, the cursor indexes 
+// the prefilter's ranking instead of the chip numbers.
+typedef struct
+   {
+   int max_string_len;
+   int received_XMR_SHD_num_bytes;
+   unsigned char *SKE_authen_XMR_SHD;
+   signed char *authen_SpreadFactors_binary;
+   int current_function;
+   int do_scaling;
+   int check_all_chips;
+   int num_chips;
+   DACandidateStruct *candidates;
+   int chunk_size;
+   int next_chip_num;
+   pthread_mutex_t top_mutex;
+   AuthenDataStruct top_ADS[DA_SCAN_TOP_K];
+   int num_top_ADS;
+   double sum_CC;
+   int num_chips_scored;
+   } DAScanSharedStruct;
+
+// Per-worker state. Each worker gets a private SAP copy (see AllocateDAScanWorkerSAP) so the SRF scratch buffers are not shared,
+// and private chip-major PNDc and PNDco blocks for the batched SRF kernel (max_batch_chips chips of num_required_PNDiffs values each).
+// PNR_gather and PNF_gather hold copies of the timing values of a batch whose chips are not consecutive in the database.
+typedef struct
+   {
+   int worker_num;
+   SRFAlgoParamsStruct SAP;
+   DAScanSharedStruct *DSS_ptr;
+   int max_batch_chips;
+   float *PNDc_block;
+   float *PNDco_block;
+   float *PNR_gather;
+   float *PNF_gather;
+   unsigned char *miss_mask;
+   int *int_scratch;
+   unsigned short *LFSR_pair_map;
+   int num_pos_vals;
+   int num_neg_vals;
+   int num_zero_vals;
+   } DAScanWorkerStruct;
+
+// Per-worker state of the PopOnly SpreadFactor stage (see ComputePopPNDcMedians). Worker 'worker_num' computes the PNDc of chips 
+// first_chip_num to first_chip_num+num_worker_chips-1, and after the barrier the medians of columns first_col to first_col+num_worker_cols-1.
+typedef struct
+   {
+   int worker_num;
+   SRFAlgoParamsStruct *SAP_ptr;
+   int num_chips;
+   int first_chip_num;
+   int num_worker_chips;
+   int first_col;
+   int num_worker_cols;
+   float *medians;
+   pthread_barrier_t *barrier_ptr;
+   } PopSFWorkerStruct;
+
 // Set to -1 to disable
 #define DO_DUMP_PN_DATA_CHIP_NUM -1
 char *DumpDir = "../DumpData/";
@@ -52,6 +120,48 @@ int ADS_CC_AscendCompareFunc(const void *a1, const void *a2)
    }
 
 
+// ===========================================================================================================
+// ===========================================================================================================
+// Insert ADS_ptr into the top-k list top_ADS (num_top_ADS entries, at most max_top_ADS, ascending CC as in 
+// ADS_CC_AscendCompareFunc with ties broken on the chip index). The list is small so a bounded insertion is 
+// used. Returns the new number of entries.
+
+int InsertTopKADS(AuthenDataStruct *top_ADS, int num_top_ADS, int max_top_ADS, AuthenDataStruct *ADS_ptr)
+   {
+   int pos, cmp;
+
+// Find the insertion position. Chips that are not better than the last entry of a full list are dropped.
+   for ( pos = num_top_ADS; pos > 0; pos-- )
+      {
+      cmp = ADS_CC_AscendCompareFunc(&(top_ADS[pos - 1]), ADS_ptr);
+      if ( cmp < 0 || (cmp == 0 && top_ADS[pos - 1].index < ADS_ptr->index) )
+         break;
+      }
+   if ( pos >= max_top_ADS )
+      return num_top_ADS;
+
+   if ( num_top_ADS < max_top_ADS )
+      num_top_ADS++;
+   memmove(&(top_ADS[pos + 1]), &(top_ADS[pos]), sizeof(AuthenDataStruct) * (num_top_ADS - 1 - pos));
+   top_ADS[pos] = *ADS_ptr;
+
+   return num_top_ADS;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// The authentic-to-nearest (AE) PCC of a top-k list with at least 2 entries, i.e., the percentage change of the 
+// second smallest CC to the smallest. Returns -1.0 if the second CC is 0.0 (no decision possible).
+
+float ComputeTopKAEPCC(AuthenDataStruct *top_ADS)
+   {
+   if ( top_ADS[1].CC == 0.0 )
+      return -1.0;
+   return (top_ADS[1].CC - top_ADS[0].CC)/top_ADS[1].CC*100.0;
+   }
+
+
 // ===========================================================================================================
 // ===========================================================================================================
 // Sort ADS in descending order.
@@ -69,16 +179,15 @@ int ADS_CC_DescendCompareFunc(const void *a1, const void *a2)
 
 // ========================================================================================================
 // ========================================================================================================
-// Free up the timing data arrays dynamically allocated.
+// Free up the timing data arrays dynamically allocated. The rows of all chips are stored in ONE block that
+// starts at the row of chip 0 (see GetAllPUFInstanceTimingValsForChallenge).
 
 void FreeAllTimingValsForChallenge(int *num_PUF_instances_ptr, float ***PNR_ptr, float ***PNF_ptr)
    {
-   int chip_num;
-
    if ( PNR_ptr != NULL && *PNR_ptr != NULL )
       {
-      for ( chip_num = 0; chip_num < *num_PUF_instances_ptr; chip_num++ )
-         free((*PNR_ptr)[chip_num]);
+      if ( *num_PUF_instances_ptr > 0 )
+         free((*PNR_ptr)[0]);
       free(*PNR_ptr);
       }
    else
@@ -87,8 +196,8 @@ void FreeAllTimingValsForChallenge(int *num_PUF_instances_ptr, float ***PNR_ptr,
 
    if ( PNF_ptr != NULL && *PNF_ptr != NULL )
       {
-      for ( chip_num = 0; chip_num < *num_PUF_instances_ptr; chip_num++ )
-         free((*PNF_ptr)[chip_num]);
+      if ( *num_PUF_instances_ptr > 0 )
+         free((*PNF_ptr)[0]);
       free(*PNF_ptr);
       }
    else
@@ -456,504 +565,441 @@ printf("\tDoSRFComp(): LFSR seed low %u\tLFSR seed high %u\tRangeConstant %d\tSp
    }
 
 
-// ===========================================================================================================
-// ===========================================================================================================
-// We use 8-bit SpreadFactors now, so MUST reduce the median PNDc to a value < TrimCodeConstant, and make all 
-// SF positive (they can be very small negative numbers via other modes). This was debugged originally in 
-// /borg_data/FPGAs/ZYBO/SR_RFM/ANALYSIS/code/common.c, in ComputePCRSpreadFactors().
-
-//#define DEBUG1 0
+// ========================================================================================================
+// ========================================================================================================
+// The two 11-bit LFSRs in ComputePNDiffsTwoSeeds step together, so every PND pairs PNR[low] with PNF[high]
+// for a fixed (low -> high) mapping that depends ONLY on the two seeds. Compute that mapping once so the 
+// batched kernel below can form the PND with a simple indexed loop. The low LFSR visits all num_PNDiffs values.
 
-void ReduceRawSF(int max_string_len, float *fSpreadFactors, signed char *iSpreadFactors, int iSpreadFactorScaler,
-   int num_SF, int TrimCodeConstant)
+void ComputeLFSRPairMap(int num_PNDiffs, int LFSR_seed_low, int LFSR_seed_high, unsigned short *LFSR_pair_map)
    {
-   int SF_num, multiple;
+   uint16_t lfsr_val_low, lfsr_val_high;
+   int PND_num; 
 
-#ifdef DEBUG1
-int limit = 20;
-#endif
+// Sanity check: Don't allow this because first call uses the LFSR seed directly.
+   if ( LFSR_seed_low >= num_PNDiffs || LFSR_seed_high >= num_PNDiffs )
+      { 
+      printf("ERROR: ComputeLFSRPairMap(): SEED for LFSR low %d or high %d larger than max %d!\n", 
+         LFSR_seed_low, LFSR_seed_high, num_PNDiffs); 
+      exit(EXIT_FAILURE); 
+      }
 
-   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
+   LFSR_11_A_bits_low(1, (uint16_t)LFSR_seed_low, &lfsr_val_low);
+   LFSR_11_A_bits_high(1, (uint16_t)LFSR_seed_high, &lfsr_val_high);
+   for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
       {
 
-// Find the nearest multiple of TrimCodeConstant for the current fSpreadFactors. If positive, truncate to lowest integer. 
-// If negative, we need to round down to the next smallest negative number, e.g., if -1.x, round to -2. Preserve the sign here. 
-// NOTE: We have rounded fSpreadFactors to 4 binary digits of precision in the caller.
-      multiple = (int)(fSpreadFactors[SF_num]*16)/(TrimCodeConstant*16);
-      if ( fSpreadFactors[SF_num] < 0 )
-         {
-
-// If the remainder is non-zero, round down. NOTE: fSpreadFactors MUST be rounded to 4 precision places for this to work.
-         if ( (int)fabs(fSpreadFactors[SF_num] * 16) % (TrimCodeConstant*16) != 0 )
-            multiple -= 1;
+// Sanity check
+      if ( (int)lfsr_val_low >= num_PNDiffs || (int)lfsr_val_high >= num_PNDiffs )
+         { 
+         printf("ERROR: ComputeLFSRPairMap(): LFSR low %d or high %d larger than max %d!\n", 
+            lfsr_val_low, lfsr_val_high, num_PNDiffs); exit(EXIT_FAILURE); 
          }
 
-#ifdef DEBUG1
-if ( SF_num < limit )
-   { 
-   printf("ReduceRawSF(): Orig SpreadFactor[%4d]: %+8.4f\tmultiple %2d\tAdd -1 ? %3d with %3d mod %3d =?= 0\t", SF_num, fSpreadFactors[SF_num], multiple, 
-      (int)fabs(fSpreadFactors[SF_num] * 16) % (TrimCodeConstant*16), (int)fabs(fSpreadFactors[SF_num] * 16), (TrimCodeConstant*16)); fflush(stdout); 
+      LFSR_pair_map[lfsr_val_low] = lfsr_val_high;
+
+      LFSR_11_A_bits_low(0, (uint16_t)0, &lfsr_val_low);
+      LFSR_11_A_bits_high(0, (uint16_t)0, &lfsr_val_high);
+      }
+
+   return;
    }
-#endif
 
-// THIS MUST be always positive and less than TrimCodeConstant.
-      fSpreadFactors[SF_num] = fSpreadFactors[SF_num] - (float)multiple*TrimCodeConstant;
 
-#ifdef DEBUG1
-if ( SF_num < limit )
-   { printf("ReduceRawSF(): New SpreadFactor[%4d]: %+8.4f\n", SF_num, fSpreadFactors[SF_num]); fflush(stdout); }
-#endif
+// ========================================================================================================
+// ========================================================================================================
+// First stage of the batched SRF engine: the PNDc (ComputePNDiffsTwoSeeds and GPEVCal) for num_batch_chips chips 
+// whose PNR/PNF are stored chip-major and contiguously in PNR_block/PNF_block, written in the same layout to 
+// PNDc_block. Chips with chip_mask[b] == 0 are skipped (chip_mask may be NULL). The loops are written without 
+// data-dependent branches so the compiler can vectorize them:
+//    - PND are formed with the LFSR pair map (see ComputeLFSRPairMap) instead of stepping the LFSRs.
+//    - The bounded range is computed with two selections on the rounded, shifted PND instead of a histogram
+//      (the histogram's low index is the range_low_limit'th smallest value, and its high index is one less 
+//      than the (range_high_limit + 1)'th smallest value).
+// fPND_scratch (floats) and int_scratch (ints) must have num_PNDiffs elements.
+
+void SRFBatchPNDcKernel(int num_PNDiffs, int num_batch_chips, float *PNR_block, float *PNF_block, unsigned char *chip_mask, 
+   unsigned short *LFSR_pair_map, float range_low_limit, float range_high_limit, int DIST_range, unsigned int RangeConstant, 
+   float *fPND_scratch, int *int_scratch, float *PNDc_block)
+   {
+   float *PNR, *PNF, *PNDc;
+   float largest_neg_PND, largest_pos_PND, temp_float;
+   float cur_mean, cur_range, range_conv;
+   int low_k, high_k, low_index, high_index;
+   int chip_num, PND_num;
 
-// Sanity check
-      if ( fSpreadFactors[SF_num] < 0 || fSpreadFactors[SF_num] >= TrimCodeConstant )
+// Selection ranks that reproduce the cumulative histogram test in ComputeBoundedRange.
+   low_k = (int)ceilf(range_low_limit) - 1;
+   high_k = (int)floorf(range_high_limit);
+
+   for ( chip_num = 0; chip_num < num_batch_chips; chip_num++ )
+      {
+      if ( chip_mask != NULL && chip_mask[chip_num] == 0 )
+         continue;
+
+      PNR = PNR_block + chip_num*num_PNDiffs;
+      PNF = PNF_block + chip_num*num_PNDiffs;
+      PNDc = PNDc_block + chip_num*num_PNDiffs;
+
+// ***** Compute PND
+      for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+         fPND_scratch[PND_num] = PNR[PND_num] - PNF[LFSR_pair_map[PND_num]];
+
+      largest_neg_PND = fPND_scratch[0];
+      largest_pos_PND = fPND_scratch[0];
+      for ( PND_num = 1; PND_num < num_PNDiffs; PND_num++ )
          {
-         printf("ERROR: ReduceRawSF(): fSpreadFactors[%d] is less than 0 or >= TrimCodeConstant %d => %f\n", 
-            SF_num, TrimCodeConstant, fSpreadFactors[SF_num]);
-         exit(EXIT_FAILURE);
+         largest_neg_PND = fPND_scratch[PND_num] < largest_neg_PND ? fPND_scratch[PND_num] : largest_neg_PND;
+         largest_pos_PND = fPND_scratch[PND_num] > largest_pos_PND ? fPND_scratch[PND_num] : largest_pos_PND;
          }
-      }
 
-// Convert floats to signed char for transmission to device. Round off appropriately. With iSpreadFactorScaler at 2, and 
-// if I have 35.6875, then store 35.5000. But if I have 16.9375, store 17.000 (anything larger than 16.75 should be 17.0, 
-// anything larger than 16.25 should be 16.5, etc). Similarly, with iSpreadFactorScaler at 1, than anything larger than 
-// 16.5 should be 17, etc. NOTE: Use 0.5 here for all cases, i.e., when iSpreadFactorScaler is 2, we need to add 0.5 and 
-// NOT 0.25!
-   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
-      if ( fSpreadFactors[SF_num] >= 0 )
-         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler + 0.5);
-      else 
-         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler - 0.5);
+// Check for overflow that would happen in the hardware.
+      if ( largest_pos_PND > LARGEST_POS_VAL || largest_neg_PND < LARGEST_NEG_VAL )
+         { 
+         printf("ERROR: SRFBatchPNDcKernel(): fPND larger than largest or smaller than smallest allowable value %d/%d!\n", 
+            LARGEST_POS_VAL, LARGEST_NEG_VAL); 
+         exit(EXIT_FAILURE); 
+         }
 
-#ifdef DEBUG1
-for ( SF_num = 0; SF_num < limit; SF_num++ )
-   printf("ReduceRawSF(): TRIMMED PopOnly SpreadFactors[%4d], PART A, Median (fSpreadFactor) %8.4f\n", SF_num, fSpreadFactors[SF_num]);
-fflush(stdout);
-#endif
+// Sanity check (same as ComputeBoundedRange).
+      if ( largest_pos_PND - largest_neg_PND > (float)DIST_range )
+         { printf("ERROR: SRFBatchPNDcKernel(): Adjusted PNDIFF OUTSIDE of DIST_range => %f\n", largest_pos_PND - largest_neg_PND); exit(EXIT_FAILURE); }
 
-   return;
-   }
+// ***** Bounded range. Shift and round exactly as ComputeBoundedRange does before binning.
+      for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+         {
+         temp_float = fPND_scratch[PND_num] - largest_neg_PND;
+         int_scratch[PND_num] = (int)(temp_float + 0.5);
+         }
 
+      if ( low_k < 0 || low_k >= num_PNDiffs )
+         low_index = 0;
+      else
+         low_index = SelectKthSmallestInt(num_PNDiffs, int_scratch, low_k);
 
-// ===========================================================================================================
-// ===========================================================================================================
-// When the server needs to compute the SF COMPLETELY (device does NOT do it), the PopOnly SF MUST be updated
-// to flip the distribution on the device. NOTE: NORMALLY, WE ONLY CALL THIS ROUTINE when we know which device
-// we are communicating with. HOWEVER, FOR DA where we do NOT know, we will need to call this routine for each 
-// device in the DB starting with fresh PopOnly SF. We assume the SAP_ptr->chip_num field is VALID (checked in 
-// the caller). 
-//
-// NOTE: This routine is passed the PNDc from a specific chip, i.e., PopOnly SF have not been applied.
-//
-// NOTE: Although the PopOnly SF are < TrimCodeConstant after ReduceRawSF() is called, that MAY NOT be the case
-// after we do distribution flips here. This routine is called when this server needs to compute the SF
-// completely. ONLY IN THE CASE where the server sends pure PopOnly SF will the SF remain < TrimCodeConstant.
+      if ( high_k >= num_PNDiffs )
+         high_index = DIST_range - 1;
+      else
+         {
+         high_index = SelectKthSmallestInt(num_PNDiffs, int_scratch, high_k) - 1;
+         if ( high_index > DIST_range - 1 )
+            high_index = DIST_range - 1;
+         if ( high_index < 0 )
+            high_index = 0;
+         }
+      cur_range = high_index - low_index;
 
-void FlipPO_SF(int max_string_len, float *PNDc, float *fSpreadFactors, signed char *iSpreadFactors, 
-   int iSpreadFactorScaler, int num_SF, int TrimCodeConstant)
-   {
-   int SF_num, num_TCC_iters;
-   float PNDco; 
+// ***** GPEVCal. The mean is accumulated in the same order as GPEVCal so the results are identical.
+      cur_mean = 0.0;
+      for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+         cur_mean += fPND_scratch[PND_num];
+      cur_mean /= (float)num_PNDiffs;
 
-#ifdef DEBUG
-float orig_SF;
-#endif
+      range_conv = (float)RangeConstant/cur_range;
 
-#ifdef DEBUG
-int limit = 20;
-float temp;
-printf("FlipPO_SF(): CALLED -- MODIFYING PopOnly SF!\n"); fflush(stdout);
-#endif
+      for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+         PNDc[PND_num] = (float)((int)(((fPND_scratch[PND_num] - cur_mean)*range_conv)*16.0))/16.0;
+      }
 
-// Sanity check
-   if ( TrimCodeConstant == 0 )
-      { printf("ERROR: FlipPO_SF(): TrimCodeConstant MUST be > 0!\n"); exit(EXIT_FAILURE); }
+   return;
+   }
 
-   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
-      {
 
-#ifdef DEBUG
-orig_SF = fSpreadFactors[SF_num];
-#endif
+// ========================================================================================================
+// ========================================================================================================
+// Second stage of the batched SRF engine: AddSpreadFactors for the chip-major PNDc_block. The wrap moves PNDco 
+// into [-TrimCodeConstant/2, TrimCodeConstant/2] in whole multiples of TrimCodeConstant, which is what the while 
+// loop in AddSpreadFactors does one step at a time. PNDco_block may be the same as PNDc_block.
 
-// Sanity check. ONLY POSITIVE SF are allowed now.
-      if ( fSpreadFactors[SF_num] < 0 )
-         { printf("ERROR: FlipPO_SF(): fSpreadFactor[%d] is NEGATIVE %9.4f!\n", SF_num, fSpreadFactors[SF_num]); exit(EXIT_FAILURE); }
+void SRFBatchAddSpreadFactors(int num_PNDiffs, int num_batch_chips, unsigned char *chip_mask, float *PNDc_block, 
+   float *fSpreadFactors, int TrimCodeConstant, float *PNDco_block)
+   {
+   float *PNDc, *PNDco;
+   float PNDco_val, num_down, num_up;
+   float half_TCC, fTCC;
+   int chip_num, PND_num;
 
-// Apply the PopOnly SF to the chip's PNDc since we need this value below.
-      PNDco = PNDc[SF_num] - fSpreadFactors[SF_num];
+   fTCC = (float)TrimCodeConstant;
+   half_TCC = (float)TrimCodeConstant/2;
 
-// 12_24_2021: I originally worked on this in 10_15-21_2021 and came up with two algorithms that reduce the SF to 8-bit values (but 
-// NOT with 4 bits of binary precision, only 3 or 2). We need to iteratively reduce the fPNDco. The SF are ALWAYS positive either 
-// reducing positive SF (when subtracted) to the nearest multiple of TrimCodeConstant toward 0 or further reducing negative SF more 
-// negative, ie., from -50 to -64 when the TrimCodeConstant is 32. This reduction also done in AddSpreadFactors()
-      num_TCC_iters = 0;
-      while (1)
-         {
-         if ( PNDco < (float)-TrimCodeConstant/2 )
-            {
-            PNDco += (float)TrimCodeConstant;
-            num_TCC_iters++;
-            }
-         else if ( PNDco > (float)TrimCodeConstant/2 )
-            {
-            PNDco -= (float)TrimCodeConstant;
-            num_TCC_iters++;
-            }
-         else
-            break;
-         }
+   for ( chip_num = 0; chip_num < num_batch_chips; chip_num++ )
+      {
+      if ( chip_mask != NULL && chip_mask[chip_num] == 0 )
+         continue;
 
-// If the number of iterations is odd, adjust the fSpreadFactor.
-      if ( (num_TCC_iters % 2) == 1 )
-//      if ( ((num_TCC_iters % 2) == 1 && (((int)(fSpreadFactors[SF_num]*16) % (TrimCodeConstant*16)) >= TrimCodeConstant/2*16)) ||
-//           ((num_TCC_iters % 2) == 0 && (((int)(fSpreadFactors[SF_num]*16) % (TrimCodeConstant*16)) < TrimCodeConstant/2*16)) )
+      PNDc = PNDc_block + chip_num*num_PNDiffs;
+      PNDco = PNDco_block + chip_num*num_PNDiffs;
+      for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
          {
-         fSpreadFactors[SF_num] += 2.0*PNDco;
+         PNDco_val = PNDc[PND_num] - fSpreadFactors[PND_num];
 
+         num_down = ceilf((PNDco_val - half_TCC)/fTCC);
+         num_up = ceilf((-half_TCC - PNDco_val)/fTCC);
+         num_down = num_down > 0.0f ? num_down : 0.0f;
+         num_up = num_up > 0.0f ? num_up : 0.0f;
 
-// Needed when the actual PNDco are passed in, as opposed to a temporary copy that happens in ComputePxxSpreadFactors. 
-// DO THIS AFTER the modification to fSpreadFactors. Does NOTHING here.
-         PNDco = -PNDco;
+         PNDco[PND_num] = PNDco_val - num_down*fTCC + num_up*fTCC;
          }
+      }
 
-#ifdef DEBUG
-if ( SF_num < limit )
-   printf("SF_num %4d\tSF %9.4f\tFinal PNDco %9.4f\n", SF_num, fSpreadFactors[SF_num], PNDco);
-fflush(stdout);
-#endif
+   return;
+   }
 
-#ifdef DEBUG
-if ( fSpreadFactors[SF_num] < 0 || fSpreadFactors[SF_num] >= (float)TrimCodeConstant )
-   printf("SF_num %4d\tOrig SF %9.4f\tNew SF <0 or >TrimCodeConstant %d => %9.4f\n", 
-      SF_num, orig_SF, TrimCodeConstant, fSpreadFactors[SF_num]);
-fflush(stdout);
-#endif
-      }
 
-// Round off appropriately. With iSpreadFactorScaler at 2, and if I have 35.6875, then store 35.5000. But if I have 16.9375, 
-// store 17.000 (anything larger than 16.75 should be 17.0, Anything larger than 16.25 should be 16.5, etc). Similarly, 
-// with iSpreadFactorScaler at 1, than anything larger than 16.5 should be 17, etc. NOTE: Use 0.5 here for all cases, i.e., 
-// when iSpreadFactorScaler is 2, we need to add 0.5 and NOT 0.25!
-   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
-      if ( fSpreadFactors[SF_num] >= 0 )
-         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler + 0.5);
-      else 
-         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler - 0.5);
+// ========================================================================================================
+// ========================================================================================================
+// Batched SRF engine. Produces the same PNDco as DoSRFComp (ComputePNDiffsTwoSeeds, GPEVCal and AddSpreadFactors)
+// for num_batch_chips chips whose PNR/PNF are stored chip-major and contiguously in PNR_block/PNF_block, i.e.,
+// chip b's values start at b*num_PNDiffs. The PNDco are written in the same layout to PNDco_block. Chips with
+// chip_mask[b] == 0 are skipped (chip_mask may be NULL). The work is split in two stages, SRFBatchPNDcKernel and
+// SRFBatchAddSpreadFactors, so the PNDc (which do NOT depend on the SpreadFactors) can be cached by the caller.
+// fPND_scratch (floats) and int_scratch (ints) must have num_PNDiffs elements.
+
+void SRFBatchKernel(int num_PNDiffs, int num_batch_chips, float *PNR_block, float *PNF_block, unsigned char *chip_mask, 
+   unsigned short *LFSR_pair_map, float *fSpreadFactors, float range_low_limit, float range_high_limit, int DIST_range, 
+   unsigned int RangeConstant, int TrimCodeConstant, float *fPND_scratch, int *int_scratch, float *PNDco_block)
+   {
+   SRFBatchPNDcKernel(num_PNDiffs, num_batch_chips, PNR_block, PNF_block, chip_mask, LFSR_pair_map, range_low_limit, range_high_limit, 
+      DIST_range, RangeConstant, fPND_scratch, int_scratch, PNDco_block);
+   SRFBatchAddSpreadFactors(num_PNDiffs, num_batch_chips, chip_mask, PNDco_block, fSpreadFactors, TrimCodeConstant, PNDco_block);
 
    return;
    }
 
 
-// ===========================================================================================================
-// ===========================================================================================================
-// Compute the PCR SpreadFactors. NOTE: YOU CAN NOT reseed srand with the same seed in this routine. In fact,
-// you cannot use srand or rand because it is NOT re-entrant.
+// ========================================================================================================
+// ========================================================================================================
+// Create the LRU cache of PNDc vectors with as many entries as fit in budget_bytes. Returns NULL if the budget 
+// is too small for a single entry (cache disabled).
 
-void ComputePxxSpreadFactors(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int do_part_A_or_B)
+PNDcCacheStruct *CreatePNDcCache(int num_PNDiffs, long budget_bytes)
    {
-   float strong_1_center, strong_0_center;
-   int PND_num;
+   PNDcCacheStruct *PCC_ptr;
+   int bucket_num;
+   long max_entries;
+
+   max_entries = budget_bytes/(long)(sizeof(float) * num_PNDiffs + sizeof(PNDcCacheEntryStruct) + sizeof(int));
+   if ( max_entries < 1 )
+      return NULL;
+   if ( max_entries > 1000000 )
+      max_entries = 1000000;
+
+   if ( (PCC_ptr = (PNDcCacheStruct *)calloc(1, sizeof(PNDcCacheStruct))) == NULL )
+      { printf("ERROR: CreatePNDcCache(): Failed to allocate storage for PNDcCacheStruct!\n"); exit(EXIT_FAILURE); }
+   PCC_ptr->num_PNDiffs = num_PNDiffs;
+   PCC_ptr->max_entries = (int)max_entries;
+   if ( (PCC_ptr->entries = (PNDcCacheEntryStruct *)malloc(sizeof(PNDcCacheEntryStruct) * max_entries)) == NULL )
+      { printf("ERROR: CreatePNDcCache(): Failed to allocate storage for entries!\n"); exit(EXIT_FAILURE); }
+   if ( (PCC_ptr->PNDc_slab = (float *)malloc(sizeof(float) * num_PNDiffs * max_entries)) == NULL )
+      { printf("ERROR: CreatePNDcCache(): Failed to allocate storage for PNDc_slab!\n"); exit(EXIT_FAILURE); }
+
+// Power-of-2 number of buckets, at least as many as entries.
+   PCC_ptr->num_buckets = 1;
+   while ( PCC_ptr->num_buckets < PCC_ptr->max_entries )
+      PCC_ptr->num_buckets *= 2;
+   if ( (PCC_ptr->buckets = (int *)malloc(sizeof(int) * PCC_ptr->num_buckets)) == NULL )
+      { printf("ERROR: CreatePNDcCache(): Failed to allocate storage for buckets!\n"); exit(EXIT_FAILURE); }
+   for ( bucket_num = 0; bucket_num < PCC_ptr->num_buckets; bucket_num++ )
+      PCC_ptr->buckets[bucket_num] = -1;
+
+   PCC_ptr->num_entries = 0;
+   PCC_ptr->LRU_head = -1;
+   PCC_ptr->LRU_tail = -1;
+   pthread_mutex_init(&(PCC_ptr->mutex), NULL);
+
+   return PCC_ptr;
+   }
 
-   float *fPNDco, *fSpreadFactors; 
-   signed char *iSpreadFactors;
-   int num_PNDiffs, num_chips; 
-   int SpreadConstant;
-   int TrimCodeConstant;
 
-// Fields of the structure used within this routine.
-   num_PNDiffs = SAP_ptr->num_required_PNDiffs; 
-   num_chips = SAP_ptr->num_chips; 
-   fPNDco = SAP_ptr->fPNDco;
-   fSpreadFactors = SAP_ptr->fSpreadFactors; 
-   iSpreadFactors = SAP_ptr->iSpreadFactors; 
-   SpreadConstant = SAP_ptr->param_SpreadConstant;
-   TrimCodeConstant = SAP_ptr->param_TrimCodeConstant;
-
-// Sanity check. For rounding below.
-   if ( SAP_ptr->iSpreadFactorScaler < 1 || SAP_ptr->iSpreadFactorScaler > 2 )
-      { printf("ERROR: ComputePxxSpreadFactors(): iSpreadFactorScaler %d MUST be 1 or 2!\n", SAP_ptr->iSpreadFactorScaler); exit(EXIT_FAILURE); }
+// ========================================================================================================
+// ========================================================================================================
+// Fill in the PNDc cache key for chip_num from the challenge and SRF parameters currently set in SAP_ptr.
 
-// ======================================
-// ======================================
-// Does PopOnly SF. Here we calculate the median values of each PNDc using enrollment data across all chips.
-   if ( do_part_A_or_B == 0 )
-      {
-      int chip_num, PND_num;
-      float largest_neg_PND;
-      float **PO_PNDc; 
-      float *vals;
+void SetPNDcCacheKey(SRFAlgoParamsStruct *SAP_ptr, int chip_num, PNDcCacheKeyStruct *key_ptr)
+   {
 
-#ifdef DEBUG
-printf("Compute Pop SF\n"); fflush(stdout);
-#endif
+// Zero the key (including padding and the unused part of the name) since keys are compared with memcmp.
+   memset(key_ptr, 0, sizeof(PNDcCacheKeyStruct));
+   strncpy(key_ptr->ChallengeSetName, SAP_ptr->ChallengeSetName_NAT, PNDC_CACHE_MAX_NAME_LEN - 1);
+   key_ptr->challenge_seed = SAP_ptr->DB_ChallengeGen_seed;
+   key_ptr->LFSR_seed_low = SAP_ptr->param_LFSR_seed_low;
+   key_ptr->LFSR_seed_high = SAP_ptr->param_LFSR_seed_high;
+   key_ptr->RangeConstant = SAP_ptr->param_RangeConstant;
+   key_ptr->chip_num = chip_num;
 
-// Don't use all the chips if the number is very large b/c it takes too long -- only a subset is needed. 
-// 6_27_2022: LATENT BUG: If you have do_PO_dist_flip set to 1, YOU MUST USE ALL CHIPS HERE. See below
-// FlipPO_SF which uses the PO_PNDc[SAP_ptr->chip_num] computed here to determine when flips occur so 
-// so the dataset of SAP_ptr->chip_num better be present else crash. Alternatively, you can just make
-// sure SAP_ptr->chip_num data is included in the selected set.
-//
-// 10_22_2022: You can add this back later -- I'm debugging.
-//      if ( num_chips >= 100 && SAP_ptr->do_PO_dist_flip == 0 )
-//         num_chips = 100;
-//      else
-         num_chips = SAP_ptr->num_chips;
+   return;
+   }
 
-// Allocate space to compute the Median values.
-      if ( (PO_PNDc = (float **)malloc(sizeof(float *) * num_chips)) == NULL )
-         { printf("ERROR: ComputePxxSpreadFactors(): failed to allocate temporary storage for 'PO_PNDc'!\n"); exit(EXIT_FAILURE); }
-      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
-         if ( (PO_PNDc[chip_num] = (float *)malloc(sizeof(float) * SAP_ptr->num_required_PNDiffs)) == NULL )
-            { printf("ERROR: ComputePxxSpreadFactors(): failed to allocate temporary storage for 'PO_PNDc[chip_num]'!\n"); exit(EXIT_FAILURE); }
 
-// ---------------------------------
-// Compute differences and calibrate
-      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
-         {
-// Compute the PND and PNDc for each chip
-         largest_neg_PND = ComputePNDiffsTwoSeeds(SAP_ptr->num_required_PNDiffs, SAP_ptr->PNR[chip_num], SAP_ptr->PNF[chip_num], PO_PNDc[chip_num], 
-            SAP_ptr->param_LFSR_seed_low, SAP_ptr->param_LFSR_seed_high);
+// ========================================================================================================
+// ========================================================================================================
+// Bucket of a PNDc cache key (FNV-1a over the key bytes).
 
-// GPEVCal the PNDc for this chip. NOTE: Source and destination arrays are identical.
-         GPEVCal(SAP_ptr->num_required_PNDiffs, PO_PNDc[chip_num], PO_PNDc[chip_num], SAP_ptr->range_low_limit, SAP_ptr->range_high_limit, 
-            SAP_ptr->dist_range, SAP_ptr->param_RangeConstant, largest_neg_PND);
-         }
+int HashPNDcCacheKey(PNDcCacheStruct *PCC_ptr, PNDcCacheKeyStruct *key_ptr)
+   {
+   unsigned char *key_bytes = (unsigned char *)key_ptr;
+   unsigned int hash = 2166136261u;
+   int byte_num;
 
-// Allocate storage.
-      if ( (vals = (float *)malloc(sizeof(float) * num_chips)) == NULL )
-         { printf("ERROR: ComputePxxSpreadFactors(): failed to allocate temporary storage for 'vals'!\n"); exit(EXIT_FAILURE); }
+   for ( byte_num = 0; byte_num < (int)sizeof(PNDcCacheKeyStruct); byte_num++ )
+      hash = (hash ^ key_bytes[byte_num]) * 16777619u;
 
-// For each PNDc, compute the median value.
-      for ( PND_num = 0; PND_num < SAP_ptr->num_required_PNDiffs; PND_num++ )
-         {
-         for ( chip_num = 0; chip_num < num_chips; chip_num++ )
-            vals[chip_num] = PO_PNDc[chip_num][PND_num];
+   return (int)(hash & (unsigned int)(PCC_ptr->num_buckets - 1));
+   }
 
-// These MUST be rounded to 4 binary digits for ReduceRawSF to work properly.
-         fSpreadFactors[PND_num] = (float)((int)(ComputeMedian(num_chips, vals)*16.0))/16.0;
 
-// They will NOT fit until they are trimmed below by ReduceRawSF().
-//         iSpreadFactors[PND_num] = (signed short)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler);
+// ========================================================================================================
+// ========================================================================================================
+// LRU list maintenance. The caller holds the mutex.
 
-#ifdef DEBUG
-if ( PND_num == 0 )
-   int i;
-   for ( i = 0; i < num_chips; i++ )
-      printf("Chip %d\tPND %d\tPO_PNDc %10.4f\tMedian fSpreadFactor %9.4f\tPO_PNDc_pop %10.4f\n", i , PND_num, PO_PNDc[i][PND_num], 
-         fSpreadFactors[PND_num], PO_PNDc[i][PND_num] - fSpreadFactors[PND_num]);
-#endif
-#ifdef DEBUG
-if ( PND_num < 10 )
+void UnlinkPNDcCacheLRU(PNDcCacheStruct *PCC_ptr, int entry_num)
    {
-   int i, num_pos_vals = 0, num_neg_vals = 0, num_zero_vals = 0;
-   for ( i = 0; i < num_chips; i++ )
-      {
-      if ( PO_PNDc[i][PND_num] - fSpreadFactors[PND_num] < 0.0 )
-         num_neg_vals++; 
-      if ( PO_PNDc[i][PND_num] - fSpreadFactors[PND_num] > 0.0 )
-         num_pos_vals++; 
-      if ( PO_PNDc[i][PND_num] - fSpreadFactors[PND_num] == 0.0 )
-         num_zero_vals++; 
-      }
-   printf("\tPND %d\tnum chips %d\tnum_pos %d\tnum neg %d\tnum_zeros %d\n", PND_num, num_chips, num_pos_vals, num_neg_vals, num_zero_vals); fflush(stdout);
-   }
-#endif
-         }
+   PNDcCacheEntryStruct *entry_ptr = &(PCC_ptr->entries[entry_num]);
 
-// -----------------------------------------
-// We use 8-bit SpreadFactors now, so this MUST ALWAYS BE CALLED. We MUST reduce the median PNDc to a value < the TrimCodeConstant, and 
-// make them ALL positive. 
-      ReduceRawSF(max_string_len, fSpreadFactors, iSpreadFactors, SAP_ptr->iSpreadFactorScaler, SAP_ptr->num_required_PNDiffs, 
-         TrimCodeConstant);
+   if ( entry_ptr->LRU_prev != -1 )
+      PCC_ptr->entries[entry_ptr->LRU_prev].LRU_next = entry_ptr->LRU_next;
+   else
+      PCC_ptr->LRU_head = entry_ptr->LRU_next;
+   if ( entry_ptr->LRU_next != -1 )
+      PCC_ptr->entries[entry_ptr->LRU_next].LRU_prev = entry_ptr->LRU_prev;
+   else
+      PCC_ptr->LRU_tail = entry_ptr->LRU_prev;
 
-#ifdef DEBUG
-int j;
-for ( j = 0; j < 10; j++ )
-   printf("ComputePxxSpreadFactors(): HERE: fSpreadFactors[%d] %.4f\tiSpreadFactors[%d] %d\n", j, fSpreadFactors[j], j, iSpreadFactors[j]);
-#endif
+   return;
+   }
 
-// -----------------------------------------
-// When the server needs to compute the SF COMPLETELY (device does NOT do it), the PopOnly SF MUST be updated to flip the distribution on the device, 
-// e.g., FUNC_VA, FUNC_SE. NOTE: For FUNC_DA, WE DO NOT KNOW WHICH DEVICE we are communicating with so we will need to call this routine for each device 
-// in the DB starting with fresh PopOnly SF. NOTE: The SF are NOT bounded to be >= 0 and < TrimCodeConstant after calling this routine (they are also NOT
-// bounded by the pure PopOnly range after PCR either).
-      if ( SAP_ptr->do_PO_dist_flip == 1 )
-         {
+void PushFrontPNDcCacheLRU(PNDcCacheStruct *PCC_ptr, int entry_num)
+   {
+   PNDcCacheEntryStruct *entry_ptr = &(PCC_ptr->entries[entry_num]);
 
-// Sanity check. SAP_ptr->chip_num MUST be set to a number between 0 and num_chips-1.
-         if ( SAP_ptr->chip_num < 0 || SAP_ptr->chip_num >= num_chips )
-            { 
-            printf("WARNING: ComputePxxSpreadFactors(): PO component WITH do_PO_dist_flip a 1 MUST have chip_num %d >= 0 and < %d -- NOT DOING PO_dist_flip!\n", 
-               SAP_ptr->chip_num, num_chips);
-            }
-         else
-            FlipPO_SF(max_string_len, PO_PNDc[SAP_ptr->chip_num], fSpreadFactors, iSpreadFactors, SAP_ptr->iSpreadFactorScaler, 
-               SAP_ptr->num_required_PNDiffs, TrimCodeConstant);
-         }
+   entry_ptr->LRU_prev = -1;
+   entry_ptr->LRU_next = PCC_ptr->LRU_head;
+   if ( PCC_ptr->LRU_head != -1 )
+      PCC_ptr->entries[PCC_ptr->LRU_head].LRU_prev = entry_num;
+   PCC_ptr->LRU_head = entry_num;
+   if ( PCC_ptr->LRU_tail == -1 )
+      PCC_ptr->LRU_tail = entry_num;
 
-// Free the space.
-      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
-         if ( PO_PNDc[chip_num] != NULL )
-            free(PO_PNDc[chip_num]);
-      if ( PO_PNDc != NULL )
-         free(PO_PNDc); 
-      if ( vals != NULL )
-         free(vals);
-      return;
-      }
+   return;
+   }
 
-// ======================================
-// ======================================
-// Do PCR SF
 
-// Sanity check. SAP_ptr->chip_num MUST be set to a number between 0 and num_chips-1.
-   if ( SAP_ptr->chip_num < 0 || SAP_ptr->chip_num >= SAP_ptr->num_chips )
-      { 
-      printf("ERROR: ComputePxxSpreadFactors(): PerChip+Random component MUST have chip_num %d >= 0 and < num_chips %d\n", 
-         SAP_ptr->chip_num, SAP_ptr->num_chips); exit(EXIT_FAILURE); 
-      }
+// ========================================================================================================
+// ========================================================================================================
+// Look up the PNDc of key_ptr. On a hit, the vector is copied to PNDc (so a later eviction cannot change it 
+// under the caller), the entry becomes the most recently used and 1 is returned. Returns 0 on a miss.
 
-// Sanity check. Do NOT run PCR is we specify PopOnly.
-   if ( SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_POPONLY )
-      { printf("ERROR: ComputePxxSpreadFactors(): Can NOT run PCR code when SF mode is PopOnly!\n"); exit(EXIT_FAILURE); }
+int LookupPNDcCache(PNDcCacheStruct *PCC_ptr, PNDcCacheKeyStruct *key_ptr, float *PNDc)
+   {
+   int entry_num, bucket_num;
 
-// We first call DoSRFComp() to compute PND, PNDc and fPNDco for the chip number set in SAP_ptr->chip_num, which ALSO APPLIES the 
-// population-based SpreadFactors to the fPNDco (useful in case we are computing a response bitstring within the verifier). 
-   DoSRFComp(max_string_len, SAP_ptr, 0);
+   bucket_num = HashPNDcCacheKey(PCC_ptr, key_ptr);
 
-// We just need to move these population-adjusted PNDco to the CENTER of the strong bit region and then randomly distribute across 
-// the SpreadConstant/2 and we are done. However, we also need to update fSpreadFactors because that is what we store when the 
-// enrollment process is completed. So we focus here on adjusting the fSpreadFactors and then appling them to the PNDco to 
-// generate the final PNDco. 
+   pthread_mutex_lock(&(PCC_ptr->mutex));
+   for ( entry_num = PCC_ptr->buckets[bucket_num]; entry_num != -1; entry_num = PCC_ptr->entries[entry_num].hash_next )
+      if ( memcmp(&(PCC_ptr->entries[entry_num].key), key_ptr, sizeof(PNDcCacheKeyStruct)) == 0 )
+         break;
 
-// Make the center of the strong bit region the SpreadConstant, 20/4 = +/-5. NOTE: SpreadConstant MUST be similar to the maximum 
-// amount of entropy present in the path delay differences. If larger, information may leak in the final SpreadFactors
-   strong_0_center = (float)(-SpreadConstant)/4.0;
-   strong_1_center = (float)SpreadConstant/4.0;
+   if ( entry_num == -1 )
+      {
+      PCC_ptr->num_misses++;
+      pthread_mutex_unlock(&(PCC_ptr->mutex));
+      return 0;
+      }
 
-// We canNOT use rand any longer in multi-threaded routines when use_database_chlngs = 1. So on the verifier, we use /dev/urandom
-// instead.
-   FILE *fp = fopen("/dev/urandom", "r");
-   char num_str[5];
-   num_str[4] = '\0';
+   memcpy(PNDc, PCC_ptr->PNDc_slab + (size_t)entry_num*PCC_ptr->num_PNDiffs, sizeof(float) * PCC_ptr->num_PNDiffs);
+   UnlinkPNDcCacheLRU(PCC_ptr, entry_num);
+   PushFrontPNDcCacheLRU(PCC_ptr, entry_num);
+   PCC_ptr->num_hits++;
+   pthread_mutex_unlock(&(PCC_ptr->mutex));
 
-// ------------------------------------------------
-// Apply the remaining components of the PCR method. 
-   float PerChip_spread_factor = 0.0;
-   int random_val; 
-   for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
-      {
-      float init_fPNDco;
+   return 1;
+   }
 
-// NOTE: We use enrollment PNDco which have been updated with the PopOnly SF already BUT ONLY IF PCR_or_PBD_or_PO is 
-// set to PCR or PopOnly mode (otherwise they have NOT been updated and fSpreadFactors are all 0).
-      init_fPNDco = fPNDco[PND_num];
 
-// Sanity check
-      if ( SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PBD && fSpreadFactors[PND_num] != 0.0 )
-         { printf("ERROR: ComputePxxSpreadFactors(): fSpreadFactors MUST BE zero in PBD mode!\n"); exit(EXIT_FAILURE); }
+// ========================================================================================================
+// ========================================================================================================
+// Add the PNDc of key_ptr to the cache, evicting the least recently used entry when the cache is full. If 
+// another thread added the key in the meantime, its entry is only refreshed.
 
-// Determine the closest strong bit line (at SpreadConstant/2 or -SpreadConstant/2) in PCR mode. If PBD mode, use the low 
-// order integer bit of the PNDc (NOT THE PRECISION BITS) to determine the super-strong bit region. NOTE: Similar to the 
-// hardware, we do NOT apply Pop SFs above when SAP_ptr->param_PCR_or_PBD_or_PO is set to 1 since we want to avoid using 
-// SFs altogether on the device in PBD mode.
-      if ( (fabs(strong_0_center - init_fPNDco) < fabs(strong_1_center - init_fPNDco) && 
-         SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PCR) || 
-         ( (((int)init_fPNDco % 2) == 0) && SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PBD) )
-         PerChip_spread_factor = strong_0_center - init_fPNDco;
-      else
-         PerChip_spread_factor = strong_1_center - init_fPNDco;
+void InsertPNDcCache(PNDcCacheStruct *PCC_ptr, PNDcCacheKeyStruct *key_ptr, float *PNDc)
+   {
+   int entry_num, bucket_num, *link_ptr;
 
-// CHANGE HERE: 10_17_2021: Handle the fPNDco 0.0 case. Leave the PerChip+Random Spreadfactor at zero. The population 
-// value (already added into the fPNDco) makes this fPNDco 0.0 so it will NOT be used during bitstring generation.
-      if ( init_fPNDco == 0 )
+   bucket_num = HashPNDcCacheKey(PCC_ptr, key_ptr);
+
+   pthread_mutex_lock(&(PCC_ptr->mutex));
+   for ( entry_num = PCC_ptr->buckets[bucket_num]; entry_num != -1; entry_num = PCC_ptr->entries[entry_num].hash_next )
+      if ( memcmp(&(PCC_ptr->entries[entry_num].key), key_ptr, sizeof(PNDcCacheKeyStruct)) == 0 )
          {
-#ifdef DEBUG
-printf("\tChip %3d\tfPNDco[%4d] is 0.0 %f\tLeaving fPNDco and fSpreadFactors at population value\n", SAP_ptr->chip_num, 
-   PND_num, init_fPNDco); fflush(stdout);
-#endif
-         continue;
+         UnlinkPNDcCacheLRU(PCC_ptr, entry_num);
+         PushFrontPNDcCacheLRU(PCC_ptr, entry_num);
+         pthread_mutex_unlock(&(PCC_ptr->mutex));
+         return;
          }
 
-// PopOnly SF are just the median values of the PND across all chips, but with TrimCodeConstant, they are moved to the 
-// next lower multiple of TrimCode. And they are always positive. They have ALREADY been applied to the fPNDco and trimmed.
-
-#ifdef DEBUG
-if ( PND_num < 20 )
-   printf("\tChip %3d\tINIT fPNDco[%4d] %9.4f\tINIT SF %9.4f\tPerChip_spread_factor %9.4f\n", SAP_ptr->chip_num, 
-      PND_num, init_fPNDco, fSpreadFactors[PND_num], PerChip_spread_factor); 
-fflush(stdout);
-#endif
-
-// So PCR SpreadFactor = Pop SpreadFactor - PerChip SpreadFactor + random_val, which would then be SUBTRACTED from the PNDc. 
-// Note that SF are the PopOnly SF, which with TrimCodeConstant applied, are all positive. 
-// 1_1_2022: NOTE: After PCR, SF can become slightly negative and more positive than the TrimCodeConstant. 
-      fSpreadFactors[PND_num] -= PerChip_spread_factor;
+// Take a free entry, or evict the tail of the LRU list and unlink it from its bucket chain.
+   if ( PCC_ptr->num_entries < PCC_ptr->max_entries )
+      entry_num = PCC_ptr->num_entries++;
+   else
+      {
+      entry_num = PCC_ptr->LRU_tail;
+      UnlinkPNDcCacheLRU(PCC_ptr, entry_num);
+
+      link_ptr = &(PCC_ptr->buckets[HashPNDcCacheKey(PCC_ptr, &(PCC_ptr->entries[entry_num].key))]);
+      while ( *link_ptr != entry_num )
+         link_ptr = &(PCC_ptr->entries[*link_ptr].hash_next);
+      *link_ptr = PCC_ptr->entries[entry_num].hash_next;
+      PCC_ptr->num_evictions++;
+      }
 
-// Now randomize the value over the 0 or 1 regions. If SpreadConstant is 20, then rand() returns a number between 0 and 8, 
-// 20/2 - 1 = 9. Subtracting 20/4 - 1 = 4 makes the range -4 to +4. TRIM THIS TO 16-bit so we can send the rand values to the 
-// hardware and have it compute the same random value here.
-      unsigned int rand_uint;
-      fread(num_str, sizeof(uint8_t), 4, fp);
-      rand_uint = (num_str[3] << 24) | (num_str[2] << 16) | (num_str[1] << 8) | num_str[0]; 
+   PCC_ptr->entries[entry_num].key = *key_ptr;
+   memcpy(PCC_ptr->PNDc_slab + (size_t)entry_num*PCC_ptr->num_PNDiffs, PNDc, sizeof(float) * PCC_ptr->num_PNDiffs);
+   PCC_ptr->entries[entry_num].hash_next = PCC_ptr->buckets[bucket_num];
+   PCC_ptr->buckets[bucket_num] = entry_num;
+   PushFrontPNDcCacheLRU(PCC_ptr, entry_num);
+   pthread_mutex_unlock(&(PCC_ptr->mutex));
 
-//if ( PND_num < 10 )
-//   { printf("rand_uint %u\n", rand_uint); fflush(stdout); }
+   return;
+   }
 
-      random_val = (rand_uint % (SpreadConstant/2 - 1)) - (SpreadConstant/4 - 1);
 
-// Update fSpreadFactors with random value.
-      fSpreadFactors[PND_num] += random_val;
+// ========================================================================================================
+// ========================================================================================================
+// Report the cache counters.
 
-// We need to invert the signs here, i.e., add in the PerChip SF and subtract the random_val from the fPNDco. 
-      fPNDco[PND_num] = fPNDco[PND_num] + PerChip_spread_factor - (float)random_val;
+void PrintPNDcCacheStats(PNDcCacheStruct *PCC_ptr)
+   {
+   if ( PCC_ptr == NULL )
+      return;
 
-// Sanity check. We MUST have values within the bounds of the SpreadConstant. I purposely stay one away from the max values.
-      if ( fPNDco[PND_num] >= (float)SpreadConstant/2.0 || fPNDco[PND_num] <= (float)(-SpreadConstant)/2.0 )
-         { 
-         printf("ERROR: ComputePxxSpreadFactors(): fPNDco[%d] %+8.4f OUTSIDE bounds of SpreadConstant +/- %d\n", 
-            PND_num, fPNDco[PND_num], SpreadConstant/2); exit(EXIT_FAILURE); 
-         }
+   pthread_mutex_lock(&(PCC_ptr->mutex));
+   printf("PNDc cache: %d of %d entries\tHits %ld\tMisses %ld\tHit rate %.1f%%\tEvictions %ld\n", 
+      PCC_ptr->num_entries, PCC_ptr->max_entries, PCC_ptr->num_hits, PCC_ptr->num_misses, 
+      PCC_ptr->num_hits + PCC_ptr->num_misses > 0 ? 100.0*PCC_ptr->num_hits/(PCC_ptr->num_hits + PCC_ptr->num_misses) : 0.0, 
+      PCC_ptr->num_evictions); 
+   fflush(stdout);
+   pthread_mutex_unlock(&(PCC_ptr->mutex));
 
-// Sanity check
-      if ( fSpreadFactors[PND_num]*16.0 < -32767 || fSpreadFactors[PND_num]*16.0 > 32767 )
-         { 
-         printf("ERROR: ComputePxxSpreadFactors(): Scaled integer SpreadFactor %d exceeds max/min signed short!\n", 
-            (int)(fSpreadFactors[PND_num]*16.0)); exit(EXIT_FAILURE); 
-         }
+   return;
+   }
 
-// Save the integer-based SpreadFactors to a separate array. Can SF these become negative after PCR adjustments -- yes, negative 
-// and more positive than the TrimCodeConstant. See example(s) above. So a TrimCodeConstant of 32 will require one extra positive 
-// bit to represent numbers >= 32 and one extra bit for negative numbers. So 7 bits will be needed, so only one bit of precision 
-// for TrimCodeConstant <= 32. For TrimCodeConstant > 32 and <= 64, we need all 8 bits (no precision bits are preserved). For the
-// first case, iSpreadFactorScaler shifts the fSpreadFactors by 1 bit to the left and then trunscates it to a (signed char). Otherwise
-// multiple by 1 which does nothing by truncate the floating point value to an integer (signed char).
-      if ( (int)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler) < -127 || 
-         (int)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler > 127) )
-         { 
-         printf("ERROR: ComputePxxSpreadFactors(): iSpreadFactors[%d] exceeds (signed char) limits of -127 to 127: %d\n", PND_num, 
-            (int)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler)); 
-         exit(EXIT_FAILURE); 
-         }
 
-// Round off appropriately. With iSpreadFactorScaler at 2, and if I have 35.6875, then store 35.5000. But if I have 16.9375, 
-// store 17.000 (anything larger than 16.75 should be 17.0, Anything larger than 16.25 should be 16.5, etc). Similarly, with 
-// iSpreadFactorScaler at 1, than anything larger than 16.5 should be 17, etc. NOTE: Use 0.5 here for all cases, i.e., when 
-// iSpreadFactorScaler is 2, we need to add 0.5 and NOT 0.25!
-      if ( fSpreadFactors[PND_num] >= 0 )
-         iSpreadFactors[PND_num] = (signed char)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler + 0.5);
-      else 
-         iSpreadFactors[PND_num] = (signed char)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler - 0.5);
+// ========================================================================================================
+// ========================================================================================================
+// Free the PNDc cache.
 
-#ifdef DEBUG
-if ( PND_num < 20 )
-   printf("\tChip %3d\tFINAL fPNDco[%4d] %9.4f\tFINAL fSF %9.4f\tRandom val %2d\tiSF %4d\n", SAP_ptr->chip_num, PND_num, 
-      fPNDco[PND_num], fSpreadFactors[PND_num], random_val, (int)iSpreadFactors[PND_num]); 
-fflush(stdout);
-#endif
+void FreePNDcCache(PNDcCacheStruct **PCC_ptr_ptr)
+   {
+   if ( *PCC_ptr_ptr == NULL )
+      return;
 
-      }
-   fclose(fp);
+   pthread_mutex_destroy(&((*PCC_ptr_ptr)->mutex));
+   free((*PCC_ptr_ptr)->entries);
+   free((*PCC_ptr_ptr)->PNDc_slab);
+   free((*PCC_ptr_ptr)->buckets);
+   free(*PCC_ptr_ptr);
+   *PCC_ptr_ptr = NULL;
 
    return;
    }
@@ -961,324 +1007,1602 @@ fflush(stdout);
 
 // ========================================================================================================
 // ========================================================================================================
-// Compute the SBS and SHD from the timing data for a given Threshold Note, we can get the raw bitstring
-// with all 2048 bits by setting the Threshold to 0.
+// Create the counters of the chip search candidate prefilter.
 
-int SingleHelpBitGen(int max_PNDiffs, float *fPNDco, unsigned char *SBS, unsigned char *SHD, int *HD_num_bytes_ptr, 
-   unsigned short Threshold)
+DAPrefilterStatsStruct *CreateDAPrefilterStats()
    {
-   int SBS_num_bits, PND_num;
-   unsigned char bit_val;
-   unsigned char HD_val;
-   float fThreshold;
+   DAPrefilterStatsStruct *DPS_ptr;
 
-   fThreshold = (float)Threshold;
+   if ( (DPS_ptr = (DAPrefilterStatsStruct *)calloc(1, sizeof(DAPrefilterStatsStruct))) == NULL )
+      { printf("ERROR: CreateDAPrefilterStats(): Failed to allocate storage for DAPrefilterStatsStruct!\n"); exit(EXIT_FAILURE); }
+   pthread_mutex_init(&(DPS_ptr->mutex), NULL);
 
-// Basic idea here is to carry out what the device did in the server authentication, compute the strong bitstring and single
-// helper bitstring using the fPNDco 
-   SBS_num_bits = 0;
-   for ( PND_num = 0; PND_num < max_PNDiffs; PND_num++ )
+   return DPS_ptr;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Record the outcome of one prefiltered chip search. pruned is 1 if a candidate authenticated and the other 
+// chips were skipped. auth_rank is the position of the accepted chip in the candidate order, or -1 if the device 
+// failed to authenticate.
+
+void RecordDAPrefilterSearch(DAPrefilterStatsStruct *DPS_ptr, int num_candidates, int pruned, int auth_rank)
+   {
+   if ( DPS_ptr == NULL )
+      return;
+
+   pthread_mutex_lock(&(DPS_ptr->mutex));
+   DPS_ptr->num_searches++;
+   if ( pruned == 1 )
+      DPS_ptr->num_pruned++;
+   else
+      DPS_ptr->num_fallback++;
+   if ( auth_rank != -1 )
       {
+      DPS_ptr->num_auth++;
+      if ( auth_rank < num_candidates )
+         DPS_ptr->num_auth_in_candidates++;
+      DPS_ptr->sum_auth_rank += auth_rank;
+      if ( auth_rank > DPS_ptr->max_auth_rank )
+         DPS_ptr->max_auth_rank = auth_rank;
+      }
+   pthread_mutex_unlock(&(DPS_ptr->mutex));
 
-// Compute the bit value
-      if ( fPNDco[PND_num] < 0.0 )
-         bit_val = 0;
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Report the prefilter counters.
+
+void PrintDAPrefilterStats(DAPrefilterStatsStruct *DPS_ptr)
+   {
+   if ( DPS_ptr == NULL )
+      return;
+
+   pthread_mutex_lock(&(DPS_ptr->mutex));
+   printf("DA prefilter: Searches %ld\tPruned %ld\tFull scan %ld\tRecall %.1f%% (%ld of %ld)\tAve rank %.1f\tMax rank %d\n", 
+      DPS_ptr->num_searches, DPS_ptr->num_pruned, DPS_ptr->num_fallback, 
+      DPS_ptr->num_auth > 0 ? 100.0*DPS_ptr->num_auth_in_candidates/DPS_ptr->num_auth : 0.0, DPS_ptr->num_auth_in_candidates, 
+      DPS_ptr->num_auth, DPS_ptr->num_auth > 0 ? (float)DPS_ptr->sum_auth_rank/DPS_ptr->num_auth : 0.0, DPS_ptr->max_auth_rank); 
+   fflush(stdout);
+   pthread_mutex_unlock(&(DPS_ptr->mutex));
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// We use 8-bit SpreadFactors now, so MUST reduce the median PNDc to a value < TrimCodeConstant, and make all 
+// SF positive (they can be very small negative numbers via other modes). This was debugged originally in 
+// /borg_data/FPGAs/ZYBO/SR_RFM/ANALYSIS/code/common.c, in ComputePCRSpreadFactors().
+
+//#define DEBUG1 0
+
+void ReduceRawSF(int max_string_len, float *fSpreadFactors, signed char *iSpreadFactors, int iSpreadFactorScaler,
+   int num_SF, int TrimCodeConstant)
+   {
+   int SF_num, multiple;
+
+#ifdef DEBUG1
+int limit = 20;
+#endif
+
+   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
+      {
+
+// Find the nearest multiple of TrimCodeConstant for the current fSpreadFactors. If positive, truncate to lowest integer. 
+// If negative, we need to round down to the next smallest negative number, e.g., if -1.x, round to -2. Preserve the sign here. 
+// NOTE: We have rounded fSpreadFactors to 4 binary digits of precision in the caller.
+      multiple = (int)(fSpreadFactors[SF_num]*16)/(TrimCodeConstant*16);
+      if ( fSpreadFactors[SF_num] < 0 )
+         {
+
+// If the remainder is non-zero, round down. NOTE: fSpreadFactors MUST be rounded to 4 precision places for this to work.
+         if ( (int)fabs(fSpreadFactors[SF_num] * 16) % (TrimCodeConstant*16) != 0 )
+            multiple -= 1;
+         }
+
+#ifdef DEBUG1
+if ( SF_num < limit )
+   { 
+   printf("ReduceRawSF(): Orig SpreadFactor[%4d]: %+8.4f\tmultiple %2d\tAdd -1 ? %3d with %3d mod %3d =?= 0\t", SF_num, fSpreadFactors[SF_num], multiple, 
+      (int)fabs(fSpreadFactors[SF_num] * 16) % (TrimCodeConstant*16), (int)fabs(fSpreadFactors[SF_num] * 16), (TrimCodeConstant*16)); fflush(stdout); 
+   }
+#endif
+
+// THIS MUST be always positive and less than TrimCodeConstant.
+      fSpreadFactors[SF_num] = fSpreadFactors[SF_num] - (float)multiple*TrimCodeConstant;
+
+#ifdef DEBUG1
+if ( SF_num < limit )
+   { printf("ReduceRawSF(): New SpreadFactor[%4d]: %+8.4f\n", SF_num, fSpreadFactors[SF_num]); fflush(stdout); }
+#endif
+
+// Sanity check
+      if ( fSpreadFactors[SF_num] < 0 || fSpreadFactors[SF_num] >= TrimCodeConstant )
+         {
+         printf("ERROR: ReduceRawSF(): fSpreadFactors[%d] is less than 0 or >= TrimCodeConstant %d => %f\n", 
+            SF_num, TrimCodeConstant, fSpreadFactors[SF_num]);
+         exit(EXIT_FAILURE);
+         }
+      }
+
+// Convert floats to signed char for transmission to device. Round off appropriately. With iSpreadFactorScaler at 2, and 
+// if I have 35.6875, then store 35.5000. But if I have 16.9375, store 17.000 (anything larger than 16.75 should be 17.0, 
+// anything larger than 16.25 should be 16.5, etc). Similarly, with iSpreadFactorScaler at 1, than anything larger than 
+// 16.5 should be 17, etc. NOTE: Use 0.5 here for all cases, i.e., when iSpreadFactorScaler is 2, we need to add 0.5 and 
+// NOT 0.25!
+   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
+      if ( fSpreadFactors[SF_num] >= 0 )
+         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler + 0.5);
       else 
-         bit_val = 1;
+         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler - 0.5);
 
-// Thresholding: if the fPNDco is within a 'Threshold' of the bit-flip line, consider it invalid. This works when Threshold of 0, which makes 
-// ALL bits strong (required for KEK regeneration). MUST USE '>' to handle the case where the threshold is 0.
-      if ( fPNDco[PND_num] > -fThreshold && fPNDco[PND_num] < fThreshold )
-         HD_val = 0;
-      else
-         HD_val = 1;
+#ifdef DEBUG1
+for ( SF_num = 0; SF_num < limit; SF_num++ )
+   printf("ReduceRawSF(): TRIMMED PopOnly SpreadFactors[%4d], PART A, Median (fSpreadFactor) %8.4f\n", SF_num, fSpreadFactors[SF_num]);
+fflush(stdout);
+#endif
+
+   return;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// When the server needs to compute the SF COMPLETELY (device does NOT do it), the PopOnly SF MUST be updated
+// to flip the distribution on the device. NOTE: NORMALLY, WE ONLY CALL THIS ROUTINE when we know which device
+// we are communicating with. HOWEVER, FOR DA where we do NOT know, we will need to call this routine for each 
+// device in the DB starting with fresh PopOnly SF. We assume the SAP_ptr->chip_num field is VALID (checked in 
+// the caller). 
+//
+// NOTE: This routine is passed the PNDc from a specific chip, i.e., PopOnly SF have not been applied.
+//
+// NOTE: Although the PopOnly SF are < TrimCodeConstant after ReduceRawSF() is called, that MAY NOT be the case
+// after we do distribution flips here. This routine is called when this server needs to compute the SF
+// completely. ONLY IN THE CASE where the server sends pure PopOnly SF will the SF remain < TrimCodeConstant.
+
+void FlipPO_SF(int max_string_len, float *PNDc, float *fSpreadFactors, signed char *iSpreadFactors, 
+   int iSpreadFactorScaler, int num_SF, int TrimCodeConstant)
+   {
+   int SF_num, num_TCC_iters;
+   float PNDco; 
 
 #ifdef DEBUG
-if ( PND_num < 10 )
-   printf("%4d\tPNDco %+9.4f\tBit val %d\tHD val %d\n", PND_num, fPNDco[PND_num], bit_val, HD_val); 
+float orig_SF;
+#endif
+
+#ifdef DEBUG
+int limit = 20;
+float temp;
+printf("FlipPO_SF(): CALLED -- MODIFYING PopOnly SF!\n"); fflush(stdout);
+#endif
+
+// Sanity check
+   if ( TrimCodeConstant == 0 )
+      { printf("ERROR: FlipPO_SF(): TrimCodeConstant MUST be > 0!\n"); exit(EXIT_FAILURE); }
+
+   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
+      {
+
+#ifdef DEBUG
+orig_SF = fSpreadFactors[SF_num];
+#endif
+
+// Sanity check. ONLY POSITIVE SF are allowed now.
+      if ( fSpreadFactors[SF_num] < 0 )
+         { printf("ERROR: FlipPO_SF(): fSpreadFactor[%d] is NEGATIVE %9.4f!\n", SF_num, fSpreadFactors[SF_num]); exit(EXIT_FAILURE); }
+
+// Apply the PopOnly SF to the chip's PNDc since we need this value below.
+      PNDco = PNDc[SF_num] - fSpreadFactors[SF_num];
+
+// 12_24_2021: I originally worked on this in 10_15-21_2021 and came up with two algorithms that reduce the SF to 8-bit values (but 
+// NOT with 4 bits of binary precision, only 3 or 2). We need to iteratively reduce the fPNDco. The SF are ALWAYS positive either 
+// reducing positive SF (when subtracted) to the nearest multiple of TrimCodeConstant toward 0 or further reducing negative SF more 
+// negative, ie., from -50 to -64 when the TrimCodeConstant is 32. This reduction also done in AddSpreadFactors()
+      num_TCC_iters = 0;
+      while (1)
+         {
+         if ( PNDco < (float)-TrimCodeConstant/2 )
+            {
+            PNDco += (float)TrimCodeConstant;
+            num_TCC_iters++;
+            }
+         else if ( PNDco > (float)TrimCodeConstant/2 )
+            {
+            PNDco -= (float)TrimCodeConstant;
+            num_TCC_iters++;
+            }
+         else
+            break;
+         }
+
+// If the number of iterations is odd, adjust the fSpreadFactor.
+      if ( (num_TCC_iters % 2) == 1 )
+//      if ( ((num_TCC_iters % 2) == 1 && (((int)(fSpreadFactors[SF_num]*16) % (TrimCodeConstant*16)) >= TrimCodeConstant/2*16)) ||
+//           ((num_TCC_iters % 2) == 0 && (((int)(fSpreadFactors[SF_num]*16) % (TrimCodeConstant*16)) < TrimCodeConstant/2*16)) )
+         {
+         fSpreadFactors[SF_num] += 2.0*PNDco;
+
+
+// Needed when the actual PNDco are passed in, as opposed to a temporary copy that happens in ComputePxxSpreadFactors. 
+// DO THIS AFTER the modification to fSpreadFactors. Does NOTHING here.
+         PNDco = -PNDco;
+         }
+
+#ifdef DEBUG
+if ( SF_num < limit )
+   printf("SF_num %4d\tSF %9.4f\tFinal PNDco %9.4f\n", SF_num, fSpreadFactors[SF_num], PNDco);
 fflush(stdout);
 #endif
 
-// Initialize the byte
-      if ( (PND_num % 8) == 0 )
-         SHD[PND_num/8] = 0;
+#ifdef DEBUG
+if ( fSpreadFactors[SF_num] < 0 || fSpreadFactors[SF_num] >= (float)TrimCodeConstant )
+   printf("SF_num %4d\tOrig SF %9.4f\tNew SF <0 or >TrimCodeConstant %d => %9.4f\n", 
+      SF_num, orig_SF, TrimCodeConstant, fSpreadFactors[SF_num]);
+fflush(stdout);
+#endif
+      }
 
-// Store the helper bit if it is a '1' (otherwise, leave this bit at 0)
-      if ( HD_val == 1 )
-         SHD[PND_num/8] = SHD[PND_num/8] | (1 << (PND_num % 8));
+// Round off appropriately. With iSpreadFactorScaler at 2, and if I have 35.6875, then store 35.5000. But if I have 16.9375, 
+// store 17.000 (anything larger than 16.75 should be 17.0, Anything larger than 16.25 should be 16.5, etc). Similarly, 
+// with iSpreadFactorScaler at 1, than anything larger than 16.5 should be 17, etc. NOTE: Use 0.5 here for all cases, i.e., 
+// when iSpreadFactorScaler is 2, we need to add 0.5 and NOT 0.25!
+   for ( SF_num = 0; SF_num < num_SF; SF_num++ )
+      if ( fSpreadFactors[SF_num] >= 0 )
+         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler + 0.5);
+      else 
+         iSpreadFactors[SF_num] = (signed char)(fSpreadFactors[SF_num] * (float)iSpreadFactorScaler - 0.5);
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Grow (or create) the PopOnly SpreadFactor workspace of SAP_ptr so it holds num_chips chips. Only called by 
+// the thread that owns SAP_ptr.
+
+static PopSFWorkspaceStruct *GetPopSFWorkspace(SRFAlgoParamsStruct *SAP_ptr, int num_chips)
+   {
+   PopSFWorkspaceStruct *PSW_ptr;
+   int num_PNDiffs = SAP_ptr->num_required_PNDiffs;
+   int chip_num;
+
+   if ( SAP_ptr->PopSF_ptr == NULL )
+      {
+      if ( (SAP_ptr->PopSF_ptr = (PopSFWorkspaceStruct *)calloc(1, sizeof(PopSFWorkspaceStruct))) == NULL )
+         { printf("ERROR: GetPopSFWorkspace(): Failed to allocate PopSFWorkspaceStruct!\n"); exit(EXIT_FAILURE); }
+      PSW_ptr = SAP_ptr->PopSF_ptr;
+      PSW_ptr->num_threads = (SAP_ptr->num_PO_SF_threads < 1) ? 1 : SAP_ptr->num_PO_SF_threads;
+      if ( (PSW_ptr->LFSR_pair_map = (unsigned short *)malloc(sizeof(unsigned short) * num_PNDiffs)) == NULL ||
+         (PSW_ptr->fPND_scratch = (float *)malloc(sizeof(float) * PSW_ptr->num_threads * num_PNDiffs)) == NULL ||
+         (PSW_ptr->int_scratch = (int *)malloc(sizeof(int) * PSW_ptr->num_threads * num_PNDiffs)) == NULL )
+         { printf("ERROR: GetPopSFWorkspace(): Failed to allocate worker scratch!\n"); exit(EXIT_FAILURE); }
+      }
+   PSW_ptr = SAP_ptr->PopSF_ptr;
+
+   if ( num_chips > PSW_ptr->max_chips )
+      {
+      if ( (PSW_ptr->PNDc_block = (float *)realloc(PSW_ptr->PNDc_block, sizeof(float) * num_chips * num_PNDiffs)) == NULL ||
+         (PSW_ptr->PNDc_rows = (float **)realloc(PSW_ptr->PNDc_rows, sizeof(float *) * num_chips)) == NULL ||
+         (PSW_ptr->col_rows = (float **)realloc(PSW_ptr->col_rows, sizeof(float *) * PSW_ptr->num_threads * num_chips)) == NULL )
+         { printf("ERROR: GetPopSFWorkspace(): Failed to grow PNDc matrix to %d chips!\n", num_chips); exit(EXIT_FAILURE); }
+      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
+         PSW_ptr->PNDc_rows[chip_num] = PSW_ptr->PNDc_block + chip_num*num_PNDiffs;
+      PSW_ptr->max_chips = num_chips;
+      }
+
+   return PSW_ptr;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Free a PopOnly SpreadFactor workspace.
+
+void FreePopSFWorkspace(PopSFWorkspaceStruct *PSW_ptr)
+   {
+   if ( PSW_ptr == NULL )
+      return;
+   free(PSW_ptr->LFSR_pair_map);
+   free(PSW_ptr->fPND_scratch);
+   free(PSW_ptr->int_scratch);
+   if ( PSW_ptr->PNDc_block != NULL )
+      free(PSW_ptr->PNDc_block);
+   if ( PSW_ptr->PNDc_rows != NULL )
+      free(PSW_ptr->PNDc_rows);
+   if ( PSW_ptr->col_rows != NULL )
+      free(PSW_ptr->col_rows);
+   free(PSW_ptr);
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// One worker of ComputePopPNDcMedians. Stage 1 computes the PNDc of its chips into their rows of the shared 
+// matrix, and stage 2 (after all workers are past the barrier) the medians of its columns. Each worker only 
+// writes its own rows, its own columns of the medians and its own scratch, so no locks are needed.
+
+static void *PopSFWorkerThread(void *arg)
+   {
+   PopSFWorkerStruct *PSWK_ptr = (PopSFWorkerStruct *)arg;
+   SRFAlgoParamsStruct *SAP_ptr = PSWK_ptr->SAP_ptr;
+   PopSFWorkspaceStruct *PSW_ptr = SAP_ptr->PopSF_ptr;
+   int num_PNDiffs = SAP_ptr->num_required_PNDiffs;
+   float **col_rows;
+   int chip_num;
+
+   if ( PSWK_ptr->num_worker_chips > 0 )
+      SRFBatchPNDcKernel(num_PNDiffs, PSWK_ptr->num_worker_chips, SAP_ptr->PNR[PSWK_ptr->first_chip_num], SAP_ptr->PNF[PSWK_ptr->first_chip_num], 
+         NULL, PSW_ptr->LFSR_pair_map, SAP_ptr->range_low_limit, SAP_ptr->range_high_limit, SAP_ptr->dist_range, SAP_ptr->param_RangeConstant, 
+         PSW_ptr->fPND_scratch + PSWK_ptr->worker_num*num_PNDiffs, PSW_ptr->int_scratch + PSWK_ptr->worker_num*num_PNDiffs, 
+         PSW_ptr->PNDc_rows[PSWK_ptr->first_chip_num]);
+
+   if ( PSWK_ptr->barrier_ptr != NULL )
+      pthread_barrier_wait(PSWK_ptr->barrier_ptr);
+
+   if ( PSWK_ptr->num_worker_cols > 0 )
+      {
+      col_rows = PSW_ptr->col_rows + PSWK_ptr->worker_num*PSWK_ptr->num_chips;
+      for ( chip_num = 0; chip_num < PSWK_ptr->num_chips; chip_num++ )
+         col_rows[chip_num] = PSW_ptr->PNDc_rows[chip_num] + PSWK_ptr->first_col;
+      ComputeColumnMedians(PSWK_ptr->num_chips, PSWK_ptr->num_worker_cols, col_rows, PSWK_ptr->medians + PSWK_ptr->first_col, 1);
+      }
+
+   return NULL;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// PopOnly stage of ComputePxxSpreadFactors: the PNDc (ComputePNDiffsTwoSeeds and GPEVCal, computed with the 
+// batched SRF kernel) of the first num_chips chips, written to the reusable chip-major matrix in the SAP 
+// workspace, and the median of each PNDc across the chips in 'medians'. The chips and then the columns are 
+// split across num_PO_SF_threads workers (worker 0 runs in this thread). Returns the matrix rows.
+
+float **ComputePopPNDcMedians(SRFAlgoParamsStruct *SAP_ptr, int num_chips, float *medians)
+   {
+   PopSFWorkspaceStruct *PSW_ptr;
+   PopSFWorkerStruct PSWK_arr[SAP_ptr->num_PO_SF_threads > 1 ? SAP_ptr->num_PO_SF_threads : 1];
+   pthread_t PSWK_threads[SAP_ptr->num_PO_SF_threads > 1 ? SAP_ptr->num_PO_SF_threads : 1];
+   pthread_barrier_t barrier;
+   int num_PNDiffs = SAP_ptr->num_required_PNDiffs;
+   int num_workers, worker_num;
+
+   PSW_ptr = GetPopSFWorkspace(SAP_ptr, num_chips);
+   ComputeLFSRPairMap(num_PNDiffs, SAP_ptr->param_LFSR_seed_low, SAP_ptr->param_LFSR_seed_high, PSW_ptr->LFSR_pair_map);
+
+   num_workers = PSW_ptr->num_threads;
+   if ( num_workers > SAP_ptr->num_PO_SF_threads )
+      num_workers = SAP_ptr->num_PO_SF_threads;
+   if ( num_workers < 1 )
+      num_workers = 1;
+   if ( num_workers > num_chips )
+      num_workers = num_chips;
+
+   if ( num_workers > 1 )
+      pthread_barrier_init(&barrier, NULL, num_workers);
+
+   for ( worker_num = 0; worker_num < num_workers; worker_num++ )
+      {
+      PSWK_arr[worker_num].worker_num = worker_num;
+      PSWK_arr[worker_num].SAP_ptr = SAP_ptr;
+      PSWK_arr[worker_num].num_chips = num_chips;
+      PSWK_arr[worker_num].first_chip_num = (int)((long)num_chips*worker_num/num_workers);
+      PSWK_arr[worker_num].num_worker_chips = (int)((long)num_chips*(worker_num + 1)/num_workers) - PSWK_arr[worker_num].first_chip_num;
+      PSWK_arr[worker_num].first_col = (int)((long)num_PNDiffs*worker_num/num_workers);
+      PSWK_arr[worker_num].num_worker_cols = (int)((long)num_PNDiffs*(worker_num + 1)/num_workers) - PSWK_arr[worker_num].first_col;
+      PSWK_arr[worker_num].medians = medians;
+      PSWK_arr[worker_num].barrier_ptr = (num_workers > 1) ? &barrier : NULL;
+      }
+
+   for ( worker_num = 1; worker_num < num_workers; worker_num++ )
+      if ( pthread_create(&(PSWK_threads[worker_num]), NULL, PopSFWorkerThread, (void *)&(PSWK_arr[worker_num])) != 0 )
+         { printf("ERROR: ComputePopPNDcMedians(): Failed to create worker thread %d!\n", worker_num); exit(EXIT_FAILURE); }
+
+   if ( num_workers > 0 )
+      PopSFWorkerThread((void *)&(PSWK_arr[0]));
+
+   for ( worker_num = 1; worker_num < num_workers; worker_num++ )
+      pthread_join(PSWK_threads[worker_num], NULL);
+
+   if ( num_workers > 1 )
+      pthread_barrier_destroy(&barrier);
+
+   return PSW_ptr->PNDc_rows;
+   }
+
+
+// ===========================================================================================================
+// ===========================================================================================================
+// Compute the PCR SpreadFactors. NOTE: YOU CAN NOT reseed srand with the same seed in this routine. In fact,
+// you cannot use srand or rand because it is NOT re-entrant.
+
+void ComputePxxSpreadFactors(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int do_part_A_or_B)
+   {
+   float strong_1_center, strong_0_center;
+   int PND_num;
+
+   float *fPNDco, *fSpreadFactors; 
+   signed char *iSpreadFactors;
+   int num_PNDiffs, num_chips; 
+   int SpreadConstant;
+   int TrimCodeConstant;
+
+// Fields of the structure used within this routine.
+   num_PNDiffs = SAP_ptr->num_required_PNDiffs; 
+   num_chips = SAP_ptr->num_chips; 
+   fPNDco = SAP_ptr->fPNDco;
+   fSpreadFactors = SAP_ptr->fSpreadFactors; 
+   iSpreadFactors = SAP_ptr->iSpreadFactors; 
+   SpreadConstant = SAP_ptr->param_SpreadConstant;
+   TrimCodeConstant = SAP_ptr->param_TrimCodeConstant;
+
+// Sanity check. For rounding below.
+   if ( SAP_ptr->iSpreadFactorScaler < 1 || SAP_ptr->iSpreadFactorScaler > 2 )
+      { printf("ERROR: ComputePxxSpreadFactors(): iSpreadFactorScaler %d MUST be 1 or 2!\n", SAP_ptr->iSpreadFactorScaler); exit(EXIT_FAILURE); }
+
+// ======================================
+// ======================================
+// Does PopOnly SF. Here we calculate the median values of each PNDc using enrollment data across all chips.
+   if ( do_part_A_or_B == 0 )
+      {
+      int PND_num;
+      float **PO_PNDc; 
+
+#ifdef DEBUG
+printf("Compute Pop SF\n"); fflush(stdout);
+#endif
+
+// Don't use all the chips if the number is very large b/c it takes too long -- only a subset is needed. 
+// 6_27_2022: LATENT BUG: If you have do_PO_dist_flip set to 1, YOU MUST USE ALL CHIPS HERE. See below
+// FlipPO_SF which uses the PO_PNDc[SAP_ptr->chip_num] computed here to determine when flips occur so 
+// so the dataset of SAP_ptr->chip_num better be present else crash. Alternatively, you can just make
+// sure SAP_ptr->chip_num data is included in the selected set.
+//
+// 10_22_2022: You can add this back later -- I'm debugging.
+//      if ( num_chips >= 100 && SAP_ptr->do_PO_dist_flip == 0 )
+//         num_chips = 100;
+//      else
+         num_chips = SAP_ptr->num_chips;
+
+// Compute the PND and PNDc of each chip, and for each PNDc the median value across the chips. The rows of PO_PNDc live in the 
+// SAP workspace and are reused on the next call. The PNDc are multiples of 1/16 (see GPEVCal), so the medians are mostly found 
+// by counting.
+      PO_PNDc = ComputePopPNDcMedians(SAP_ptr, num_chips, fSpreadFactors);
+
+      for ( PND_num = 0; PND_num < SAP_ptr->num_required_PNDiffs; PND_num++ )
+         {
+
+// These MUST be rounded to 4 binary digits for ReduceRawSF to work properly.
+         fSpreadFactors[PND_num] = (float)((int)(fSpreadFactors[PND_num]*16.0))/16.0;
+
+// They will NOT fit until they are trimmed below by ReduceRawSF().
+//         iSpreadFactors[PND_num] = (signed short)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler);
+
+#ifdef DEBUG
+if ( PND_num == 0 )
+   int i;
+   for ( i = 0; i < num_chips; i++ )
+      printf("Chip %d\tPND %d\tPO_PNDc %10.4f\tMedian fSpreadFactor %9.4f\tPO_PNDc_pop %10.4f\n", i , PND_num, PO_PNDc[i][PND_num], 
+         fSpreadFactors[PND_num], PO_PNDc[i][PND_num] - fSpreadFactors[PND_num]);
+#endif
+#ifdef DEBUG
+if ( PND_num < 10 )
+   {
+   int i, num_pos_vals = 0, num_neg_vals = 0, num_zero_vals = 0;
+   for ( i = 0; i < num_chips; i++ )
+      {
+      if ( PO_PNDc[i][PND_num] - fSpreadFactors[PND_num] < 0.0 )
+         num_neg_vals++; 
+      if ( PO_PNDc[i][PND_num] - fSpreadFactors[PND_num] > 0.0 )
+         num_pos_vals++; 
+      if ( PO_PNDc[i][PND_num] - fSpreadFactors[PND_num] == 0.0 )
+         num_zero_vals++; 
+      }
+   printf("\tPND %d\tnum chips %d\tnum_pos %d\tnum neg %d\tnum_zeros %d\n", PND_num, num_chips, num_pos_vals, num_neg_vals, num_zero_vals); fflush(stdout);
+   }
+#endif
+         }
+
+// -----------------------------------------
+// We use 8-bit SpreadFactors now, so this MUST ALWAYS BE CALLED. We MUST reduce the median PNDc to a value < the TrimCodeConstant, and 
+// make them ALL positive. 
+      ReduceRawSF(max_string_len, fSpreadFactors, iSpreadFactors, SAP_ptr->iSpreadFactorScaler, SAP_ptr->num_required_PNDiffs, 
+         TrimCodeConstant);
+
+#ifdef DEBUG
+int j;
+for ( j = 0; j < 10; j++ )
+   printf("ComputePxxSpreadFactors(): HERE: fSpreadFactors[%d] %.4f\tiSpreadFactors[%d] %d\n", j, fSpreadFactors[j], j, iSpreadFactors[j]);
+#endif
+
+// -----------------------------------------
+// When the server needs to compute the SF COMPLETELY (device does NOT do it), the PopOnly SF MUST be updated to flip the distribution on the device, 
+// e.g., FUNC_VA, FUNC_SE. NOTE: For FUNC_DA, WE DO NOT KNOW WHICH DEVICE we are communicating with so we will need to call this routine for each device 
+// in the DB starting with fresh PopOnly SF. NOTE: The SF are NOT bounded to be >= 0 and < TrimCodeConstant after calling this routine (they are also NOT
+// bounded by the pure PopOnly range after PCR either).
+      if ( SAP_ptr->do_PO_dist_flip == 1 )
+         {
+
+// Sanity check. SAP_ptr->chip_num MUST be set to a number between 0 and num_chips-1.
+         if ( SAP_ptr->chip_num < 0 || SAP_ptr->chip_num >= num_chips )
+            { 
+            printf("WARNING: ComputePxxSpreadFactors(): PO component WITH do_PO_dist_flip a 1 MUST have chip_num %d >= 0 and < %d -- NOT DOING PO_dist_flip!\n", 
+               SAP_ptr->chip_num, num_chips);
+            }
+         else
+            FlipPO_SF(max_string_len, PO_PNDc[SAP_ptr->chip_num], fSpreadFactors, iSpreadFactors, SAP_ptr->iSpreadFactorScaler, 
+               SAP_ptr->num_required_PNDiffs, TrimCodeConstant);
+         }
+
+      return;
+      }
+
+// ======================================
+// ======================================
+// Do PCR SF
+
+// Sanity check. SAP_ptr->chip_num MUST be set to a number between 0 and num_chips-1.
+   if ( SAP_ptr->chip_num < 0 || SAP_ptr->chip_num >= SAP_ptr->num_chips )
+      { 
+      printf("ERROR: ComputePxxSpreadFactors(): PerChip+Random component MUST have chip_num %d >= 0 and < num_chips %d\n", 
+         SAP_ptr->chip_num, SAP_ptr->num_chips); exit(EXIT_FAILURE); 
+      }
+
+// Sanity check. Do NOT run PCR is we specify PopOnly.
+   if ( SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_POPONLY )
+      { printf("ERROR: ComputePxxSpreadFactors(): Can NOT run PCR code when SF mode is PopOnly!\n"); exit(EXIT_FAILURE); }
+
+// We first call DoSRFComp() to compute PND, PNDc and fPNDco for the chip number set in SAP_ptr->chip_num, which ALSO APPLIES the 
+// population-based SpreadFactors to the fPNDco (useful in case we are computing a response bitstring within the verifier). 
+   DoSRFComp(max_string_len, SAP_ptr, 0);
+
+// We just need to move these population-adjusted PNDco to the CENTER of the strong bit region and then randomly distribute across 
+// the SpreadConstant/2 and we are done. However, we also need to update fSpreadFactors because that is what we store when the 
+// enrollment process is completed. So we focus here on adjusting the fSpreadFactors and then appling them to the PNDco to 
+// generate the final PNDco. 
+
+// Make the center of the strong bit region the SpreadConstant, 20/4 = +/-5. NOTE: SpreadConstant MUST be similar to the maximum 
+// amount of entropy present in the path delay differences. If larger, information may leak in the final SpreadFactors
+   strong_0_center = (float)(-SpreadConstant)/4.0;
+   strong_1_center = (float)SpreadConstant/4.0;
+
+// We canNOT use rand any longer in multi-threaded routines when use_database_chlngs = 1. So on the verifier, we draw from this
+// thread's random stream instead (see GetRandomUniform).
+
+// ------------------------------------------------
+// Apply the remaining components of the PCR method. 
+   float PerChip_spread_factor = 0.0;
+   int random_val; 
+   for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+      {
+      float init_fPNDco;
+
+// NOTE: We use enrollment PNDco which have been updated with the PopOnly SF already BUT ONLY IF PCR_or_PBD_or_PO is 
+// set to PCR or PopOnly mode (otherwise they have NOT been updated and fSpreadFactors are all 0).
+      init_fPNDco = fPNDco[PND_num];
+
+// Sanity check
+      if ( SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PBD && fSpreadFactors[PND_num] != 0.0 )
+         { printf("ERROR: ComputePxxSpreadFactors(): fSpreadFactors MUST BE zero in PBD mode!\n"); exit(EXIT_FAILURE); }
+
+// Determine the closest strong bit line (at SpreadConstant/2 or -SpreadConstant/2) in PCR mode. If PBD mode, use the low 
+// order integer bit of the PNDc (NOT THE PRECISION BITS) to determine the super-strong bit region. NOTE: Similar to the 
+// hardware, we do NOT apply Pop SFs above when SAP_ptr->param_PCR_or_PBD_or_PO is set to 1 since we want to avoid using 
+// SFs altogether on the device in PBD mode.
+      if ( (fabs(strong_0_center - init_fPNDco) < fabs(strong_1_center - init_fPNDco) && 
+         SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PCR) || 
+         ( (((int)init_fPNDco % 2) == 0) && SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PBD) )
+         PerChip_spread_factor = strong_0_center - init_fPNDco;
+      else
+         PerChip_spread_factor = strong_1_center - init_fPNDco;
+
+// CHANGE HERE: 10_17_2021: Handle the fPNDco 0.0 case. Leave the PerChip+Random Spreadfactor at zero. The population 
+// value (already added into the fPNDco) makes this fPNDco 0.0 so it will NOT be used during bitstring generation.
+      if ( init_fPNDco == 0 )
+         {
+#ifdef DEBUG
+printf("\tChip %3d\tfPNDco[%4d] is 0.0 %f\tLeaving fPNDco and fSpreadFactors at population value\n", SAP_ptr->chip_num, 
+   PND_num, init_fPNDco); fflush(stdout);
+#endif
+         continue;
+         }
+
+// PopOnly SF are just the median values of the PND across all chips, but with TrimCodeConstant, they are moved to the 
+// next lower multiple of TrimCode. And they are always positive. They have ALREADY been applied to the fPNDco and trimmed.
+
+#ifdef DEBUG
+if ( PND_num < 20 )
+   printf("\tChip %3d\tINIT fPNDco[%4d] %9.4f\tINIT SF %9.4f\tPerChip_spread_factor %9.4f\n", SAP_ptr->chip_num, 
+      PND_num, init_fPNDco, fSpreadFactors[PND_num], PerChip_spread_factor); 
+fflush(stdout);
+#endif
+
+// So PCR SpreadFactor = Pop SpreadFactor - PerChip SpreadFactor + random_val, which would then be SUBTRACTED from the PNDc. 
+// Note that SF are the PopOnly SF, which with TrimCodeConstant applied, are all positive. 
+// 1_1_2022: NOTE: After PCR, SF can become slightly negative and more positive than the TrimCodeConstant. 
+      fSpreadFactors[PND_num] -= PerChip_spread_factor;
+
+// Now randomize the value over the 0 or 1 regions. If SpreadConstant is 20, then rand() returns a number between 0 and 8, 
+// 20/2 - 1 = 9. Subtracting 20/4 - 1 = 4 makes the range -4 to +4. TRIM THIS TO 16-bit so we can send the rand values to the 
+// hardware and have it compute the same random value here.
+      random_val = (int)GetRandomUniform(SpreadConstant/2 - 1) - (SpreadConstant/4 - 1);
+
+// Update fSpreadFactors with random value.
+      fSpreadFactors[PND_num] += random_val;
+
+// We need to invert the signs here, i.e., add in the PerChip SF and subtract the random_val from the fPNDco. 
+      fPNDco[PND_num] = fPNDco[PND_num] + PerChip_spread_factor - (float)random_val;
+
+// Sanity check. We MUST have values within the bounds of the SpreadConstant. I purposely stay one away from the max values.
+      if ( fPNDco[PND_num] >= (float)SpreadConstant/2.0 || fPNDco[PND_num] <= (float)(-SpreadConstant)/2.0 )
+         { 
+         printf("ERROR: ComputePxxSpreadFactors(): fPNDco[%d] %+8.4f OUTSIDE bounds of SpreadConstant +/- %d\n", 
+            PND_num, fPNDco[PND_num], SpreadConstant/2); exit(EXIT_FAILURE); 
+         }
+
+// Sanity check
+      if ( fSpreadFactors[PND_num]*16.0 < -32767 || fSpreadFactors[PND_num]*16.0 > 32767 )
+         { 
+         printf("ERROR: ComputePxxSpreadFactors(): Scaled integer SpreadFactor %d exceeds max/min signed short!\n", 
+            (int)(fSpreadFactors[PND_num]*16.0)); exit(EXIT_FAILURE); 
+         }
+
+// Save the integer-based SpreadFactors to a separate array. Can SF these become negative after PCR adjustments -- yes, negative 
+// and more positive than the TrimCodeConstant. See example(s) above. So a TrimCodeConstant of 32 will require one extra positive 
+// bit to represent numbers >= 32 and one extra bit for negative numbers. So 7 bits will be needed, so only one bit of precision 
+// for TrimCodeConstant <= 32. For TrimCodeConstant > 32 and <= 64, we need all 8 bits (no precision bits are preserved). For the
+// first case, iSpreadFactorScaler shifts the fSpreadFactors by 1 bit to the left and then trunscates it to a (signed char). Otherwise
+// multiple by 1 which does nothing by truncate the floating point value to an integer (signed char).
+      if ( (int)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler) < -127 || 
+         (int)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler > 127) )
+         { 
+         printf("ERROR: ComputePxxSpreadFactors(): iSpreadFactors[%d] exceeds (signed char) limits of -127 to 127: %d\n", PND_num, 
+            (int)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler)); 
+         exit(EXIT_FAILURE); 
+         }
+
+// Round off appropriately. With iSpreadFactorScaler at 2, and if I have 35.6875, then store 35.5000. But if I have 16.9375, 
+// store 17.000 (anything larger than 16.75 should be 17.0, Anything larger than 16.25 should be 16.5, etc). Similarly, with 
+// iSpreadFactorScaler at 1, than anything larger than 16.5 should be 17, etc. NOTE: Use 0.5 here for all cases, i.e., when 
+// iSpreadFactorScaler is 2, we need to add 0.5 and NOT 0.25!
+      if ( fSpreadFactors[PND_num] >= 0 )
+         iSpreadFactors[PND_num] = (signed char)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler + 0.5);
+      else 
+         iSpreadFactors[PND_num] = (signed char)(fSpreadFactors[PND_num] * (float)SAP_ptr->iSpreadFactorScaler - 0.5);
+
+#ifdef DEBUG
+if ( PND_num < 20 )
+   printf("\tChip %3d\tFINAL fPNDco[%4d] %9.4f\tFINAL fSF %9.4f\tRandom val %2d\tiSF %4d\n", SAP_ptr->chip_num, PND_num, 
+      fPNDco[PND_num], fSpreadFactors[PND_num], random_val, (int)iSpreadFactors[PND_num]); 
+fflush(stdout);
+#endif
+
+      }
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Compute the SBS and SHD from the timing data for a given Threshold Note, we can get the raw bitstring
+// with all 2048 bits by setting the Threshold to 0.
+
+int SingleHelpBitGen(int max_PNDiffs, float *fPNDco, unsigned char *SBS, unsigned char *SHD, int *HD_num_bytes_ptr, 
+   unsigned short Threshold)
+   {
+   int SBS_num_bits, PND_num;
+   unsigned char bit_val;
+   unsigned char HD_val;
+   float fThreshold;
+
+   fThreshold = (float)Threshold;
+
+// Use the 64-bit word version if selected. It produces the same outputs.
+   if ( BitOpsMode == BIT_OPS_WORD )
+      return SingleHelpBitGenWord(max_PNDiffs, fPNDco, SBS, SHD, HD_num_bytes_ptr, Threshold);
+
+// Basic idea here is to carry out what the device did in the server authentication, compute the strong bitstring and single
+// helper bitstring using the fPNDco 
+   SBS_num_bits = 0;
+   for ( PND_num = 0; PND_num < max_PNDiffs; PND_num++ )
+      {
+
+// Compute the bit value
+      if ( fPNDco[PND_num] < 0.0 )
+         bit_val = 0;
+      else 
+         bit_val = 1;
+
+// Thresholding: if the fPNDco is within a 'Threshold' of the bit-flip line, consider it invalid. This works when Threshold of 0, which makes 
+// ALL bits strong (required for KEK regeneration). MUST USE '>' to handle the case where the threshold is 0.
+      if ( fPNDco[PND_num] > -fThreshold && fPNDco[PND_num] < fThreshold )
+         HD_val = 0;
+      else
+         HD_val = 1;
+
+#ifdef DEBUG
+if ( PND_num < 10 )
+   printf("%4d\tPNDco %+9.4f\tBit val %d\tHD val %d\n", PND_num, fPNDco[PND_num], bit_val, HD_val); 
+fflush(stdout);
+#endif
+
+// Initialize the byte
+      if ( (PND_num % 8) == 0 )
+         SHD[PND_num/8] = 0;
+
+// Store the helper bit if it is a '1' (otherwise, leave this bit at 0)
+      if ( HD_val == 1 )
+         SHD[PND_num/8] = SHD[PND_num/8] | (1 << (PND_num % 8));
+
+// Do NOT add a strong bit to the 'SBS' for bits classified as weak
+      else
+         continue;
+
+// Initialize the byte
+      if ( (SBS_num_bits % 8) == 0 ) 
+         SBS[SBS_num_bits/8] = 0;
+
+// NOTE: WE DO NOT use a shift register approach for the strong bitstring in the hardware to make the strong bitstring consistent with the helper 
+// data. So the last strong bits of LAST byte (highest numbered) are in the low order positions of the byte.
+      if ( bit_val == 1 )
+         SBS[SBS_num_bits/8] = SBS[SBS_num_bits/8] | (1 << (SBS_num_bits % 8));
+
+      SBS_num_bits++;
+
+// Sanity check
+      if ( SBS_num_bits > max_PNDiffs )
+         { printf("ERROR: SingleHelpBitGen(): SBS_num_bits larger than MAX -- increase in program!\n"); exit(EXIT_FAILURE); }
+      }
+
+#ifdef DEBUG
+printf("\t\tSingleHelpBitGen(): Strong bitstring size %d (bits)\tSingle Helper Data size %d (bits)\n", SBS_num_bits, max_PNDiffs); fflush(stdout);
+#endif
+
+// Return the HD size in bytes -- this should always be 2048/8 = 256 bytes. Not really needed
+   *HD_num_bytes_ptr = max_PNDiffs/8;
+
+// Sanity check
+   if ( Threshold == 0 && SBS_num_bits != max_PNDiffs )
+      { printf("ERROR: SingleHelpBitGen(): Threshold is 0 but number of strong bits %d is NOT equal to max_PNDiffs %d!\n", SBS_num_bits, max_PNDiffs); exit(EXIT_FAILURE); }
+
+   return SBS_num_bits;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// 64-bit word version of SingleHelpBitGen. The bit values and helper bits of 64 PNDco are collected into two words,
+// the SHD is written a word at a time and the strong bits are gathered with ExtractBits64 and appended to the SBS.
+
+int SingleHelpBitGenWord(int max_PNDiffs, float *fPNDco, unsigned char *SBS, unsigned char *SHD, int *HD_num_bytes_ptr, 
+   unsigned short Threshold)
+   {
+   int SBS_num_bits, PND_num, word_PND_num, word_num_PNDs, num_strong, byte_num;
+   uint64_t bit_word, HD_word;
+   float fThreshold;
+
+   fThreshold = (float)Threshold;
+
+   SBS_num_bits = 0;
+   for ( word_PND_num = 0; word_PND_num < max_PNDiffs; word_PND_num += 64 )
+      {
+      word_num_PNDs = max_PNDiffs - word_PND_num;
+      if ( word_num_PNDs > 64 )
+         word_num_PNDs = 64;
+
+// Same bit value and thresholding tests as SingleHelpBitGen. 
+      bit_word = 0;
+      HD_word = 0;
+      for ( PND_num = 0; PND_num < word_num_PNDs; PND_num++ )
+         {
+         bit_word |= (uint64_t)(!(fPNDco[word_PND_num + PND_num] < 0.0)) << PND_num;
+         HD_word |= (uint64_t)(!(fPNDco[word_PND_num + PND_num] > -fThreshold && fPNDco[word_PND_num + PND_num] < fThreshold)) << PND_num;
+         }
+
+// Write whole SHD bytes (unused high order bits of a partial last byte are 0, as in SingleHelpBitGen).
+      for ( byte_num = 0; byte_num*8 < word_num_PNDs; byte_num++ )
+         SHD[word_PND_num/8 + byte_num] = (unsigned char)(HD_word >> (byte_num*8));
+
+      num_strong = PopCount64(HD_word);
+      StoreBitWord(SBS, SBS_num_bits, num_strong, ExtractBits64(bit_word, HD_word));
+      SBS_num_bits += num_strong;
+      }
+
+// Clear the unused high order bits of the last SBS byte.
+   if ( (SBS_num_bits % 8) != 0 )
+      StoreBitWord(SBS, SBS_num_bits, 8 - (SBS_num_bits % 8), 0);
+
+#ifdef DEBUG
+printf("\t\tSingleHelpBitGenWord(): Strong bitstring size %d (bits)\tSingle Helper Data size %d (bits)\n", SBS_num_bits, max_PNDiffs); fflush(stdout);
+#endif
+
+   *HD_num_bytes_ptr = max_PNDiffs/8;
+
+// Sanity check
+   if ( Threshold == 0 && SBS_num_bits != max_PNDiffs )
+      { printf("ERROR: SingleHelpBitGenWord(): Threshold is 0 but number of strong bits %d is NOT equal to max_PNDiffs %d!\n", SBS_num_bits, max_PNDiffs); exit(EXIT_FAILURE); }
+
+   return SBS_num_bits;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Generate verifier nonce n1, send to device and get XOR nonce from device.
+
+void GenNonceExchange(int max_string_len, int device_socket_desc, int num_required_nonce_bytes, 
+   unsigned char *verifier_n2, unsigned char *XOR_nonce, int DUMP_BITSTRINGS, int debug_flag)
+   {
+   struct timeval t0, t1;
+   long elapsed; 
+
+// ****************************************
+// ***** Generate nonce n2. 
+   if ( debug_flag == 1 )
+      {
+      printf("GNExch.1) Generating nonce n2\n");
+      gettimeofday(&t0, 0);
+      }
+
+// Draw this from the thread's random stream.
+   GetRandomBytes(verifier_n2, num_required_nonce_bytes);
+   if ( debug_flag == 1 )
+      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+
+// Dump out the values as hex
+   if ( DUMP_BITSTRINGS == 1 )
+      {
+      char header_str[max_string_len];
+      sprintf(header_str, "\n\tVerifier nonce n2 (high to low)\n");
+      PrintHeaderAndHexVals(header_str, num_required_nonce_bytes, verifier_n2, 8);
+      }
+
+// ****************************************
+// ***** Send the nonce n2 to the device
+   if ( debug_flag == 1 )
+      {
+      printf("GNExch.2: Sending verifier nonce n2\n");
+      gettimeofday(&t0, 0);
+      }
+   if ( SockSendB(verifier_n2, num_required_nonce_bytes, device_socket_desc) < 0 )
+      { printf("ERROR: GenNonceExchange(): Failed to send 'verifier_n2' to device!\n"); exit(EXIT_FAILURE); }
+   if ( debug_flag == 1 )
+      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+
+
+// ****************************************
+// ***** Receive nonce (n1 XOR n2) from device
+   if ( debug_flag == 1 )
+      {
+      printf("GNExch.3) Receiving device nonce (n1 XOR n2)\n");
+      gettimeofday(&t0, 0);
+      }
+   if ( SockGetB(XOR_nonce, num_required_nonce_bytes, device_socket_desc) != num_required_nonce_bytes )
+      { printf("ERROR: GenNonceExchange(): Failed to get 'XOR_nonce' from device!\n"); exit(EXIT_FAILURE); }
+   if ( debug_flag == 1 )
+      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+
+// Dump out the values as hex
+   if ( DUMP_BITSTRINGS == 1 )
+      {
+      char header_str[max_string_len];
+      sprintf(header_str, "\n\tReceived device XOR nonces (n1 XOR n2) (high to low):\n");
+      PrintHeaderAndHexVals(header_str, num_required_nonce_bytes, XOR_nonce, 8);
+      }
+   fflush(stdout);
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Compute and transmit SpreadFactors
+
+void ComputeSendSpreadFactors(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, 
+   int current_function, int send_SpreadFactors, int compute_PCR_PBD_SF)
+   {
+   struct timeval t0, t1;
+   long elapsed; 
+
+#ifdef DEBUG
+printf("ComputeSendSpreadFactors(): CALLED!\n"); fflush(stdout);
+#endif
+
+// Clear the SpreadFactors array. 
+   int PND_num;
+   for ( PND_num = 0; PND_num < SAP_ptr->num_required_PNDiffs; PND_num++ ) 
+      {
+      SAP_ptr->iSpreadFactors[PND_num] = 0;
+      SAP_ptr->fSpreadFactors[PND_num] = 0.0;
+      }
+
+// ----------------------------------------------------
+// In the first call, we compute population SpreadFactors. We analysis the data from ALL chips (actually, if the number of chips is > 100, then we 
+// only analyze the first 100) and compute a set of fSpreadFactors that center each PND distribution over the bit-flip line. 
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      {
+      printf("CO.1) Computing SpreadFactors, Part 1\n");
+      gettimeofday(&t0, 0);
+      }
+
+// This routine ONLY computes the PopSF and stores results in SAP_ptr->i/fSpreadFactors. The 2-D arrays of PNR and PNF are referenced in this call.
+// Note, when param_PCR_or_PBD_or_PO == SF_MODE_PBD, we do NOT use Pop. SF since the low order bit of the PNDc is used to determine the bit value. 
+   int do_part_A_or_B = 0;
+   if ( SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PCR || SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_POPONLY )
+      ComputePxxSpreadFactors(max_string_len, SAP_ptr, do_part_A_or_B);
+
+#ifdef DEBUG
+PrintHeaderAndHexVals("ComputeSendSpreadFactors(): Pop. SpreadFactors:\n", SAP_ptr->num_SF_bytes, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
+#endif
+
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      {
+      char header_str[max_string_len];
+      sprintf(header_str, "\n\tPopulation SpreadFactors %d\n", SAP_ptr->num_SF_bytes);
+      PrintHeaderAndHexVals(header_str, SAP_ptr->num_SF_bytes, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
+      }
+
+// If PCR or PBD are requested, then call ComputePxxSpreadFactors again.
+   if ( compute_PCR_PBD_SF == 1 )
+      {
+
+// ----------------------------------------------------
+// If requested, compute the PCR (this is done on the device now for DA and LL_Enroll). DoSRFComp() is called to compute fPNDco for the SAP_ptr->chip_num set, 
+// and these are used to determine the adjustments that are made to fSpreadFactors. So we MUST set the chip_num BEFORE calling ComputePxxSpreadFactors. 
+// Also, this routine updates the fPNDco with the PCR SpreadFactors. Useful in case we are computing a response bitstring within the verifier. Carry out 
+// the full computation so we have the properly generated PND and PNDc.
+
+// Sanity check. SAP_ptr->chip_num MUST be set to a number between 0 and num_chips-1.
+      if ( SAP_ptr->chip_num < 0 || SAP_ptr->chip_num >= SAP_ptr->num_chips )
+         { 
+         printf("ERROR: ComputeSendSpreadFactors(): PCR component MUST have chip_num %d >= 0 and < num_chips %d\n", 
+            SAP_ptr->chip_num, SAP_ptr->num_chips); exit(EXIT_FAILURE); 
+         }
+
+#ifdef DEBUG
+printf("ComputeSendSpreadFactors(): Chip set for calculation of PCR SpreadFactors %d\n", SAP_ptr->chip_num); fflush(stdout);
+#endif
+
+      if ( SAP_ptr->DEBUG_FLAG == 1 )
+         {
+         printf("CO.1) Computing SpreadFactors, Part 2\n");
+         gettimeofday(&t0, 0);
+         }
+
+// Second call to ComputePxxSpreadFactors. Note, we do NOT do SF at ALL when current function is DA or LL_ENROLL (they are computed on the device). 
+      do_part_A_or_B = 1;
+      if ( current_function != FUNC_DA && current_function != FUNC_LL_ENROLL )
+         ComputePxxSpreadFactors(max_string_len, SAP_ptr, do_part_A_or_B);
+
+      if ( SAP_ptr->DEBUG_FLAG == 1 )
+         {
+         printf("CO.2) Sending PCR SpreadFactors to Device\n");
+         gettimeofday(&t0, 0);
+         }
+      }
+
+// The iSpreadFactors are signed char (5- or 6-bit integer with 1- or 0-bits of binary precision), We can also fit these into 12-bits if needed which 
+// gives +/-256.xxx (9 bits of integer and 3 bits of precision), reducing this transfer from 4096 bytes to 3072 bytes, but we would need to 'pack' them. 
+// I can get back to 8-bits by giving up the 3 or 4 bits of precision. 
+   if ( send_SpreadFactors == 1 )
+      if ( SockSendB((unsigned char *)SAP_ptr->iSpreadFactors, SAP_ptr->num_SF_bytes, device_socket_desc) < 0 )
+         { printf("ERROR: ComputeSendSpreadFactors(): Send 'PCR SpreadFactors' failed\n"); exit(EXIT_FAILURE); }
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      {
+      char header_str[max_string_len];
+      sprintf(header_str, "\n\tPCR SpreadFactors %d\n", SAP_ptr->num_SF_bytes);
+      PrintHeaderAndHexVals(header_str, SAP_ptr->num_SF_bytes, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
+      }
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// This routine is a convenience routine to generate a random DB_ChallengeGen_seed, select a set of vectors
+// from the timing DB and fetch the timing data into PNR and PNF arrays.
+
+void GenVecSeedChlngsTimingData(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, sqlite3 *timing_DB,
+   char *ChlngSetName, TimingValCacheStruct *TVC)
+   { 
+
+// If the user wants to randomize the challenge vectors by selecting a random seed (vs. what is stored in 
+// the SAP_ptr->Seed already), then draw one from the thread's random stream and assign it. Only applicable to the DATABASE VERSION.
+   if ( SAP_ptr->gen_random_challenge == 1 )
+      {
+      unsigned char seed_char[4];
+      GetRandomBytes(seed_char, 4);
+      SAP_ptr->DB_ChallengeGen_seed = seed_char[3] << 24 | seed_char[2] << 16 | seed_char[1] << 8 | seed_char[0];
+      }
+
+// Compute a random set of challenges from the compatibility set given by 'ChlngSetName'. This routine returns binary 
+// vectors and masks (both are always returned) and an array of (vecpair, PO_num) used to locate the TimingVals data 
+// for any one, a subset or all PUFInstances (chips). The field vecpair is an index into VecPair table for the PUFDesign 
+// identifed using Netlist_name and Synthesis_name. NOTE: vecpair refers to the single configuration vector used in 
+// the SRF PUF, which is split into two pieces (first_vec and second_vec) to optimize storage in the database. PO_num is 
+// a value between 0 and num_POs - 1. EXACTLY NUM_REQUIRED_PNs values are returned in this array half of which identify 
+// rising PN and the other half identify fall PNs. Both of these constraints are checked in GenChallengeDB. NOTE: THESE 
+// VECTORS and DATA STRUCTURES MUST BE FREED once we are done with them. ONLY applicable to the DATABASE VERSION.
+   if ( timing_DB != NULL )
+      {
+      VecPairPOStruct *challenge_vecpair_id_PO_arr = NULL;
+      int num_challenge_vecpair_id_PO = 0;
+
+      GenChallengeDB(max_string_len, timing_DB, SAP_ptr->design_index, ChlngSetName, SAP_ptr->DB_ChallengeGen_seed, 0, 
+         NULL, NULL, &(SAP_ptr->first_vecs_b), &(SAP_ptr->second_vecs_b), &(SAP_ptr->masks_b), &(SAP_ptr->num_vecs), 
+         &(SAP_ptr->num_rise_vecs), &num_challenge_vecpair_id_PO, 
+         &challenge_vecpair_id_PO_arr);
+
+printf("\tGenVecSeedChlngsTimingData(): Number of vectors read %d\tNumber of rising vectors %d\n", SAP_ptr->num_vecs, 
+   SAP_ptr->num_rise_vecs); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+// Get a subset of 2048 PNR and 2048 PNF of the timing data for all (or a subset) of PUFInstances. The set of 4096 timing 
+// values are identified by an array of challenge_vecpair_id_PO_arr structures with (vecpair, PO) elements. These are 
+// constructed by GenChallengeDB as the random challenge is generated and are guaranteed to match the PN tested by these 
+// challenge vectors/masks. Use '%' for * and '_' for ? in pattern match. The PNR and PNF are DYNAMICALLY allocated based 
+// on the challenge and will need to be freed once we are done with them.
+      GetAllPUFInstanceTimingValsForChallenge(max_string_len, timing_DB, challenge_vecpair_id_PO_arr, num_challenge_vecpair_id_PO, 
+         "%", &(SAP_ptr->PNR), &(SAP_ptr->PNF), &(SAP_ptr->num_chips), TVC, SAP_ptr->use_TVC_cache);
+
+// Free up the challenge_vecpair_id_PO_arr. We'll free the vectors and timing data in the caller if it isn't needed again 
+// for something else.
+      if ( challenge_vecpair_id_PO_arr != NULL )
+         free(challenge_vecpair_id_PO_arr);
+      }
+   else
+      { printf("ERROR: Timing DB is NULL!\n"); exit(EXIT_FAILURE); }
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Common operations carried out indendent of the function.
+
+void CommonCore(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, 
+   int set_threshold_to_zero, int target_attempts, int do_part_A_part_B_both, int current_function, 
+   int compute_SpreadFactors, int send_SpreadFactors, int compute_PCR_PBD_SF)
+   {
+   struct timeval t0, t1;
+   long elapsed; 
+
+// Both authentication modes, session key and KEK call this routine with do_part_A_part_B_both set to 0 (do this if stmt and return) and then 
+// with 1 (skip this if stmt and do the rest). This is true because we may need to call the CommonCore multiple times but do NOT want to execute 
+// this if stmt after the first call. The multiple calls simply change the SRF parameters to generate additional key bits until the required 
+// number is reached. We generate the challenge vectors and masks and then send them to the device. We are done with them at this point and 
+// free them. During vector/mask generation, we also retrieve the timing values tested by these challenges (PNR and PNF) for ALL devices and 
+// keep pass these back to the caller. So the caller will free the PNR and PNF once we are done with them.
+   if ( do_part_A_part_B_both == 0 || do_part_A_part_B_both == 2 )
+      {
+
+      GenVecSeedChlngsTimingData(max_string_len, SAP_ptr, SAP_ptr->database_NAT, SAP_ptr->ChallengeSetName_NAT, SAP_ptr->TVC_NAT);
+
+// Receive 'GO' and send vectors and masks
+      int wait_for_GO = 1;
+      GoSendVectors(max_string_len, SAP_ptr->num_POs, SAP_ptr->num_PIs, device_socket_desc, SAP_ptr->num_vecs, SAP_ptr->num_rise_vecs, 
+         SAP_ptr->has_masks, SAP_ptr->first_vecs_b, SAP_ptr->second_vecs_b, SAP_ptr->masks_b, wait_for_GO, SAP_ptr->use_database_chlngs, 
+         SAP_ptr->DB_ChallengeGen_seed, SAP_ptr->DEBUG_FLAG);
+
+// Generate verifier nonce n1, send to device and get XOR nonce from device.
+      GenNonceExchange(max_string_len, device_socket_desc, SAP_ptr->num_required_nonce_bytes, SAP_ptr->verifier_n2, SAP_ptr->XOR_nonce, 
+         SAP_ptr->DUMP_BITSTRINGS, SAP_ptr->DEBUG_FLAG);
+      }
+
+// If only part A is requested (Session Key Gen and Long-Lived), return. These routines will call CommonCore again with do_part_A_part_B_both set to 1
+// possibly multiple times. If part B (Session Key Gen and Long-Lived) or both (Device Authentication and Verifier Authentication), do the rest.
+   if ( do_part_A_part_B_both == 0 )
+      return;
+
+// ============================================================================
+// Select parameter values. MUST DO THIS BEFORE ComputeSendSpreadFactors since we need the parameters to compute population SpreadFactors.
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      {
+      printf("ComCore.1) Selecting parameters\n");
+      gettimeofday(&t0, 0);
+      }
 
-// Do NOT add a strong bit to the 'SBS' for bits classified as weak
-      else
-         continue;
+// Select parameters based on the value of XOR_nonce. 
+   if ( SAP_ptr->fix_params == 0 )
+      SelectParams(SAP_ptr->num_required_nonce_bytes, SAP_ptr->XOR_nonce, SAP_ptr->nonce_base_address, &(SAP_ptr->param_LFSR_seed_low), 
+         &(SAP_ptr->param_LFSR_seed_high), &(SAP_ptr->param_RangeConstant), &(SAP_ptr->param_SpreadConstant), &(SAP_ptr->param_Threshold),
+         &(SAP_ptr->param_TrimCodeConstant));
 
-// Initialize the byte
-      if ( (SBS_num_bits % 8) == 0 ) 
-         SBS[SBS_num_bits/8] = 0;
+// Use randomly selected parameters if user requests fixed parameters.
+   else
+      {
+      SAP_ptr->param_LFSR_seed_low = FIXED_LFSR_SEED_LOW;
+      SAP_ptr->param_LFSR_seed_high = FIXED_LFSR_SEED_HIGH;
+      SAP_ptr->param_RangeConstant = FIXED_RANGE_CONSTANT;
+      SAP_ptr->param_SpreadConstant = FIXED_SPREAD_CONSTANT;
+      SAP_ptr->param_Threshold = FIXED_THRESHOLD;
+      }
 
-// NOTE: WE DO NOT use a shift register approach for the strong bitstring in the hardware to make the strong bitstring consistent with the helper 
-// data. So the last strong bits of LAST byte (highest numbered) are in the low order positions of the byte.
-      if ( bit_val == 1 )
-         SBS[SBS_num_bits/8] = SBS[SBS_num_bits/8] | (1 << (SBS_num_bits % 8));
+   if ( SAP_ptr->DEBUG_FLAG == 1 )
+      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
 
-      SBS_num_bits++;
+// Force threshold to be zero for RawBitstring.
+   if ( set_threshold_to_zero == 1 )
+      SAP_ptr->param_Threshold = 0;
 
-// Sanity check
-      if ( SBS_num_bits > max_PNDiffs )
-         { printf("ERROR: SingleHelpBitGen(): SBS_num_bits larger than MAX -- increase in program!\n"); exit(EXIT_FAILURE); }
-      }
+// For iterating in session encryption and KEK until we reach a 'target_num_key_bits'. Assume same 'XOR_nonce' bytes are used repeatedly. 
+// Just increment the LFSR seed (do NOT increment BOTH otherwise you get the same sequence).
+   SAP_ptr->param_LFSR_seed_high = (SAP_ptr->param_LFSR_seed_high + target_attempts) % SAP_ptr->num_required_PNDiffs;
 
+// Don't enable this -- it is called many times from Device SKE Authentication functions
 #ifdef DEBUG
-printf("\t\tSingleHelpBitGen(): Strong bitstring size %d (bits)\tSingle Helper Data size %d (bits)\n", SBS_num_bits, max_PNDiffs); fflush(stdout);
+printf("\tLFSR seed low %u\tLFSR seed high %u\tRangeConstant %d\tSpreadConstant %u\tThreshold %u\n\n", 
+   SAP_ptr->param_LFSR_seed_low, SAP_ptr->param_LFSR_seed_high, SAP_ptr->param_RangeConstant, SAP_ptr->param_SpreadConstant, 
+   SAP_ptr->param_Threshold); fflush(stdout);
 #endif
 
-// Return the HD size in bytes -- this should always be 2048/8 = 256 bytes. Not really needed
-   *HD_num_bytes_ptr = max_PNDiffs/8;
+   if ( compute_SpreadFactors == 1 )
+      ComputeSendSpreadFactors(max_string_len, SAP_ptr, device_socket_desc, current_function, send_SpreadFactors, compute_PCR_PBD_SF);
 
-// Sanity check
-   if ( Threshold == 0 && SBS_num_bits != max_PNDiffs )
-      { printf("ERROR: SingleHelpBitGen(): Threshold is 0 but number of strong bits %d is NOT equal to max_PNDiffs %d!\n", SBS_num_bits, max_PNDiffs); exit(EXIT_FAILURE); }
+// Sometimes, we just want send the pre-computed SpreadFactors (compute_SpreadFactors == 0).
+   else if ( send_SpreadFactors == 1 )
+      if ( SockSendB((unsigned char *)SAP_ptr->iSpreadFactors, SAP_ptr->num_SF_bytes, device_socket_desc) < 0 )
+         { printf("ERROR: CommonCore(): Send 'PCR SpreadFactors' failed\n"); exit(EXIT_FAILURE); }
 
-   return SBS_num_bits;
+   return;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// Generate verifier nonce n1, send to device and get XOR nonce from device.
+// A convenience function that calls CommonCore when do_part_A is 1 to generate challenges, collect timing data 
+// from the database and send challenges and exchange nonces with device, and then always does part_B of 
+// CommonCore where consecutative sets of SpreadFactors are generated and sent to the device. NOTE: target_attempts 
+// is FORCED to 0 when 'do_part_A' is 1. The 'return_after_each_set' is used in device authentication to
+// optimize the speed of the database search, where we return and the parent stores the SpreadFactors for each
+// iteration in a larger array for re-use later.
 
-void GenNonceExchange(int max_string_len, int device_socket_desc, int num_required_nonce_bytes, 
-   unsigned char *verifier_n2, unsigned char *XOR_nonce, int RANDOM, int DUMP_BITSTRINGS, int debug_flag)
+int GenChlngDeliverSpreadFactorsToDevice(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int do_part_A, 
+   int target_attempts, int device_socket_desc, int *done_ptr, int return_after_each_set, 
+   int compute_PCR_PBD_SF, int restore_store_SF, signed char **SpreadFactors_binary_ptr, int current_function)
    {
+   int set_threshold_to_zero, do_part_A_part_B_both, compute_SpreadFactors, send_SpreadFactors;
+   char request_str[max_string_len];
+   int i;
+
    struct timeval t0, t1;
    long elapsed; 
 
-// ****************************************
-// ***** Generate nonce n2. 
-   if ( debug_flag == 1 )
+// When 1, call CommonCore to generate challenges, collect timing data from the database and send challenges to the device 
+// and exchange nonces with the device. DO NOT select parameters or generate/send SpreadFactors -- that is done in the loop below.
+   if ( do_part_A == 1 )
       {
-      printf("GNExch.1) Generating nonce n2\n");
-      gettimeofday(&t0, 0);
-      }
-
-// Calling /dev/urandom here to get this
-   if ( read(RANDOM, verifier_n2, num_required_nonce_bytes) == -1 )
-      { printf("ERROR: GenNonceExchange(): Read /dev/urandom failed!\n"); exit(EXIT_FAILURE); }
-   if ( debug_flag == 1 )
-      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+      set_threshold_to_zero = 0;
+      do_part_A_part_B_both = 0;
 
-// Dump out the values as hex
-   if ( DUMP_BITSTRINGS == 1 )
-      {
-      char header_str[max_string_len];
-      sprintf(header_str, "\n\tVerifier nonce n2 (high to low)\n");
-      PrintHeaderAndHexVals(header_str, num_required_nonce_bytes, verifier_n2, 8);
+// These don't matter when do_part_A_part_B_both is 0.
+      compute_SpreadFactors = 0;
+      send_SpreadFactors = 0;
+      target_attempts = 0;
+      CommonCore(max_string_len, SAP_ptr, device_socket_desc, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, 
+         current_function, compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
       }
 
-// ****************************************
-// ***** Send the nonce n2 to the device
-   if ( debug_flag == 1 )
+// We need to iterate here calling SelectParams and computing SpreadFactors until device indicates that it has generated enough bits. 
+// Calls CommonCore doing ONLY part B, which selects paramters and computes and sends SpreadFactors.
+   while (1)
       {
-      printf("GNExch.2: Sending verifier nonce n2\n");
-      gettimeofday(&t0, 0);
-      }
-   if ( SockSendB(verifier_n2, num_required_nonce_bytes, device_socket_desc) < 0 )
-      { printf("ERROR: GenNonceExchange(): Failed to send 'verifier_n2' to device!\n"); exit(EXIT_FAILURE); }
-   if ( debug_flag == 1 )
-      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
 
+// Here we only select parameters, set the LFSR_seed_high and compute and send SpreadFactors. Feed the device with this information until 
+// it indicates it has completed its operation. Do part_B only.
+      set_threshold_to_zero = 0;
+      do_part_A_part_B_both = 1;
 
-// ****************************************
-// ***** Receive nonce (n1 XOR n2) from device
-   if ( debug_flag == 1 )
-      {
-      printf("GNExch.3) Receiving device nonce (n1 XOR n2)\n");
-      gettimeofday(&t0, 0);
-      }
-   if ( SockGetB(XOR_nonce, num_required_nonce_bytes, device_socket_desc) != num_required_nonce_bytes )
-      { printf("ERROR: GenNonceExchange(): Failed to get 'XOR_nonce' from device!\n"); exit(EXIT_FAILURE); }
-   if ( debug_flag == 1 )
-      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+// We do NOT compute or send ANY SpreadFactors if current function is DA or LL_Enroll and PBD mode is requested.
+      if ( (current_function == FUNC_DA || current_function == FUNC_LL_ENROLL) && SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PBD )
+         {
+         compute_SpreadFactors = 0;
+         send_SpreadFactors = 0;
+         }
+      else
+         {
+         compute_SpreadFactors = 1;
+         send_SpreadFactors = 1;
+         }
 
-// Dump out the values as hex
-   if ( DUMP_BITSTRINGS == 1 )
-      {
-      char header_str[max_string_len];
-      sprintf(header_str, "\n\tReceived device XOR nonces (n1 XOR n2) (high to low):\n");
-      PrintHeaderAndHexVals(header_str, num_required_nonce_bytes, XOR_nonce, 8);
+// Restore SpreadFactors if incoming *SpreadFactors_binary_ptr is NON-NULL. In this case, we've already computed them previously and
+// want to re-use them.
+      if ( compute_SpreadFactors == 1 && restore_store_SF == 0 && SpreadFactors_binary_ptr != NULL )
+         {
+
+// Be sure to restore the fSpreadFactors since they are used in the AddSpreadFactors software routine.
+         for ( i = 0; i < SAP_ptr->num_SF_words; i++ )
+            {
+            SAP_ptr->iSpreadFactors[i] = (*SpreadFactors_binary_ptr)[target_attempts*SAP_ptr->num_SF_words + i];
+            SAP_ptr->fSpreadFactors[i] = (float)SAP_ptr->iSpreadFactors[i]/(float)SAP_ptr->iSpreadFactorScaler;
+            }
+         compute_SpreadFactors = 0;
+         }
+
+      CommonCore(max_string_len, SAP_ptr, device_socket_desc, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, 
+         current_function, compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
+
+// Store the SpreadFactors if they are being computed assuming that we'll need them again.
+      if ( compute_SpreadFactors == 1 && restore_store_SF == 1 )
+         {
+         if ( (*SpreadFactors_binary_ptr = (signed char *)realloc(*SpreadFactors_binary_ptr, 
+            ((target_attempts+1) * SAP_ptr->num_SF_words) * sizeof(signed char))) == NULL )
+            { printf("ERROR: GenChlngDeliverSpreadFactorsToDevice(): Failed to allocate storage for SpreadFactors_binary!\n"); exit(EXIT_FAILURE); }
+
+         memcpy(&((*SpreadFactors_binary_ptr)[target_attempts*SAP_ptr->num_SF_words]), SAP_ptr->iSpreadFactors, SAP_ptr->num_SF_words);
+//         for ( i = 0; i < SAP_ptr->num_SF_words; i++ )
+//            (*SpreadFactors_binary_ptr)[target_attempts*SAP_ptr->num_SF_words + i] = SAP_ptr->iSpreadFactors[i];
+         }
+
+      target_attempts++;
+
+// Continue to compute and send new SpreadFactors for each increment of the LFSR seed as needed by the device. 
+      if ( SAP_ptr->DEBUG_FLAG == 1 )
+         {
+         printf("\tReceiving more SpreadFactors command\n");
+         gettimeofday(&t0, 0);
+         }
+      if ( SockGetB((unsigned char *)request_str, max_string_len, device_socket_desc) == -1 )
+         { printf("ERROR: GenChlngDeliverSpreadFactorsToDevice(): Receive SpreadFactors request failed!\n"); exit(EXIT_FAILURE); }
+      if ( strcmp(request_str, "SPREAD_FACTORS DONE") == 0 )
+         {
+         *done_ptr = 1;
+         break;
+         }
+      if ( SAP_ptr->DEBUG_FLAG == 1 )
+         { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tTOTAL EXEC TIME %ld us\n\n", (long)elapsed); }
+
+      if ( return_after_each_set == 1 )
+         break;
       }
-   fflush(stdout);
 
-   return;
+   return target_attempts;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// Compute and transmit SpreadFactors
+// We MUST save the individual curves to separate files here (unlike ZED analysis) because we keep adding to them as 
+// authentications progress. 
 
-void ComputeSendSpreadFactors(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, 
-   int current_function, int send_SpreadFactors, int compute_PCR_PBD_SF)
+void WriteAuthenPointToFile(int max_string_len, char *outfile_name, int authen_num, char *wfm_header_str, float fval)
    {
-   struct timeval t0, t1;
-   long elapsed; 
+   FILE *OUTFILE;
 
-#ifdef DEBUG
-printf("ComputeSendSpreadFactors(): CALLED!\n"); fflush(stdout);
-#endif
+   if ( authen_num == 0 && (OUTFILE = fopen(outfile_name, "w")) == NULL )
+      { printf("ERROR: WriteAuthenPointToFile(): Data file '%s' open failed for writing!\n", outfile_name); exit(EXIT_FAILURE); }
+   else if ( authen_num != 0 && (OUTFILE = fopen(outfile_name, "a")) == NULL )
+      { printf("ERROR: WriteAuthenPointToFile(): Data file '%s' open failed for appending!\n", outfile_name); exit(EXIT_FAILURE); }
 
-// Clear the SpreadFactors array. 
-   int PND_num;
-   for ( PND_num = 0; PND_num < SAP_ptr->num_required_PNDiffs; PND_num++ ) 
+// We don't know the authenticating chip number here (unlike the ZED TV analysis). We print a message above and will need to make 
+// note in the paper how many, if any, authentications fail.
+   if ( authen_num == 0 )
+      fprintf(OUTFILE, "%s", wfm_header_str);
+   fprintf(OUTFILE, "%d\t%f\n", authen_num, fval);
+
+   fclose(OUTFILE);
+ 
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Run the SRF engine and the SKE regeneration for a batch of num_batch_chips chips of the database, chip_nums[0 .. 
+// num_batch_chips-1], using the device's XMR_SHD helper data and the SpreadFactors already collected by 
+// the parent. The iterations (target_attempts) are the outer loop so the SRF parameters and SpreadFactors are set 
+// up once per iteration and the PNDco for all chips still active in the batch are computed together by 
+// SRFBatchKernel. The NSB, NMM, NMBF, NTBF and CC for each chip are recorded in ADS[0 .. num_batch_chips-1] and the 
+// number of mismatches in num_mismatches_arr[0 .. num_batch_chips-1]. NOTE: This routine writes the SRF scratch fields of 
+// SAP_ptr (fPND, SpreadFactors, device_SBS/SHD and the parameters) and the batch blocks in DSW_ptr, so each scan 
+// worker has its own copies.
+
+void KEK_DA_SKE_ScoreChipBatch(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, DAScanWorkerStruct *DSW_ptr, int *chip_nums, 
+   int num_batch_chips, int received_XMR_SHD_num_bytes, unsigned char *SKE_authen_XMR_SHD, signed char *authen_SpreadFactors_binary, 
+   int current_function, int do_scaling, int check_all_chips, AuthenDataStruct *ADS, int *num_mismatches_arr)
+   {
+   int enroll_or_regen, SBS_num_bits, SHD_num_bytes, do_part_A_part_B_both, set_threshold_to_zero; 
+   unsigned char KEK_authentication_nonce_reproduced[SAP_ptr->num_KEK_authen_nonce_bits/8];
+   int target_attempts, num_strong_bits;
+   int num_PNDiffs, batch_num, chip_num, num_active, num_misses;
+   unsigned short Threshold;
+   float *fPNDco, *PNR_block, *PNF_block;
+   int num_compare_bits, num_mismatches;
+   int i, j;
+
+// Per-chip state carried across the iterations.
+   int current_num_strong_bits[num_batch_chips];
+   int bits_remaining[num_batch_chips];
+   int num_minority_bit_flips[num_batch_chips];
+   int true_minority_bit_flips[num_batch_chips];
+   unsigned char *DA_nonce_reproduced[num_batch_chips];
+   unsigned char chip_mask[num_batch_chips];
+   PNDcCacheKeyStruct PNDc_keys[num_batch_chips];
+
+   int PND_num_inspect = 0;
+   int PND_num; 
+
+   enroll_or_regen = 1;
+   num_PNDiffs = SAP_ptr->num_required_PNDiffs;
+
+// Sanity check
+   if ( num_batch_chips > DSW_ptr->max_batch_chips )
+      { printf("ERROR: KEK_DA_SKE_ScoreChipBatch(): Batch size %d larger than allocated %d!\n", num_batch_chips, DSW_ptr->max_batch_chips); exit(EXIT_FAILURE); }
+
+// The PNR and PNF rows of all chips are stored contiguously, chip-major (see GetAllPUFInstanceTimingValsForChallenge), so the rows of 
+// a batch of consecutive chips are used in place by SRFBatchKernel. Otherwise (chips taken in prefilter order), copy them into the 
+// worker's gather blocks.
+   for ( batch_num = 1; batch_num < num_batch_chips; batch_num++ )
+      if ( chip_nums[batch_num] != chip_nums[0] + batch_num )
+         break;
+   if ( batch_num == num_batch_chips )
       {
-      SAP_ptr->iSpreadFactors[PND_num] = 0;
-      SAP_ptr->fSpreadFactors[PND_num] = 0.0;
+      PNR_block = SAP_ptr->PNR[chip_nums[0]];
+      PNF_block = SAP_ptr->PNF[chip_nums[0]];
       }
-
-// ----------------------------------------------------
-// In the first call, we compute population SpreadFactors. We analysis the data from ALL chips (actually, if the number of chips is > 100, then we 
-// only analyze the first 100) and compute a set of fSpreadFactors that center each PND distribution over the bit-flip line. 
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
+   else
       {
-      printf("CO.1) Computing SpreadFactors, Part 1\n");
-      gettimeofday(&t0, 0);
+      PNR_block = DSW_ptr->PNR_gather;
+      PNF_block = DSW_ptr->PNF_gather;
+      for ( batch_num = 0; batch_num < num_batch_chips; batch_num++ )
+         {
+         memcpy(PNR_block + batch_num*num_PNDiffs, SAP_ptr->PNR[chip_nums[batch_num]], sizeof(float) * num_PNDiffs);
+         memcpy(PNF_block + batch_num*num_PNDiffs, SAP_ptr->PNF[chip_nums[batch_num]], sizeof(float) * num_PNDiffs);
+         }
       }
 
-// This routine ONLY computes the PopSF and stores results in SAP_ptr->i/fSpreadFactors. The 2-D arrays of PNR and PNF are referenced in this call.
-// Note, when param_PCR_or_PBD_or_PO == SF_MODE_PBD, we do NOT use Pop. SF since the low order bit of the PNDc is used to determine the bit value. 
-   int do_part_A_or_B = 0;
-   if ( SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PCR || SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_POPONLY )
-      ComputePxxSpreadFactors(max_string_len, SAP_ptr, do_part_A_or_B);
+   for ( batch_num = 0; batch_num < num_batch_chips; batch_num++ )
+      {
+      chip_num = chip_nums[batch_num];
 
-#ifdef DEBUG
-PrintHeaderAndHexVals("ComputeSendSpreadFactors(): Pop. SpreadFactors:\n", SAP_ptr->num_SF_bytes, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
-#endif
+// Sanity check.
+      if ( do_scaling == 1 && SAP_ptr->ChipScalingConstantNotifiedArr[chip_num] == 1 && SAP_ptr->ChipScalingConstantArr[chip_num] == 0.0 )
+         { printf("ERROR: KEK_DA_SKE_ScoreChipBatch(): ChipScalingConstantNotifiedArr[x] is 1 but ChipScalingConstantArr[x] value is 0.0"); exit(EXIT_FAILURE); }
 
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
-      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+#ifdef DEBUG3
+printf("KEK_DA_SKE_ScoreChipBatch(): Checking chip %d\n", chip_num); fflush(stdout);
+#endif
 
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
-      {
-      char header_str[max_string_len];
-      sprintf(header_str, "\n\tPopulation SpreadFactors %d\n", SAP_ptr->num_SF_bytes);
-      PrintHeaderAndHexVals(header_str, SAP_ptr->num_SF_bytes, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
+      ADS[batch_num].index = chip_num;
+      ADS[batch_num].NSB = 0;
+      ADS[batch_num].NMM = 0.0;
+      ADS[batch_num].NMBF = 0.0;
+      ADS[batch_num].NTBF = 0.0;
+      ADS[batch_num].CC = 0.0;
+
+      current_num_strong_bits[batch_num] = 0;
+      num_mismatches_arr[batch_num] = 0;
+      num_minority_bit_flips[batch_num] = 0;
+      true_minority_bit_flips[batch_num] = 0;
+      bits_remaining[batch_num] = SAP_ptr->num_KEK_authen_nonce_bits;
+      DA_nonce_reproduced[batch_num] = NULL;
+      chip_mask[batch_num] = 1;
       }
+   num_active = num_batch_chips;
 
-// If PCR or PBD are requested, then call ComputePxxSpreadFactors again.
-   if ( compute_PCR_PBD_SF == 1 )
+// ASSUME that the timing vals (PNR and PNF) have already been allocated and stored in the SAP fields based on a challenge 
+// and the XOR_nonce has been set with the first call to CommonCore with do_part_A_part_B_both set to 0. Since multiple
+// calls to CommonCore have been made to give updated SpreadFactors to the device for each iteration, we must call CommonCore 
+// here with do_part_A_part_B_both set to 1, which will select parameters and set the LFSR_seed_high according to the number
+// of target_attempts. Assume multiple iterations of KEK were needed to generate enough SKE_authen_XMR_SHD helper data to 
+// encode the entire nonce. A chip drops out of the batch (chip_mask) once it has reproduced the whole nonce (or on a 
+// mismatch when check_all_chips is 0).
+   target_attempts = 0;
+   while ( num_active > 0 )
       {
 
-// ----------------------------------------------------
-// If requested, compute the PCR (this is done on the device now for DA and LL_Enroll). DoSRFComp() is called to compute fPNDco for the SAP_ptr->chip_num set, 
-// and these are used to determine the adjustments that are made to fSpreadFactors. So we MUST set the chip_num BEFORE calling ComputePxxSpreadFactors. 
-// Also, this routine updates the fPNDco with the PCR SpreadFactors. Useful in case we are computing a response bitstring within the verifier. Carry out 
-// the full computation so we have the properly generated PND and PNDc.
+// Call CommonCore to reset the parameters (LFSR_seed_high) based on XOR_nonce and target_attempts. Do not compute or send SpreadFactors.
+      int compute_SpreadFactors = 0;
+      int send_SpreadFactors = 0;
 
-// Sanity check. SAP_ptr->chip_num MUST be set to a number between 0 and num_chips-1.
-      if ( SAP_ptr->chip_num < 0 || SAP_ptr->chip_num >= SAP_ptr->num_chips )
-         { 
-         printf("ERROR: ComputeSendSpreadFactors(): PCR component MUST have chip_num %d >= 0 and < num_chips %d\n", 
-            SAP_ptr->chip_num, SAP_ptr->num_chips); exit(EXIT_FAILURE); 
-         }
+// Do NOT compute PCR (or PBD) SF (which is irrelevant because compute_SpreadFactors is 0).
+      int compute_PCR_PBD_SF = 0;
 
-#ifdef DEBUG
-printf("ComputeSendSpreadFactors(): Chip set for calculation of PCR SpreadFactors %d\n", SAP_ptr->chip_num); fflush(stdout);
-#endif
+      do_part_A_part_B_both = 1;
 
-      if ( SAP_ptr->DEBUG_FLAG == 1 )
+      set_threshold_to_zero = 0;
+      CommonCore(max_string_len, SAP_ptr, 0, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
+         compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
+
+// Use SpreadFactors already collected by parent. 
+      for ( i = 0, j = target_attempts * SAP_ptr->num_SF_words; i < SAP_ptr->num_SF_words; i++, j++ )
          {
-         printf("CO.1) Computing SpreadFactors, Part 2\n");
-         gettimeofday(&t0, 0);
+         SAP_ptr->iSpreadFactors[i] = authen_SpreadFactors_binary[j];
+
+// Note: iSpreadFactorScaler is either 2 (or 1), depending on the TRIMCODE_CONSTANT (if <= 32, it is 2, else 1).
+         SAP_ptr->fSpreadFactors[i] = (float)authen_SpreadFactors_binary[j]/(float)SAP_ptr->iSpreadFactorScaler;
          }
 
-// Second call to ComputePxxSpreadFactors. Note, we do NOT do SF at ALL when current function is DA or LL_ENROLL (they are computed on the device). 
-      do_part_A_or_B = 1;
-      if ( current_function != FUNC_DA && current_function != FUNC_LL_ENROLL )
-         ComputePxxSpreadFactors(max_string_len, SAP_ptr, do_part_A_or_B);
+// Sanity check. The number of iterations here should NEVER exceed what the device did to generate the received_XMR_SHD_num_bytes.
+      if ( target_attempts*SAP_ptr->num_required_PNDiffs/8 >= received_XMR_SHD_num_bytes )
+         { printf("ERROR: KEK_DA_SKE_ScoreChipBatch(): server target attempts exceed size of SKE_authen_XMR_SHD!\n"); exit(EXIT_FAILURE); }
 
-      if ( SAP_ptr->DEBUG_FLAG == 1 )
+// Do SRF Engine operations in software for all active chips in the batch. The PNDc do NOT depend on the SpreadFactors, so they are taken 
+// from the PNDc cache when the same challenge, LFSR seeds and RangeConstant were already used for a chip, and computed (and cached) for 
+// the rest. 
+      num_misses = 0;
+      for ( batch_num = 0; batch_num < num_batch_chips; batch_num++ )
          {
-         printf("CO.2) Sending PCR SpreadFactors to Device\n");
-         gettimeofday(&t0, 0);
+         DSW_ptr->miss_mask[batch_num] = chip_mask[batch_num];
+         if ( chip_mask[batch_num] == 0 || SAP_ptr->PNDc_cache == NULL )
+            { num_misses += chip_mask[batch_num]; continue; }
+
+         SetPNDcCacheKey(SAP_ptr, chip_nums[batch_num], &(PNDc_keys[batch_num]));
+         if ( LookupPNDcCache(SAP_ptr->PNDc_cache, &(PNDc_keys[batch_num]), DSW_ptr->PNDc_block + batch_num*num_PNDiffs) == 1 )
+            DSW_ptr->miss_mask[batch_num] = 0;
+         else
+            num_misses++;
          }
-      }
 
-// The iSpreadFactors are signed char (5- or 6-bit integer with 1- or 0-bits of binary precision), We can also fit these into 12-bits if needed which 
-// gives +/-256.xxx (9 bits of integer and 3 bits of precision), reducing this transfer from 4096 bytes to 3072 bytes, but we would need to 'pack' them. 
-// I can get back to 8-bits by giving up the 3 or 4 bits of precision. 
-   if ( send_SpreadFactors == 1 )
-      if ( SockSendB((unsigned char *)SAP_ptr->iSpreadFactors, SAP_ptr->num_SF_bytes, device_socket_desc) < 0 )
-         { printf("ERROR: ComputeSendSpreadFactors(): Send 'PCR SpreadFactors' failed\n"); exit(EXIT_FAILURE); }
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
-      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
+      if ( num_misses > 0 )
+         {
+         ComputeLFSRPairMap(num_PNDiffs, SAP_ptr->param_LFSR_seed_low, SAP_ptr->param_LFSR_seed_high, DSW_ptr->LFSR_pair_map);
+         SRFBatchPNDcKernel(num_PNDiffs, num_batch_chips, PNR_block, PNF_block, DSW_ptr->miss_mask, DSW_ptr->LFSR_pair_map, 
+            SAP_ptr->range_low_limit, SAP_ptr->range_high_limit, SAP_ptr->dist_range, SAP_ptr->param_RangeConstant, SAP_ptr->fPND, 
+            DSW_ptr->int_scratch, DSW_ptr->PNDc_block);
+
+         if ( SAP_ptr->PNDc_cache != NULL )
+            for ( batch_num = 0; batch_num < num_batch_chips; batch_num++ )
+               if ( DSW_ptr->miss_mask[batch_num] == 1 )
+                  InsertPNDcCache(SAP_ptr->PNDc_cache, &(PNDc_keys[batch_num]), DSW_ptr->PNDc_block + batch_num*num_PNDiffs);
+         }
 
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
-      {
-      char header_str[max_string_len];
-      sprintf(header_str, "\n\tPCR SpreadFactors %d\n", SAP_ptr->num_SF_bytes);
-      PrintHeaderAndHexVals(header_str, SAP_ptr->num_SF_bytes, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
-      }
+// Note, SF are signed char now and are computed to move PNDco (using PNDc) to the nearest lower multiple of TrimCodeConstant. The wrap in 
+// SRFBatchAddSpreadFactors removes the DC bias in the same way as AddSpreadFactors.
+      SRFBatchAddSpreadFactors(num_PNDiffs, num_batch_chips, chip_mask, DSW_ptr->PNDc_block, SAP_ptr->fSpreadFactors, 
+         SAP_ptr->param_TrimCodeConstant, DSW_ptr->PNDco_block);
 
-   return;
+      for ( batch_num = 0; batch_num < num_batch_chips; batch_num++ )
+         {
+         if ( chip_mask[batch_num] == 0 )
+            continue;
+
+         chip_num = chip_nums[batch_num];
+         SAP_ptr->chip_num = chip_num;
+         fPNDco = DSW_ptr->PNDco_block + batch_num*num_PNDiffs;
+
+// 10_23_2022: Newest (correct) version which uses ScalingConstants.
+         if ( do_scaling == 1 && SAP_ptr->ChipScalingConstantNotifiedArr[chip_num] == 1 )
+            {
+            for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+               fPNDco[PND_num] = (float)((int)(fPNDco[PND_num] * SAP_ptr->ChipScalingConstantArr[chip_num] * 16.0))/16.0;
+
+#ifdef DEBUG3
+printf("Chip %3d\tScaled fPNDco with ScalingConstant %f\n", chip_num, SAP_ptr->ChipScalingConstantArr[chip_num]); fflush(stdout);
+#endif
+            }
+
+// The KEK_FSB_SKE() routine in common.c wants the raw bitstring (computed with Threshold set to 0). Run the SingleHelpBitGen algorithm with the 
+// Threshold set to 0.
+         Threshold = 0;
+         SBS_num_bits = SingleHelpBitGen(num_PNDiffs, fPNDco, SAP_ptr->device_SBS, SAP_ptr->device_SHD, &SHD_num_bytes, Threshold);
+
+// Sanity check. With Threshold set to 0, the number of strong bits is the same size as the SHD.
+         if ( SBS_num_bits != num_PNDiffs )
+            { 
+            printf("ERROR: KEK_DA_SKE_ScoreChipBatch(): Number of bits in raw bitstring must be %d -- found %d!\n", num_PNDiffs, SBS_num_bits); 
+            exit(EXIT_FAILURE); 
+            }
+
+// The PRODUCT of KEK_FSB_SKE() during regeneration mode is KEK_authentication_nonce_reproduced, which uses the XMR SHD helper data generated 
+// during enrollment and the raw bitstring device_SBS. Each iteration generates a portion of the KEK_authentication_nonce. Note that 'bits_remaining' 
+// during regeneration is used to exit the loop early when the number of bits produced reaches the max. num_minority_bit_flips and 
+// true_minority_bit_flips count the number of bits that mismatch and are used in the statistics to show distinguishability (see 
+// KEK_DA_SKE_FindMatch).
+         int do_mismatch_count = 1;
+         int FSB_or_SKE = 1;
+         num_strong_bits = KEK_FSB_SKE(num_PNDiffs, SAP_ptr->XMR_val, SKE_authen_XMR_SHD + target_attempts*num_PNDiffs/8, SAP_ptr->device_SBS, 
+            NULL, bits_remaining[batch_num], KEK_authentication_nonce_reproduced, enroll_or_regen, do_mismatch_count, 
+            &(num_minority_bit_flips[batch_num]), current_num_strong_bits[batch_num], SAP_ptr->KEK_authentication_nonce, 
+            &(true_minority_bit_flips[batch_num]), FSB_or_SKE, chip_num, 0);
+         bits_remaining[batch_num] -= num_strong_bits;
+
+if ( target_attempts == 0 )
+   {
+   if ( fPNDco[PND_num_inspect] > 0.0 )
+      DSW_ptr->num_pos_vals++;
+   if ( fPNDco[PND_num_inspect] < 0.0 )
+      DSW_ptr->num_neg_vals++;
+   if ( fPNDco[PND_num_inspect] == 0.0 )
+      DSW_ptr->num_zero_vals++;
    }
 
+// Count the number of mismatches (Hamming distance). Do NOT try to match bits beyond the last KEK_authentication_nonce bit. 
+// When check_all_chips is 0, stop at the first mismatch. j is the number of bits compared before stopping, i the nonce bit reached.
+         num_compare_bits = num_strong_bits;
+         if ( num_compare_bits > SAP_ptr->num_KEK_authen_nonce_bits - current_num_strong_bits[batch_num] )
+            num_compare_bits = SAP_ptr->num_KEK_authen_nonce_bits - current_num_strong_bits[batch_num];
+         if ( num_compare_bits < 0 )
+            num_compare_bits = 0;
+         num_mismatches = HammingDistanceBS(num_compare_bits, KEK_authentication_nonce_reproduced, 0, SAP_ptr->KEK_authentication_nonce, 
+            current_num_strong_bits[batch_num], check_all_chips == 0 ? 1 : 0, &j);
+         i = current_num_strong_bits[batch_num] + j;
+         num_mismatches_arr[batch_num] += num_mismatches;
 
-// ========================================================================================================
-// ========================================================================================================
-// This routine is a convenience routine to generate a random DB_ChallengeGen_seed, select a set of vectors
-// from the timing DB and fetch the timing data into PNR and PNF arrays.
+#ifdef DEBUG3
+if ( num_mismatches > 0 && check_all_chips == 0 )
+   printf("\tMISMATCH for chip %d on bit %d\n", chip_num, i); 
+fflush(stdout);
+#endif
 
-void GenVecSeedChlngsTimingData(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, sqlite3 *timing_DB,
-   char *ChlngSetName, TimingValCacheStruct *TVC_arr, int num_TVC_arr, int RANDOM)
-   { 
+// DEBUG ONLY, BUT NEED TO KEEP TRACK of how many KEK_authentication_nonce bit have been reproduced (current_num_strong_bits). 
+         current_num_strong_bits[batch_num] = JoinBytePackedBitStrings(current_num_strong_bits[batch_num], &(DA_nonce_reproduced[batch_num]), 
+            num_strong_bits, KEK_authentication_nonce_reproduced);
 
-// If the user wants to randomize the challenge vectors by selecting a random seed (vs. what is stored in 
-// the SAP_ptr->Seed already), then get one from RANDOM and assign it. Only applicable to the DATABASE VERSION.
-   if ( SAP_ptr->gen_random_challenge == 1 )
-      {
-      unsigned char seed_char[4];
-      if ( read(RANDOM, seed_char, 4) == -1 )
-         { printf("ERROR: GenVecSeedChlngsTimingData(): Read /dev/urandom failed!\n"); exit(EXIT_FAILURE); }
-      SAP_ptr->DB_ChallengeGen_seed = seed_char[3] << 24 | seed_char[2] << 16 | seed_char[1] << 8 | seed_char[0];
-      }
+// Keep updating these on multiple iterations.
+         ADS[batch_num].NSB = current_num_strong_bits[batch_num];
+         ADS[batch_num].NMM = (float)num_mismatches_arr[batch_num];
+         ADS[batch_num].NMBF += (float)num_minority_bit_flips[batch_num];
+         ADS[batch_num].NTBF += (float)true_minority_bit_flips[batch_num];
 
-// Compute a random set of challenges from the compatibility set given by 'ChlngSetName'. This routine returns binary 
-// vectors and masks (both are always returned) and an array of (vecpair, PO_num) used to locate the TimingVals data 
-// for any one, a subset or all PUFInstances (chips). The field vecpair is an index into VecPair table for the PUFDesign 
-// identifed using Netlist_name and Synthesis_name. NOTE: vecpair refers to the single configuration vector used in 
-// the SRF PUF, which is split into two pieces (first_vec and second_vec) to optimize storage in the database. PO_num is 
-// a value between 0 and num_POs - 1. EXACTLY NUM_REQUIRED_PNs values are returned in this array half of which identify 
-// rising PN and the other half identify fall PNs. Both of these constraints are checked in GenChallengeDB. NOTE: THESE 
-// VECTORS and DATA STRUCTURES MUST BE FREED once we are done with them. ONLY applicable to the DATABASE VERSION.
-   if ( timing_DB != NULL )
-      {
-      VecPairPOStruct *challenge_vecpair_id_PO_arr = NULL;
-      int num_challenge_vecpair_id_PO = 0;
+         if ( num_strong_bits == 0 )
+            { printf("ERROR: Chip %d\tNumber of strong bits is 0!\n", chip_num); exit(EXIT_FAILURE); }
 
-      GenChallengeDB(max_string_len, timing_DB, SAP_ptr->design_index, ChlngSetName, SAP_ptr->DB_ChallengeGen_seed, 0, 
-         NULL, NULL, &(SAP_ptr->first_vecs_b), &(SAP_ptr->second_vecs_b), &(SAP_ptr->masks_b), &(SAP_ptr->num_vecs), 
-         &(SAP_ptr->num_rise_vecs), SAP_ptr->GenChallenge_mutex_ptr, &num_challenge_vecpair_id_PO, 
-         &challenge_vecpair_id_PO_arr);
+// Compute the CC. Smaller is better here, where NMM and NTBF are both zero is the best achievable.
+         ADS[batch_num].CC = ADS[batch_num].NTBF + ADS[batch_num].NMM;
 
-printf("\tGenVecSeedChlngsTimingData(): Number of vectors read %d\tNumber of rising vectors %d\n", SAP_ptr->num_vecs, 
-   SAP_ptr->num_rise_vecs); fflush(stdout);
-#ifdef DEBUG
+// If we exit the bit-check loop early, a bit was found that mismatched. Drop the chip from the batch. This does NOT apply when we
+// exited because we processed the last of the KEK_authentication_nonce bits (authentication success).
+         if ( j < num_strong_bits && i != SAP_ptr->num_KEK_authen_nonce_bits && check_all_chips == 0 )
+            { chip_mask[batch_num] = 0; num_active--; continue; }
+
+// Set number of bits matched to max size when we processed all bits in the authentication nonce. 
+         if ( i == SAP_ptr->num_KEK_authen_nonce_bits )
+            current_num_strong_bits[batch_num] = SAP_ptr->num_KEK_authen_nonce_bits;
+
+#ifdef DEBUG3
+if ( num_mismatches_arr[batch_num] == 0 )
+   printf("\tMATCHED on iteration %2d for chip %3d\tTotal bits matched %5d\tWith bits remaining %4d\tCummulative number matching %5d\tCummulative minority bit flips %4d\n", 
+      target_attempts, chip_num, num_strong_bits, bits_remaining[batch_num], current_num_strong_bits[batch_num], num_minority_bit_flips[batch_num]); 
+fflush(stdout);
 #endif
 
-// Get a subset of 2048 PNR and 2048 PNF of the timing data for all (or a subset) of PUFInstances. The set of 4096 timing 
-// values are identified by an array of challenge_vecpair_id_PO_arr structures with (vecpair, PO) elements. These are 
-// constructed by GenChallengeDB as the random challenge is generated and are guaranteed to match the PN tested by these 
-// challenge vectors/masks. Use '%' for * and '_' for ? in pattern match. The PNR and PNF are DYNAMICALLY allocated based 
-// on the challenge and will need to be freed once we are done with them.
-      GetAllPUFInstanceTimingValsForChallenge(max_string_len, timing_DB, challenge_vecpair_id_PO_arr, num_challenge_vecpair_id_PO, 
-         "%", &(SAP_ptr->PNR), &(SAP_ptr->PNF), &(SAP_ptr->num_chips), TVC_arr, num_TVC_arr, SAP_ptr->use_TVC_cache);
+// Done with this chip once the entire nonce has been reproduced.
+         if ( current_num_strong_bits[batch_num] >= SAP_ptr->num_KEK_authen_nonce_bits )
+            { chip_mask[batch_num] = 0; num_active--; }
+         }
 
-// Free up the challenge_vecpair_id_PO_arr. We'll free the vectors and timing data in the caller if it isn't needed again 
-// for something else.
-      if ( challenge_vecpair_id_PO_arr != NULL )
-         free(challenge_vecpair_id_PO_arr);
+      target_attempts++;
+      }
+
+// Free the DA_nonce_reproduced if it was allocated. The DA_nonce_reproduced is NOT USED by this routine. DEBUG ONLY.
+   for ( batch_num = 0; batch_num < num_batch_chips; batch_num++ )
+      {
+
+#ifdef DEBUG3
+chip_num = chip_nums[batch_num];
+if ( num_mismatches_arr[batch_num] == 0 )
+   printf("\tMATCHED***\tFor chip %3d\tTotal bits mismatched %5d\tFrom total bits compared %5d\tWith bits remaining %4d\tTotal minority bit flips %d\n",
+      chip_num, num_mismatches_arr[batch_num], current_num_strong_bits[batch_num], bits_remaining[batch_num], num_minority_bit_flips[batch_num]); 
+else
+   printf("\t\tMISMATCHED\tFor chip %3d\tTotal bits mismatched %5d\tFrom total bits compared %5d\tWith bits remaining %4d\tTotal minority bit flips %d\n",
+      chip_num, num_mismatches_arr[batch_num], current_num_strong_bits[batch_num], bits_remaining[batch_num], num_minority_bit_flips[batch_num]); 
+fflush(stdout);
+#endif
+
+      if ( DA_nonce_reproduced[batch_num] != NULL )
+         free(DA_nonce_reproduced[batch_num]);
       }
-   else
-      { printf("ERROR: Timing DB is NULL!\n"); exit(EXIT_FAILURE); }
 
    return;
    }
@@ -1286,231 +2610,318 @@ printf("\tGenVecSeedChlngsTimingData(): Number of vectors read %d\tNumber of ris
 
 // ========================================================================================================
 // ========================================================================================================
-// Common operations carried out indendent of the function.
+// Sort prefilter candidates in ascending sketch distance, ties broken on the chip number.
 
-void CommonCore(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, int RANDOM, 
-   int set_threshold_to_zero, int target_attempts, int do_part_A_part_B_both, int current_function, 
-   int compute_SpreadFactors, int send_SpreadFactors, int compute_PCR_PBD_SF)
+int DACandidateAscendCompareFunc(const void *a1, const void *a2)
    {
-   struct timeval t0, t1;
-   long elapsed; 
-
-// Both authentication modes, session key and KEK call this routine with do_part_A_part_B_both set to 0 (do this if stmt and return) and then 
-// with 1 (skip this if stmt and do the rest). This is true because we may need to call the CommonCore multiple times but do NOT want to execute 
-// this if stmt after the first call. The multiple calls simply change the SRF parameters to generate additional key bits until the required 
-// number is reached. We generate the challenge vectors and masks and then send them to the device. We are done with them at this point and 
-// free them. During vector/mask generation, we also retrieve the timing values tested by these challenges (PNR and PNF) for ALL devices and 
-// keep pass these back to the caller. So the caller will free the PNR and PNF once we are done with them.
-   if ( do_part_A_part_B_both == 0 || do_part_A_part_B_both == 2 )
-      {
+   DACandidateStruct *cand1 = (DACandidateStruct *)a1;
+   DACandidateStruct *cand2 = (DACandidateStruct *)a2;
 
-      GenVecSeedChlngsTimingData(max_string_len, SAP_ptr, SAP_ptr->database_NAT, SAP_ptr->ChallengeSetName_NAT, SAP_ptr->TVC_arr_NAT, 
-         SAP_ptr->num_TVC_arr_NAT, RANDOM);
-
-// Receive 'GO' and send vectors and masks
-      int wait_for_GO = 1;
-      GoSendVectors(max_string_len, SAP_ptr->num_POs, SAP_ptr->num_PIs, device_socket_desc, SAP_ptr->num_vecs, SAP_ptr->num_rise_vecs, 
-         SAP_ptr->has_masks, SAP_ptr->first_vecs_b, SAP_ptr->second_vecs_b, SAP_ptr->masks_b, wait_for_GO, SAP_ptr->use_database_chlngs, 
-         SAP_ptr->DB_ChallengeGen_seed, SAP_ptr->DEBUG_FLAG);
-
-// Generate verifier nonce n1, send to device and get XOR nonce from device.
-      GenNonceExchange(max_string_len, device_socket_desc, SAP_ptr->num_required_nonce_bytes, SAP_ptr->verifier_n2, SAP_ptr->XOR_nonce, RANDOM, 
-         SAP_ptr->DUMP_BITSTRINGS, SAP_ptr->DEBUG_FLAG);
-      }
+   if ( cand1->sketch_dist != cand2->sketch_dist )
+      return cand1->sketch_dist < cand2->sketch_dist ? -1 : 1;
+   return cand1->chip_num - cand2->chip_num;
+   }
 
-// If only part A is requested (Session Key Gen and Long-Lived), return. These routines will call CommonCore again with do_part_A_part_B_both set to 1
-// possibly multiple times. If part B (Session Key Gen and Long-Lived) or both (Device Authentication and Verifier Authentication), do the rest.
-   if ( do_part_A_part_B_both == 0 )
-      return;
 
-// ============================================================================
-// Select parameter values. MUST DO THIS BEFORE ComputeSendSpreadFactors since we need the parameters to compute population SpreadFactors.
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
+// ========================================================================================================
+// ========================================================================================================
+// Candidate prefilter of the chip search. The device encodes nonce bit n in the first iteration of its XMR_SHD
+// helper data with XMR_val marked raw bits, in order, and only marks raw bits that are EQUAL to n. So the 
+// authentic chip is expected to produce nonce bit marked_num/XMR_val at the marked_num'th marked position. Up 
+// to DA_PREFILTER_SKETCH_BITS marked positions, spread evenly over the helper data, form a bit sketch of this 
+// expected behavior. For every chip, the raw bits at the same positions are predicted with the first iteration's 
+// SRF parameters and SpreadFactors, and its sketch distance is the Hamming distance (popcount) to the expected 
+// sketch. The PND mean does not depend on the LFSR pairing, so it is computed exactly from the PNR and PNF means, 
+// while the bounded range (see SRFBatchPNDcKernel) is estimated from a regular sample of DA_PREFILTER_SKETCH_BITS 
+// PND. There are no selections over all num_PNDiffs PND and no per-iteration work, so this is a small fraction 
+// of the cost of scoring the chip. The chips are returned in candidates[0 .. num_chips-1] in ascending sketch 
+// distance. The worker's SAP copy and LFSR pair map are used as scratch. Returns the number of sketch bits, or 0 
+// if the helper data has too few marked bits to rank the chips (the caller then scans all of them).
+
+int KEK_DA_SKE_RankCandidates(int max_string_len, DAScanWorkerStruct *DSW_ptr, unsigned char *SKE_authen_XMR_SHD, 
+   signed char *authen_SpreadFactors_binary, int current_function, DACandidateStruct *candidates)
+   {
+   SRFAlgoParamsStruct *SAP_ptr = &(DSW_ptr->SAP);
+   unsigned short *LFSR_pair_map = DSW_ptr->LFSR_pair_map;
+   int sketch_pos[DA_PREFILTER_SKETCH_BITS];
+   uint64_t expected_sketch[DA_PREFILTER_SKETCH_BITS/64];
+   float range_sample[DA_PREFILTER_SKETCH_BITS];
+   int num_PNDiffs, num_marked, marked_num, marked_stride, nonce_bit_num;
+   int num_sketch_bits, num_sketch_words, word_num, bit_num;
+   int num_range_samples, range_stride, low_k, high_k;
+   float *PNR, *PNF, PNDco_val, num_down, num_up, fTCC, half_TCC;
+   float cur_mean, cur_range, range_conv;
+   uint64_t chip_word;
+   int chip_num, PND_num, i;
+
+   num_PNDiffs = SAP_ptr->num_required_PNDiffs;
+
+// Set the SRF parameters and SpreadFactors of the first iteration exactly as KEK_DA_SKE_ScoreChipBatch does.
+   CommonCore(max_string_len, SAP_ptr, 0, 0, 0, 1, current_function, 0, 0, 0);
+   for ( i = 0; i < SAP_ptr->num_SF_words; i++ )
+      SAP_ptr->fSpreadFactors[i] = (float)authen_SpreadFactors_binary[i]/(float)SAP_ptr->iSpreadFactorScaler;
+   ComputeLFSRPairMap(num_PNDiffs, SAP_ptr->param_LFSR_seed_low, SAP_ptr->param_LFSR_seed_high, LFSR_pair_map);
+
+// Build the expected sketch from the marked positions of the first iteration's helper data.
+   num_marked = 0;
+   for ( bit_num = 0; bit_num < num_PNDiffs; bit_num++ )
+      num_marked += GetBitFromByte(SKE_authen_XMR_SHD[bit_num/8], bit_num % 8);
+   if ( num_marked < 64 )
+      return 0;
+   marked_stride = num_marked/DA_PREFILTER_SKETCH_BITS;
+   if ( marked_stride < 1 )
+      marked_stride = 1;
+
+   memset(expected_sketch, 0, sizeof(expected_sketch));
+   num_sketch_bits = 0;
+   marked_num = 0;
+   for ( bit_num = 0; bit_num < num_PNDiffs && num_sketch_bits < DA_PREFILTER_SKETCH_BITS; bit_num++ )
       {
-      printf("ComCore.1) Selecting parameters\n");
-      gettimeofday(&t0, 0);
-      }
-
-// Select parameters based on the value of XOR_nonce. 
-   if ( SAP_ptr->fix_params == 0 )
-      SelectParams(SAP_ptr->num_required_nonce_bytes, SAP_ptr->XOR_nonce, SAP_ptr->nonce_base_address, &(SAP_ptr->param_LFSR_seed_low), 
-         &(SAP_ptr->param_LFSR_seed_high), &(SAP_ptr->param_RangeConstant), &(SAP_ptr->param_SpreadConstant), &(SAP_ptr->param_Threshold),
-         &(SAP_ptr->param_TrimCodeConstant));
+      if ( GetBitFromByte(SKE_authen_XMR_SHD[bit_num/8], bit_num % 8) == 0 )
+         continue;
 
-// Use randomly selected parameters if user requests fixed parameters.
-   else
-      {
-      SAP_ptr->param_LFSR_seed_low = FIXED_LFSR_SEED_LOW;
-      SAP_ptr->param_LFSR_seed_high = FIXED_LFSR_SEED_HIGH;
-      SAP_ptr->param_RangeConstant = FIXED_RANGE_CONSTANT;
-      SAP_ptr->param_SpreadConstant = FIXED_SPREAD_CONSTANT;
-      SAP_ptr->param_Threshold = FIXED_THRESHOLD;
+      nonce_bit_num = marked_num/SAP_ptr->XMR_val;
+      if ( nonce_bit_num >= SAP_ptr->num_KEK_authen_nonce_bits )
+         break;
+      if ( (marked_num % marked_stride) == 0 )
+         {
+         sketch_pos[num_sketch_bits] = bit_num;
+         if ( GetBitFromByte(SAP_ptr->KEK_authentication_nonce[nonce_bit_num/8], nonce_bit_num % 8) == 1 )
+            expected_sketch[num_sketch_bits/64] |= (uint64_t)1 << (num_sketch_bits % 64);
+         num_sketch_bits++;
+         }
+      marked_num++;
       }
+   num_sketch_words = num_sketch_bits/64;
+   if ( num_sketch_words == 0 )
+      return 0;
 
-   if ( SAP_ptr->DEBUG_FLAG == 1 )
-      { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tElapsed %ld us\n\n", (long)elapsed); }
-
-// Force threshold to be zero for RawBitstring.
-   if ( set_threshold_to_zero == 1 )
-      SAP_ptr->param_Threshold = 0;
+// Selection ranks of the bounded range (see SRFBatchPNDcKernel) scaled to the sample.
+   num_range_samples = DA_PREFILTER_SKETCH_BITS;
+   range_stride = num_PNDiffs/num_range_samples;
+   low_k = (int)(((long)ceilf(SAP_ptr->range_low_limit) - 1)*num_range_samples/num_PNDiffs);
+   high_k = (int)((long)floorf(SAP_ptr->range_high_limit)*num_range_samples/num_PNDiffs);
+   if ( low_k < 0 )
+      low_k = 0;
+   if ( high_k > num_range_samples - 1 )
+      high_k = num_range_samples - 1;
 
-// For iterating in session encryption and KEK until we reach a 'target_num_key_bits'. Assume same 'XOR_nonce' bytes are used repeatedly. 
-// Just increment the LFSR seed (do NOT increment BOTH otherwise you get the same sequence).
-   SAP_ptr->param_LFSR_seed_high = (SAP_ptr->param_LFSR_seed_high + target_attempts) % SAP_ptr->num_required_PNDiffs;
+   fTCC = (float)SAP_ptr->param_TrimCodeConstant;
+   half_TCC = (float)SAP_ptr->param_TrimCodeConstant/2;
 
-// Don't enable this -- it is called many times from Device SKE Authentication functions
-#ifdef DEBUG
-printf("\tLFSR seed low %u\tLFSR seed high %u\tRangeConstant %d\tSpreadConstant %u\tThreshold %u\n\n", 
-   SAP_ptr->param_LFSR_seed_low, SAP_ptr->param_LFSR_seed_high, SAP_ptr->param_RangeConstant, SAP_ptr->param_SpreadConstant, 
-   SAP_ptr->param_Threshold); fflush(stdout);
-#endif
+   for ( chip_num = 0; chip_num < SAP_ptr->num_chips; chip_num++ )
+      {
+      PNR = SAP_ptr->PNR[chip_num];
+      PNF = SAP_ptr->PNF[chip_num];
+      candidates[chip_num].chip_num = chip_num;
+
+      cur_mean = 0.0;
+      for ( PND_num = 0; PND_num < num_PNDiffs; PND_num++ )
+         cur_mean += PNR[PND_num] - PNF[PND_num];
+      cur_mean /= (float)num_PNDiffs;
+
+      for ( i = 0, PND_num = 0; i < num_range_samples; i++, PND_num += range_stride )
+         range_sample[i] = PNR[PND_num] - PNF[LFSR_pair_map[PND_num]];
+
+// The second selection only needs the values below the high one.
+      cur_range = SelectKthSmallestFloat(num_range_samples, range_sample, high_k);
+      if ( low_k < high_k )
+         cur_range -= SelectKthSmallestFloat(high_k, range_sample, low_k);
+      else
+         cur_range = 0.0;
+      if ( cur_range <= 0.0 )
+         { candidates[chip_num].sketch_dist = num_sketch_words*64; continue; }
+      range_conv = (float)SAP_ptr->param_RangeConstant/cur_range;
+
+// Predict the raw bits (PNDco sign, see SingleHelpBitGen) with the same SpreadFactor wrap as SRFBatchAddSpreadFactors. A chip's 
+// ScalingConstant does not change the sign, so it is ignored.
+      candidates[chip_num].sketch_dist = 0;
+      for ( word_num = 0; word_num < num_sketch_words; word_num++ )
+         {
+         chip_word = 0;
+         for ( bit_num = 0; bit_num < 64; bit_num++ )
+            {
+            PND_num = sketch_pos[word_num*64 + bit_num];
+            PNDco_val = (PNR[PND_num] - PNF[LFSR_pair_map[PND_num]] - cur_mean)*range_conv - SAP_ptr->fSpreadFactors[PND_num];
 
-   if ( compute_SpreadFactors == 1 )
-      ComputeSendSpreadFactors(max_string_len, SAP_ptr, device_socket_desc, current_function, send_SpreadFactors, compute_PCR_PBD_SF);
+            num_down = ceilf((PNDco_val - half_TCC)/fTCC);
+            num_up = ceilf((-half_TCC - PNDco_val)/fTCC);
+            num_down = num_down > 0.0f ? num_down : 0.0f;
+            num_up = num_up > 0.0f ? num_up : 0.0f;
+            PNDco_val = PNDco_val - num_down*fTCC + num_up*fTCC;
 
-// Sometimes, we just want send the pre-computed SpreadFactors (compute_SpreadFactors == 0).
-   else if ( send_SpreadFactors == 1 )
-      if ( SockSendB((unsigned char *)SAP_ptr->iSpreadFactors, SAP_ptr->num_SF_bytes, device_socket_desc) < 0 )
-         { printf("ERROR: CommonCore(): Send 'PCR SpreadFactors' failed\n"); exit(EXIT_FAILURE); }
+            chip_word |= (uint64_t)(PNDco_val < 0.0f ? 0 : 1) << bit_num;
+            }
+         candidates[chip_num].sketch_dist += PopCount64(chip_word ^ expected_sketch[word_num]);
+         }
+      }
 
-   return;
+   qsort(candidates, SAP_ptr->num_chips, sizeof(DACandidateStruct), DACandidateAscendCompareFunc);
+
+   return num_sketch_words*64;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// A convenience function that calls CommonCore when do_part_A is 1 to generate challenges, collect timing data 
-// from the database and send challenges and exchange nonces with device, and then always does part_B of 
-// CommonCore where consecutative sets of SpreadFactors are generated and sent to the device. NOTE: target_attempts 
-// is FORCED to 0 when 'do_part_A' is 1. The 'return_after_each_set' is used in device authentication to
-// optimize the speed of the database search, where we return and the parent stores the SpreadFactors for each
-// iteration in a larger array for re-use later.
-
-int GenChlngDeliverSpreadFactorsToDevice(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int do_part_A, 
-   int target_attempts, int RANDOM, int device_socket_desc, int *done_ptr, int return_after_each_set, 
-   int compute_PCR_PBD_SF, int restore_store_SF, signed char **SpreadFactors_binary_ptr, int current_function)
+// Scan worker for KEK_DA_SKE_FindMatch. Workers claim chunks of chips from the shared cursor (in prefilter order 
+// when DSS_ptr->candidates is set) and score each chunk as one batch until the cursor reaches num_chips. The 
+// scores of a chunk are merged into the shared top-k list, so no per-chip score array is kept. A scan is never 
+// stopped early on a score: a chip that is not scored yet can still have the smallest CC or a CC between the two 
+// best, which changes the AE PCC decision, and nothing bounds its CC from below except 0. Only the candidate 
+// prefilter in KEK_DA_SKE_FindMatch limits the chips scanned.
+
+void *KEK_DA_SKE_ScanThread(void *arg)
    {
-   int set_threshold_to_zero, do_part_A_part_B_both, compute_SpreadFactors, send_SpreadFactors;
-   char request_str[max_string_len];
-   int i;
-
-   struct timeval t0, t1;
-   long elapsed; 
-
-// When 1, call CommonCore to generate challenges, collect timing data from the database and send challenges to the device 
-// and exchange nonces with the device. DO NOT select parameters or generate/send SpreadFactors -- that is done in the loop below.
-   if ( do_part_A == 1 )
+   DAScanWorkerStruct *DSW_ptr = (DAScanWorkerStruct *)arg;
+   DAScanSharedStruct *DSS_ptr = DSW_ptr->DSS_ptr;
+   int start_chip_num, end_chip_num, batch_num;
+   int num_mismatches_arr[DSS_ptr->chunk_size];
+   int chip_nums[DSS_ptr->chunk_size];
+   AuthenDataStruct batch_ADS[DSS_ptr->chunk_size];
+   AuthenDataStruct *top_ADS = DSS_ptr->top_ADS;
+
+   while ( 1 )
       {
-      set_threshold_to_zero = 0;
-      do_part_A_part_B_both = 0;
 
-// These don't matter when do_part_A_part_B_both is 0.
-      compute_SpreadFactors = 0;
-      send_SpreadFactors = 0;
-      target_attempts = 0;
-      CommonCore(max_string_len, SAP_ptr, device_socket_desc, RANDOM, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, 
-         current_function, compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
-      }
+// Claim the next chunk of chips. The cursor runs past num_chips once all chunks have been handed out.
+      start_chip_num = __atomic_fetch_add(&(DSS_ptr->next_chip_num), DSS_ptr->chunk_size, __ATOMIC_RELAXED);
+      if ( start_chip_num >= DSS_ptr->num_chips )
+         break;
 
-// We need to iterate here calling SelectParams and computing SpreadFactors until device indicates that it has generated enough bits. 
-// Calls CommonCore doing ONLY part B, which selects paramters and computes and sends SpreadFactors.
-   while (1)
-      {
+      end_chip_num = start_chip_num + DSS_ptr->chunk_size;
+      if ( end_chip_num > DSS_ptr->num_chips )
+         end_chip_num = DSS_ptr->num_chips;
 
-// Here we only select parameters, set the LFSR_seed_high and compute and send SpreadFactors. Feed the device with this information until 
-// it indicates it has completed its operation. Do part_B only.
-      set_threshold_to_zero = 0;
-      do_part_A_part_B_both = 1;
+      for ( batch_num = 0; batch_num < end_chip_num - start_chip_num; batch_num++ )
+         if ( DSS_ptr->candidates != NULL )
+            chip_nums[batch_num] = DSS_ptr->candidates[start_chip_num + batch_num].chip_num;
+         else
+            chip_nums[batch_num] = start_chip_num + batch_num;
 
-// We do NOT compute or send ANY SpreadFactors if current function is DA or LL_Enroll and PBD mode is requested.
-      if ( (current_function == FUNC_DA || current_function == FUNC_LL_ENROLL) && SAP_ptr->param_PCR_or_PBD_or_PO == SF_MODE_PBD )
-         {
-         compute_SpreadFactors = 0;
-         send_SpreadFactors = 0;
-         }
-      else
+// Score the chunk in one batch.
+      KEK_DA_SKE_ScoreChipBatch(DSS_ptr->max_string_len, &(DSW_ptr->SAP), DSW_ptr, chip_nums, end_chip_num - start_chip_num, 
+         DSS_ptr->received_XMR_SHD_num_bytes, DSS_ptr->SKE_authen_XMR_SHD, DSS_ptr->authen_SpreadFactors_binary, DSS_ptr->current_function, 
+         DSS_ptr->do_scaling, DSS_ptr->check_all_chips, batch_ADS, num_mismatches_arr);
+
+      pthread_mutex_lock(&(DSS_ptr->top_mutex));
+      for ( batch_num = 0; batch_num < end_chip_num - start_chip_num; batch_num++ )
          {
-         compute_SpreadFactors = 1;
-         send_SpreadFactors = 1;
+         DSS_ptr->num_top_ADS = InsertTopKADS(top_ADS, DSS_ptr->num_top_ADS, DA_SCAN_TOP_K, &(batch_ADS[batch_num]));
+         DSS_ptr->sum_CC += batch_ADS[batch_num].CC;
+         DSS_ptr->num_chips_scored++;
          }
+      pthread_mutex_unlock(&(DSS_ptr->top_mutex));
+      }
 
-// Restore SpreadFactors if incoming *SpreadFactors_binary_ptr is NON-NULL. In this case, we've already computed them previously and
-// want to re-use them.
-      if ( compute_SpreadFactors == 1 && restore_store_SF == 0 && SpreadFactors_binary_ptr != NULL )
-         {
+   return NULL;
+   }
 
-// Be sure to restore the fSpreadFactors since they are used in the AddSpreadFactors software routine.
-         for ( i = 0; i < SAP_ptr->num_SF_words; i++ )
-            {
-            SAP_ptr->iSpreadFactors[i] = (*SpreadFactors_binary_ptr)[target_attempts*SAP_ptr->num_SF_words + i];
-            SAP_ptr->fSpreadFactors[i] = (float)SAP_ptr->iSpreadFactors[i]/(float)SAP_ptr->iSpreadFactorScaler;
-            }
-         compute_SpreadFactors = 0;
-         }
 
-      CommonCore(max_string_len, SAP_ptr, device_socket_desc, RANDOM, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, 
-         current_function, compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
+// ========================================================================================================
+// ========================================================================================================
+// Give a scan worker its own copy of the SAP structure with private SRF scratch buffers, and the chip-major
+// PNDco block for batches of up to max_batch_chips chips. Everything else (PNR/PNF, nonces, scaling constants, 
+// database handles) is shared read-only with the parent SAP.
 
-// Store the SpreadFactors if they are being computed assuming that we'll need them again.
-      if ( compute_SpreadFactors == 1 && restore_store_SF == 1 )
-         {
-         if ( (*SpreadFactors_binary_ptr = (signed char *)realloc(*SpreadFactors_binary_ptr, 
-            ((target_attempts+1) * SAP_ptr->num_SF_words) * sizeof(signed char))) == NULL )
-            { printf("ERROR: GenChlngDeliverSpreadFactorsToDevice(): Failed to allocate storage for SpreadFactors_binary!\n"); exit(EXIT_FAILURE); }
+void AllocateDAScanWorkerSAP(DAScanWorkerStruct *DSW_ptr, SRFAlgoParamsStruct *SAP_ptr, int max_batch_chips)
+   {
+   SRFAlgoParamsStruct *worker_SAP_ptr = &(DSW_ptr->SAP);
+   int num_PNDiffs = SAP_ptr->num_required_PNDiffs;
+
+   memcpy((char *)worker_SAP_ptr, (char *)SAP_ptr, sizeof(SRFAlgoParamsStruct));
+
+   if ( (worker_SAP_ptr->fPND = (float *)calloc(SAP_ptr->num_required_PNDiffs, sizeof(float))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for fPND!\n"); exit(EXIT_FAILURE); }
+   if ( (worker_SAP_ptr->fPNDc = (float *)calloc(SAP_ptr->num_required_PNDiffs, sizeof(float))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for fPNDc!\n"); exit(EXIT_FAILURE); }
+   if ( (worker_SAP_ptr->fPNDco = (float *)calloc(SAP_ptr->num_required_PNDiffs, sizeof(float))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for fPNDco!\n"); exit(EXIT_FAILURE); }
+   if ( (worker_SAP_ptr->fSpreadFactors = (float *)calloc(SAP_ptr->num_SF_words, sizeof(float))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for fSpreadFactors!\n"); exit(EXIT_FAILURE); }
+   if ( (worker_SAP_ptr->iSpreadFactors = (signed char *)calloc(SAP_ptr->num_SF_words, sizeof(signed char))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for iSpreadFactors!\n"); exit(EXIT_FAILURE); }
+   if ( (worker_SAP_ptr->device_SHD = (unsigned char *)calloc(SAP_ptr->num_required_PNDiffs/8, sizeof(unsigned char))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for device_SHD!\n"); exit(EXIT_FAILURE); }
+   if ( (worker_SAP_ptr->device_SBS = (unsigned char *)calloc(SAP_ptr->num_required_PNDiffs/8, sizeof(unsigned char))) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for device_SBS!\n"); exit(EXIT_FAILURE); }
+   worker_SAP_ptr->DA_nonce_reproduced = NULL;
+
+// The PopOnly SF workspace of the parent is not shared. A worker that needs one builds its own, single threaded.
+   worker_SAP_ptr->PopSF_ptr = NULL;
+   worker_SAP_ptr->num_PO_SF_threads = 1;
+
+   DSW_ptr->max_batch_chips = max_batch_chips;
+   if ( (DSW_ptr->PNDc_block = (float *)malloc(sizeof(float) * max_batch_chips * num_PNDiffs)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for PNDc_block!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_ptr->PNDco_block = (float *)malloc(sizeof(float) * max_batch_chips * num_PNDiffs)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for PNDco_block!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_ptr->PNR_gather = (float *)malloc(sizeof(float) * max_batch_chips * num_PNDiffs)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for PNR_gather!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_ptr->PNF_gather = (float *)malloc(sizeof(float) * max_batch_chips * num_PNDiffs)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for PNF_gather!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_ptr->miss_mask = (unsigned char *)malloc(sizeof(unsigned char) * max_batch_chips)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for miss_mask!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_ptr->int_scratch = (int *)malloc(sizeof(int) * num_PNDiffs)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for int_scratch!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_ptr->LFSR_pair_map = (unsigned short *)malloc(sizeof(unsigned short) * num_PNDiffs)) == NULL )
+      { printf("ERROR: AllocateDAScanWorkerSAP(): Failed to allocate storage for LFSR_pair_map!\n"); exit(EXIT_FAILURE); }
 
-         memcpy(&((*SpreadFactors_binary_ptr)[target_attempts*SAP_ptr->num_SF_words]), SAP_ptr->iSpreadFactors, SAP_ptr->num_SF_words);
-//         for ( i = 0; i < SAP_ptr->num_SF_words; i++ )
-//            (*SpreadFactors_binary_ptr)[target_attempts*SAP_ptr->num_SF_words + i] = SAP_ptr->iSpreadFactors[i];
-         }
+   return;
+   }
 
-      target_attempts++;
 
-// Continue to compute and send new SpreadFactors for each increment of the LFSR seed as needed by the device. 
-      if ( SAP_ptr->DEBUG_FLAG == 1 )
-         {
-         printf("\tReceiving more SpreadFactors command\n");
-         gettimeofday(&t0, 0);
-         }
-      if ( SockGetB((unsigned char *)request_str, max_string_len, device_socket_desc) == -1 )
-         { printf("ERROR: GenChlngDeliverSpreadFactorsToDevice(): Receive SpreadFactors request failed!\n"); exit(EXIT_FAILURE); }
-      if ( strcmp(request_str, "SPREAD_FACTORS DONE") == 0 )
-         {
-         *done_ptr = 1;
-         break;
-         }
-      if ( SAP_ptr->DEBUG_FLAG == 1 )
-         { gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t0.tv_sec)*1000000 + t1.tv_usec-t0.tv_usec; printf("\tTOTAL EXEC TIME %ld us\n\n", (long)elapsed); }
+// ========================================================================================================
+// ========================================================================================================
+// Free the private SRF scratch buffers of a scan worker.
 
-      if ( return_after_each_set == 1 )
-         break;
-      }
+void FreeDAScanWorkerSAP(DAScanWorkerStruct *DSW_ptr)
+   {
+   SRFAlgoParamsStruct *worker_SAP_ptr = &(DSW_ptr->SAP);
+
+   free(worker_SAP_ptr->fPND);
+   free(worker_SAP_ptr->fPNDc);
+   free(worker_SAP_ptr->fPNDco);
+   free(worker_SAP_ptr->fSpreadFactors);
+   free(worker_SAP_ptr->iSpreadFactors);
+   free(worker_SAP_ptr->device_SHD);
+   free(worker_SAP_ptr->device_SBS);
+   if ( worker_SAP_ptr->DA_nonce_reproduced != NULL )
+      free(worker_SAP_ptr->DA_nonce_reproduced);
+   worker_SAP_ptr->DA_nonce_reproduced = NULL;
+   FreePopSFWorkspace(worker_SAP_ptr->PopSF_ptr);
+   worker_SAP_ptr->PopSF_ptr = NULL;
+
+   free(DSW_ptr->PNDc_block);
+   free(DSW_ptr->PNDco_block);
+   free(DSW_ptr->PNR_gather);
+   free(DSW_ptr->PNF_gather);
+   free(DSW_ptr->miss_mask);
+   free(DSW_ptr->int_scratch);
+   free(DSW_ptr->LFSR_pair_map);
 
-   return target_attempts;
+   return;
    }
 
 
 // ========================================================================================================
 // ========================================================================================================
-// We MUST save the individual curves to separate files here (unlike ZED analysis) because we keep adding to them as 
-// authentications progress. 
+// Run the scan workers until the shared cursor reaches DSS_ptr->num_chips. Worker 0 runs in this thread while 
+// the others are spawned.
 
-void WriteAuthenPointToFile(int max_string_len, char *outfile_name, int authen_num, char *wfm_header_str, float fval)
+void RunDAScanWorkers(DAScanWorkerStruct *DSW_arr, pthread_t *DSW_threads, int num_workers)
    {
-   FILE *OUTFILE;
+   int worker_num;
 
-   if ( authen_num == 0 && (OUTFILE = fopen(outfile_name, "w")) == NULL )
-      { printf("ERROR: WriteAuthenPointToFile(): Data file '%s' open failed for writing!\n", outfile_name); exit(EXIT_FAILURE); }
-   else if ( authen_num != 0 && (OUTFILE = fopen(outfile_name, "a")) == NULL )
-      { printf("ERROR: WriteAuthenPointToFile(): Data file '%s' open failed for appending!\n", outfile_name); exit(EXIT_FAILURE); }
+   for ( worker_num = 1; worker_num < num_workers; worker_num++ )
+      if ( pthread_create(&(DSW_threads[worker_num]), NULL, KEK_DA_SKE_ScanThread, (void *)&(DSW_arr[worker_num])) != 0 )
+         { printf("ERROR: RunDAScanWorkers(): Failed to create scan thread %d!\n", worker_num); exit(EXIT_FAILURE); }
 
-// We don't know the authenticating chip number here (unlike the ZED TV analysis). We print a message above and will need to make 
-// note in the paper how many, if any, authentications fail.
-   if ( authen_num == 0 )
-      fprintf(OUTFILE, "%s", wfm_header_str);
-   fprintf(OUTFILE, "%d\t%f\n", authen_num, fval);
+   KEK_DA_SKE_ScanThread((void *)&(DSW_arr[0]));
+
+   for ( worker_num = 1; worker_num < num_workers; worker_num++ )
+      pthread_join(DSW_threads[worker_num], NULL);
 
-   fclose(OUTFILE);
- 
    return;
    }
 
@@ -1531,16 +2942,19 @@ void KEK_DA_SKE_FindMatch(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int
    unsigned char *SKE_authen_XMR_SHD, signed char *authen_SpreadFactors_binary, int current_function,
    int do_scaling)
    {
-   int enroll_or_regen, SBS_num_bits, SHD_num_bytes, current_num_strong_bits, do_part_A_part_B_both, set_threshold_to_zero; 
-   unsigned char KEK_authentication_nonce_reproduced[SAP_ptr->num_KEK_authen_nonce_bits/8];
-   int chip_num, target_attempts, num_strong_bits;
-   int bits_remaining, num_minority_bit_flips;
-   unsigned short Threshold;
-   int i, j;
+   int chip_num, check_all_chips; 
+   int num_chips, num_scored_chips;
+   float ave_CC;
 
-   int check_all_chips, num_mismatches, true_minority_bit_flips; 
+// Parallel scan of the chips in the DB.
+   DAScanSharedStruct DSS;
+   DAScanWorkerStruct *DSW_arr = NULL;
+   pthread_t *DSW_threads = NULL;
+   int num_workers, worker_num;
 
-   int num_chips;
+// Candidate prefilter.
+   DACandidateStruct *candidates = NULL;
+   int num_candidates, candidate_chip_num, decision_chip_num, auth_rank;
 
 // FIX ME -- should be 0.
    static int authen_num = 0;
@@ -1559,8 +2973,9 @@ void KEK_DA_SKE_FindMatch(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int
 //   strcpy(KEK_SHD_base_dir, "../ANALYSIS/PROTOCOL_V3.0_TDC/KEK_Authentication_SHD_INDIVID");
 
 // There are 4 basic components of information for SKE (only two for FSB). The number of strong bits (NSB), the number of mismatches (NMM),
-// the number of minority bit flips (NMBF) and the number of true minority bit flis (NTBF).
-   AuthenDataStruct *ADS = NULL;
+// the number of minority bit flips (NMBF) and the number of true minority bit flis (NTBF). ONLY the DA_SCAN_TOP_K chips with the 
+// smallest CC are kept, in ascending order.
+   AuthenDataStruct ADS[DA_SCAN_TOP_K];
 
    num_chips = SAP_ptr->num_chips;
 
@@ -1568,13 +2983,10 @@ void KEK_DA_SKE_FindMatch(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int
    if ( num_chips < 4 )
       { printf("ERROR: KEK_DA_SKE_FindMatch(): Must have at least 4 chips in the DB => %d!\n", num_chips); exit(EXIT_FAILURE); }
 
-   if ( (ADS = (AuthenDataStruct *)calloc(num_chips, sizeof(AuthenDataStruct))) == NULL )
-      { printf("ERROR: KEK_DA_SKE_FindMatch(): Failed to allocate ADS!\n"); exit(EXIT_FAILURE); }
-
 // Set this to 1 to do all comparisons, which is more robust authentication method but takes longer. If set to 0, then we break out of the
-// inner loop that searches chunks of the KEK_authentication_nonce_reproduced bitstring, AND we select the first chip that has 0 mismatches
-// and has num_minority_bit_flips less than a threshold, e.g. 15. This makes this routine twice as fast because we only need to look at half 
-// the chips in the DB on average. If we are saving PARCE file stats, force this routine to check all chips.
+// inner loop that searches chunks of the KEK_authentication_nonce_reproduced bitstring at the first mismatch. The search does not stop at 
+// the first chip that has 0 mismatches and a CC below CC_SKE_AUTHEN_THRESHOLD, since a chip that is not scored yet can still change the 
+// AE PCC decision. Only the candidate prefilter below skips chips. If we are saving PARCE file stats, force this routine to check all chips.
    check_all_chips = 1;
    if ( SAP_ptr->do_save_PARCE_COBRA_file_stats == 1 )
       check_all_chips = 1;
@@ -1601,280 +3013,117 @@ PrintHeaderAndHexVals("ORIGINAL AUTHENTICATION NONCE:\n", SAP_ptr->num_KEK_authe
 
 // =================================================================================================================================
 // =================================================================================================================================
+// Parallel chip search. Each worker scores chips (KEK_DA_SKE_ScoreChipBatch) on a private copy of the SAP structure, claiming them in 
+// chunks of DA_SCAN_CHUNK_SIZE from a shared cursor so faster workers pick up the slack. Each chunk is scored as one batch and merged into 
+// the shared top-k list (DSS.top_ADS) as the scan runs.
    int num_pos_vals = 0;
    int num_neg_vals = 0;
    int num_zero_vals = 0;
-   int PND_num_inspect = 0;
-
-   int PND_num; 
 
-   enroll_or_regen = 1;
-   for ( chip_num = 0; chip_num < num_chips; chip_num++ )
+   num_workers = SAP_ptr->num_DA_scan_threads;
+   if ( num_workers < 1 )
+      num_workers = 1;
+   if ( num_workers > num_chips )
+      num_workers = num_chips;
+
+   DSS.max_string_len = max_string_len;
+   DSS.received_XMR_SHD_num_bytes = received_XMR_SHD_num_bytes;
+   DSS.SKE_authen_XMR_SHD = SKE_authen_XMR_SHD;
+   DSS.authen_SpreadFactors_binary = authen_SpreadFactors_binary;
+   DSS.current_function = current_function;
+   DSS.do_scaling = do_scaling;
+   DSS.check_all_chips = check_all_chips;
+   DSS.num_chips = num_chips;
+   DSS.candidates = NULL;
+   DSS.chunk_size = DA_SCAN_CHUNK_SIZE;
+   DSS.next_chip_num = 0;
+   pthread_mutex_init(&(DSS.top_mutex), NULL);
+   DSS.num_top_ADS = 0;
+   DSS.sum_CC = 0.0;
+   DSS.num_chips_scored = 0;
+
+   if ( (DSW_arr = (DAScanWorkerStruct *)calloc(num_workers, sizeof(DAScanWorkerStruct))) == NULL )
+      { printf("ERROR: KEK_DA_SKE_FindMatch(): Failed to allocate DSW_arr!\n"); exit(EXIT_FAILURE); }
+   if ( (DSW_threads = (pthread_t *)malloc(sizeof(pthread_t) * num_workers)) == NULL )
+      { printf("ERROR: KEK_DA_SKE_FindMatch(): Failed to allocate DSW_threads!\n"); exit(EXIT_FAILURE); }
+
+   for ( worker_num = 0; worker_num < num_workers; worker_num++ )
       {
+      DSW_arr[worker_num].worker_num = worker_num;
+      DSW_arr[worker_num].DSS_ptr = &DSS;
+      AllocateDAScanWorkerSAP(&(DSW_arr[worker_num]), SAP_ptr, DA_SCAN_CHUNK_SIZE);
+      }
 
-// Run the SRF engine and compute the fPNDco for this chip. 
-      SAP_ptr->chip_num = chip_num;
+// Candidate prefilter. Rank the chips by their sketch distance to the device's helper data (KEK_DA_SKE_RankCandidates) and score only 
+// the num_candidates best. The remaining chips are skipped ONLY when the best candidate is a clear match, i.e., the AE PCC test below 
+// passes on the candidates, so its CC is well separated from every other candidate's. An unscored chip ranked further from the helper 
+// data could in principle still have a smaller CC, which is the approximation the prefilter makes. Otherwise the remaining chips are 
+// scored in prefilter order and merged into the same top-k list, which is the full scan.
+   num_candidates = SAP_ptr->num_DA_prefilter_candidates;
+   if ( num_candidates > 0 && num_candidates < DA_SCAN_TOP_K )
+      num_candidates = DA_SCAN_TOP_K;
+   if ( num_candidates > 0 && num_candidates < num_chips && SAP_ptr->do_save_PARCE_COBRA_file_stats == 0 )
+      {
+      if ( (candidates = (DACandidateStruct *)malloc(sizeof(DACandidateStruct) * num_chips)) == NULL )
+         { printf("ERROR: KEK_DA_SKE_FindMatch(): Failed to allocate candidates!\n"); exit(EXIT_FAILURE); }
+      if ( KEK_DA_SKE_RankCandidates(max_string_len, &(DSW_arr[0]), SKE_authen_XMR_SHD, authen_SpreadFactors_binary, current_function, 
+         candidates) == 0 )
+         { free(candidates); candidates = NULL; }
+      }
+   if ( candidates != NULL )
+      {
+      DSS.candidates = candidates;
+      DSS.num_chips = num_candidates;
+      }
 
-// Sanity check.
-      if ( do_scaling == 1 && SAP_ptr->ChipScalingConstantNotifiedArr[SAP_ptr->chip_num] == 1 && SAP_ptr->ChipScalingConstantArr[SAP_ptr->chip_num] == 0.0 )
-         { printf("ERROR: KEK_DA_SKE_FindMatch(): ChipScalingConstantNotifiedArr[x] is 1 but ChipScalingConstantArr[x] value is 0.0"); exit(EXIT_FAILURE); }
+// With one worker, run the scan in this thread. Otherwise worker 0 also runs in this thread while the others are spawned.
+   RunDAScanWorkers(DSW_arr, DSW_threads, num_workers);
 
-#ifdef DEBUG3
-printf("KEK_DA_SKE_FindMatch(): Checking chip %d\n", SAP_ptr->chip_num); fflush(stdout);
-#endif
-      ADS[chip_num].index = chip_num;
-      ADS[chip_num].NSB = 0;
-      ADS[chip_num].NMM = 0.0;
-      ADS[chip_num].NMBF = 0.0;
-      ADS[chip_num].NTBF = 0.0;
-      ADS[chip_num].CC = 0.0;
+// Prune if a candidate authenticates, otherwise fall back to scanning the remaining chips.
+   candidate_chip_num = -1;
+   if ( candidates != NULL )
+      {
+      if ( DSS.num_top_ADS >= 2 && ComputeTopKAEPCC(DSS.top_ADS) > PCC_SKE_AUTHEN_THRESHOLD )
+         candidate_chip_num = DSS.top_ADS[0].index;
 
-// ASSUME that the timing vals (PNR and PNF) have already been allocated and stored in the SAP fields based on a challenge 
-// and the XOR_nonce has been set with the first call to CommonCore with do_part_A_part_B_both set to 0. Since multiple
-// calls to CommonCore have been made to give updated SpreadFactors to the device for each iteration, we must call CommonCore 
-// here with do_part_A_part_B_both set to 1, which will select parameters and set the LFSR_seed_high according to the number
-// of target_attempts. 
-      current_num_strong_bits = 0;
-      num_mismatches = 0;
-      num_minority_bit_flips = 0;
-      true_minority_bit_flips = 0;
-      bits_remaining = SAP_ptr->num_KEK_authen_nonce_bits;
-
-// Assume multiple iterations of KEK were needed to generate enough SKE_authen_XMR_SHD helper data to encode the entire nonce.
-      target_attempts = 0;
-      while ( current_num_strong_bits < SAP_ptr->num_KEK_authen_nonce_bits )
+      if ( candidate_chip_num == -1 )
          {
-
-// Call CommonCore to reset the parameters (LFSR_seed_high) based on XOR_nonce and target_attempts. Do not compute or send SpreadFactors.
-         int compute_SpreadFactors = 0;
-         int send_SpreadFactors = 0;
-
-// Do NOT compute PCR (or PBD) SF (which is irrelevant because compute_SpreadFactors is 0).
-         int compute_PCR_PBD_SF = 0;
-
-         do_part_A_part_B_both = 1;
-
-         set_threshold_to_zero = 0;
-         CommonCore(max_string_len, SAP_ptr, 0, 0, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
-            compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
-
-// Use SpreadFactors already collected by parent. 
-         for ( i = 0, j = target_attempts * SAP_ptr->num_SF_words; i < SAP_ptr->num_SF_words; i++, j++ )
-            {
-            SAP_ptr->iSpreadFactors[i] = authen_SpreadFactors_binary[j];
-
-// Note: iSpreadFactorScaler is either 2 (or 1), depending on the TRIMCODE_CONSTANT (if <= 32, it is 2, else 1).
-            SAP_ptr->fSpreadFactors[i] = (float)authen_SpreadFactors_binary[j]/(float)SAP_ptr->iSpreadFactorScaler;
-            }
-
-// SAME server-generated SF is used for EVERY chip (NOTE THESE are (signed char)). Validated this with SHD on chip.
-#ifdef DEBUG3
-//PrintHeaderAndHexVals("SERVER: SF:\n", SAP_ptr->num_SF_words, (unsigned char *)SAP_ptr->iSpreadFactors, 32);
-#endif
-
-
-// Do SRF Engine operations in software. Note, SF are signed char now and are computed to move PNDco (using PNDc) to the nearest lower multiple
-// of TrimCodeConstant. AddSpreadFactors in this routine will remove the DC bias by repeatedly adding (if PNDco is negative) or subtracting
-// (if PNDco is positve) TrimCodeConstant while the PNDco is < -TrimCodeConstant/2 or > TrimCodeConstant/2.
-         DoSRFComp(max_string_len, SAP_ptr, (target_attempts == 0));
-
-// 10_23_2022: Newest (correct) version which uses ScalingConstants.
-         if ( do_scaling == 1 && SAP_ptr->ChipScalingConstantNotifiedArr[SAP_ptr->chip_num] == 1 )
-            {
-            for ( PND_num = 0; PND_num < SAP_ptr->num_required_PNDiffs; PND_num++ )
-               {
-
-#ifdef DEBUG3
-float temp = (float)((int)(SAP_ptr->fPNDco[PND_num] * SAP_ptr->ChipScalingConstantArr[SAP_ptr->chip_num] * 16.0))/16.0;
-if ( SAP_ptr->chip_num >= 4 && SAP_ptr->chip_num < 8 && target_attempts == 0 && PND_num < 50 )
-   printf("Chip %3d\tScaling Constant %f\tDevice SHD bit [%d] %d\tOrig fPNDco %f\tScaled fPNDco %f\tBit val %d\n", 
-      SAP_ptr->chip_num, SAP_ptr->ChipScalingConstantArr[SAP_ptr->chip_num], 
-      PND_num, GetBitFromByte((SKE_authen_XMR_SHD + target_attempts*SAP_ptr->num_required_PNDiffs/8)[PND_num/8], PND_num % 8),
-      SAP_ptr->fPNDco[PND_num], temp, (int)(temp >= 0));
-fflush(stdout);
-#endif
-               SAP_ptr->fPNDco[PND_num] = (float)((int)(SAP_ptr->fPNDco[PND_num] * SAP_ptr->ChipScalingConstantArr[SAP_ptr->chip_num] * 16.0))/16.0;
-               }
-
-#ifdef DEBUG3
-printf("Chip %3d\tScaled fPNDco with ScalingConstant %f\n", SAP_ptr->chip_num, SAP_ptr->ChipScalingConstantArr[SAP_ptr->chip_num]); fflush(stdout);
-#endif
-            }
-
-// The KEK_FSB_SKE() routine in common.c wants the raw bitstring (computed with Threshold set to 0). Run the SingleHelpBitGen algorithm with the 
-// Threshold set to 0.
-         Threshold = 0;
-         SBS_num_bits = SingleHelpBitGen(SAP_ptr->num_required_PNDiffs, SAP_ptr->fPNDco, SAP_ptr->device_SBS, SAP_ptr->device_SHD, 
-            &SHD_num_bytes, Threshold);
-
-// Sanity check. With Threshold set to 0, the number of strong bits is the same size as the SHD.
-         if ( SBS_num_bits != SAP_ptr->num_required_PNDiffs )
-            { 
-            printf("ERROR: KEK_DA_SKE_FindMatch(): Number of bits in raw bitstring must be %d -- found %d!\n", 
-               SAP_ptr->num_required_PNDiffs, SBS_num_bits); 
-            exit(EXIT_FAILURE); 
-            }
-
-// Sanity check. The number of iterations here should NEVER exceed what the device did to generate the received_XMR_SHD_num_bytes.
-         if ( target_attempts*SAP_ptr->num_required_PNDiffs/8 >= received_XMR_SHD_num_bytes )
-            { printf("ERROR: KEK_DA_SKE_FindMatch(): server target attempts exceed size of SKE_authen_XMR_SHD!\n"); exit(EXIT_FAILURE); }
-
-// SAME device-generated SHD (helper data) is used for EVERY chip. Validated this with SHD on chip.
-#ifdef DEBUG3
-//PrintHeaderAndHexVals("SERVER: XMR_SHD_chunk:\n", SAP_ptr->num_required_PNDiffs/8, (unsigned char *)(SKE_authen_XMR_SHD + target_attempts*SAP_ptr->num_required_PNDiffs/8), 32);
-#endif
-
-// The PRODUCT of KEK_FSB_SKE() during regeneration mode is KEK_authentication_nonce_reproduced, which uses the XMR SHD helper data generated 
-// during enrollment and the raw bitstring device_SBS. Each iteration generates a portion of the KEK_authentication_nonce. It returns a portion of 
-// KEK_authentication_nonce_reproduced that was generated. Note that 'bits_remaining' during regeneration is used to exit the loop early when the
-// number of bits produced reaches the max (same thing that happens during enrollment when we are encoding KEK_authentication_nonce). 
-//
-// We record some statistics to help make the chip selection process robust. In cases where there are NO disagreements between the actual nonce
-// and the regenerated nonce, then num_minority_bit_flips counts the number of bits in the XMR scheme that disagree with the majority vote.
-// Also when num_mismatches is zero (computed below and also in this routine) then num_minority_bit_flips == true_minority_bit_flips. When num_mismatches 
-// is > 0 (some majority vote bits disagree with the true nonce), then true_minority_bit_flips needs to be used to determine how many bits disgree with 
-// an XMR encoded version of the true nonce. In either case, num_minority_bit_flips and true_minority_bit_flips count the number of bits that mismatch 
-// and should be used in the statistics to show distinguishability.
-         int do_mismatch_count = 1;
-         int FSB_or_SKE = 1;
-         num_strong_bits = KEK_FSB_SKE(SAP_ptr->num_required_PNDiffs, SAP_ptr->XMR_val, 
-            SKE_authen_XMR_SHD + target_attempts*SAP_ptr->num_required_PNDiffs/8, SAP_ptr->device_SBS, NULL, bits_remaining, 
-            KEK_authentication_nonce_reproduced, enroll_or_regen, do_mismatch_count, &num_minority_bit_flips, current_num_strong_bits, 
-            SAP_ptr->KEK_authentication_nonce, &true_minority_bit_flips, FSB_or_SKE, chip_num, 0);
-         bits_remaining -= num_strong_bits;
-
-
-if ( target_attempts == 0 )
-   {
-   if ( SAP_ptr->fPNDco[PND_num_inspect] > 0.0 )
-      num_pos_vals++;
-   if ( SAP_ptr->fPNDco[PND_num_inspect] < 0.0 )
-      num_neg_vals++;
-   if ( SAP_ptr->fPNDco[PND_num_inspect] == 0.0 )
-      num_zero_vals++;
-#ifdef DEBUG3
-   printf("fSpreadFactor[%d] %8.4f\tiSpreadFactor[%d] %3d\n", PND_num_inspect, SAP_ptr->fSpreadFactors[PND_num_inspect], PND_num_inspect, SAP_ptr->iSpreadFactors[PND_num_inspect]); fflush(stdout);
-#endif
-   }
-
-
-#ifdef DEBUG3
-if ( chip_num == 0 )
-printf("\tCHIP x: Target attempts %d for chip %d number of strong bits to match %d\n", target_attempts, SAP_ptr->chip_num, num_strong_bits); 
-fflush(stdout);
-#endif
-
-#ifdef DEBUG3
-PrintHeaderAndHexVals("ORIGINAL AUTHENTICATION NONCE:\n", SAP_ptr->num_KEK_authen_nonce_bits/8, (unsigned char *)SAP_ptr->KEK_authentication_nonce, 32);
-#endif
-
-// Count the number of mismatches. Do NOT try to match bits beyond the last KEK_authentication_nonce bit.
-         for ( i = current_num_strong_bits, j = 0; i < current_num_strong_bits + num_strong_bits && i < SAP_ptr->num_KEK_authen_nonce_bits; i++, j++ )
-            if ( GetBitFromByte(KEK_authentication_nonce_reproduced[j/8], j % 8) != GetBitFromByte(SAP_ptr->KEK_authentication_nonce[i/8], i % 8) )
-               {
-
-#ifdef DEBUG3
-//if ( chip_num == 0 )
-printf("\tMISMATCH for chip %d on bit %d\n", SAP_ptr->chip_num, i); 
-fflush(stdout);
-#endif
-
-// ***** NOTE: THE DEVICE IS STILL COMPUTING PCR AND COMPUTING XMR_SHD USING PCR OFFSETS EVEN THOUGH WE ARE USING POPULATION ONLY HERE ON THE 
-// SERVER -- WE WILL NOT BE ABLE TO GET 0 MISMATCHES BECAUSE OF THIS. I would need to disable disable PCR mode on the device by making 
-// some changes, e.g., do NOT invoke the DA authentication function in the hardware.
-               num_mismatches++;
-               if ( check_all_chips == 0 )
-                  break;
-               }
-
-// DEBUG ONLY, BUT NEED TO KEEP TRACK of how many KEK_authentication_nonce bit have been reproduced (current_num_strong_bits). 
-         current_num_strong_bits = JoinBytePackedBitStrings(current_num_strong_bits, &(SAP_ptr->DA_nonce_reproduced), num_strong_bits, 
-            KEK_authentication_nonce_reproduced);
-
-// Keep updating these on multiple iterations.
-         ADS[chip_num].NSB = current_num_strong_bits;
-         ADS[chip_num].NMM = (float)num_mismatches;
-         ADS[chip_num].NMBF += (float)num_minority_bit_flips;
-         ADS[chip_num].NTBF += (float)true_minority_bit_flips;
-
-         if ( num_strong_bits == 0 )
-            { printf("ERROR: Chip %d\tNumber of strong bits is 0!\n", chip_num); exit(EXIT_FAILURE); }
-
-// Compute the CC. Smaller is better here, where NMM and NTBF are both zero is the best achievable.
-// Note that true_minority_bit_flips INCORPORATES the number of mismatches so we do NOT need add them to the numerator here. It is identical
-// to num_minority_bit_flips when there are NO mismatches but when there is a mismatch(es), then the complement of the minority is added in.
-//         CC[chip_num] = ADS[chip_num].NTBF/(float)ADS[chip_num].NSB*100.0;
-         ADS[chip_num].CC = ADS[chip_num].NTBF + ADS[chip_num].NMM;
-
-// If we exit the bit-check loop early, a bit was found that mismatched. Here we break again from the 'chunk' loop. Note, if multiple 
-// iterations are used (very likely), then we can also exit the above loop when we process the last of the KEK_authentication_nonce bits 
-// (and find a match). This represents an authentication success so DO NOT EXECUTE this break under those conditions.
-         if ( j < num_strong_bits && i != SAP_ptr->num_KEK_authen_nonce_bits )
-            if ( check_all_chips == 0 )
-               break;
-
-// Set number of bits matched to max size when we processed all bits in the authentication nonce. Not sure if this is needed now???
-         if ( i == SAP_ptr->num_KEK_authen_nonce_bits )
-            current_num_strong_bits = SAP_ptr->num_KEK_authen_nonce_bits;
-
-#ifdef DEBUG3
-if ( num_mismatches == 0 )
-   printf("\tMATCHED on iteration %2d for chip %3d\tTotal bits matched %5d\tWith bits remaining %4d\tCummulative number matching %5d\tCummulative minority bit flips %4d\n", 
-      target_attempts, SAP_ptr->chip_num, num_strong_bits, bits_remaining, current_num_strong_bits, num_minority_bit_flips); 
-fflush(stdout);
-#endif
-
-         target_attempts++;
+         DSS.next_chip_num = num_candidates;
+         DSS.num_chips = num_chips;
+         RunDAScanWorkers(DSW_arr, DSW_threads, num_workers);
          }
+      }
 
-#ifdef DEBUG3
-if ( chip_num < 4 )
-PrintHeaderAndHexVals("Nonce Reproduced:\n", current_num_strong_bits/8, (unsigned char *)SAP_ptr->DA_nonce_reproduced, 32);
-#endif
-
-// Free the DA_nonce_reproduced if it was allocated. The DA_nonce_reproduced is NOT USED by this routine. DEBUG ONLY.
-      if ( SAP_ptr->DA_nonce_reproduced != NULL )
-         free(SAP_ptr->DA_nonce_reproduced);
-      SAP_ptr->DA_nonce_reproduced = NULL;
-
-#ifdef DEBUG3
-if ( num_mismatches == 0 )
-   printf("\tMATCHED***\tAuthen num %d\tFor chip %3d\tTotal bits mismatched %5d\tFrom total bits compared %5d\tWith bits remaining %4d\tTotal minority bit flips %d\n",
-      authen_num, SAP_ptr->chip_num, num_mismatches, current_num_strong_bits, bits_remaining, num_minority_bit_flips); 
-else
-   {
-   printf("\t\tMISMATCHED\tAuthen num %d\tFor chip %3d\tTotal bits mismatched %5d\tFrom total bits compared %5d\tWith bits remaining %4d\tTotal minority bit flips %d\t",
-      authen_num, SAP_ptr->chip_num, num_mismatches, current_num_strong_bits, bits_remaining, num_minority_bit_flips); 
+// The SRF parameters do NOT depend on the chip (only on XOR_nonce and target_attempts). Return those of worker 0 to the parent SAP
+// since they are used in the stats file names below.
+   SAP_ptr->param_LFSR_seed_low = DSW_arr[0].SAP.param_LFSR_seed_low;
+   SAP_ptr->param_LFSR_seed_high = DSW_arr[0].SAP.param_LFSR_seed_high;
+   SAP_ptr->param_RangeConstant = DSW_arr[0].SAP.param_RangeConstant;
+   SAP_ptr->param_SpreadConstant = DSW_arr[0].SAP.param_SpreadConstant;
+   SAP_ptr->param_Threshold = DSW_arr[0].SAP.param_Threshold;
+   SAP_ptr->param_TrimCodeConstant = DSW_arr[0].SAP.param_TrimCodeConstant;
 
-// If we are NOT doing all comparisons, then this fraction is meaningless since we exit on the first mismatch above. In which case, don't print it.
-   if ( check_all_chips == 1 )
+   for ( worker_num = 0; worker_num < num_workers; worker_num++ )
       {
-      printf("Fraction %5.2f\t", (float)num_mismatches/(float)current_num_strong_bits*100);
-
-// Flag those less than 10% different.
-      if ( (float)num_mismatches/(float)current_num_strong_bits*100 < 10.0 )
-         printf("*\n");
-      else
-         printf("\n");
+      num_pos_vals += DSW_arr[worker_num].num_pos_vals;
+      num_neg_vals += DSW_arr[worker_num].num_neg_vals;
+      num_zero_vals += DSW_arr[worker_num].num_zero_vals;
+      FreeDAScanWorkerSAP(&(DSW_arr[worker_num]));
       }
-   else
-      printf("\n");
-   fflush(stdout);
-   }
-#endif
+   free(DSW_arr);
+   free(DSW_threads);
 
-// Handle case with no mismatches! Break out of the chip search loop early IF check_all_chips is 0.
-      if ( num_mismatches == 0 )
-         {
+   pthread_mutex_destroy(&(DSS.top_mutex));
+   num_scored_chips = DSS.num_chips_scored;
+   memcpy(ADS, DSS.top_ADS, sizeof(AuthenDataStruct) * DA_SCAN_TOP_K);
+   ave_CC = (float)(DSS.sum_CC/num_scored_chips);
 
-// When we select the first chip that has a CC less than the threshold, then this routine is fast because we only need to look at half the 
-// chips in the DB on average.
-         if ( check_all_chips == 0 && ADS[chip_num].CC <= CC_SKE_AUTHEN_THRESHOLD )
-            break;
-         }
-      }
+// Sanity check
+   if ( num_scored_chips < 4 )
+      { printf("ERROR: KEK_DA_SKE_FindMatch(): Must score at least 4 chips => %d!\n", num_scored_chips); exit(EXIT_FAILURE); }
 
 #ifdef DEBUG
+int PND_num_inspect = 0;
 printf("BALANCE: PND_num %4d\tnum_pos_vals %4d\tnum_neg_vals %4d\tnum_zero_vals %4d\n", PND_num_inspect, num_pos_vals, num_neg_vals, num_zero_vals); fflush(stdout); 
 #endif
 
@@ -1885,11 +3134,9 @@ printf("BALANCE: PND_num %4d\tnum_pos_vals %4d\tnum_neg_vals %4d\tnum_zero_vals
 
 // ==============================================
 // ==============================================
-// Compute stats. First sort on CC in ascending order. We want the SMALLEST at the top of the list.
-   qsort(ADS, num_chips, sizeof(AuthenDataStruct), ADS_CC_AscendCompareFunc); 
-
+// Compute stats. The top-k list is already in ascending CC order. We want the SMALLEST at the top of the list.
 #ifdef DEBUG3
-for ( chip_num = 0; chip_num < num_chips; chip_num++ )
+for ( chip_num = 0; chip_num < DA_SCAN_TOP_K; chip_num++ )
    printf("Cnter %3d\tChip %3d\tCC %.0f\n", chip_num, ADS[chip_num].index, ADS[chip_num].CC);
 #endif
 
@@ -2012,6 +3259,21 @@ fflush(stdout);
    if ( SAP_ptr->chip_num == -1 )
       { printf("\tFAILED AUTHENTICATION!\n"); fflush(stdout); }
 
+// Record whether the search was pruned, and where the accepted chip was ranked by the prefilter (the recall counters). This uses the 
+// AE PCC decision itself, not the TESTING ONLY my_chip_num check.
+   if ( candidates != NULL )
+      {
+      decision_chip_num = -1;
+      if ( AE_PCC > PCC_SKE_AUTHEN_THRESHOLD )
+         decision_chip_num = ADS[0].index;
+
+      auth_rank = -1;
+      if ( decision_chip_num != -1 )
+         for ( auth_rank = 0; candidates[auth_rank].chip_num != decision_chip_num; auth_rank++ );
+      RecordDAPrefilterSearch(SAP_ptr->DA_prefilter_stats, num_candidates, candidate_chip_num != -1, auth_rank);
+      free(candidates);
+      }
+
 // ==============================================
 // ==============================================
 // Save stats to file if requested.
@@ -2045,10 +3307,6 @@ if ( 0 )
       WriteAuthenPointToFile(max_string_len, outfile_name, authen_num, wfm_header_str, ADS[2].CC);
 
 // The fourth file gives the average CC. 
-      float ave_CC = 0.0; 
-      for ( chip_num = 0; chip_num < num_chips; chip_num++ )
-         ave_CC += ADS[chip_num].CC;
-      ave_CC /= num_chips;
 
       sprintf(outfile_name, "%s/KEK_SKE_RC_%d_SF_%d_TH_%d_XMR_%d_ave_CC.xy", KEK_Authen_base_dir, 
          SAP_ptr->param_RangeConstant, SAP_ptr->param_SpreadConstant, SAP_ptr->param_Threshold, SAP_ptr->XMR_val); 
@@ -2121,13 +3379,16 @@ if ( 0 )
       }
 
 
+PrintPNDcCacheStats(SAP_ptr->PNDc_cache);
+if ( SAP_ptr->num_DA_prefilter_candidates > 0 )
+   PrintDAPrefilterStats(SAP_ptr->DA_prefilter_stats);
+#ifdef DEBUG
+#endif
+
 #ifdef DEBUG
 printf("\tKEK_DA_SKE_FindMatch(): DONE -- chip_num identified %d\n", SAP_ptr->chip_num); fflush(stdout);
 #endif
 
-   if ( ADS != NULL )
-      free(ADS);
-   ADS = NULL;
 
    authen_num++; 
 
@@ -2148,8 +3409,7 @@ printf("\tKEK_DA_SKE_FindMatch(): DONE -- chip_num identified %d\n", SAP_ptr->ch
 // for PCR, I had this working with device-generated PCR and then using the PopOnly SF here but that's not
 // working now.
 
-void KEK_DeviceAuthentication_SKE(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, 
-   int RANDOM)
+void KEK_DeviceAuthentication_SKE(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc)
    {
    char request_str[max_string_len];
    int target_attempts;
@@ -2204,8 +3464,7 @@ void KEK_DeviceAuthentication_SKE(int max_string_len, SRFAlgoParamsStruct *SAP_p
    SAP_ptr->DA_nonce_reproduced = NULL;
 
 // Generate and send the device the KEK_authentication_nonce.
-   if ( read(RANDOM, SAP_ptr->KEK_authentication_nonce, SAP_ptr->num_KEK_authen_nonce_bits/8) == -1 )
-      { printf("ERROR: KEK_DeviceAuthentication_SKE(): Read /dev/urandom failed!\n"); exit(EXIT_FAILURE); }
+   GetRandomBytes(SAP_ptr->KEK_authentication_nonce, SAP_ptr->num_KEK_authen_nonce_bits/8);
 
 // 12_2_20220: Original version sends the KEK_authentication_nonce in plain form to the device.
 //   if ( do_two_way_encryption == 0 )
@@ -2254,7 +3513,7 @@ void KEK_DeviceAuthentication_SKE(int max_string_len, SRFAlgoParamsStruct *SAP_p
 // see below (which we don't do any longer). This is NOT necessary any longer. 
       int return_after_each_set = 1;
 
-      target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, RANDOM, device_socket_desc, 
+      target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, device_socket_desc, 
          &done, return_after_each_set, compute_PCR_PBD_SF, restore_store_SF, NULL, current_function);
 
 // Do NOT do part A on subsequent calls.
@@ -2377,8 +3636,7 @@ printf("KEK_DeviceAuthentication_SKE(): Getting SKE_authen_XMR_SHD %d bytes from
 // ========================================================================================================
 // Device authenticates verifier
 
-int KEK_VerifierAuthentication(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, 
-   int RANDOM)
+int KEK_VerifierAuthentication(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc)
    {
    int set_threshold_to_zero, target_attempts, do_part_A_part_B_both;
 
@@ -2442,7 +3700,7 @@ int KEK_VerifierAuthentication(int max_string_len, SRFAlgoParamsStruct *SAP_ptr,
    int compute_PCR_PBD_SF = 0;
 
    target_attempts = 0;
-   CommonCore(max_string_len, SAP_ptr, device_socket_desc, RANDOM, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
+   CommonCore(max_string_len, SAP_ptr, device_socket_desc, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
       compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
 
 // Get KEK_authentication nonce from device. NOTE: We must wait for the CollectPNs to finish generating the random nonce bytes before receiving these.
@@ -2488,7 +3746,7 @@ printf("KEK_VerifierAuthentication(): Starting iteration %d!\n", target_attempts
       else
          compute_PCR_PBD_SF = 0;
 
-      CommonCore(max_string_len, SAP_ptr, device_socket_desc, RANDOM, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
+      CommonCore(max_string_len, SAP_ptr, device_socket_desc, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
          compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
 
 // 1_1_2022: BUG: Forgot to do this here when mode is PopOnly! Since we do NOT run the PCR part of ComputePxxSpreadFactors(), we do NOT run DoSRFComp
@@ -2567,13 +3825,15 @@ printf("KEK_VerifierAuthentication(): Sending %d XMR_SHD_num_bytes to device\n",
 #endif
 
 // ------------------------------------------------------------------
-// Send device the KEK_authen_XMR_SHD. Send the size first so the device can allocate storage.
+// Send device the KEK_authen_XMR_SHD. Send the size first so the device can allocate storage. Corked so both go out together.
    sprintf(current_XMR_SHD_num_bytes_str, "%d", current_XMR_SHD_num_bytes);
+   SockCork(device_socket_desc, 1);
    if ( SockSendB((unsigned char *)current_XMR_SHD_num_bytes_str, strlen(current_XMR_SHD_num_bytes_str) + 1, device_socket_desc) < 0 )
       { printf("ERROR: KEK_VerifierAuthentication(): Send 'current_XMR_SHD_num_bytes_str' failed\n"); exit(EXIT_FAILURE); }
 
    if ( SockSendB(KEK_authen_XMR_SHD, current_XMR_SHD_num_bytes, device_socket_desc) < 0 )
       { printf("ERROR: KEK_VerifierAuthentication(): Send KEK_authen_XMR_SHD failed\n"); exit(EXIT_FAILURE); }
+   SockCork(device_socket_desc, 0);
 
 // Save design information and the XMR_SHD to the RunTime database if user requests it.
    if ( SAP_ptr->do_save_bitstrings_to_RT_DB == 1 )
@@ -2598,7 +3858,7 @@ printf("KEK_VerifierAuthentication(): Sending %d XMR_SHD_num_bytes to device\n",
    target_attempts = 0;
    int done;
    int return_after_each_set = 0;
-   target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, RANDOM, device_socket_desc, &done, 
+   target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, device_socket_desc, &done, 
       return_after_each_set, compute_PCR_PBD_SF, restore_store_SF, &SpreadFactors_binary, current_function);
 
 // Sanity check
@@ -2651,7 +3911,7 @@ printf("KEK_VerifierAuthentication(): Sending %d XMR_SHD_num_bytes to device\n",
 // version of the FSB version of KEK to reproduce the key. NOTE: On the device, there is no KEK_SessionKeyGen() 
 // routine because we just reuse KEK_Enroll with a flag.
 
-int KEK_SessionKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, int RANDOM)
+int KEK_SessionKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc)
    {
    int Threshold, current_function, compute_SpreadFactors, send_SpreadFactors, do_part_A, target_attempts; 
    int enroll_or_regen, SBS_num_bits, SHD_num_bytes, do_part_A_part_B_both, set_threshold_to_zero; 
@@ -2722,7 +3982,7 @@ printf("KEK_SessionKeyGen(): Freeing SE_final_key!\n"); fflush(stdout);
    target_attempts = 0;
    int done;
    int return_after_each_set = 0;
-   target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, RANDOM, device_socket_desc, &done, 
+   target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, device_socket_desc, &done, 
       return_after_each_set, compute_PCR_PBD_SF, restore_store_SF, &SpreadFactors_binary, current_function);
 
 // Sanity check
@@ -2779,7 +4039,7 @@ printf("KEK_SessionKeyGen(): About to generate Session key with XMR val %d!\n",
 
       do_part_A_part_B_both = 1;
       set_threshold_to_zero = 0;
-      CommonCore(max_string_len, SAP_ptr, 0, 0, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
+      CommonCore(max_string_len, SAP_ptr, 0, set_threshold_to_zero, target_attempts, do_part_A_part_B_both, current_function, 
          compute_SpreadFactors, send_SpreadFactors, compute_PCR_PBD_SF);
 
 // 10_26_2021: BUG: Forgot to do this here! Do SRF Engine operations in software. 
@@ -2903,7 +4163,7 @@ printf("KEK_SessionKeyGen(): DONE -- number of bits generated %d!\n", current_nu
 // ========================================================================================================
 // KEK provisioning. This is done once after manufacture.
 
-void KEK_EnrollProvisioning(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, int RANDOM)
+void KEK_EnrollProvisioning(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc)
    {
    char request_str[max_string_len];
    int target_attempts;
@@ -2940,7 +4200,7 @@ void KEK_EnrollProvisioning(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, in
    target_attempts = 0;
    int done;
    int return_after_each_set = 0;
-   target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, RANDOM, 
+   target_attempts = GenChlngDeliverSpreadFactorsToDevice(max_string_len, SAP_ptr, do_part_A, target_attempts, 
       device_socket_desc, &done, return_after_each_set, compute_PCR_PBD_SF, restore_store_SF, NULL, current_function);
 
 // Sanity check
@@ -2986,7 +4246,7 @@ void KEK_EnrollProvisioning(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, in
 // ========================================================================================================
 // KEK-based authentication only
 
-int KEK_ClientServerAuthen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, int RANDOM)
+int KEK_ClientServerAuthen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc)
    {
    char request_str[max_string_len];
    int retries;
@@ -3010,7 +4270,7 @@ int KEK_ClientServerAuthen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int
       {
 
 // SKE mode authentication of device to the server. Device Authentication returns SAP_ptr->chip_num = -1 IF IT FAILS.
-      KEK_DeviceAuthentication_SKE(max_string_len, SAP_ptr, client_socket_desc, RANDOM);
+      KEK_DeviceAuthentication_SKE(max_string_len, SAP_ptr, client_socket_desc);
 
       if ( SAP_ptr->chip_num != -1 )
          sprintf(request_str, "SUCCESS %d", SAP_ptr->chip_num);
@@ -3059,8 +4319,7 @@ printf("KEK_ClientServerAuthen(): Device authentication chip number found in DB
 // ========================================================================================================
 // KEK-based authentication and session key generation functions. 
 
-int KEK_ClientServerAuthenKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, int RANDOM,
-   int gen_session_key)
+int KEK_ClientServerAuthenKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, int gen_session_key)
    {
    struct timeval t1, t2;
    long elapsed; 
@@ -3068,14 +4327,14 @@ int KEK_ClientServerAuthenKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_pt
 
 // =========================================
 // Device Authentication
-   if ( KEK_ClientServerAuthen(max_string_len, SAP_ptr, client_socket_desc, RANDOM) == 0 )
+   if ( KEK_ClientServerAuthen(max_string_len, SAP_ptr, client_socket_desc) == 0 )
       return 0;
 
 // =========================================
 // Verifier authentication. Only have the SHD bitstring when VerifierAuthentication is carried out so not saving anything right now. We would need
 // to transmit the DHD bitstring back from the device.
    gettimeofday(&t2, 0);
-   if ( KEK_VerifierAuthentication(max_string_len, SAP_ptr, client_socket_desc, RANDOM) == 0 )
+   if ( KEK_VerifierAuthentication(max_string_len, SAP_ptr, client_socket_desc) == 0 )
       return 0;
 
 #ifdef DEBUG
@@ -3101,7 +4360,7 @@ printf("KEK_ClientServerAuthenKeyGen(): DONE to vectors and timing data\n"); ffl
       int fail_or_pass;
 
       gettimeofday(&t2, 0);
-      fail_or_pass = KEK_SessionKeyGen(max_string_len, SAP_ptr, client_socket_desc, RANDOM);
+      fail_or_pass = KEK_SessionKeyGen(max_string_len, SAP_ptr, client_socket_desc);
 
 // DATABASE VERSION ONLY -- do NOT free these for the FILE VERSION.
       if ( SAP_ptr->database_NAT != NULL )
@@ -3124,7 +4383,7 @@ printf("KEK_ClientServerAuthenKeyGen(): DONE to vectors and timing data\n"); ffl
 // KEK enrollment after provisioning. NOTE: We need to free the SE_final_key once we are done with it in
 // the caller.
 
-void KEK_EnrollInField(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, int RANDOM)
+void KEK_EnrollInField(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc)
    {
    int gen_session_key = 1;
 
@@ -3134,7 +4393,7 @@ void KEK_EnrollInField(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int dev
 
 // Here, we must first authenticate and THEN generate new KEK challenge information.
    gen_session_key = 1;
-   if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, device_socket_desc, RANDOM, gen_session_key) == 0 )
+   if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, device_socket_desc, gen_session_key) == 0 )
       { 
       printf("ERROR: KEK_EnrollInField(): Failed to authenticate or generate a session key with device!\n"); 
       fflush(stdout);
@@ -3142,7 +4401,7 @@ void KEK_EnrollInField(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int dev
       }
 
 // Call the function responsible for generating a new KEK challenge for this device.
-   KEK_EnrollProvisioning(max_string_len, SAP_ptr, device_socket_desc, RANDOM);
+   KEK_EnrollProvisioning(max_string_len, SAP_ptr, device_socket_desc);
 
    return;
    }
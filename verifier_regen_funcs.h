@@ -20,17 +20,25 @@ void ComputeSendSpreadFactors(int max_string_len, SRFAlgoParamsStruct *SAP_ptr,
 
 void DoSRFComp(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int do_dump);
 
+PNDcCacheStruct *CreatePNDcCache(int num_PNDiffs, long budget_bytes);
+void PrintPNDcCacheStats(PNDcCacheStruct *PCC_ptr);
+void FreePNDcCache(PNDcCacheStruct **PCC_ptr_ptr);
+
+DAPrefilterStatsStruct *CreateDAPrefilterStats();
+void PrintDAPrefilterStats(DAPrefilterStatsStruct *DPS_ptr);
+
 int SingleHelpBitGen(int max_PNDiffs, float *fPNDco, unsigned char *SBS, unsigned char *SHD, int *HD_num_bytes_ptr, 
    unsigned short Threshold);
+int SingleHelpBitGenWord(int max_PNDiffs, float *fPNDco, unsigned char *SBS, unsigned char *SHD, int *HD_num_bytes_ptr, 
+   unsigned short Threshold);
 
-int KEK_SessionKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, int RANDOM);
+int KEK_SessionKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc);
 
 // PUF-Cash V3.0
 void GenPOPLLKs(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int RANDOM, int POP_LLK_num_bytes, int num_chips);
 
-int KEK_ClientServerAuthen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, int RANDOM);
+int KEK_ClientServerAuthen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc);
 
-int KEK_ClientServerAuthenKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, int RANDOM,
-   int gen_session_key);
+int KEK_ClientServerAuthenKeyGen(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, int gen_session_key);
 
-void KEK_EnrollInField(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc, int RANDOM);
+void KEK_EnrollInField(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int device_socket_desc);
@@ -40,10 +40,10 @@ typedef struct
    int TTP_request;
    int Device_socket_desc;
    int port_number;
-   int RANDOM;
-   int in_use;
    int client_index;
-   int *client_sockets; 
+   EpollServerStruct *ESS_ptr;
+   ThreadPoolStruct *TP_ptr;
+   RequestStatsStruct *RS_ptr;
    int TTP_num; 
    unsigned char **TTP_session_keys;
    int num_TTPs;
@@ -55,9 +55,9 @@ typedef struct
    int num_preauth_n3_bytes; 
    int num_eCt_nonce_bytes;
    int *TTP_socket_descs;
+   int *TTP_slot_nums;
+   int *TTP_slot_authen;
    AccountStruct *Accounts_ptr;
-   pthread_mutex_t Thread_mutex;
-   pthread_cond_t Thread_cv;
    } ThreadDataType;
 
 
@@ -65,7 +65,7 @@ typedef struct
 // ========================================================================================================
 // Alice withdrawal request. 
 
-void AliceWithdrawal(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int TTP_socket_desc, int RANDOM, 
+void AliceWithdrawal(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int TTP_socket_desc, 
    int num_eCt_nonce_bytes, char *TTP_IP, int port_number, unsigned char *SK_TF, int task_num, 
    int iteration_cnt)
    {
@@ -127,7 +127,7 @@ if ( SockGetB((unsigned char *)eID_amt, AES_INPUT_NUM_BYTES, TTP_socket_desc) <
 
 // SESSION KEY GEN THROUGH THE TTP: Generate the Session key THROUGH THE TTP.
    int fail_or_succeed;
-   if ( (fail_or_succeed = KEK_SessionKeyGen(max_string_len, SAP_ptr, TTP_socket_desc, RANDOM)) == 0 )
+   if ( (fail_or_succeed = KEK_SessionKeyGen(max_string_len, SAP_ptr, TTP_socket_desc)) == 0 )
       { printf("WARNING: AliceWithdrawal(): Failed to generate a Session Key between Alice and the Bank THROUGH THE TTP!\n"); fflush(stdout); }
 
 // Free up the vectors.
@@ -164,8 +164,7 @@ if ( SockGetB((unsigned char *)eID_amt, AES_INPUT_NUM_BYTES, TTP_socket_desc) <
    unsigned char *heCt_buffer = Allocate1DUnsignedChar(eCt_tot_bytes);
 
 // Generate requested number of eCt, encrypt them and send them to TTP. Currently each are 16 bytes.
-   if ( read(RANDOM, eCt_buffer, eCt_tot_bytes) == -1 )
-      { printf("ERROR: AliceWithdrawal(): Read /dev/urandom failed for eCt generation!\n"); exit(EXIT_FAILURE); }
+   GetRandomBytes(eCt_buffer, eCt_tot_bytes);
 
 // 4) Get encrypted LLK with SK_TA key from Alice.
    unsigned char *eLLK = Allocate1DUnsignedChar(SAP_ptr->ZHK_A_num_bytes);
@@ -268,10 +267,12 @@ encrypt_256(SK_TA, SAP_ptr->AES_IV, heCt_buffer, eCt_tot_bytes, eheCt_buffer);
 
 //////////////Natasha/////////////////////////////
 printf("----------BANK SENDING encrypted eCT and eheCT buffers to TTP-----------\n");
+ SockCork(TTP_socket_desc, 1);
  if ( SockSendB((unsigned char *)eeCt_buffer, eCt_tot_bytes, TTP_socket_desc) < 0 )
       { printf("ERROR: AliceWithdrawal(): Bank failed to send encrypted 'eeCt_buffer' to TTP!\n"); exit(EXIT_FAILURE); }
  if ( SockSendB((unsigned char *)eheCt_buffer, eCt_tot_bytes, TTP_socket_desc) < 0 )
       { printf("ERROR: AliceWithdrawal(): Bank failed to send encrypted 'eheCt_buffer' to TTP!\n"); exit(EXIT_FAILURE); }
+ SockCork(TTP_socket_desc, 0);
 ////////////////////////////////////////
 
    return;
@@ -324,7 +325,7 @@ printf("Fetched Chip %3d\tScalingConstant %f\tIP %s and Bitstream number %d from
 // them in its database for distribution to the other customers. 
 
 void ZeroTrust_Enroll(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int Alice_socket_desc, 
-   int RANDOM, int TTP_request, unsigned char *session_key)
+   int TTP_request, unsigned char *session_key)
    {
    char request_str[max_string_len];
 
@@ -351,7 +352,7 @@ printf("\nZeroTrust_Enroll(): BEGIN!\n"); fflush(stdout);
    if ( TTP_request == 0 )
       {
       int gen_session_key = 1;
-      if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Alice_socket_desc, RANDOM, gen_session_key) == 0 )
+      if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Alice_socket_desc, gen_session_key) == 0 )
          { printf("ERROR: ZeroTrust_Enroll(): Failed to authenticate Alice or the Bank!\n"); exit(EXIT_FAILURE); }
 
       session_key = SAP_ptr->SE_final_key;
@@ -487,7 +488,7 @@ printf("\nZeroTrust_Enroll(): DONE!\n"); fflush(stdout);
 // NOTE: When TTP invokes this function, it wants the AT for a specific customer, not all customers.
 
 void ZeroTrust_GetATs(int max_string_len, SRFAlgoParamsStruct *SAP_ptr, int client_socket_desc, 
-   int RANDOM, int TTP_request, unsigned char *session_key) 
+   int TTP_request, unsigned char *session_key) 
    {
    char request_str[max_string_len];
    int chip_num = -1;
@@ -515,7 +516,7 @@ printf("\nZeroTrust_GetATs(): BEGIN!\n"); fflush(stdout);
    if ( TTP_request == 0 )
       {
       int gen_session_key = 1;
-      if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, client_socket_desc, RANDOM, gen_session_key) == 0 )
+      if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, client_socket_desc, gen_session_key) == 0 )
          { printf("ERROR: ZeroTrust_GetATs(): Failed to authenticate Alice or the Bank!\n"); exit(EXIT_FAILURE); }
 
       session_key = SAP_ptr->SE_final_key;
@@ -557,7 +558,7 @@ printf("\tZeroTrust_GetATs(): TTP sent chip_num %d!\n", chip_num); fflush(stdout
 // stored in the array parameters. Note that this action sets the status of the AT as USED (can NOT be used again).
    int return_customer_AT_info = 1;
    int unused;
-   num_customers = ZeroTrustGetCustomerATs(max_string_len, SAP_ptr->DB_Trust_AT, &chip_num_arr, &chlng_num_arr, 
+   num_customers = ZeroTrustGetCustomerATs(SAP_ptr->DB_Trust_AT, &chip_num_arr, &chlng_num_arr, 
       SAP_ptr->ZHK_A_num_bytes, &ZHK_A_nonce_arr, &nonce_arr, get_only_customer_AT, chip_num,
       return_customer_AT_info, report_num_ATs_only, &unused);
 
@@ -820,16 +821,32 @@ void TransmitTTP_DeviceIDInfo(int max_string_len, SRFAlgoParamsStruct *SAP_ptr,
 
 // ========================================================================================================
 // ========================================================================================================
-// Device thread.
+// Close a client connection and return its slot to the acceptor. The slot also loses its TTP number and authentication, so 
+// the next connection given the slot is identified again from its IP.
 
-void BankThread(ThreadDataType *ThreadDataPtr)
+void CloseBankClient(ThreadDataType *ThreadDataPtr, int client_index)
    {
+   ThreadDataPtr->TTP_slot_nums[client_index] = -1;
+   ThreadDataPtr->TTP_slot_authen[client_index] = 0;
+   CloseEpollSocketServerClient(ThreadDataPtr->ESS_ptr, client_index);
+
+   return;
+   }
+
+
+// ========================================================================================================
+// ========================================================================================================
+// Device thread. 'arg' is the thread's ThreadDataType entry (see CreateThreadPool).
+
+void *BankThread(void *arg)
+   {
+   ThreadDataType *ThreadDataPtr = (ThreadDataType *)arg;
    SRFAlgoParamsStruct *SAP_ptr;
    int TTP_request;
    int Device_socket_desc;
    int port_number;
    int client_index;
-   int *client_sockets;
+   ServerConnStruct conn;
    int TTP_num;
    unsigned char **TTP_session_keys;
    int num_TTPs;
@@ -839,14 +856,12 @@ void BankThread(ThreadDataType *ThreadDataPtr)
    int ip_length;
    int max_string_len;
    int num_eCt_nonce_bytes;
-   int RANDOM;
 
    int task_num, iteration_cnt;
 
 // Making this static here makes it global to all threads.
    static pthread_mutex_t RT_DB_mutex = PTHREAD_MUTEX_INITIALIZER;
    static pthread_mutex_t FileStat_mutex = PTHREAD_MUTEX_INITIALIZER;
-   static pthread_mutex_t GenChallenge_mutex = PTHREAD_MUTEX_INITIALIZER;
    static pthread_mutex_t Authentication_mutex = PTHREAD_MUTEX_INITIALIZER;
 
    static pthread_mutex_t PUFCash_WRec_DB_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -856,16 +871,16 @@ printf("BankThread: CALLED!\t(Task %d\tIterationCnt %d)\n", ThreadDataPtr->task_
 #ifdef DEBUG
 #endif
 
-// Threads never return
-   while (1)
+// Sleep waiting for the main program to receive connect request from Alice or a TTP. main() submits each ready connection 
+// to the thread pool and the first idle thread takes it. No CPU cycles are wasted here in a busy wait, which is important 
+// when we query TTPs for performance information. The thread returns when the pool shrinks or shuts down.
+   while ( GetThreadPoolTask(ThreadDataPtr->TP_ptr, ThreadDataPtr->task_num, &conn) == 1 )
       {
-
-// Sleep waiting for the main program to receive connect request from Alice or a TTP, and assign a device_socket_desc
-// No CPU cycles are wasted here in a busy wait, which is important when we query TTPs for performance information.
-      pthread_mutex_lock(&(ThreadDataPtr->Thread_mutex));
-      while ( ThreadDataPtr->in_use == 0 )
-         pthread_cond_wait(&(ThreadDataPtr->Thread_cv), &(ThreadDataPtr->Thread_mutex));
-      pthread_mutex_unlock(&(ThreadDataPtr->Thread_mutex));
+      ThreadDataPtr->TTP_request = (conn.TTP_num != -1);
+      ThreadDataPtr->Device_socket_desc = conn.socket_desc;
+      ThreadDataPtr->client_index = conn.client_index;
+      ThreadDataPtr->iteration_cnt = conn.iteration_cnt;
+      ThreadDataPtr->TTP_num = conn.TTP_num;
 
       task_num = ThreadDataPtr->task_num;
       iteration_cnt = ThreadDataPtr->iteration_cnt;
@@ -876,7 +891,6 @@ printf("BankThread: CALLED!\t(Task %d\tIterationCnt %d)\n", ThreadDataPtr->task_
       Device_socket_desc = ThreadDataPtr->Device_socket_desc;
       port_number = ThreadDataPtr->port_number;
       client_index = ThreadDataPtr->client_index;
-      client_sockets = ThreadDataPtr->client_sockets;
       TTP_num = ThreadDataPtr->TTP_num;
       TTP_session_keys = ThreadDataPtr->TTP_session_keys;
       num_TTPs = ThreadDataPtr->num_TTPs;
@@ -886,23 +900,17 @@ printf("BankThread: CALLED!\t(Task %d\tIterationCnt %d)\n", ThreadDataPtr->task_
       ip_length = ThreadDataPtr->ip_length;
       max_string_len = ThreadDataPtr->max_string_len;
       num_eCt_nonce_bytes = ThreadDataPtr->num_eCt_nonce_bytes;
-      RANDOM = ThreadDataPtr->RANDOM;
 
-// If we set SAP_ptr->use_database_chlngs to 1, then we can NOT allow more than one thread to run GenChallengeDB() at the same time because we
-// call rand(). If the device or TTP is going to get the same set of random numbers as this verifier is than after srand() is seeded with 
-// SAP_ptr->DB_ChallengeGen_seed, we must block other threads until the vector sequence is completely generated, i.e., rand() is NOT re-entrant!
-// We can do this in main() or here once we've initialized the GenChallenge_mutex mutex above (it is static and therefore global to all threads).
       SAP_ptr->RT_DB_mutex_ptr = &RT_DB_mutex;
       SAP_ptr->FileStat_mutex_ptr = &FileStat_mutex;
-      SAP_ptr->GenChallenge_mutex_ptr = &GenChallenge_mutex;
       SAP_ptr->Authentication_mutex_ptr = &Authentication_mutex; 
 
       SAP_ptr->PUFCash_WRec_DB_mutex_ptr = &PUFCash_WRec_DB_mutex;
       SAP_ptr->PUFCash_POP_DB_mutex_ptr = &PUFCash_POP_DB_mutex;
 
-// Get the request
-      char client_request_str[max_string_len];
-      int client_request;
+// Get the request header.
+      RequestHeaderStruct client_request;
+      int close_conn = 0;
 
 struct timeval t1, t2;
 long elapsed; 
@@ -910,44 +918,46 @@ gettimeofday(&t2, 0);
 #ifdef DEBUG
 #endif
 
-      if ( SockGetB((unsigned char *)client_request_str, max_string_len, Device_socket_desc) < 0 )
-         { printf("ERROR: BankThread(): Error receiving 'client_request_str' from Device or TTP (TTP_request? %d)!\n", TTP_request); exit(EXIT_FAILURE); }
+// The TTP closes a Bank channel whose exchange failed (see DiscardChannel), which shows up here as a failed read.
+      if ( SockGetRequest(max_string_len, Device_socket_desc, &client_request) < 0 )
+         { 
+         printf("WARNING: BankThread(): Error receiving 'client_request' from Device or TTP (TTP_request? %d) -- closing connection!\n", 
+            TTP_request); fflush(stdout); 
+         CloseBankClient(ThreadDataPtr, client_index);
+         continue;
+         }
 
 #ifdef DEBUG
-printf("BankThread(): Client request '%s'\tIs TTP request %d\tIterationCnt %d\n", client_request_str, TTP_request, iteration_cnt); fflush(stdout);
+printf("BankThread(): Client request '%s'\tID %u\tIs TTP request %d\tIterationCnt %d\n", GetRequestName(client_request.opcode), 
+   client_request.request_id, TTP_request, iteration_cnt); fflush(stdout);
 #endif
 
 // ========================================================
-// Supported client requests
-      client_request = -1;
-      if ( strcmp(client_request_str, "KEK-CHALLENGE-ENROLL") == 0 )
-         client_request = 1;
-      else if ( strcmp(client_request_str, "ZERO-TRUST-ENROLL") == 0 )
-         client_request = 3;
-      else if ( strcmp(client_request_str, "ZERO-TRUST-GET-ATS") == 0 )
-         client_request = 4;
-      else if ( strcmp(client_request_str, "WITHDRAW") == 0 )
-         client_request = 5;
-      else if ( strcmp(client_request_str, "TTP-AUTHENTICATION") == 0 )
-         client_request = 10;
-      else if ( strcmp(client_request_str, "ALICE-GET-TTP-IPS") == 0 )
-         client_request = 11;
-      else if ( strcmp(client_request_str, "ALICE-GET-CUSTOMER-IPS") == 0 )
-         client_request = 12;
-      else if ( strcmp(client_request_str, "TTP-MASTER-GET-TTP-IP-INFO") == 0 )
-         client_request = 13;
-      else if ( strcmp(client_request_str, "TTP-GET-DEVICE-IDS") == 0 )
-         client_request = 15;
-      else if ( strcmp(client_request_str, "CLIENT-AUTHENTICATION") == 0 )
-         client_request = 17;
-      else if ( strcmp(client_request_str, "CLIENT-SERVER-KEYGEN") == 0 )
-         client_request = 20;
-      if ( client_request == -1 )
-         { printf("ERROR: BankThread(): Unknown 'client_request' '%s'!\n", client_request_str); exit(EXIT_FAILURE); }
+// Supported client requests. SockGetRequest has already reported why a request was refused (e.g., a peer older than 
+// REQ_HDR_VERSION), so just drop the connection before any exchange starts.
+      if ( client_request.opcode == REQ_OP_UNKNOWN )
+         { 
+         printf("WARNING: BankThread(): Refused client request (TTP_request? %d) -- closing connection!\n", TTP_request); fflush(stdout); 
+         CloseBankClient(ThreadDataPtr, client_index);
+         continue;
+         }
+
+// A TTP channel is trusted once it has authenticated, with TTP-AUTHENTICATION on the TTP's startup channel or TTP-CHANNEL-AUTHENTICATION 
+// on the others. Until then, the requests that rely on the TTP's session key are refused and the connection is dropped.
+      if ( TTP_request == 1 && ThreadDataPtr->TTP_slot_authen[client_index] == 0 && 
+         (client_request.opcode == REQ_OP_ZERO_TRUST_ENROLL || client_request.opcode == REQ_OP_ZERO_TRUST_GET_ATS || 
+         client_request.opcode == REQ_OP_WITHDRAW || client_request.opcode == REQ_OP_TTP_MASTER_GET_TTP_IP_INFO || 
+         client_request.opcode == REQ_OP_TTP_GET_DEVICE_IDS) )
+         {
+         printf("WARNING: BankThread(): '%s' request on an unauthenticated channel of TTP %d -- closing connection!\n", 
+            GetRequestName(client_request.opcode), TTP_num); fflush(stdout);
+         CloseBankClient(ThreadDataPtr, client_index);
+         continue;
+         }
 
 // ===============================================================
 // Alice/Bob is getting KEK challenge information DURING FIELD OPERATION. Here, we need to authenticate using the old information first.
-      if ( strcmp(client_request_str, "KEK-CHALLENGE-ENROLL") == 0 )
+      if ( client_request.opcode == REQ_OP_KEK_CHALLENGE_ENROLL )
          {
 
 printf("\tKEK-CHALLENGE-ENROLL: BankThread(): Request from socket %d at index %d!\tIterationCnt %d\n", 
@@ -957,14 +967,14 @@ printf("\tKEK-CHALLENGE-ENROLL: BankThread(): Request from socket %d at index %d
          int prev_udc = SAP_ptr->use_database_chlngs;
          SAP_ptr->use_database_chlngs = 1;
 
-         KEK_EnrollInField(max_string_len, SAP_ptr, Device_socket_desc, RANDOM);
+         KEK_EnrollInField(max_string_len, SAP_ptr, Device_socket_desc);
 
          SAP_ptr->use_database_chlngs = prev_udc;
          }
 
 // ===============================================================
 // PUF-Cash 3.0: ZeroTrust: Alice makes this call. There is NO TTP involved in ZeroTrust
-      else if ( strcmp(client_request_str, "ZERO-TRUST-ENROLL") == 0 )
+      else if ( client_request.opcode == REQ_OP_ZERO_TRUST_ENROLL )
          {
 
 printf("\tZERO-TRUST-ENROLL: BankThread(): Request from socket %d at index %d!\tIterationCnt %d\n", 
@@ -986,13 +996,13 @@ printf("\tZERO-TRUST-ENROLL: BankThread(): Request from socket %d at index %d!\t
             session_key = TTP_session_keys[0];
 
 // ZeroTrust enrollment. NOTE: This requests comes in from a customer device, 
-         ZeroTrust_Enroll(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, TTP_request, session_key);
+         ZeroTrust_Enroll(max_string_len, SAP_ptr, Device_socket_desc, TTP_request, session_key);
          }
 
 
 // ===============================================================
 // PUF-Cash 3.0: ZeroTrust: Get ATs. Alice makes this call. There is NO TTP involved in ZeroTrust
-      else if ( strcmp(client_request_str, "ZERO-TRUST-GET-ATS") == 0 )
+      else if ( client_request.opcode == REQ_OP_ZERO_TRUST_GET_ATS )
          {
 
 printf("\tZERO-TRUST-GET-ATS: BankThread(): Request from socket %d at index %d!\tIterationCnt %d\n", 
@@ -1012,12 +1022,12 @@ printf("\tZERO-TRUST-GET-ATS: BankThread(): Request from socket %d at index %d!\
             session_key = TTP_session_keys[0];
 
 // ZeroTrust enrollment. NOTE: This requests comes in from a customer device or a TTP.
-         ZeroTrust_GetATs(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, TTP_request, session_key);
+         ZeroTrust_GetATs(max_string_len, SAP_ptr, Device_socket_desc, TTP_request, session_key);
          }
 
 // ===============================================================
 // Alice is requesting a withdrawal.
-      else if ( strcmp(client_request_str, "WITHDRAW") == 0 )
+      else if ( client_request.opcode == REQ_OP_WITHDRAW )
          {
 
 // 11_12_2021: While developing PUF-Cash, I'm assuming only ONE TTP. If more exist, then we'll need to make a decision here regarding which TTP to use.
@@ -1029,13 +1039,13 @@ printf("WITHDRAW: BankThread(): Request from socket %d at index %d!\tIterationCn
    Device_socket_desc, client_index, iteration_cnt); fflush(stdout);
 #ifdef DEBUG
 #endif
-         AliceWithdrawal(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, num_eCt_nonce_bytes, TTP_IPs[0], port_number, 
+         AliceWithdrawal(max_string_len, SAP_ptr, Device_socket_desc, num_eCt_nonce_bytes, TTP_IPs[0], port_number, 
             TTP_session_keys[0], task_num, iteration_cnt);
          }
 
 // ===============================================================
 // Authentication and session key generation request from TTP. NOTE: This socket stays open.
-      else if ( strcmp(client_request_str, "TTP-AUTHENTICATION") == 0 )
+      else if ( client_request.opcode == REQ_OP_TTP_AUTHENTICATION )
          {
          int gen_session_key; 
 
@@ -1051,19 +1061,48 @@ printf("\tTTP-AUTHENTICATION: BankThread(): Request from socket %d at index %d!\
 
 // This MUST succeed. Exit is appropriate here if device or server authentication fails. Database mutex is for storing bitstring info to Runtime DB.
             gen_session_key = 1;
-            if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, gen_session_key) == 0 )
+            if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, gen_session_key) == 0 )
                { printf("ERROR: BankThread(): Failed to authenticate or generate a session key with TTP!\n"); exit(EXIT_FAILURE); }
 
 // Transfer the dynamically allocated key to preserve it forever. This array is shared among all the threads. Each TTP updates its own
 // key so no need for mutex here.
             TTP_session_keys[TTP_num] = SAP_ptr->SE_final_key;
             SAP_ptr->SE_final_key = NULL;
+            ThreadDataPtr->TTP_slot_authen[client_index] = 1;
+            }
+         }
+
+// ===============================================================
+// Authentication of an additional persistent channel the TTP opened to the Bank (see AcquireChannel). Same mutual authentication 
+// as TTP-AUTHENTICATION but the TTP's session key is kept. A channel that fails is closed.
+      else if ( client_request.opcode == REQ_OP_TTP_CHANNEL_AUTHENTICATION )
+         {
+         int gen_session_key; 
+
+         if ( TTP_num == -1 )
+            { printf("WARNING: BankThread(): TTP-CHANNEL-AUTHENTICATION request but NOT from a TTP - IGNORING!\n"); fflush(stdout); }
+         else
+            {
+
+printf("\tTTP-CHANNEL-AUTHENTICATION: BankThread(): Request from socket %d at index %d!\tIterationCnt %d\n", 
+   Device_socket_desc, client_index, iteration_cnt); fflush(stdout);
+#ifdef DEBUG
+#endif
+
+            gen_session_key = 0;
+            if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, gen_session_key) == 0 )
+               { 
+               printf("WARNING: BankThread(): Failed to authenticate channel of TTP %d -- closing connection!\n", TTP_num); fflush(stdout); 
+               close_conn = 1;
+               }
+            else
+               ThreadDataPtr->TTP_slot_authen[client_index] = 1;
             }
          }
 
 // ===============================================================
 // Alice does this at startup and periodically as needed. The Bank encrypts and transmits all of the TTP IPs to Alice. 
-      else if ( strcmp(client_request_str, "ALICE-GET-TTP-IPS") == 0 )
+      else if ( client_request.opcode == REQ_OP_ALICE_GET_TTP_IPS )
          {
          int gen_session_key; 
 
@@ -1072,7 +1111,7 @@ printf("\tALICE-GET-TTP-IPS: BankThread(): Request from socket %d at index %d!\t
 #ifdef DEBUG
 #endif
          gen_session_key = 1;
-         if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, gen_session_key) == 0 )
+         if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, gen_session_key) == 0 )
             { printf("ERROR: BankThread(): 'ALICE-GET-TTP-IPS': Failed to authenticate Alice or the Bank!\n"); exit(EXIT_FAILURE); }
 
          TransmitDevice_IPInfo(max_string_len, SAP_ptr, num_TTPs, Device_socket_desc, TTP_IPs, ip_length, SAP_ptr->SE_final_key, 
@@ -1086,7 +1125,7 @@ printf("\tALICE-GET-TTP-IPS: BankThread(): Request from socket %d at index %d!\t
 
 // ===============================================================
 // Alice does this at startup and periodically as needed. The Bank encrypts and transmits all of the customer IPs to Alice. 
-      else if ( strcmp(client_request_str, "ALICE-GET-CUSTOMER-IPS") == 0 )
+      else if ( client_request.opcode == REQ_OP_ALICE_GET_CUSTOMER_IPS )
          {
          int gen_session_key; 
 
@@ -1095,7 +1134,7 @@ printf("\tALICE-GET-CUSTOMER-IPS: BankThread(): Request from socket %d at index
 #ifdef DEBUG
 #endif
          gen_session_key = 1;
-         if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, gen_session_key) == 0 )
+         if ( KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, gen_session_key) == 0 )
             { printf("ERROR: BankThread(): 'ALICE-GET-CUSTOMER-IPS': Failed to authenticate Alice or the Bank!\n"); exit(EXIT_FAILURE); }
 
          TransmitDevice_IPInfo(max_string_len, SAP_ptr, num_customers, Device_socket_desc, customer_IPs, ip_length, SAP_ptr->SE_final_key, 
@@ -1109,7 +1148,7 @@ printf("\tALICE-GET-CUSTOMER-IPS: BankThread(): Request from socket %d at index
 
 // ===============================================================
 // TTPs get list of other TTP IPs 
-      else if ( strcmp(client_request_str, "TTP-MASTER-GET-TTP-IP-INFO") == 0 )
+      else if ( client_request.opcode == REQ_OP_TTP_MASTER_GET_TTP_IP_INFO )
          {
          if ( TTP_num == -1 )
             { printf("ERROR: BankThread(): TTP-MASTER-GET-TTP-IP-INFO request but NOT from a TTP!\n"); exit(EXIT_FAILURE); }
@@ -1126,7 +1165,7 @@ printf("\tTTP-MASTER-GET-TTP-IP-INFO: BankThread(): Request from socket %d at in
 // The server needs to send the TTP a list of chip_nums (non-anonymous) to be used as identifiers in the PUFCash_V3 Account Table
 // that the TTP (commercial bank) uses to keep bank account information on Alice and Bob. These are unique IDs for ALL devices
 // in the field, so the TTP can use them to identify unique accounts.
-      else if ( strcmp(client_request_str, "TTP-GET-DEVICE-IDS") == 0 )
+      else if ( client_request.opcode == REQ_OP_TTP_GET_DEVICE_IDS )
          {
 
          if ( TTP_num == -1 )
@@ -1142,7 +1181,7 @@ printf("\tTTP-GET-DEVICE-IDS: BankThread(): Request from TTP socket %d at index
 
 // ===============================================================
 // Authentication only 
-      else if ( strcmp(client_request_str, "CLIENT-AUTHENTICATION") == 0 )
+      else if ( client_request.opcode == REQ_OP_CLIENT_AUTHENTICATION )
          {
 
 // TESTING ONLY: Get chip information
@@ -1155,14 +1194,14 @@ printf("\tCLIENT-AUTHENTICATION: BankThread(): Request from socket %d at index %
          int prev_udc = SAP_ptr->use_database_chlngs;
          SAP_ptr->use_database_chlngs = 1;
 
-         KEK_ClientServerAuthen(max_string_len, SAP_ptr, Device_socket_desc, RANDOM);
+         KEK_ClientServerAuthen(max_string_len, SAP_ptr, Device_socket_desc);
 
          SAP_ptr->use_database_chlngs = prev_udc;
          }
 
 // ===============================================================
 // Device/Server Authentication and Session Key Generation
-      else if ( strcmp(client_request_str, "CLIENT-SERVER-KEYGEN") == 0 )
+      else if ( client_request.opcode == REQ_OP_CLIENT_SERVER_KEYGEN )
          {
          int gen_session_key;
 
@@ -1178,7 +1217,7 @@ printf("\tCLIENT-SERVER-KEYGEN-AUTHENTICATION: BankThread(): Request from socket
 
          gen_session_key = 1;
 
-         KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, RANDOM, gen_session_key);
+         KEK_ClientServerAuthenKeyGen(max_string_len, SAP_ptr, Device_socket_desc, gen_session_key);
 
          SAP_ptr->use_database_chlngs = prev_udc;
          }
@@ -1186,48 +1225,36 @@ printf("\tCLIENT-SERVER-KEYGEN-AUTHENTICATION: BankThread(): Request from socket
 // ===============================================================
 // Unknown message
       else
-         { printf("ERROR: BankThread(): Unknown client request '%s'!\n", client_request_str); exit(EXIT_FAILURE); }
+         { printf("ERROR: BankThread(): Unknown client request '%s'!\n", GetRequestName(client_request.opcode)); exit(EXIT_FAILURE); }
 
 
 // ===============================================================
 // ===============================================================
-// Close the socket descriptor if the request is from Alice (do NOT close TTP socket descriptors).
-      if ( TTP_request == 0 )
-         {
-         close(Device_socket_desc);
-
-// Make the socket descriptor processed by this thread available again to 'select' in OpenMultipleServerSocket.
-// Note this is a shared array among the threads but no semaphore needed here because each thread updates a unique element
-// given by client_index.
-         client_sockets[client_index] = 0;
-         }
+// Close the socket descriptor if the request is from Alice (do NOT close TTP socket descriptors unless the channel failed to 
+// authenticate). Closing also returns the slot given by client_index to the acceptor.
+      if ( TTP_request == 0 || close_conn == 1 )
+         CloseBankClient(ThreadDataPtr, client_index);
 
-// If a TTP request, then restore activity on this socket_descriptor? Note that I assign a TTP socket descriptor to Device_socket_desc
-// when the request is from a TTP in main when this thread is spun up. I also 'disable' this TTP socket descriptor by assigning a -1
-// while this thread executes. At least this is what I can deduce on 10_29_2021.
+// If a TTP request, then restore activity on this socket descriptor. The acceptor hands out connections disarmed, so the 
+// TTP's next request is not reported until we re-arm it here.
       else
-         client_sockets[client_index] = Device_socket_desc;
+         RearmEpollSocketServerClient(ThreadDataPtr->ESS_ptr, client_index);
 
-gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; printf("\tElapsed: For '%s' %ld us\tIterationCnt %d\n\n", 
-   client_request_str, (long)elapsed, iteration_cnt);
+gettimeofday(&t1, 0); elapsed = (t1.tv_sec-t2.tv_sec)*1000000 + t1.tv_usec-t2.tv_usec; printf("\tElapsed: For '%s' ID %u %ld us\tIterationCnt %d\n\n", 
+   GetRequestName(client_request.opcode), client_request.request_id, (long)elapsed, iteration_cnt);
 #ifdef DEBUG
 #endif
-
-// Indicate to the parent that this thread is available for reassignment.
-      pthread_mutex_lock(&(ThreadDataPtr->Thread_mutex));
-      ThreadDataPtr->in_use = 0;
-      pthread_mutex_unlock(&(ThreadDataPtr->Thread_mutex));
+      RecordRequestStats(ThreadDataPtr->RS_ptr, &client_request, elapsed);
       }
 
-// Exit and clean up resources. Nope -- this generates some type of library required message -- an error. I'm not destroying threads
-// any longer -- they get created and run forever.
+// Exit and clean up resources. Nope -- this generates some type of library required message -- an error. Returning hands the
+// thread back to the pool (see GetThreadPoolTask).
 //   pthread_exit(NULL);
 
-// NEVER GETS EXECUTED anyway
 #ifdef DEBUG
-printf("TTPThread: DONE!\t(Task %d\tIterationCnt %d)\n", task_num, iteration_cnt); fflush(stdout);
+printf("BankThread: DONE!\t(Task %d)\n", ThreadDataPtr->task_num); fflush(stdout);
 #endif
-   return;
+   return NULL;
    }
 
 
@@ -1239,37 +1266,19 @@ printf("TTPThread: DONE!\t(Task %d\tIterationCnt %d)\n", task_num, iteration_cnt
 #define MAX_TTPS 20
 #define MAX_CUSTOMERS 20
 
-int client_sockets[MAX_CLIENTS];
-
 int TTP_socket_descs[MAX_TTPS]; 
 int TTP_socket_indexes[MAX_TTPS]; 
+
+// TTP number of each acceptor slot, or -1 for Alice/Bob. A TTP may keep several persistent channels open to the Bank, and 
+// TTP_slot_authen is set once the channel in the slot has authenticated.
+int TTP_slot_nums[MAX_CLIENTS]; 
+int TTP_slot_authen[MAX_CLIENTS]; 
 unsigned char *TTP_session_keys[MAX_TTPS]; 
 
-#define MAX_THREADS 20
-SRFAlgoParamsStruct SAP_arr[MAX_THREADS];
-
-ThreadDataType ThreadDataArr[MAX_THREADS] = {
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   {0, 0, NULL, 0, -1, 0, 0, 0, 0, NULL, 0, NULL, 0, NULL, 0, NULL, 0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER},
-   };
+// Per-worker data and SAP structures are allocated in main() for the pool's maximum number of workers.
+SRFAlgoParamsStruct *SAP_arr;
+
+ThreadDataType *ThreadDataArr;
 
 
 // ============================================================================
@@ -1306,8 +1315,14 @@ int main(int argc, char *argv[])
 
    int rc;
 
-// Declare sockaddr_in structures 
-   int Bank_server_socket_desc = 0;
+// Epoll acceptor and the queue that hands its connections to the worker threads.
+   EpollServerStruct *ESS_ptr;
+   ThreadPoolStruct *TP_ptr;
+   ServerConnStruct conn;
+
+// Per-opcode request counts and service times reported with the pool statistics.
+   RequestStatsStruct RequestStats;
+   int num_threads = SERVER_MAX_THREADS;
    int Device_socket_desc = 0;
 
    char **TTP_IPs = NULL;
@@ -1319,13 +1334,10 @@ int main(int argc, char *argv[])
    int num_customers;
 
    int client_index;
-   int first_time;
    int SD;
 
    int port_number;
 
-   int RANDOM;
-
    int iteration, num_iterations;
 
    int fix_params; 
@@ -1341,6 +1353,7 @@ int main(int argc, char *argv[])
    int num_KEK_authen_nonce_bytes; 
 
    int use_TVC_cache; 
+   int use_TVC_snapshot; 
 
    int gen_random_challenge; 
 
@@ -1350,6 +1363,8 @@ int main(int argc, char *argv[])
    int do_save_SKE_SHD;
 
    int read_db_into_memory;
+   int DB_persist_RPO_ms, DB_persist_checkpoint_secs, DB_persist_pages_per_step, DB_persist_step_budget_ms;
+   DBPersistStruct *DBP_Trust_AT_ptr, *DBP_PUFCash_V3_ptr;
 
    int max_chips, chip_num;
 
@@ -1418,11 +1433,27 @@ int main(int argc, char *argv[])
 // Set this to 1 to create an in-memory version of the database. Memory limited operation but it at least 100 times faster.
    read_db_into_memory = 1;
 
+// Write-back persistence of the in-memory AT and PUF-Cash databases (see StartDBPersist). Commits reach the journal on disk within
+// DB_persist_RPO_ms (0 syncs every commit) and the databases are checkpointed back to their files every DB_persist_checkpoint_secs,
+// DB_persist_pages_per_step pages at a time for at most DB_persist_step_budget_ms before the rest is copied in one locked step.
+   DB_persist_RPO_ms = 1000;
+   DB_persist_checkpoint_secs = 60;
+   DB_persist_pages_per_step = 256;
+   DB_persist_step_budget_ms = 200;
+
 // Setting this to 1 creates a PN cache. Here, the qualifing PNs (according to the ChallengeSetName) for all chips 
 // are read out of the database and stored in the TimingValCacheStruct array for very quick access. USE THIS TOO with the
 // in memory copy.
    use_TVC_cache = 1;
 
+// Setting this to 1 maps the PN cache from a binary snapshot file written next to the NAT database ('<DB file>.<ChallengeSetName>.tvc') 
+// instead of rebuilding it from the database. The snapshot is (re)written whenever it is missing or stale.
+   use_TVC_snapshot = 1;
+
+// Use the 64-bit word versions of the bitstring routines (KEK_FSB_SKE, SingleHelpBitGen, etc). Set to BIT_OPS_BYTE to run the
+// original bit-at-a-time versions.
+   SelectBitOps(BIT_OPS_DEFAULT);
+
    char AES_IV[AES_IV_NUM_BYTES] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE, 0xF};
 
 // Copying this for now since I'm copy the Master_NAT.db to the Master_AT.db but eventually this will become a command line 
@@ -1534,6 +1565,11 @@ int main(int argc, char *argv[])
       TTP_socket_descs[i] = -1; 
       TTP_socket_indexes[i] = -1; 
       }
+   for ( i = 0; i < MAX_CLIENTS; i++ )
+      {
+      TTP_slot_nums[i] = -1; 
+      TTP_slot_authen[i] = 0; 
+      }
 
 // Check for at least the correct number of characters.
    for ( i = 0; i < num_TTPs; i++ )
@@ -1650,6 +1686,23 @@ fflush(stdout);
          }
       }
 
+// Bring the schemas of the ZeroTrust and PUF-Cash databases up to date and prepare their runtime statements once, before any worker 
+// thread uses them.
+   MigrateZeroTrustSchema(MAX_STRING_LEN, DB_Trust_AT, DB_name_Trust_AT);
+   MigratePUFCashSchema(MAX_STRING_LEN, DB_PUFCash_V3, DB_name_PUFCash_V3);
+   PrepareZeroTrustSQLStmts(DB_Trust_AT);
+   PreparePUFCashSQLStmts(DB_PUFCash_V3);
+
+// The in-memory copies are otherwise lost on exit. Replays the journal of a crashed run.
+   DBP_Trust_AT_ptr = DBP_PUFCash_V3_ptr = NULL;
+   if ( read_db_into_memory == 1 )
+      {
+      DBP_Trust_AT_ptr = StartDBPersist(DB_Trust_AT, DB_name_Trust_AT, DB_persist_RPO_ms, DB_persist_checkpoint_secs, 
+         DB_persist_pages_per_step, DB_persist_step_budget_ms);
+      DBP_PUFCash_V3_ptr = StartDBPersist(DB_PUFCash_V3, DB_name_PUFCash_V3, DB_persist_RPO_ms, DB_persist_checkpoint_secs, 
+         DB_persist_pages_per_step, DB_persist_step_budget_ms);
+      }
+
 // Open up the run-time database. Third arg to sqlite3_open_v2 forced serialized mode, which makes it thread-safe with NO restrictions
    rc = sqlite3_open_v2(DB_name_RunTime, &DB_RunTime, SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, NULL);
    if ( rc != 0 )
@@ -1662,17 +1715,17 @@ fflush(stdout);
 
 // =====================================================================================================================================
 // MISC
-// Open up the random source for verifier to generate nonce bytes that will be used to SelectParams for authentication.
-   if ( (RANDOM = open("/dev/urandom", O_RDONLY)) == -1 )
-      { printf("ERROR: Could not open /dev/urandom\n"); exit(EXIT_FAILURE); }
-   printf("\tSuccessfully open '/dev/urandom'\n");
-
-// Initialize all client_sockets to 0. We do NOT DO THIS any longer in the call to OpenMultipleSocketServer below.
-// We needed to remove this because ttp.c needs to set a client_socket after opening the connection to the Bank (this
-// code). 
-   int client_num;
-   for ( client_num = 0; client_num < MAX_CLIENTS; client_num++) 
-      { client_sockets[client_num] = 0; }
+// Open the listening socket now so the worker threads started below can re-arm and close connections through ESS_ptr.
+   ESS_ptr = OpenEpollSocketServer(Bank_server_IP, port_number, SERVER_LISTEN_BACKLOG, MAX_CLIENTS);
+
+// Worker data, including the SAP scratch buffers, is preallocated for every worker the pool may create.
+   if ( (ThreadDataArr = (ThreadDataType *)calloc(num_threads, sizeof(ThreadDataType))) == NULL )
+      { printf("ERROR: Failed to allocate storage for %d ThreadDataArr elements!\n", num_threads); exit(EXIT_FAILURE); }
+   if ( (SAP_arr = (SRFAlgoParamsStruct *)calloc(num_threads, sizeof(SRFAlgoParamsStruct))) == NULL )
+      { printf("ERROR: Failed to allocate storage for %d SAP_arr elements!\n", num_threads); exit(EXIT_FAILURE); }
+   TP_ptr = CreateThreadPool(SERVER_MIN_THREADS, num_threads, SERVER_THREAD_IDLE_TIMEOUT_MS, SERVER_CONN_QUEUE_SIZE, 
+      BankThread, (void *)ThreadDataArr, sizeof(ThreadDataType));
+   InitRequestStats(&RequestStats);
 
 // =====================================================================================================================================
 // =====================================================================================================================================
@@ -1690,7 +1743,7 @@ fflush(stdout);
 
 // -------------------------------------------
 // Load up verifier data structure for the thread.
-   for ( thread_num = 0; thread_num < MAX_THREADS; thread_num++ )
+   for ( thread_num = 0; thread_num < num_threads; thread_num++ )
       {
       ThreadDataArr[thread_num].task_num = thread_num;
 
@@ -1863,6 +1916,9 @@ fflush(stdout);
 
 // These are filled in by the verifier. 
       ThreadDataArr[thread_num].SAP_ptr->num_chips = 0;
+      ThreadDataArr[thread_num].SAP_ptr->num_DA_scan_threads = DA_SCAN_NUM_THREADS;
+      ThreadDataArr[thread_num].SAP_ptr->num_DA_prefilter_candidates = DA_PREFILTER_NUM_CANDIDATES;
+      ThreadDataArr[thread_num].SAP_ptr->num_PO_SF_threads = PO_SF_NUM_THREADS;
       ThreadDataArr[thread_num].SAP_ptr->num_vecs = 0;
       ThreadDataArr[thread_num].SAP_ptr->num_rise_vecs = 0;;
 
@@ -1929,12 +1985,10 @@ fflush(stdout);
       ThreadDataArr[thread_num].SAP_ptr->DUMP_BITSTRINGS = DUMP_BITSTRINGS;
 
 // If the user chooses to use the PN cache, then the qualifing PNs (according to the ChallengeSetName_NAT and ChallengeSetName_AT) for all chips are 
-// read out of the database and stored in the TimingValCacheStruct array for very quick access. 
+// read out of the database and stored in the TimingValCacheStruct for very quick access. 
       ThreadDataArr[thread_num].SAP_ptr->use_TVC_cache = use_TVC_cache;
-      ThreadDataArr[thread_num].SAP_ptr->TVC_arr_NAT = NULL;
-      ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_NAT = 0;
-      ThreadDataArr[thread_num].SAP_ptr->TVC_arr_AT = NULL;
-      ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_AT = 0;
+      ThreadDataArr[thread_num].SAP_ptr->TVC_NAT = NULL;
+      ThreadDataArr[thread_num].SAP_ptr->TVC_AT = NULL;
 
 // Do this if the cache is enabled. YOU MUST DO THIS FOR THE AT database too.
       if ( ThreadDataArr[thread_num].SAP_ptr->use_TVC_cache == 1 )
@@ -1945,13 +1999,12 @@ fflush(stdout);
          if ( thread_num == 0 )
             {
 // Use '%' for * and '_' for ?
-            ThreadDataArr[thread_num].SAP_ptr->num_chips = CreateTimingValsCacheFromChallengeSet(MAX_STRING_LEN, ThreadDataArr[thread_num].SAP_ptr->database_NAT, 
-               ThreadDataArr[thread_num].SAP_ptr->design_index, ThreadDataArr[thread_num].SAP_ptr->ChallengeSetName_NAT, "%", &(ThreadDataArr[thread_num].SAP_ptr->TVC_arr_NAT), 
-               &(ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_NAT));
+            ThreadDataArr[thread_num].SAP_ptr->num_chips = GetTimingValsCache(MAX_STRING_LEN, ThreadDataArr[thread_num].SAP_ptr->database_NAT, 
+               DB_name_NAT, use_TVC_snapshot, ThreadDataArr[thread_num].SAP_ptr->design_index, 
+               ThreadDataArr[thread_num].SAP_ptr->ChallengeSetName_NAT, "%", &(ThreadDataArr[thread_num].SAP_ptr->TVC_NAT));
 
 //            check_num_chips = CreateTimingValsCacheFromChallengeSet(MAX_STRING_LEN, ThreadDataArr[thread_num].SAP_ptr->database_AT, 
-//               ThreadDataArr[thread_num].SAP_ptr->design_index, ThreadDataArr[thread_num].SAP_ptr->ChallengeSetName_AT, "%", &(ThreadDataArr[thread_num].SAP_ptr->TVC_arr_AT), 
-//               &(ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_AT));
+//               ThreadDataArr[thread_num].SAP_ptr->design_index, ThreadDataArr[thread_num].SAP_ptr->ChallengeSetName_AT, "%", &(ThreadDataArr[thread_num].SAP_ptr->TVC_AT));
 
 // Sanity check. These databases MUST have the same number of chips. They also must have the same SynthesisName and NetlistName, which is not checked here.
 //            if ( ThreadDataArr[thread_num].SAP_ptr->num_chips != check_num_chips )
@@ -1965,10 +2018,8 @@ fflush(stdout);
 // As noted elsewhere, SAP_ptr->num_chips is used during challenge generation to record the number of DVR/DVF and is zero'ed out afterwards when the data is freed,
 // so this assignment cannot be depended on to remain.
             ThreadDataArr[thread_num].SAP_ptr->num_chips = ThreadDataArr[0].SAP_ptr->num_chips; 
-            ThreadDataArr[thread_num].SAP_ptr->TVC_arr_NAT = ThreadDataArr[0].SAP_ptr->TVC_arr_NAT;
-            ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_NAT = ThreadDataArr[0].SAP_ptr->num_TVC_arr_NAT;
-            ThreadDataArr[thread_num].SAP_ptr->TVC_arr_AT = ThreadDataArr[0].SAP_ptr->TVC_arr_AT;
-            ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_AT = ThreadDataArr[0].SAP_ptr->num_TVC_arr_AT;
+            ThreadDataArr[thread_num].SAP_ptr->TVC_NAT = ThreadDataArr[0].SAP_ptr->TVC_NAT;
+            ThreadDataArr[thread_num].SAP_ptr->TVC_AT = ThreadDataArr[0].SAP_ptr->TVC_AT;
             }
 
 // Force this to 1 if the timing data has been read into arrays because fast population SpreadFactor method requested (which NOT currently supported).
@@ -1979,21 +2030,33 @@ fflush(stdout);
       else
          {
          ThreadDataArr[thread_num].SAP_ptr->num_chips = 0;
-         ThreadDataArr[thread_num].SAP_ptr->TVC_arr_NAT = NULL;
-         ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_NAT = 0;
-         ThreadDataArr[thread_num].SAP_ptr->TVC_arr_AT = NULL;
-         ThreadDataArr[thread_num].SAP_ptr->num_TVC_arr_AT = 0;
+         ThreadDataArr[thread_num].SAP_ptr->TVC_NAT = NULL;
+         ThreadDataArr[thread_num].SAP_ptr->TVC_AT = NULL;
          }
 
+// One PNDc cache is shared by all threads. The timing data (and the chip list) is loaded once above and never changes while the 
+// verifier runs, so its entries never need to be invalidated.
+      if ( thread_num == 0 )
+         ThreadDataArr[thread_num].SAP_ptr->PNDc_cache = CreatePNDcCache(ThreadDataArr[thread_num].SAP_ptr->num_required_PNDiffs, 
+            PNDC_CACHE_BUDGET_BYTES);
+      else
+         ThreadDataArr[thread_num].SAP_ptr->PNDc_cache = ThreadDataArr[0].SAP_ptr->PNDc_cache;
+
+// The counters of the chip search prefilter are also shared by all threads.
+      if ( thread_num == 0 )
+         ThreadDataArr[thread_num].SAP_ptr->DA_prefilter_stats = CreateDAPrefilterStats();
+      else
+         ThreadDataArr[thread_num].SAP_ptr->DA_prefilter_stats = ThreadDataArr[0].SAP_ptr->DA_prefilter_stats;
+
 // ============================================================================
 // Additional fields beyond SAP needed by the thread.
       ThreadDataArr[thread_num].TTP_request = 0;
       ThreadDataArr[thread_num].Device_socket_desc = -1;
       ThreadDataArr[thread_num].port_number = port_number;
-      ThreadDataArr[thread_num].RANDOM = RANDOM;
-      ThreadDataArr[thread_num].in_use = 0;
       ThreadDataArr[thread_num].client_index = -1;
-      ThreadDataArr[thread_num].client_sockets = client_sockets;
+      ThreadDataArr[thread_num].ESS_ptr = ESS_ptr;
+      ThreadDataArr[thread_num].TP_ptr = TP_ptr;
+      ThreadDataArr[thread_num].RS_ptr = &RequestStats;
       ThreadDataArr[thread_num].TTP_num = -1;
       ThreadDataArr[thread_num].TTP_session_keys = TTP_session_keys;
       ThreadDataArr[thread_num].num_TTPs = num_TTPs;
@@ -2006,68 +2069,42 @@ fflush(stdout);
       ThreadDataArr[thread_num].num_eCt_nonce_bytes = num_eCt_nonce_bytes;
 
       ThreadDataArr[thread_num].TTP_socket_descs = TTP_socket_descs;
+      ThreadDataArr[thread_num].TTP_slot_nums = TTP_slot_nums;
+      ThreadDataArr[thread_num].TTP_slot_authen = TTP_slot_authen;
 
 // This will need to be protected by a mutex.
       ThreadDataArr[thread_num].Accounts_ptr = NULL;
-
-// ******************************************************
-// Create a set of static threads -- thread memory management on the Cora/Zybo seems to have problems. Pass to each a copy
-// of DeviceDataArr structure. The loop below will update Device_socket_desc, client_index and in_use if Alice/Bob else it
-// will be a TTP. The Thread will use the Device_socket_desc or the TTP_socket_desc as the new communication channel. The 
-// client_index refers to the element in the client_sockets array that is in use during the message processing -- the 
-// processing thread will set this back to client_sockets[client_index] back to 0 before finishing. The Threads are in an 
-// infinite loop testing the in_use field. The parent here sets this to 1 when a new message is to be processed.
-//
-// We need to call pthread_cancel() to have the pthread free resources (I think pthread_detach also frees resources). If I
-// try to use pthread_cancel, I get a library complaint that some part of the thread library is missing -- need a newer version,
-// or whatever. Since I create all these threads statically I don't need to create and destroy them so no need for these functions
-// anyway.
-      int err;
-      pthread_t thread_id;
-      if ( (err = pthread_create((pthread_t *)&thread_id, NULL, (void *)BankThread, (void *)&(ThreadDataArr[thread_num]))) != 0 )
-         { printf("Failed to create thread: %d\n", err); fflush(stdout); }
-
-// Detach thread since we don't need to synchronize with it (no 'join' required). Also allows resources to be freed when thread 
-// terminates.
-//      pthread_detach(thread_id);
-
-#ifdef DEBUG
-printf("Thread ID %lu\n", (unsigned long int)thread_id); fflush(stdout);
-#endif
-
-printf("Number of threads created: %d\n", thread_num + 1); fflush(stdout);
-#ifdef DEBUG
-#endif
       }
 
 // NOT USED
-   for ( thread_num = 1; thread_num < MAX_THREADS; thread_num++ )
+   for ( thread_num = 1; thread_num < num_threads; thread_num++ )
       {
       SAP_arr[thread_num].ChipScalingConstantArr = NULL;
       SAP_arr[thread_num].ChipScalingConstantNotifiedArr = NULL;
       }
 
+// ******************************************************
+// Start the worker threads. Thread memory management on the Cora/Zybo seems to have problems, so the pool reuses the 
+// ThreadDataArr element of a worker slot instead of allocating one per thread. The loop below submits each ready connection 
+// (Alice/Bob or a TTP) to the pool and an idle thread takes it. The Thread will use the Device_socket_desc or the 
+// TTP_socket_desc as the new communication channel. The client_index refers to the slot in the epoll acceptor that is in use 
+// during the message processing -- the processing thread closes it (Alice/Bob) or re-arms it (TTP) before finishing.
+   StartThreadPool(TP_ptr);
+
 
 // ********************************************************************************
 // ********************************************************************************
 // LOOP
-   first_time = 1;
    for ( iteration = 0; (iteration < num_iterations || num_iterations == -1); iteration++ )
       {
 
-// Note: If NOT a new connection, 'client_IP' is NOT filled in by OpenMultipleSocketServer(). 'client_IP' is NOT filled in
-// for repeated communications from a TTP since we do NOT close this socket. NOTE: On FIRST call, client_sockets array is
-// initialized to ALL zeros.
-      strcpy(client_IP, "");
-      client_index = -1;
+// Note: If NOT a new connection, 'client_IP' is NOT filled in by WaitEpollSocketServer(). 'client_IP' is NOT filled in
+// for repeated communications from a TTP since we do NOT close this socket. Connections beyond MAX_CLIENTS are refused 
+// inside WaitEpollSocketServer(), so 'client_index' is -1 only when epoll_wait was interrupted by a signal.
       Device_socket_desc = -1;
-      SD = OpenMultipleSocketServer(MAX_STRING_LEN, &Bank_server_socket_desc, Bank_server_IP, port_number, client_IP,
-         MAX_CLIENTS, client_sockets, &client_index, first_time);
-      first_time = 0;
-
-// Sanity check. 
+      SD = WaitEpollSocketServer(MAX_STRING_LEN, ESS_ptr, client_IP, &client_index);
       if ( client_index == -1 )
-         { printf("ERROR: Failed to find an empty slot in client_sockets -- increase MAX_CLIENTS!\n"); exit(EXIT_FAILURE); }
+         continue;
 
 
 struct timeval tv;
@@ -2085,32 +2122,38 @@ milliseconds = tv.tv_usec/1000;
 
 //printf("ITERATION %d\tDate: %s.%06ld\n", iteration, time_string, milliseconds); fflush(stdout);
 printf("ITERATION %d\tDate: %s.%03ld.%03ld\t%s\n", iteration, time_string, milliseconds, tv.tv_usec - milliseconds*1000, client_IP); fflush(stdout);
-printf("\tSD and Client_IP returned by OpenMultipleSocketServer %d and %s\tClient index %d\tClient socket %d\tIterationCnt %d!\n", 
-   SD, client_IP, client_index, client_sockets[client_index], iteration); fflush(stdout);
+printf("\tSD and Client_IP returned by WaitEpollSocketServer %d and %s\tClient index %d\tClient socket %d\tIterationCnt %d!\n", 
+   SD, client_IP, client_index, ESS_ptr->client_sockets[client_index], iteration); fflush(stdout);
 #ifdef DEBUG
 #endif
 
 // ========================================================
 // Multiple TTP: Determine if request is from a TTP. Do NOT use the client_IP here for re-connect requests -- it doesn't work. 
-// Use 'client_index' instead. NOTE: On the initial connection, the IP is correct.
+// Use 'client_index' instead. NOTE: On the initial connection, the IP is correct, and every connection a TTP opens (it keeps 
+// a small pool of them) is recorded against its slot.
       TTP_request = 0;
-      for ( TTP_num = 0; TTP_num < num_TTPs; TTP_num++ )
-         if ( strcmp(TTP_IPs[TTP_num], client_IP) == 0 || TTP_socket_indexes[TTP_num] == client_index )
-            {
-            TTP_request = 1;
-            break;
-            }
+      TTP_num = TTP_slot_nums[client_index];
+      if ( TTP_num == -1 && strlen(client_IP) > 0 )
+         {
+         for ( TTP_num = 0; TTP_num < num_TTPs; TTP_num++ )
+            if ( strcmp(TTP_IPs[TTP_num], client_IP) == 0 )
+               break;
 
 // Invalidate TTP_num if not found
-      if ( TTP_num == num_TTPs )
-         TTP_num = -1;
+         if ( TTP_num == num_TTPs )
+            TTP_num = -1;
+         else
+            TTP_slot_nums[client_index] = TTP_num;
+         }
+      if ( TTP_num != -1 )
+         TTP_request = 1;
 
 // -------------------------------------------
 // TTPs are always first, and they never close.
       if ( TTP_request == 1 )
          {
 
-// Assign the new socket descriptor ONLY on the first iteration.
+// Assign the new socket descriptor ONLY on the first iteration. This is the channel the TTP authenticated on.
          if ( TTP_socket_descs[TTP_num] == -1 )
             {
             TTP_socket_descs[TTP_num] = SD;
@@ -2118,7 +2161,7 @@ printf("\tSD and Client_IP returned by OpenMultipleSocketServer %d and %s\tClien
             }
 
 printf("\tTTP REQUEST: TTP %d with IP %s has connected with TTP_socket_desc %d at socket index %d\tIterationCnt %d!\n", TTP_num, TTP_IPs[TTP_num],
-   TTP_socket_descs[TTP_num], TTP_socket_indexes[TTP_num], iteration); fflush(stdout);
+   SD, client_index, iteration); fflush(stdout);
 #ifdef DEBUG
 #endif
          }
@@ -2131,7 +2174,7 @@ printf("\tTTP REQUEST: TTP %d with IP %s has connected with TTP_socket_desc %d a
          { printf("ERROR: Socket descriptor returned %d is negative!\n", SD); exit(EXIT_FAILURE); }
 
 // If NOT the first connection from the TTP, then 'client_IP' is null -- fill it in for printing purposes only.
-// IP retrieval in OpenMultipleSocketServer does not seem to work -- returns '0.0.0.0'???
+// WaitEpollSocketServer only fills in the IP for new connections.
       if ( TTP_request == 1 && (strlen(client_IP) == 0 || strcmp(client_IP, "0.0.0.0") == 0 ))
          strcpy(client_IP, TTP_IPs[TTP_num]);
 
@@ -2144,43 +2187,34 @@ printf("Client socket descriptor %d, client index %d from IP '%s'\n", SD, client
 //      if ( TTP_request != 1 && client_index <= 0 )
 //         { printf("ERROR: Unexpected 'client_index' %d!\n", client_index); exit(EXIT_FAILURE); }
 
-      int found_one = 0;
-      while ( found_one == 0 )
-         {
-         for ( thread_num = 0; thread_num < MAX_THREADS; thread_num++ )
-            {
-            pthread_mutex_lock(&(ThreadDataArr[thread_num].Thread_mutex));
-            if ( ThreadDataArr[thread_num].in_use == 0 )
-               {
-               ThreadDataArr[thread_num].TTP_request = TTP_request;
-               if ( TTP_request == 1 )
-                  ThreadDataArr[thread_num].Device_socket_desc = TTP_socket_descs[TTP_num];
-               else
-                  ThreadDataArr[thread_num].Device_socket_desc = Device_socket_desc;
-               ThreadDataArr[thread_num].client_index = client_index;
-               ThreadDataArr[thread_num].iteration_cnt = iteration;
-               ThreadDataArr[thread_num].in_use = 1;
-               ThreadDataArr[thread_num].TTP_num = TTP_num;
-               found_one = 1;
-
-// Make further activity on this socket descriptors ignored by OpenMultipleSocketServer() until the thread restores the 
-// client_socket value when it completes communication with a TTP.
-               client_sockets[client_index] = -1;
-
-               pthread_cond_signal(&(ThreadDataArr[thread_num].Thread_cv));
-               }
-            pthread_mutex_unlock(&(ThreadDataArr[thread_num].Thread_mutex));
-            if ( found_one == 1 )
-               break;
-            }
-         }
-       
-printf("\tTasking Thread %d\n", thread_num); fflush(stdout);
+// Hand the connection to the first idle thread. The slot stays disarmed in the acceptor until the thread closes it or, for a TTP, 
+// re-arms it. Blocks only when SERVER_CONN_QUEUE_SIZE requests are already waiting for a thread.
+      if ( TTP_request == 1 )
+         conn.socket_desc = SD;
+      else
+         conn.socket_desc = Device_socket_desc;
+      conn.client_index = client_index;
+      conn.iteration_cnt = iteration;
+      conn.TTP_num = TTP_num;
+      strcpy(conn.client_IP, client_IP);
+      SubmitThreadPoolTask(TP_ptr, &conn);
+
 #ifdef DEBUG
+printf("\tQueued client index %d\n", client_index); fflush(stdout);
 #endif
 
+      if ( (iteration + 1) % SERVER_POOL_STATS_INTERVAL == 0 )
+         {
+         PrintThreadPoolStats(TP_ptr);
+         PrintRequestStats(&RequestStats);
+         }
       }
 
+// Let the workers finish the queued requests before the databases are saved and closed.
+   ShutdownThreadPool(TP_ptr);
+   PrintThreadPoolStats(TP_ptr);
+   PrintRequestStats(&RequestStats);
+
 // PERFORMANCE EVAL ONLY: If we read the database into memory, and updated it (by deleting elements because of 'max_chips'), then check to 
 // see if we need to store it. This will only store the non-anonmous database. Since 5/20/2019, I've added a second database.
    if ( read_db_into_memory == 1 && max_chips != -1 )
@@ -2208,8 +2242,14 @@ printf("\tTasking Thread %d\n", thread_num); fflush(stdout);
 // Close the databases.
    sqlite3_close(DB_NAT);
 //   sqlite3_close(DB_AT);
+   if ( DBP_Trust_AT_ptr != NULL )
+      StopDBPersist(DBP_Trust_AT_ptr);
+   if ( DBP_PUFCash_V3_ptr != NULL )
+      StopDBPersist(DBP_PUFCash_V3_ptr);
+   FinalizeSQLStmtCache(DB_Trust_AT);
    sqlite3_close(DB_Trust_AT);
    sqlite3_close(DB_RunTime);
+   FinalizeSQLStmtCache(DB_PUFCash_V3);
    sqlite3_close(DB_PUFCash_V3);
 
 // Free TTP_session_key in case of multithreading. 
@@ -2221,10 +2261,11 @@ printf("\tTasking Thread %d\n", thread_num); fflush(stdout);
       }
 
 // Close server sockets
-   close(Bank_server_socket_desc);
+   close(ESS_ptr->listen_socket_desc);
 
-   for ( TTP_num = 0; TTP_num < num_TTPs; TTP_num++ )
-      close(TTP_socket_descs[TTP_num]);
+   for ( i = 0; i < MAX_CLIENTS; i++ )
+      if ( TTP_slot_nums[i] != -1 )
+         SockClose(ESS_ptr->client_sockets[i]);
 
    return 0;
    }